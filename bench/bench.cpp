@@ -0,0 +1,453 @@
+#include "pch/cqt_pch.h"
+
+#include "harness.h"
+#include "report.h"
+#include "shared.h"
+#include "image.h"
+#include "quantization.h"
+#include "palette.h"
+#include "dither.h"
+#include "histogram.h"
+#include "engine.h"
+
+#include <cmath>
+
+using namespace std;
+
+// Pixels looked up per call of the per-pixel kernels, and eigen decompositions per call.
+#define BENCH_LOOKUPS 4096
+#define BENCH_EIGEN_CALLS 1000
+// Share of the pixels the proxy palette is built from in the quality comparison.
+#define BENCH_PROXY_SHARE 16
+
+/*
+ * Deterministic photo-like test image: smooth color fields with soft edges and some sensor noise, so that its
+ * histogram has both broad clusters and a long tail of rare colors, as real images do.
+ */
+static vector<unsigned char> generate_image(unsigned width, unsigned height, uint32_t seed)
+{
+    vector<unsigned char> rgb;
+    rgb.reserve(static_cast<size_t>(width) * height * 3);
+    uint32_t state = seed;
+
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+        {
+            const double u = static_cast<double>(x) / width, v = static_cast<double>(y) / height;
+            const double field[3] = {128 + 110 * sin(u * 5.1 + v * 1.3), 128 + 100 * cos(v * 4.3 - u * 2.2),
+                                     (u + v > 1 ? 200 : 60) + 40 * sin((u - v) * 9.7)};
+
+            for (unsigned c = 0; c < 3; ++c)
+            {
+                state = state * 1664525u + 1013904223u;
+                const double noise = static_cast<double>(state >> 28) - 7.5;
+                rgb.push_back(static_cast<unsigned char>(std::clamp(field[c] + noise, 0.0, 255.0)));
+            }
+        }
+    }
+
+    return rgb;
+}
+
+// `count` colors spread over the RGB cube.
+static vector<Pixel> generate_palette(unsigned count, uint32_t seed)
+{
+    vector<Pixel> palette;
+    uint32_t state = seed;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        Pixel color(3);
+        for (unsigned c = 0; c < 3; ++c)
+        {
+            state = state * 1664525u + 1013904223u;
+            color(c) = static_cast<double>(state >> 24);
+        }
+        palette.push_back(color);
+    }
+
+    return palette;
+}
+
+// Image dimensions close to a square with about `pixels` pixels.
+static void image_size(uint64_t pixels, unsigned &width, unsigned &height)
+{
+    width = std::max(1u, static_cast<unsigned>(std::sqrt(static_cast<double>(pixels))));
+    height = static_cast<unsigned>(std::max<uint64_t>(1, pixels / width));
+}
+
+static void record(vector<BenchResult> &results, const BenchSettings &settings, const BenchCase &benchCase)
+{
+    if (!bench_selected(settings, benchCase.kernel))
+        return;
+
+    results.push_back(run_bench_case(settings, benchCase));
+    log_bench_result(results.back());
+}
+
+// The kernels of one split in partition(), on the subset holding every pixel of the image.
+static void bench_partition_kernels(vector<BenchResult> &results, const BenchSettings &settings, const MatrixRgb &pixels)
+{
+    const uint64_t count = pixels.rows();
+
+    PixelSubset subset{pixels, CovMatrix(), 0, Eigen::VectorXd(), {}, Eigen::VectorXd()};
+    subset.covariance = calculate_covariance_matrix(subset.data);
+    get_largest_eigenv(subset.covariance, subset.largestEigenvalue, subset.largestEigenvector);
+    const Eigen::VectorXd scores = calculate_pca_scores(subset);
+
+    MatrixRgb sortedPixels(pixels.rows(), 3);
+    Eigen::VectorXd sortedScores(scores.size());
+    sort_data_by_pca_score(subset.data, scores, sortedPixels, sortedScores);
+
+    CovMatrix covariance;
+    record(results, settings, {"calculate_covariance_matrix", count, 0, count, nullptr, [&]
+                               { covariance = calculate_covariance_matrix(subset.data); }});
+
+    Eigen::VectorXd projection;
+    record(results, settings, {"calculate_pca_scores", count, 0, count, nullptr, [&]
+                               { projection = calculate_pca_scores(subset); }});
+
+    MatrixRgb sortedOut(pixels.rows(), 3);
+    Eigen::VectorXd sortedScoresOut(scores.size());
+    record(results, settings, {"sort_data_by_pca_score", count, 0, count, nullptr, [&]
+                               { sort_data_by_pca_score(subset.data, scores, sortedOut, sortedScoresOut); }});
+
+    int cut = 0;
+    record(results, settings, {"find_cutting_point_index", count, 0, count, nullptr, [&]
+                               { cut = find_cutting_point_index(sortedScores); }});
+}
+
+// Mapping and dithering every pixel of the image, which both modify it in place.
+static void bench_mapping_kernels(vector<BenchResult> &results, const BenchSettings &settings, const MatrixRgb &pixels,
+                                  unsigned width, unsigned colors)
+{
+    const uint64_t count = pixels.rows();
+    vector<Pixel> palette = generate_palette(colors, colors);
+    MatrixRgb image;
+
+    record(results, settings, {"map_to_palette", count, colors, count, [&]
+                               { image = pixels; }, [&]
+                               { map_to_palette(image, palette); }});
+
+    record(results, settings, {"floyd_steinberg_dither", count, colors, count, [&]
+                               { image = pixels; }, [&]
+                               { floyd_steinberg_dither(image, palette, width); }});
+}
+
+static void bench_lookup_kernels(vector<BenchResult> &results, const BenchSettings &settings, const MatrixRgb &pixels)
+{
+    for (unsigned colors : settings.colorCounts)
+    {
+        const vector<Pixel> palette = generate_palette(colors, colors);
+        const Eigen::Index lookups = std::min<Eigen::Index>(BENCH_LOOKUPS, pixels.rows());
+        double checksum = 0;
+
+        record(results, settings, {"find_closest_pixel_value", 0, colors, static_cast<uint64_t>(lookups), nullptr, [&]
+                                   {
+                                       for (Eigen::Index i = 0; i < lookups; ++i)
+                                           checksum += find_closest_pixel_value(pixels.row(i), palette)(0);
+                                   }});
+    }
+
+    CovMatrix covariance = calculate_covariance_matrix(pixels);
+    double eigenvalue = 0;
+    Eigen::VectorXd eigenvector;
+    record(results, settings, {"get_largest_eigenv", 0, 0, BENCH_EIGEN_CALLS, nullptr, [&]
+                               {
+                                   for (unsigned i = 0; i < BENCH_EIGEN_CALLS; ++i)
+                                   {
+                                       get_largest_eigenv(covariance, eigenvalue, eigenvector);
+                                       covariance(0, 0) += 1e-9; // keeps the calls from being folded into one
+                                   }
+                               }});
+}
+
+typedef struct
+{
+    uint64_t pixels;
+    unsigned colors;
+    uint64_t budget;
+    double fullError;
+    double proxyError;
+} ProxyQuality;
+
+typedef struct
+{
+    uint64_t pixels;
+    unsigned colors;
+    const char *engine;
+    double error;
+} EngineQuality;
+
+static vector<Pixel> histogram_palette(const vector<unsigned char> &rgb, unsigned width, unsigned height, uint64_t budget,
+                                       unsigned colors, const PaletteEngine &engine = pca_engine())
+{
+    ColorHistogram histogram;
+    add_sampled_to_histogram(histogram, make_spatial_sampler(width, height, budget), rgb.data(), 0, height, 3);
+    return engine.build_palette(histogram_to_subset(histogram), colors);
+}
+
+static double mapping_error(const vector<unsigned char> &rgb, const vector<Pixel> &palette)
+{
+    vector<unsigned char> mapped = rgb;
+    map_pixels_to_palette(mapped.data(), rgb.size() / 3, 3, palette);
+    return mean_squared_error(rgb.data(), mapped.data(), rgb.size() / 3, 3);
+}
+
+/*
+ * Palette construction from every pixel against the sampled proxy that --sample-budget uses, at a budget of
+ * 1/BENCH_PROXY_SHARE of the pixels: the time of both and the mapping error each palette gives the full image.
+ */
+static void bench_proxy_palette(vector<BenchResult> &results, vector<ProxyQuality> &qualities, const BenchSettings &settings,
+                                const vector<unsigned char> &rgb, unsigned width, unsigned height, unsigned colors)
+{
+    const uint64_t count = static_cast<uint64_t>(width) * height;
+    const uint64_t budget = std::max<uint64_t>(1, count / BENCH_PROXY_SHARE);
+    vector<Pixel> full, proxy;
+
+    record(results, settings, {"build_palette(full)", count, colors, count, nullptr, [&]
+                               { full = histogram_palette(rgb, width, height, 0, colors); }});
+    record(results, settings, {"build_palette(proxy)", count, colors, count, nullptr, [&]
+                               { proxy = histogram_palette(rgb, width, height, budget, colors); }});
+
+    if (!bench_selected(settings, "build_palette(full)") || !bench_selected(settings, "build_palette(proxy)"))
+        return;
+
+    qualities.push_back(ProxyQuality{count, colors, budget, mapping_error(rgb, full), mapping_error(rgb, proxy)});
+}
+
+/*
+ * Palette construction from every pixel by the engines other than pca, whose time is build_palette(full), and the
+ * mapping error of every engine's palette.
+ */
+static void bench_engine_palettes(vector<BenchResult> &results, vector<EngineQuality> &qualities, const BenchSettings &settings,
+                                  const vector<unsigned char> &rgb, unsigned width, unsigned height, unsigned colors)
+{
+    const uint64_t count = static_cast<uint64_t>(width) * height;
+
+    for (const PaletteEngine *engine : {&pca_engine(), &pca_moments_engine(), &wu_engine(), &octree_engine()})
+    {
+        const string kernel = engine == &pca_engine() ? "build_palette(full)" : "build_palette(" + string(engine->name()) + ")";
+        if (!bench_selected(settings, kernel))
+            continue;
+
+        vector<Pixel> palette;
+        if (engine == &pca_engine())
+            palette = histogram_palette(rgb, width, height, 0, colors);
+        else
+            record(results, settings, {kernel, count, colors, count, nullptr, [&]
+                                       { palette = histogram_palette(rgb, width, height, 0, colors, *engine); }});
+
+        qualities.push_back(EngineQuality{count, colors, engine->name(), mapping_error(rgb, palette)});
+    }
+}
+
+static void log_proxy_quality(const vector<ProxyQuality> &qualities)
+{
+    if (qualities.empty())
+        return;
+
+    cout << endl << "Proxy palette quality (mean squared error of the mapped image)" << endl;
+    cout << right << setw(9) << "pixels" << setw(7) << "colors" << setw(9) << "budget" << setw(11) << "full" << setw(11)
+         << "proxy" << setw(9) << "delta" << endl;
+
+    for (const ProxyQuality &quality : qualities)
+    {
+        const double delta = quality.fullError > 0 ? (quality.proxyError / quality.fullError - 1) * 100 : 0;
+        cout << setw(9) << quality.pixels << setw(7) << quality.colors << setw(9) << quality.budget << fixed << setprecision(2)
+             << setw(11) << quality.fullError << setw(11) << quality.proxyError << showpos << setw(8) << delta << "%"
+             << noshowpos << defaultfloat << setprecision(6) << endl;
+    }
+}
+
+static void log_engine_quality(const vector<EngineQuality> &qualities)
+{
+    if (qualities.empty())
+        return;
+
+    cout << endl << "Engine palette quality (mean squared error of the mapped image)" << endl;
+    cout << right << setw(9) << "pixels" << setw(7) << "colors" << setw(13) << "engine" << setw(11) << "error" << endl;
+
+    for (const EngineQuality &quality : qualities)
+        cout << setw(9) << quality.pixels << setw(7) << quality.colors << setw(13) << quality.engine << fixed
+             << setprecision(2) << setw(11) << quality.error << defaultfloat << setprecision(6) << endl;
+}
+
+static bool parse_list(const string &text, vector<uint64_t> &values)
+{
+    values.clear();
+    stringstream stream(text);
+    string item;
+
+    while (getline(stream, item, ','))
+    {
+        try
+        {
+            size_t pos;
+            const uint64_t value = stoull(item, &pos);
+            if (pos < item.size() || value == 0)
+                return false;
+            values.push_back(value);
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
+
+    return !values.empty();
+}
+
+static bool parse_count(const string &text, unsigned &count)
+{
+    try
+    {
+        size_t pos;
+        count = static_cast<unsigned>(stoul(text, &pos));
+        return pos == text.size();
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+static void print_usage()
+{
+    cout << "Usage: cqt_bench [--filter NAME] [--pixels N,N,...] [--colors K,K,...] [--reps N] [--warmup N] [--quick]"
+            " [--json FILE]" << endl;
+    cout << "       cqt_bench --compare BASELINE.json RESULTS.json [--threshold PERCENT]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchSettings settings{2, 10, "", {65536, 262144, 1048576}, {16, 64, 256}};
+    string jsonPath, baselinePath, comparedPath;
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        vector<uint64_t> values;
+
+        if (arg == "-h" || arg == "--help")
+        {
+            print_usage();
+            return 0;
+        }
+        else if (arg == "--quick")
+        {
+            // A smoke run: one small image, one palette size, few samples.
+            settings = BenchSettings{1, 3, settings.filter, {16384}, {16}};
+        }
+        else if (arg == "--json" && i + 1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else if (arg == "--compare" && i + 2 < argc)
+        {
+            baselinePath = argv[++i];
+            comparedPath = argv[++i];
+        }
+        else if (arg == "--threshold" && i + 1 < argc)
+        {
+            try
+            {
+                threshold = stod(argv[++i]) / 100;
+            }
+            catch (const std::exception &)
+            {
+                cerr << "Invalid threshold: " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--filter" && i + 1 < argc)
+        {
+            settings.filter = argv[++i];
+        }
+        else if ((arg == "--pixels" || arg == "--colors") && i + 1 < argc)
+        {
+            if (!parse_list(argv[++i], values))
+            {
+                cerr << "Invalid list for " << arg << ": " << argv[i] << endl;
+                return 1;
+            }
+
+            if (arg == "--pixels")
+                settings.pixelCounts = values;
+            else
+                settings.colorCounts.assign(values.begin(), values.end());
+        }
+        else if ((arg == "--reps" || arg == "--warmup") && i + 1 < argc)
+        {
+            unsigned &count = arg == "--reps" ? settings.repetitions : settings.warmup;
+            if (!parse_count(argv[++i], count) || settings.repetitions == 0)
+            {
+                cerr << "Invalid count for " << arg << ": " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            cerr << "Unknown argument: " << arg << endl;
+            print_usage();
+            return 1;
+        }
+    }
+
+    // Comparison of two stored runs; the exit status tells scripts whether anything became slower.
+    if (!baselinePath.empty())
+    {
+        BenchRun baseline, compared;
+        for (auto [path, run] : {pair<const string &, BenchRun &>{baselinePath, baseline}, {comparedPath, compared}})
+        {
+            if (!read_bench_json(path, run))
+            {
+                cerr << "Cannot read benchmark results from " << path << endl;
+                return 2;
+            }
+        }
+        return compare_bench_runs(baseline, compared, threshold) > 0 ? 1 : 0;
+    }
+
+    // The kernels log as they do in the tool; only the measurements are printed here.
+    consoleOutput = false;
+
+    vector<BenchResult> results;
+    vector<ProxyQuality> qualities;
+    vector<EngineQuality> engineQualities;
+    log_bench_header();
+
+    for (size_t i = 0; i < settings.pixelCounts.size(); ++i)
+    {
+        unsigned width, height;
+        image_size(settings.pixelCounts[i], width, height);
+        const vector<unsigned char> rgb = generate_image(width, height, 12345);
+        const MatrixRgb pixels = to_matrix(rgb);
+
+        if (i == 0)
+            bench_lookup_kernels(results, settings, pixels);
+
+        bench_partition_kernels(results, settings, pixels);
+
+        for (unsigned colors : settings.colorCounts)
+            bench_mapping_kernels(results, settings, pixels, width, colors);
+
+        for (unsigned colors : settings.colorCounts)
+            bench_proxy_palette(results, qualities, settings, rgb, width, height, colors);
+
+        for (unsigned colors : settings.colorCounts)
+            bench_engine_palettes(results, engineQualities, settings, rgb, width, height, colors);
+    }
+
+    log_proxy_quality(qualities);
+    log_engine_quality(engineQualities);
+
+    if (!jsonPath.empty() && !write_bench_json(jsonPath, settings, results))
+    {
+        cerr << "Cannot write " << jsonPath << endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "pch/cqt_pch.h"
+
+#include "harness.h"
+#include "timings.h"
+#include "log.h"
+
+#include <chrono>
+
+bool bench_selected(const BenchSettings &settings, const std::string &kernel)
+{
+    return settings.filter.empty() || kernel.find(settings.filter) != std::string::npos;
+}
+
+BenchResult run_bench_case(const BenchSettings &settings, const BenchCase &benchCase)
+{
+    BenchResult result{benchCase.kernel, benchCase.pixels, benchCase.colors, benchCase.items, {}, 0, 0, 0};
+
+    for (unsigned i = 0; i < settings.warmup; ++i)
+    {
+        if (benchCase.prepare)
+            benchCase.prepare();
+        benchCase.run();
+    }
+
+    uint64_t allocations = 0, allocatedBytes = 0;
+    for (unsigned i = 0; i < settings.repetitions; ++i)
+    {
+        if (benchCase.prepare)
+            benchCase.prepare();
+
+        const uint64_t startAllocations = threadAllocations, startAllocatedBytes = threadAllocatedBytes;
+        const auto start = std::chrono::steady_clock::now();
+        benchCase.run();
+        const auto end = std::chrono::steady_clock::now();
+
+        result.samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+        allocations += threadAllocations - startAllocations;
+        allocatedBytes += threadAllocatedBytes - startAllocatedBytes;
+    }
+
+    result.allocations = static_cast<double>(allocations) / settings.repetitions;
+    result.allocatedBytes = static_cast<double>(allocatedBytes) / settings.repetitions;
+    result.peakRss = peak_rss_bytes();
+
+    std::sort(result.samples.begin(), result.samples.end());
+    return result;
+}
+
+/*
+ * The sample below which `fraction` of the samples lie, interpolated linearly between the two nearest ranks;
+ * 0.5 is the median.
+ */
+double bench_percentile(const BenchResult &result, double fraction)
+{
+    if (result.samples.empty())
+        return 0;
+
+    const double rank = fraction * (result.samples.size() - 1);
+    const size_t below = static_cast<size_t>(rank);
+    const size_t above = std::min(below + 1, result.samples.size() - 1);
+    return result.samples[below] + (result.samples[above] - result.samples[below]) * (rank - below);
+}
+
+static std::string format_parameter(uint64_t value)
+{
+    return value ? std::to_string(value) : "-";
+}
+
+void log_bench_header()
+{
+    std::cout << std::left << std::setw(30) << "kernel" << std::right << std::setw(9) << "pixels" << std::setw(7)
+              << "colors" << std::setw(11) << "median ms" << std::setw(11) << "p10 ms" << std::setw(11) << "p90 ms"
+              << std::setw(11) << "min ms" << std::setw(11) << "ns/item" << std::setw(10) << "allocs" << std::setw(10)
+              << "MiB/call" << std::endl;
+}
+
+void log_bench_result(const BenchResult &result)
+{
+    const double median = bench_percentile(result, 0.5);
+
+    std::cout << std::left << std::setw(30) << result.kernel << std::right << std::setw(9) << format_parameter(result.pixels)
+              << std::setw(7) << format_parameter(result.colors) << std::fixed << std::setprecision(3) << std::setw(11)
+              << median / 1e6 << std::setw(11) << bench_percentile(result, 0.1) / 1e6 << std::setw(11)
+              << bench_percentile(result, 0.9) / 1e6 << std::setw(11) << result.samples.front() / 1e6 << std::setprecision(2)
+              << std::setw(11) << median / result.items << std::setprecision(0) << std::setw(10) << result.allocations
+              << std::setprecision(2) << std::setw(10) << result.allocatedBytes / 1048576 << std::defaultfloat
+              << std::setprecision(6) << std::endl;
+}
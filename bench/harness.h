@@ -0,0 +1,52 @@
+#pragma once
+
+#include "shared.h"
+
+#include <functional>
+
+/*
+ * How benchmark cases are run: every case is called `warmup` times untimed, then timed `repetitions` times, one
+ * sample per call. Kernels that take well under a microsecond loop inside the case instead, and report how many
+ * items one call covers, so that clock overhead stays out of the samples.
+ */
+typedef struct
+{
+    unsigned warmup;
+    unsigned repetitions;
+    std::string filter; // runs only the kernels whose name contains it
+    std::vector<uint64_t> pixelCounts;
+    std::vector<unsigned> colorCounts;
+} BenchSettings;
+
+/*
+ * Timed samples of one case. `pixels` and `colors` are the swept parameters, 0 where a kernel does not depend
+ * on them.
+ */
+typedef struct
+{
+    std::string kernel;
+    uint64_t pixels;
+    unsigned colors;
+    uint64_t items; // units of work per call, for the time per item
+    std::vector<double> samples; // nanoseconds, sorted ascending
+    double allocations;    // per call, as counted by allocation_counter.cpp
+    double allocatedBytes; // per call
+    uint64_t peakRss;      // bytes, the process's peak resident set once the case has run
+} BenchResult;
+
+// `prepare` restores the inputs a kernel modifies; it runs before every call and is not timed.
+typedef struct
+{
+    std::string kernel;
+    uint64_t pixels;
+    unsigned colors;
+    uint64_t items;
+    std::function<void()> prepare;
+    std::function<void()> run;
+} BenchCase;
+
+bool bench_selected(const BenchSettings &settings, const std::string &kernel);
+BenchResult run_bench_case(const BenchSettings &settings, const BenchCase &benchCase);
+double bench_percentile(const BenchResult &result, double fraction);
+void log_bench_header();
+void log_bench_result(const BenchResult &result);
@@ -0,0 +1,229 @@
+#include "pch/cqt_pch.h"
+
+#include "report.h"
+#include "timings.h"
+
+#include <fstream>
+#include <map>
+#include <tuple>
+
+// Set by the build files to the build type and compiler flags; the compile-time checks below are always added.
+#ifndef CQT_BENCH_BUILD
+#define CQT_BENCH_BUILD "unknown"
+#endif
+
+// Model name of the first processor, from /proc/cpuinfo where there is one.
+std::string bench_cpu_model()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.rfind("model name", 0) == 0 && line.find(':') != std::string::npos)
+            return line.substr(line.find_first_not_of(" \t", line.find(':') + 1));
+    }
+
+    return "unknown";
+}
+
+std::string bench_build_flags()
+{
+    std::string flags = CQT_BENCH_BUILD;
+#ifdef __OPTIMIZE__
+    flags += " optimized";
+#endif
+#ifndef NDEBUG
+    flags += " assertions";
+#endif
+#ifdef __AVX2__
+    flags += " avx2";
+#endif
+#ifdef __VERSION__
+    flags += " compiler " __VERSION__;
+#endif
+    return flags;
+}
+
+static std::string escape(const std::string &text)
+{
+    std::string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            escaped += c;
+    }
+    return escaped;
+}
+
+/*
+ * Writes the statistics of every case as JSON, one case per line. Times are in nanoseconds per call of the case;
+ * throughput is in items per second at the median. Allocations are averaged over the timed calls and left out
+ * where they are not counted; the peak resident set is the process's after the case.
+ */
+bool write_bench_json(const std::string &path, const BenchSettings &settings, const std::vector<BenchResult> &results)
+{
+    std::ofstream file(path);
+    file << "{\n\"cpu\": \"" << escape(bench_cpu_model()) << "\",\n\"build\": \"" << escape(bench_build_flags())
+         << "\",\n\"warmup\": " << settings.warmup << ",\n\"repetitions\": " << settings.repetitions << ",\n\"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult &result = results[i];
+        const double median = bench_percentile(result, 0.5);
+
+        file << std::fixed << std::setprecision(0) << "{\"kernel\": \"" << escape(result.kernel) << "\", \"pixels\": "
+             << result.pixels << ", \"colors\": " << result.colors << ", \"items\": " << result.items
+             << ", \"median_ns\": " << median << ", \"p95_ns\": " << bench_percentile(result, 0.95)
+             << ", \"min_ns\": " << result.samples.front() << ", \"items_per_second\": "
+             << (median > 0 ? result.items * 1e9 / median : 0);
+        if (allocationsCounted)
+            file << ", \"allocs_per_call\": " << result.allocations << ", \"alloc_bytes_per_call\": " << result.allocatedBytes;
+        file << ", \"peak_rss_bytes\": " << result.peakRss << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    file << "]\n}\n";
+    return static_cast<bool>(file.flush());
+}
+
+// Raw value of `key` in a flat JSON object: the text of a number, or the unescaped contents of a string.
+static bool json_field(const std::string &object, const std::string &key, std::string &value)
+{
+    size_t pos = object.find('"' + key + '"');
+    if (pos == std::string::npos)
+        return false;
+    pos = object.find(':', pos + key.size() + 2);
+    if (pos == std::string::npos)
+        return false;
+    pos = object.find_first_not_of(" \t\r\n", pos + 1);
+    if (pos == std::string::npos)
+        return false;
+
+    value.clear();
+    if (object[pos] == '"')
+    {
+        for (++pos; pos < object.size() && object[pos] != '"'; ++pos)
+        {
+            if (object[pos] == '\\' && pos + 1 < object.size())
+                ++pos;
+            value += object[pos];
+        }
+        return pos < object.size();
+    }
+
+    const size_t end = object.find_first_of(",}\r\n", pos);
+    value = object.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+    return !value.empty();
+}
+
+/*
+ * Reads a file written by write_bench_json(). Only that layout is understood: a header object whose "results"
+ * array holds flat objects.
+ */
+bool read_bench_json(const std::string &path, BenchRun &run)
+{
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string text = buffer.str();
+
+    const size_t results = text.find("\"results\"");
+    if (results == std::string::npos)
+        return false;
+
+    const std::string header = text.substr(0, results);
+    json_field(header, "cpu", run.cpu);
+    json_field(header, "build", run.build);
+    run.results.clear();
+
+    try
+    {
+        for (size_t open = text.find('{', results); open != std::string::npos; open = text.find('{', open + 1))
+        {
+            const size_t close = text.find('}', open);
+            if (close == std::string::npos)
+                return false;
+
+            const std::string object = text.substr(open, close - open + 1);
+            std::string kernel, pixels, colors, median, p95, allocatedBytes;
+            if (!json_field(object, "kernel", kernel) || !json_field(object, "pixels", pixels) ||
+                !json_field(object, "colors", colors) || !json_field(object, "median_ns", median) ||
+                !json_field(object, "p95_ns", p95))
+                return false;
+
+            run.results.push_back(StoredBenchResult{kernel, std::stoull(pixels), static_cast<unsigned>(std::stoul(colors)),
+                                                    std::stod(median), std::stod(p95),
+                                                    json_field(object, "alloc_bytes_per_call", allocatedBytes) ? std::stod(allocatedBytes) : -1});
+            open = close;
+        }
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Prints the change in median time and in bytes allocated per call of every case present in both runs, and
+ * returns the number of regressions: cases that became slower, or allocate more, by more than `threshold` (a
+ * share, 0.1 for 10%). Changes within the threshold are taken as noise. Comparing runs from different processors
+ * or builds is allowed but warned about.
+ */
+unsigned compare_bench_runs(const BenchRun &baseline, const BenchRun &current, double threshold)
+{
+    if (baseline.cpu != current.cpu)
+        std::cout << "Warning: different processors (" << baseline.cpu << " / " << current.cpu << ")" << std::endl;
+    if (baseline.build != current.build)
+        std::cout << "Warning: different builds (" << baseline.build << " / " << current.build << ")" << std::endl;
+
+    std::map<std::tuple<std::string, uint64_t, unsigned>, const StoredBenchResult *> baselineCases;
+    for (const StoredBenchResult &result : baseline.results)
+        baselineCases[{result.kernel, result.pixels, result.colors}] = &result;
+
+    std::cout << std::left << std::setw(30) << "kernel" << std::right << std::setw(9) << "pixels" << std::setw(7)
+              << "colors" << std::setw(13) << "baseline ms" << std::setw(11) << "ms" << std::setw(9) << "change"
+              << std::setw(10) << "memory" << std::endl;
+
+    unsigned regressions = 0, compared = 0;
+    for (const StoredBenchResult &result : current.results)
+    {
+        const auto match = baselineCases.find({result.kernel, result.pixels, result.colors});
+        if (match == baselineCases.end() || match->second->median <= 0)
+            continue;
+
+        const double change = result.median / match->second->median - 1;
+        const char *verdict = change > threshold ? "  REGRESSION" : change < -threshold ? "  faster" : "";
+
+        // Allocation counts are exact, so any growth beyond the threshold is real; none before means none now.
+        const double baseBytes = match->second->allocatedBytes;
+        const bool counted = baseBytes >= 0 && result.allocatedBytes >= 0;
+        const double memoryChange = !counted ? 0 : baseBytes > 0 ? result.allocatedBytes / baseBytes - 1 : result.allocatedBytes > 0;
+        const bool memoryRegression = memoryChange > threshold;
+
+        regressions += change > threshold || memoryRegression;
+        compared++;
+
+        std::cout << std::left << std::setw(30) << result.kernel << std::right << std::setw(9)
+                  << (result.pixels ? std::to_string(result.pixels) : "-") << std::setw(7)
+                  << (result.colors ? std::to_string(result.colors) : "-") << std::fixed << std::setprecision(3)
+                  << std::setw(13) << match->second->median / 1e6 << std::setw(11) << result.median / 1e6
+                  << std::setprecision(1) << std::showpos << std::setw(8) << change * 100 << '%';
+        if (counted)
+            std::cout << std::setw(9) << memoryChange * 100 << '%';
+        else
+            std::cout << std::setw(10) << "-";
+        std::cout << std::noshowpos << std::defaultfloat << std::setprecision(6) << verdict
+                  << (memoryRegression ? "  MEMORY REGRESSION" : "") << std::endl;
+    }
+
+    std::cout << compared << " cases compared, " << regressions << " slower or allocating more by more than "
+              << threshold * 100 << "%" << std::endl;
+    return regressions;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "harness.h"
+
+// Default --threshold: median changes within this share are taken as noise.
+#define BENCH_DEFAULT_THRESHOLD 0.10
+
+/*
+ * One case as stored in a result file, with the statistics rather than the samples, plus the machine and build
+ * it was measured on.
+ */
+typedef struct
+{
+    std::string kernel;
+    uint64_t pixels;
+    unsigned colors;
+    double median;
+    double p95;
+    double allocatedBytes; // per call, negative if the file has no allocation counts
+} StoredBenchResult;
+
+typedef struct
+{
+    std::string cpu;
+    std::string build;
+    std::vector<StoredBenchResult> results;
+} BenchRun;
+
+std::string bench_cpu_model();
+std::string bench_build_flags();
+bool write_bench_json(const std::string &path, const BenchSettings &settings, const std::vector<BenchResult> &results);
+bool read_bench_json(const std::string &path, BenchRun &run);
+unsigned compare_bench_runs(const BenchRun &baseline, const BenchRun &current, double threshold);
@@ -0,0 +1,144 @@
+#include "pch/cqt_pch.h"
+
+#include "timings.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+/*
+ * Counts the heap allocations of the process per thread for the stage timers (see timings.h). Linked into the
+ * executables only, so that the library never replaces the allocator of a process that embeds it.
+ *
+ * With glibc the malloc family itself is wrapped, forwarding to glibc's allocator: Eigen allocates its matrices
+ * with malloc rather than operator new, and those are the largest buffers of the pipeline. Elsewhere only the
+ * global operator new is replaced.
+ */
+
+static inline void count_allocation(size_t size)
+{
+    threadAllocations++;
+    threadAllocatedBytes += size;
+}
+
+[[maybe_unused]] static const bool countingAllocations = (allocationsCounted = true);
+
+#if defined(__GLIBC__)
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *pointer, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void *pointer);
+
+    void *malloc(size_t size) noexcept
+    {
+        count_allocation(size);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size) noexcept
+    {
+        count_allocation(count * size);
+        return __libc_calloc(count, size);
+    }
+
+    // A reallocation counts as a new allocation of the full new size, as the block may be copied.
+    void *realloc(void *pointer, size_t size) noexcept
+    {
+        count_allocation(size);
+        return __libc_realloc(pointer, size);
+    }
+
+    void *memalign(size_t alignment, size_t size) noexcept
+    {
+        count_allocation(size);
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        count_allocation(size);
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void **pointer, size_t alignment, size_t size) noexcept
+    {
+        if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+
+        count_allocation(size);
+        *pointer = __libc_memalign(alignment, size);
+        return *pointer || size == 0 ? 0 : ENOMEM;
+    }
+
+    void free(void *pointer) noexcept
+    {
+        __libc_free(pointer);
+    }
+}
+
+#else
+
+static void *allocate(size_t size)
+{
+    count_allocation(size);
+    if (void *pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+static void *allocate_aligned(size_t size, std::align_val_t alignment)
+{
+    count_allocation(size);
+    const size_t align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+    void *pointer = _aligned_malloc(size ? size : 1, align);
+#else
+    void *pointer = std::aligned_alloc(align, (size + align - 1) / align * align + (size ? 0 : align));
+#endif
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+static void release_aligned(void *pointer)
+{
+#ifdef _WIN32
+    _aligned_free(pointer);
+#else
+    std::free(pointer);
+#endif
+}
+
+void *operator new(size_t size) { return allocate(size); }
+void *operator new[](size_t size) { return allocate(size); }
+void *operator new(size_t size, std::align_val_t alignment) { return allocate_aligned(size, alignment); }
+void *operator new[](size_t size, std::align_val_t alignment) { return allocate_aligned(size, alignment); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    count_allocation(size);
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    count_allocation(size);
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete[](void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { release_aligned(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { release_aligned(pointer); }
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept { release_aligned(pointer); }
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept { release_aligned(pointer); }
+
+#endif
@@ -0,0 +1,365 @@
+#include "pch/cqt_pch.h"
+
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+#include "batch.h"
+#include "codec.h"
+#include "dither.h"
+#include "engine.h"
+#include "image.h"
+#include "input.h"
+#include "log.h"
+#include "parallel.h"
+#include "quantization.h"
+
+namespace fs = std::filesystem;
+
+/*
+ * Lists the images to process. `source` is either a directory, whose files with a known image extension are
+ * taken in name order, or a manifest with one input path per line (blank lines and lines starting with '#' are
+ * skipped). A manifest line may name the output after a tab; otherwise outputs keep the input's file name and
+ * format and are placed in `outputDirectory`, which is created if needed. Returns false if the source cannot be
+ * read or the outputs would overwrite the inputs.
+ */
+bool collect_batch_items(const std::string &source, const std::string &outputDirectory, std::vector<BatchItem> &items)
+{
+    std::error_code error;
+    fs::create_directories(outputDirectory, error);
+    if (error)
+        return false;
+
+    if (fs::is_directory(source, error))
+    {
+        if (fs::equivalent(source, outputDirectory, error))
+            return false;
+
+        for (const fs::directory_entry &entry : fs::directory_iterator(source, error))
+        {
+            const fs::path &path = entry.path();
+            if (entry.is_regular_file(error) && find_codec_for_extension(path.filename().string()))
+                items.push_back(BatchItem{path.string(), (fs::path(outputDirectory) / path.filename()).string()});
+        }
+
+        std::sort(items.begin(), items.end(), [](const BatchItem &a, const BatchItem &b)
+                  { return a.input < b.input; });
+        return !error;
+    }
+
+    std::ifstream manifest(source);
+    if (!manifest)
+        return false;
+
+    for (std::string line; std::getline(manifest, line);)
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        const size_t tab = line.find('\t');
+        const std::string input = line.substr(0, tab);
+        const fs::path output = tab != std::string::npos ? fs::path(line.substr(tab + 1)) : fs::path(input).filename();
+
+        items.push_back(BatchItem{input, (fs::path(outputDirectory) / output).string()});
+    }
+
+    return true;
+}
+
+// Counts transparent and translucent pixels like add_to_histogram() does, without counting colors.
+static void count_alpha(ColorHistogram &histogram, const unsigned char *pixels, size_t numPixels)
+{
+    for (size_t pixel = 0; pixel < numPixels; ++pixel)
+    {
+        const unsigned char alpha = pixels[pixel * 4 + 3];
+        histogram.transparentPixels += alpha == 0;
+        histogram.translucentPixels += alpha != 0 && alpha != 255;
+    }
+    histogram.totalPixels += numPixels;
+}
+
+/*
+ * Decodes `source` into `scratch.image` as 8-bit RGB, or RGBA when it carries alpha, and fills `scratch.histogram`
+ * with the colors of (a sample of at most `sampleBudget` of) its pixels, or with its alpha counts only when
+ * `alphaOnly`. Returns a codec error code.
+ */
+unsigned decode_source(const ImageSource &source, BatchScratch &scratch, uint64_t sampleBudget, bool alphaOnly,
+                       unsigned &width, unsigned &height, unsigned &channels)
+{
+    std::vector<unsigned char> &image = scratch.image;
+    ColorHistogram &histogram = scratch.histogram;
+
+    image.clear();
+    histogram.counts.clear();
+    histogram.totalPixels = histogram.transparentPixels = histogram.translucentPixels = 0;
+
+    width = height = 0;
+    channels = 3;
+    SpatialSampler sampler{0, 0, 1};
+
+    return decode_image_bands(source, STREAM_BAND_ROWS, true, width, height, channels,
+                              [&](const unsigned char *pixels, unsigned firstRow, unsigned rows)
+                              {
+                                  const size_t numPixels = static_cast<size_t>(rows) * width;
+                                  if (firstRow == 0)
+                                  {
+                                      sampler = make_spatial_sampler(width, height, sampleBudget);
+                                      image.reserve(static_cast<size_t>(width) * height * channels);
+                                  }
+
+                                  if (!alphaOnly)
+                                      add_sampled_to_histogram(histogram, sampler, pixels, firstRow, rows, channels);
+                                  else if (channels == 4)
+                                      count_alpha(histogram, pixels, numPixels);
+                                  image.insert(image.end(), pixels, pixels + numPixels * channels);
+                              });
+}
+
+/*
+ * Decodes `source` into the worker's scratch buffers and quantizes it in place on the calling thread, like
+ * execute() does for a single in-core image. The quantized pixels are left in `scratch.image`. Returns a codec
+ * error code.
+ *
+ * With `sharedPalette` the image is mapped to that palette instead of its own. Only its alpha is inspected
+ * then, and the worker's lookup table is kept from image to image, since all of them use the same palette.
+ */
+unsigned quantize_source(const ImageSource &source, const std::string &name, BatchScratch &scratch,
+                         const Options &options, QuantizedImage &result, const OutputPalette *sharedPalette)
+{
+    // Workers run concurrently, so their stages do not report on the console.
+    QuietScope quiet;
+    std::vector<unsigned char> &image = scratch.image;
+    const ColorHistogram &histogram = scratch.histogram;
+
+    unsigned width, height, channels;
+    unsigned error = decode_source(source, scratch, options.sampleBudget, sharedPalette != nullptr, width, height, channels);
+    if (error)
+        return error;
+
+    // Images are the unit of parallelism, so every image is processed on a single thread.
+    const Options imageOptions{name, options.targetNumColors, options.outputFileName, options.paletteFileName,
+                               options.targetPalette, width, height, options.dither, options.tileSize, 1,
+                               options.encodeEffort, false, options.sampleBudget, 0};
+
+    result.width = width;
+    result.height = height;
+    result.channels = channels;
+    result.indexable = histogram.translucentPixels == 0;
+
+    if (sharedPalette)
+    {
+        result.palette = *sharedPalette;
+        // Sampling may have missed the transparent pixels of this image; it is then written with alpha.
+        result.indexable = result.indexable && (sharedPalette->transparent || histogram.transparentPixels == 0);
+        if (scratch.paletteCache.size() > SHARED_PALETTE_CACHE_ENTRIES)
+            scratch.paletteCache.clear();
+    }
+    else
+    {
+        result.palette = NO_OUTPUT_PALETTE;
+        result.palette.transparent = histogram.transparentPixels > 0;
+        result.palette.colors = build_histogram_palette(histogram, imageOptions);
+        scratch.paletteCache.clear();
+    }
+
+    const std::vector<Pixel> &palette = result.palette.colors;
+
+    if (!options.dither || palette.empty())
+    {
+        map_pixels_to_palette(image.data(), image.size() / channels, channels, palette, scratch.paletteCache);
+    }
+    else
+    {
+        unsigned bandRows;
+        TiledDitherSettings settings = dither_settings_for(imageOptions, bandRows);
+        tiled_floyd_steinberg_dither_pixels(image, channels, palette, width, bandRows, settings);
+    }
+
+    return 0;
+}
+
+// Writes an encoded image to `path` ("-" is stdout). Returns 0 or 79.
+unsigned write_batch_output(const std::string &path, const std::vector<unsigned char> &encoded)
+{
+    unsigned error = 0;
+    std::FILE *file = open_output_file(path.c_str());
+    if (!file || std::fwrite(encoded.data(), 1, encoded.size(), file) != encoded.size())
+        error = 79;
+    if (close_output_file(file) != 0 && !error)
+        error = 79;
+    return error;
+}
+
+/*
+ * Quantizes one image of a batch with the worker's scratch buffers and writes it to `item.output`, adding its
+ * sizes to `summary`. Returns a codec error code.
+ *
+ * With a `cache`, the input bytes are hashed first and a stored result is written without decoding anything;
+ * otherwise the new result is stored. Images mapped to a shared palette depend on the whole batch and bypass it.
+ */
+unsigned quantize_batch_item(const BatchItem &item, BatchScratch &scratch, const Options &options, BatchSummary &summary,
+                             const OutputPalette *sharedPalette, ResultCache *cache)
+{
+    InputFile input;
+    QuantizedImage quantized;
+    std::string cacheKey;
+    bool cached = false;
+
+    unsigned error = input.open(item.input.c_str());
+    if (!error && cache && !sharedPalette)
+    {
+        size_t size;
+        scratch.input.clear();
+        const unsigned char *bytes = input.remaining(scratch.input, size);
+
+        cacheKey = result_cache_key(bytes, size, options, item.output);
+        cached = cache->lookup(cacheKey, scratch.encoded);
+        if (!cached)
+            error = quantize_source(memory_source(bytes, size), item.input, scratch, options, quantized);
+    }
+    else if (!error)
+    {
+        error = quantize_source(input.source(), item.input, scratch, options, quantized, sharedPalette);
+    }
+
+    summary.inputBytes += input.bytes_read();
+    input.close();
+
+    if (error)
+        return error;
+
+    if (!cached)
+    {
+        const EncodeSettings encodeSettings{options.encodeEffort, 1};
+        error = encode_image(scratch.encoded, item.output, scratch.image.data(), quantized.channels, quantized.width,
+                             quantized.height, quantized.indexable ? quantized.palette : NO_OUTPUT_PALETTE, encodeSettings);
+        if (error)
+            return error;
+
+        if (cache && !cacheKey.empty())
+            cache->store(cacheKey, scratch.encoded);
+        summary.pixels += static_cast<uint64_t>(quantized.width) * quantized.height;
+    }
+
+    error = write_batch_output(item.output, scratch.encoded);
+
+    summary.outputBytes += scratch.encoded.size();
+
+    return error;
+}
+
+/*
+ * First pass of shared-palette mode: streams every image once into one histogram, in which each image weighs
+ * with its (sampled) pixel count. Workers fill histograms of their own that are merged at the end; no image is
+ * kept in memory. Images that cannot be decoded are skipped here and reported by the second pass.
+ */
+ColorHistogram collect_batch_histogram(const std::vector<BatchItem> &items, const Options &options)
+{
+    const unsigned count = static_cast<unsigned>(items.size());
+    const unsigned workers = std::max(std::min(resolve_thread_count(options.numThreads), count), 1u);
+    std::vector<ColorHistogram> histograms(workers);
+
+    parallel_for_stealing(count, options.numThreads, [&](unsigned i, unsigned worker)
+                          {
+        ColorHistogram image;
+        SpatialSampler sampler{0, 0, 1};
+        InputFile input;
+        unsigned width, height, channels;
+
+        if (input.open(items[i].input.c_str()) != 0)
+            return;
+
+        unsigned error = decode_image_bands(input.source(), STREAM_BAND_ROWS, true, width, height, channels,
+                                            [&](const unsigned char *pixels, unsigned firstRow, unsigned rows)
+                                            {
+                                                if (firstRow == 0)
+                                                    sampler = make_spatial_sampler(width, height, options.sampleBudget);
+                                                add_sampled_to_histogram(image, sampler, pixels, firstRow, rows, channels);
+                                            });
+        if (!error)
+            merge_histograms(histograms[worker], image); });
+
+    for (unsigned worker = 1; worker < workers; ++worker)
+    {
+        merge_histograms(histograms[0], histograms[worker]);
+        histograms[worker] = ColorHistogram();
+    }
+
+    return std::move(histograms[0]);
+}
+
+/*
+ * The palette shared by all images of a batch. Every output gets the same palette (including the transparent
+ * entry if any image has transparent pixels), so indexed outputs agree on the meaning of every index.
+ */
+OutputPalette build_shared_palette(const ColorHistogram &histogram, const Options &options)
+{
+    OutputPalette palette = NO_OUTPUT_PALETTE;
+    palette.transparent = histogram.transparentPixels > 0;
+    if (!histogram.counts.empty())
+        palette.colors = palette_engine().build_palette(histogram_to_subset(histogram), options.targetNumColors);
+    return palette;
+}
+
+/*
+ * Quantizes every item on `options.numThreads` workers, one file per worker at a time, each to its own palette
+ * or all to `sharedPalette`. The per-image log lines would interleave, so std::cout is muted while the batch
+ * runs; failures are reported on std::cerr instead.
+ */
+BatchSummary run_batch(const std::vector<BatchItem> &items, const Options &options, const OutputPalette *sharedPalette,
+                       ResultCache *cache)
+{
+    const unsigned count = static_cast<unsigned>(items.size());
+    const unsigned workers = std::max(std::min(resolve_thread_count(options.numThreads), count), 1u);
+
+    std::vector<BatchScratch> scratch(workers);
+    std::vector<BatchSummary> summaries(workers, BatchSummary{0, 0, 0, 0, 0, 0});
+    std::mutex errorMutex;
+
+    NullBuffer discard;
+    std::streambuf *console = std::cout.rdbuf(&discard);
+    auto start = std::chrono::steady_clock::now();
+
+    parallel_for_stealing(count, options.numThreads, [&](unsigned i, unsigned worker)
+                          {
+        BatchSummary &summary = summaries[worker];
+        unsigned error = quantize_batch_item(items[i], scratch[worker], options, summary, sharedPalette, cache);
+
+        if (!error)
+        {
+            summary.succeeded++;
+            return;
+        }
+
+        summary.failed++;
+        std::lock_guard<std::mutex> lock(errorMutex);
+        std::cerr << items[i].input << ": error " << error << ": " << codec_error_text(error) << std::endl; });
+
+    BatchSummary total{0, 0, 0, 0, 0, 0};
+    total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout.rdbuf(console);
+
+    for (const BatchSummary &summary : summaries)
+    {
+        total.succeeded += summary.succeeded;
+        total.failed += summary.failed;
+        total.inputBytes += summary.inputBytes;
+        total.outputBytes += summary.outputBytes;
+        total.pixels += summary.pixels;
+    }
+
+    return total;
+}
+
+void log_batch_summary(const BatchSummary &summary)
+{
+    const double seconds = std::max(summary.seconds, 1e-9);
+
+    std::cout << "Batch: " << summary.succeeded << " images (" << summary.failed << " failed) in " << std::fixed
+              << std::setprecision(2) << summary.seconds << " s, " << std::setprecision(1)
+              << summary.succeeded / seconds << " images/s, " << summary.inputBytes / 1048576.0 / seconds
+              << " MiB/s read, " << summary.outputBytes / 1048576.0 / seconds << " MiB/s written, "
+              << summary.pixels / 1e6 / seconds << " Mpixels/s" << std::defaultfloat << std::endl;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "shared.h"
+#include "histogram.h"
+#include "palette.h"
+#include "codec.h"
+#include "cache.h"
+
+// Colors remembered by a worker's lookup table while it maps images to a shared palette.
+#define SHARED_PALETTE_CACHE_ENTRIES (1u << 20)
+
+typedef struct
+{
+    std::string input;
+    std::string output;
+} BatchItem;
+
+/*
+ * Buffers owned by one worker (of a batch or of the server) and reused for every image it processes. Vectors
+ * and hash maps keep their capacity when cleared, so after the first few images a worker mostly stops allocating.
+ */
+typedef struct
+{
+    std::vector<unsigned char> input; // bytes of an input that cannot be mapped, when they are needed at once
+    std::vector<unsigned char> image;
+    std::vector<unsigned char> encoded;
+    ColorHistogram histogram;
+    PaletteCache paletteCache;
+} BatchScratch;
+
+// An image quantized by quantize_source(); its pixels are left in the worker's scratch buffer.
+typedef struct
+{
+    unsigned width;
+    unsigned height;
+    unsigned channels;
+    OutputPalette palette;
+    bool indexable; // false when partially transparent pixels keep an alpha the palette cannot express
+} QuantizedImage;
+
+typedef struct
+{
+    size_t succeeded;
+    size_t failed;
+    uint64_t inputBytes;
+    uint64_t outputBytes;
+    uint64_t pixels; // pixels quantized; results taken from a cache are not decoded
+    double seconds;
+} BatchSummary;
+
+bool collect_batch_items(const std::string &source, const std::string &outputDirectory, std::vector<BatchItem> &items);
+unsigned decode_source(const ImageSource &source, BatchScratch &scratch, uint64_t sampleBudget, bool alphaOnly,
+                       unsigned &width, unsigned &height, unsigned &channels);
+unsigned quantize_source(const ImageSource &source, const std::string &name, BatchScratch &scratch,
+                         const Options &options, QuantizedImage &result, const OutputPalette *sharedPalette = nullptr);
+unsigned write_batch_output(const std::string &path, const std::vector<unsigned char> &encoded);
+unsigned quantize_batch_item(const BatchItem &item, BatchScratch &scratch, const Options &options, BatchSummary &summary,
+                             const OutputPalette *sharedPalette = nullptr, ResultCache *cache = nullptr);
+ColorHistogram collect_batch_histogram(const std::vector<BatchItem> &items, const Options &options);
+OutputPalette build_shared_palette(const ColorHistogram &histogram, const Options &options);
+BatchSummary run_batch(const std::vector<BatchItem> &items, const Options &options,
+                       const OutputPalette *sharedPalette = nullptr, ResultCache *cache = nullptr);
+void log_batch_summary(const BatchSummary &summary);
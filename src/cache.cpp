@@ -0,0 +1,262 @@
+#include "pch/cqt_pch.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#include "cache.h"
+#include "codec.h"
+#include "engine.h"
+#include "parallel.h"
+
+namespace fs = std::filesystem;
+
+// Temporary files are named with this prefix; those older than an hour were left behind by a crashed writer.
+static const std::string TEMP_PREFIX = ".tmp-";
+static const auto STALE_TEMP_AGE = std::chrono::hours(1);
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t rotl(uint64_t x, int bits) { return (x << bits) | (x >> (64 - bits)); }
+
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t value;
+    std::memcpy(&value, p, 8);
+    return value;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, 4);
+    return value;
+}
+
+static inline uint64_t xxh_round(uint64_t accumulator, uint64_t input)
+{
+    return rotl(accumulator + input * PRIME2, 31) * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t hash, uint64_t accumulator)
+{
+    return (hash ^ xxh_round(0, accumulator)) * PRIME1 + PRIME4;
+}
+
+/*
+ * 64-bit XXH64 hash of `data`. It reads 32 bytes per step in four independent lanes, so hashing an input costs
+ * a small fraction of decoding it. Values match the reference implementation on little-endian machines.
+ */
+uint64_t hash_bytes(const unsigned char *data, size_t size, uint64_t seed)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = data + size;
+    uint64_t hash;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+        }
+
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = merge_round(merge_round(merge_round(merge_round(hash, v1), v2), v3), v4);
+    }
+    else
+    {
+        hash = seed + PRIME5;
+    }
+
+    hash += size;
+
+    for (; p + 8 <= end; p += 8)
+        hash = rotl(hash ^ xxh_round(0, read64(p)), 27) * PRIME1 + PRIME4;
+    if (p + 4 <= end)
+    {
+        hash = rotl(hash ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        hash = rotl(hash ^ (*p * PRIME5), 11) * PRIME1;
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/*
+ * Cache key of quantizing `input` with `options` into `outputName`: the hash of the input bytes followed by the
+ * hash of every setting that can change the output bytes, the palette engine included, as 32 hex digits. The
+ * output file name only counts through the format its extension selects. An error target (see build_palettes())
+ * is part of the settings when set. Parallel encoding only changes the bytes when it runs on more than one thread
+ * (see encode_with_state()), so that is what counts, not the flag alone.
+ */
+std::string result_cache_key(const unsigned char *input, size_t size, const Options &options, const std::string &outputName,
+                             double targetMse)
+{
+    const ImageCodec *codec = find_codec_for_extension(outputName);
+    const bool parallelEncode = options.parallelEncode && resolve_thread_count(options.numThreads) > 1;
+
+    std::ostringstream settings;
+    settings << RESULT_CACHE_VERSION << " engine " << palette_engine().name() << " colors " << options.targetNumColors << " dither "
+             << options.dither << " tile " << options.tileSize << " sample " << options.sampleBudget << " effort "
+             << options.encodeEffort << " parallel-encode " << parallelEncode << " format "
+             << (codec ? codec->name() : png_codec().name());
+    if (targetMse > 0)
+        settings << " target-mse " << targetMse;
+    const std::string text = settings.str();
+
+    std::ostringstream key;
+    key << std::hex << std::setfill('0') << std::setw(16) << hash_bytes(input, size) << std::setw(16)
+        << hash_bytes(reinterpret_cast<const unsigned char *>(text.data()), text.size());
+    return key.str();
+}
+
+bool ResultCache::open(const std::string &path, uint64_t limit)
+{
+    std::error_code error;
+    fs::create_directories(path, error);
+    if (error || !fs::is_directory(path, error))
+        return false;
+
+    directory = path;
+    maxBytes = limit;
+    token = std::random_device()();
+    token = (token << 32) ^ std::random_device()();
+
+    storedBytes = 0;
+    for (const fs::directory_entry &entry : fs::directory_iterator(directory, error))
+    {
+        if (entry.is_regular_file(error))
+            storedBytes += entry.file_size(error);
+    }
+
+    if (storedBytes > maxBytes)
+        evict();
+    return true;
+}
+
+bool ResultCache::lookup(const std::string &key, std::vector<unsigned char> &result)
+{
+    const fs::path path = fs::path(directory) / key;
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file)
+    {
+        missCount++;
+        return false;
+    }
+
+    result.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char *>(result.data()), result.size()))
+    {
+        missCount++;
+        return false;
+    }
+
+    // The modification time doubles as the last use for eviction.
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    hitCount++;
+    return true;
+}
+
+void ResultCache::store(const std::string &key, const std::vector<unsigned char> &result)
+{
+    uint64_t counter;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counter = tempCounter++;
+    }
+
+    std::ostringstream name;
+    name << TEMP_PREFIX << std::hex << token << '-' << counter;
+    const fs::path temporary = fs::path(directory) / name.str();
+
+    std::error_code error;
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(result.data()), result.size());
+        if (!file.flush())
+        {
+            file.close();
+            fs::remove(temporary, error);
+            return;
+        }
+    }
+
+    // A rename within one directory replaces the entry atomically, even if another writer stored it meanwhile.
+    fs::rename(temporary, fs::path(directory) / key, error);
+    if (error)
+    {
+        fs::remove(temporary, error);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    storedBytes += result.size();
+    if (storedBytes > maxBytes)
+        evict();
+}
+
+/*
+ * Deletes the least recently used entries until the directory is below 90% of its limit, so that the next
+ * eviction, which lists the whole directory, is some stores away. Called with the mutex held.
+ */
+void ResultCache::evict()
+{
+    typedef struct
+    {
+        fs::file_time_type time;
+        uint64_t size;
+        fs::path path;
+    } Entry;
+
+    std::vector<Entry> entries;
+    std::error_code error;
+    const auto now = fs::file_time_type::clock::now();
+
+    storedBytes = 0;
+    for (const fs::directory_entry &entry : fs::directory_iterator(directory, error))
+    {
+        if (!entry.is_regular_file(error))
+            continue;
+
+        const fs::file_time_type time = entry.last_write_time(error);
+        if (entry.path().filename().string().rfind(TEMP_PREFIX, 0) == 0)
+        {
+            if (now - time > STALE_TEMP_AGE)
+                fs::remove(entry.path(), error);
+            continue;
+        }
+
+        entries.push_back(Entry{time, entry.file_size(error), entry.path()});
+        storedBytes += entries.back().size;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+              { return a.time < b.time; });
+
+    const uint64_t target = maxBytes / 10 * 9;
+    for (const Entry &entry : entries)
+    {
+        if (storedBytes <= target)
+            break;
+        if (fs::remove(entry.path, error))
+            storedBytes -= entry.size;
+    }
+}
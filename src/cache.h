@@ -0,0 +1,50 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <mutex>
+
+// Bumped whenever the same key could start to produce different output bytes.
+#define RESULT_CACHE_VERSION 2
+// Default --cache-size.
+#define RESULT_CACHE_DEFAULT_BYTES (1ull << 30)
+
+/*
+ * Content-addressed store of encoded results in a directory, shared by the workers of a batch and by any number
+ * of processes. Entries are named by their key (see result_cache_key()), written to a temporary file first and
+ * renamed into place, so readers only ever see complete entries. Reading an entry refreshes its modification
+ * time; once the directory grows beyond its size limit the least recently used entries are deleted.
+ */
+class ResultCache
+{
+public:
+    // Creates the directory if needed. Returns false if it cannot be used.
+    bool open(const std::string &directory, uint64_t maxBytes);
+
+    // Fills `result` with the entry for `key`; false on a miss.
+    bool lookup(const std::string &key, std::vector<unsigned char> &result);
+    // Stores `result` under `key`. Failures are ignored; the entry is simply missing later.
+    void store(const std::string &key, const std::vector<unsigned char> &result);
+
+    uint64_t hits() const { return hitCount; }
+    uint64_t misses() const { return missCount; }
+
+private:
+    void evict();
+
+    std::string directory;
+    uint64_t maxBytes = 0;
+    uint64_t token = 0; // tells this process's temporary files apart from those of others
+
+    std::mutex mutex;
+    uint64_t storedBytes = 0; // estimated size of the directory
+    uint64_t tempCounter = 0;
+
+    std::atomic<uint64_t> hitCount{0};
+    std::atomic<uint64_t> missCount{0};
+};
+
+uint64_t hash_bytes(const unsigned char *data, size_t size, uint64_t seed = 0);
+std::string result_cache_key(const unsigned char *input, size_t size, const Options &options, const std::string &outputName,
+                             double targetMse = 0);
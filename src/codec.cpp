@@ -0,0 +1,234 @@
+#include "pch/cqt_pch.h"
+
+#include <cstring>
+#include <memory>
+
+#include "codec.h"
+#include "lodepng.h"
+#include "timings.h"
+
+class PngCodec : public ImageCodec
+{
+public:
+    const char *name() const override { return "PNG"; }
+
+    bool matches_extension(const std::string &extension) const override { return extension == ".png"; }
+
+    bool matches_magic(const unsigned char *bytes, size_t size) const override
+    {
+        static const unsigned char SIGNATURE[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+        return size >= 8 && std::memcmp(bytes, SIGNATURE, 8) == 0;
+    }
+
+    unsigned decode_bands(const ImageSource &source, unsigned bandRows, bool keepAlpha, unsigned &width,
+                          unsigned &height, unsigned &channels, const BandConsumer &consumer) const override
+    {
+        return stream_png_bands(source.read, bandRows, keepAlpha, width, height, channels, consumer);
+    }
+
+    unsigned encode(std::vector<unsigned char> &out, const unsigned char *pixels, unsigned channels, unsigned width,
+                    unsigned height, const OutputPalette &palette, const EncodeSettings &settings) const override
+    {
+        const LodePNGColorType colortype = channels == 4 ? LCT_RGBA : LCT_RGB;
+
+        // Write an indexed image from the known palette. Pixels outside of it (e.g. partially transparent ones)
+        // make lodepng report error 82, in which case it picks the color type itself.
+        if (!palette.colors.empty() && encode_indexed_png(out, pixels, width, height, colortype, palette, settings) == 0)
+            return 0;
+
+        return encode_png(out, pixels, width, height, colortype, settings);
+    }
+
+    std::unique_ptr<BandEncoder> begin_encode(ByteWriter out, unsigned channels, unsigned width, unsigned height,
+                                              const OutputPalette &palette, const EncodeSettings &settings) const override
+    {
+        class Encoder : public BandEncoder
+        {
+        public:
+            explicit Encoder(PngBandWriter &&writer) : writer(std::move(writer)) {}
+            unsigned write_rows(const unsigned char *pixels, unsigned rows) override { return writer.write_rows(pixels, rows); }
+            unsigned finish() override { return writer.finish(); }
+
+        private:
+            PngBandWriter writer;
+        };
+
+        return std::unique_ptr<BandEncoder>(new Encoder(PngBandWriter(std::move(out), width, height, channels, palette, settings)));
+    }
+};
+
+const ImageCodec &png_codec()
+{
+    static const PngCodec codec;
+    return codec;
+}
+
+static const std::vector<const ImageCodec *> &registered_codecs()
+{
+    static const std::vector<const ImageCodec *> codecs = {&png_codec(), &pnm_codec(), &pam_codec(), &qoi_codec()};
+    return codecs;
+}
+
+const ImageCodec *find_codec_for_extension(const std::string &filename)
+{
+    size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos)
+        return nullptr;
+
+    std::string extension = filename.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+                   { return static_cast<char>(std::tolower(c)); });
+
+    for (const ImageCodec *codec : registered_codecs())
+    {
+        if (codec->matches_extension(extension))
+            return codec;
+    }
+
+    return nullptr;
+}
+
+const ImageCodec *find_codec_for_magic(const unsigned char *bytes, size_t size)
+{
+    for (const ImageCodec *codec : registered_codecs())
+    {
+        if (codec->matches_magic(bytes, size))
+            return codec;
+    }
+
+    return nullptr;
+}
+
+const char *codec_error_text(unsigned error)
+{
+    switch (error)
+    {
+    case CODEC_ERROR_UNKNOWN_FORMAT:
+        return "unrecognized image format";
+    case CODEC_ERROR_BAD_HEADER:
+        return "malformed image header";
+    case CODEC_ERROR_UNSUPPORTED:
+        return "unsupported sample format";
+    case CODEC_ERROR_TRUNCATED:
+        return "image data ended early";
+    case CODEC_ERROR_TOO_LARGE:
+        return "image dimensions too large";
+    default:
+        return lodepng_error_text(error);
+    }
+}
+
+ImageSource memory_source(const unsigned char *data, size_t size)
+{
+    auto offset = std::make_shared<size_t>(0);
+
+    ByteReader read = [data, size, offset](unsigned char *buffer, size_t count)
+    {
+        count = std::min(count, size - *offset);
+        std::memcpy(buffer, data + *offset, count);
+        *offset += count;
+        return count;
+    };
+
+    return ImageSource{read, data, size};
+}
+
+ByteWriter vector_writer(std::vector<unsigned char> &out)
+{
+    return [&out](const unsigned char *data, size_t size)
+    {
+        out.insert(out.end(), data, data + size);
+        return true;
+    };
+}
+
+/*
+ * Whole-image encode() for codecs whose encoder is naturally incremental: the image is written as a single band.
+ */
+unsigned encode_with_band_encoder(const ImageCodec &codec, std::vector<unsigned char> &out, const unsigned char *pixels,
+                                  unsigned channels, unsigned width, unsigned height, const OutputPalette &palette,
+                                  const EncodeSettings &settings)
+{
+    out.clear();
+    std::unique_ptr<BandEncoder> encoder = codec.begin_encode(vector_writer(out), channels, width, height, palette, settings);
+
+    unsigned error = encoder->write_rows(pixels, height);
+    return error ? error : encoder->finish();
+}
+
+/*
+ * Decodes any registered format, chosen by the magic bytes at the start of the input. For streamed input the
+ * peeked bytes are replayed in front of the rest of the stream.
+ */
+unsigned decode_image_bands(const ImageSource &source, unsigned bandRows, bool keepAlpha, unsigned &width,
+                            unsigned &height, unsigned &channels, const BandConsumer &consumer)
+{
+    // Work done by `consumer` is timed by its own stages where it has one.
+    StageTimer timer(STAGE_DECODE);
+    channels = 3;
+
+    if (source.mapped)
+    {
+        const ImageCodec *codec = find_codec_for_magic(source.mapped, source.mappedSize);
+        return codec ? codec->decode_bands(source, bandRows, keepAlpha, width, height, channels, consumer)
+                     : CODEC_ERROR_UNKNOWN_FORMAT;
+    }
+
+    struct Peeked
+    {
+        unsigned char bytes[8];
+        size_t size = 0;
+        size_t position = 0;
+    };
+    auto peeked = std::make_shared<Peeked>();
+
+    for (size_t count = 1; count > 0 && peeked->size < sizeof(peeked->bytes);)
+    {
+        count = source.read(peeked->bytes + peeked->size, sizeof(peeked->bytes) - peeked->size);
+        peeked->size += count;
+    }
+
+    const ImageCodec *codec = find_codec_for_magic(peeked->bytes, peeked->size);
+    if (!codec)
+        return CODEC_ERROR_UNKNOWN_FORMAT;
+
+    ByteReader rest = source.read;
+    ByteReader replay = [peeked, rest](unsigned char *buffer, size_t size)
+    {
+        if (peeked->position < peeked->size)
+        {
+            size_t count = std::min(size, peeked->size - peeked->position);
+            std::memcpy(buffer, peeked->bytes + peeked->position, count);
+            peeked->position += count;
+            return count;
+        }
+        return rest(buffer, size);
+    };
+
+    return codec->decode_bands(ImageSource{replay, nullptr, 0}, bandRows, keepAlpha, width, height, channels, consumer);
+}
+
+unsigned decode_image_bands(const ImageSource &source, unsigned bandRows, unsigned &width, unsigned &height,
+                            const BandConsumer &consumer)
+{
+    unsigned channels;
+    return decode_image_bands(source, bandRows, false, width, height, channels, consumer);
+}
+
+/*
+ * Encodes with the codec matching the extension of `filename`, falling back to PNG.
+ */
+unsigned encode_image(std::vector<unsigned char> &out, const std::string &filename, const unsigned char *pixels,
+                      unsigned channels, unsigned width, unsigned height, const OutputPalette &palette,
+                      const EncodeSettings &settings)
+{
+    StageTimer timer(STAGE_ENCODE);
+    const ImageCodec *codec = find_codec_for_extension(filename);
+    return (codec ? *codec : png_codec()).encode(out, pixels, channels, width, height, palette, settings);
+}
+
+unsigned encode_image(std::vector<unsigned char> &out, const std::string &filename, const unsigned char *rgb,
+                      unsigned width, unsigned height, const EncodeSettings &settings)
+{
+    return encode_image(out, filename, rgb, 3, width, height, NO_OUTPUT_PALETTE, settings);
+}
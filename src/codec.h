@@ -0,0 +1,155 @@
+#pragma once
+
+#include "shared.h"
+#include "png_encode.h"
+#include "png_stream.h"
+
+#include <memory>
+
+// Error codes of the non-PNG codecs; lower values are lodepng's own codes.
+#define CODEC_ERROR_UNKNOWN_FORMAT 200
+#define CODEC_ERROR_BAD_HEADER 201
+#define CODEC_ERROR_UNSUPPORTED 202
+#define CODEC_ERROR_TRUNCATED 203
+#define CODEC_ERROR_TOO_LARGE 204
+
+/*
+ * Encoded image input for the codecs. `read` always works; when the whole remaining input is addressable in
+ * memory (a mapped file or a caller-owned buffer) `mapped` points at it as well, so uncompressed formats can
+ * hand out pixel rows without copying them. A decoder uses one or the other, never both.
+ */
+typedef struct
+{
+    ByteReader read;
+    const unsigned char *mapped;
+    size_t mappedSize;
+} ImageSource;
+
+/*
+ * Byte-level reader over an ImageSource for the hand-written codecs. Reads through a small buffer when the
+ * source is a stream, and can hand out spans of a mapped source directly.
+ */
+class SourceCursor
+{
+public:
+    explicit SourceCursor(const ImageSource &source) : source(source)
+    {
+        if (!source.mapped)
+            buffer.resize(65536);
+    }
+
+    // Next byte, or -1 at the end of the input.
+    int get()
+    {
+        if (position == end && !refill())
+            return -1;
+        return data()[position++];
+    }
+
+    // Copies exactly `size` bytes; returns false if the input ends first.
+    bool read(unsigned char *out, size_t size)
+    {
+        while (size > 0)
+        {
+            if (position == end && !refill())
+                return false;
+            size_t count = std::min(size, end - position);
+            std::copy(data() + position, data() + position + count, out);
+            position += count;
+            out += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    // Pointer to the next `size` bytes without copying, or nullptr when the source is not mapped or too short.
+    const unsigned char *span(size_t size)
+    {
+        if (!source.mapped || source.mappedSize - position < size)
+            return nullptr;
+        position += size;
+        return source.mapped + position - size;
+    }
+
+private:
+    const unsigned char *data() const { return source.mapped ? source.mapped : buffer.data(); }
+
+    bool refill()
+    {
+        if (source.mapped)
+        {
+            end = source.mappedSize;
+            return position < end;
+        }
+        end = source.read(buffer.data(), buffer.size());
+        position = 0;
+        return end > 0;
+    }
+
+    const ImageSource &source;
+    std::vector<unsigned char> buffer;
+    size_t position = 0;
+    size_t end = 0;
+};
+
+/*
+ * Incremental encoder fed with consecutive bands of rows, so that output can be written while the image is still
+ * being decoded. Created by ImageCodec::begin_encode(); returns the codecs' error codes.
+ */
+class BandEncoder
+{
+public:
+    virtual ~BandEncoder() = default;
+
+    virtual unsigned write_rows(const unsigned char *pixels, unsigned rows) = 0;
+    virtual unsigned finish() = 0;
+};
+
+/*
+ * A file format that can decode to and encode from packed 8-bit RGB or RGBA. Decoding is band based, mirroring
+ * stream_png_bands(), so every codec can feed the streaming pipeline. With `keepAlpha`, formats that store alpha
+ * deliver RGBA straight from their native layout and report 4 `channels`; everything else is delivered as RGB.
+ *
+ * `palette` passed to encode() describes a quantized image (no colors if unknown). Formats with indexed modes
+ * use it directly instead of searching the pixels for distinct colors.
+ */
+class ImageCodec
+{
+public:
+    virtual ~ImageCodec() = default;
+
+    virtual const char *name() const = 0;
+    virtual bool matches_extension(const std::string &extension) const = 0;
+    virtual bool matches_magic(const unsigned char *bytes, size_t size) const = 0;
+
+    virtual unsigned decode_bands(const ImageSource &source, unsigned bandRows, bool keepAlpha, unsigned &width,
+                                  unsigned &height, unsigned &channels, const BandConsumer &consumer) const = 0;
+    virtual unsigned encode(std::vector<unsigned char> &out, const unsigned char *pixels, unsigned channels, unsigned width,
+                            unsigned height, const OutputPalette &palette, const EncodeSettings &settings) const = 0;
+    virtual std::unique_ptr<BandEncoder> begin_encode(ByteWriter out, unsigned channels, unsigned width, unsigned height,
+                                                      const OutputPalette &palette, const EncodeSettings &settings) const = 0;
+};
+
+const ImageCodec &png_codec();
+const ImageCodec &pnm_codec();
+const ImageCodec &pam_codec();
+const ImageCodec &qoi_codec();
+
+const ImageCodec *find_codec_for_extension(const std::string &filename);
+const ImageCodec *find_codec_for_magic(const unsigned char *bytes, size_t size);
+const char *codec_error_text(unsigned error);
+
+ImageSource memory_source(const unsigned char *data, size_t size);
+ByteWriter vector_writer(std::vector<unsigned char> &out);
+unsigned encode_with_band_encoder(const ImageCodec &codec, std::vector<unsigned char> &out, const unsigned char *pixels,
+                                  unsigned channels, unsigned width, unsigned height, const OutputPalette &palette,
+                                  const EncodeSettings &settings);
+unsigned decode_image_bands(const ImageSource &source, unsigned bandRows, bool keepAlpha, unsigned &width,
+                            unsigned &height, unsigned &channels, const BandConsumer &consumer);
+unsigned decode_image_bands(const ImageSource &source, unsigned bandRows, unsigned &width, unsigned &height,
+                            const BandConsumer &consumer);
+unsigned encode_image(std::vector<unsigned char> &out, const std::string &filename, const unsigned char *pixels,
+                      unsigned channels, unsigned width, unsigned height, const OutputPalette &palette,
+                      const EncodeSettings &settings);
+unsigned encode_image(std::vector<unsigned char> &out, const std::string &filename, const unsigned char *rgb,
+                      unsigned width, unsigned height, const EncodeSettings &settings);
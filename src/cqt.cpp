@@ -0,0 +1,133 @@
+#include "pch/cqt_pch.h"
+
+#include <new>
+
+#include "cqt.h"
+#include "quantizer.h"
+#include "codec.h"
+
+struct cqt_quantizer
+{
+    Quantizer quantizer;
+};
+
+// lodepng's code for a failed allocation; no exception may cross the C interface.
+#define CQT_ERROR_OUT_OF_MEMORY 83
+
+template <typename Func>
+static unsigned guarded(Func &&func)
+{
+    try
+    {
+        return func();
+    }
+    catch (const std::bad_alloc &)
+    {
+        return CQT_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+// A PixelFormat cannot hold values outside its enumerators, so the C format is checked before converting it.
+static bool is_valid_format(int format)
+{
+    return format >= CQT_FORMAT_RGB8 && format <= CQT_FORMAT_BGRA8;
+}
+
+static PixelBuffer make_buffer(const unsigned char *pixels, unsigned width, unsigned height, size_t stride, int format)
+{
+    return PixelBuffer{pixels, width, height, stride, static_cast<PixelFormat>(format)};
+}
+
+cqt_quantizer *cqt_quantizer_new(unsigned num_colors, int dither)
+{
+    QuantizerSettings settings = DEFAULT_QUANTIZER_SETTINGS;
+    settings.numColors = num_colors;
+    settings.dither = dither != 0;
+    return new (std::nothrow) cqt_quantizer{Quantizer(settings)};
+}
+
+void cqt_quantizer_free(cqt_quantizer *quantizer)
+{
+    delete quantizer;
+}
+
+void cqt_quantizer_set_colors(cqt_quantizer *quantizer, unsigned num_colors)
+{
+    QuantizerSettings settings = quantizer->quantizer.settings();
+    settings.numColors = num_colors;
+    quantizer->quantizer.set_settings(settings);
+}
+
+void cqt_quantizer_set_dither(cqt_quantizer *quantizer, int dither)
+{
+    QuantizerSettings settings = quantizer->quantizer.settings();
+    settings.dither = dither != 0;
+    quantizer->quantizer.set_settings(settings);
+}
+
+void cqt_quantizer_set_sample_budget(cqt_quantizer *quantizer, uint64_t pixels)
+{
+    QuantizerSettings settings = quantizer->quantizer.settings();
+    settings.sampleBudget = pixels;
+    quantizer->quantizer.set_settings(settings);
+}
+
+unsigned cqt_quantizer_set_engine(cqt_quantizer *quantizer, const char *name)
+{
+    const PaletteEngine *engine = name ? find_palette_engine(name) : nullptr;
+    if (!engine)
+        return QUANTIZER_ERROR_UNKNOWN_ENGINE;
+
+    quantizer->quantizer.set_engine(*engine);
+    return 0;
+}
+
+void cqt_quantizer_set_progress(cqt_quantizer *quantizer, cqt_progress_callback callback, void *user)
+{
+    quantizer->quantizer.set_progress_callback(callback, user);
+}
+
+unsigned cqt_quantize(cqt_quantizer *quantizer, const unsigned char *pixels, unsigned width, unsigned height,
+                      size_t stride, int format)
+{
+    if (!is_valid_format(format))
+        return QUANTIZER_ERROR_INVALID_BUFFER;
+
+    return guarded([&]()
+                   { return quantizer->quantizer.quantize(make_buffer(pixels, width, height, stride, format)); });
+}
+
+unsigned cqt_remap(cqt_quantizer *quantizer, const unsigned char *pixels, unsigned width, unsigned height,
+                   size_t stride, int format)
+{
+    if (!is_valid_format(format))
+        return QUANTIZER_ERROR_INVALID_BUFFER;
+
+    return guarded([&]()
+                   { return quantizer->quantizer.remap(make_buffer(pixels, width, height, stride, format)); });
+}
+
+const unsigned char *cqt_palette(const cqt_quantizer *quantizer, unsigned *size)
+{
+    if (size)
+        *size = quantizer->quantizer.palette_size();
+    return quantizer->quantizer.palette().data();
+}
+
+const unsigned char *cqt_indices(const cqt_quantizer *quantizer, size_t *count)
+{
+    if (count)
+        *count = quantizer->quantizer.indices().size();
+    return quantizer->quantizer.indices().data();
+}
+
+const char *cqt_error_text(unsigned error)
+{
+    if (error == QUANTIZER_ERROR_INVALID_BUFFER)
+        return "invalid pixel buffer";
+    if (error == QUANTIZER_ERROR_UNKNOWN_ENGINE)
+        return "unknown palette engine";
+    if (error == QUANTIZER_ERROR_NO_TRANSPARENT_ENTRY)
+        return "transparent pixels but no transparent palette entry";
+    return codec_error_text(error);
+}
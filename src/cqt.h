@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+ * C interface to the quantizer (see Quantizer in quantizer.h) for callers in other languages. Pixel buffers are
+ * read in place, and the palette and index buffers returned point into the quantizer, valid until its next
+ * call or until it is freed. Functions that can fail return 0 on success or an error code for cqt_error_text().
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if defined(_WIN32) && defined(CQT_BUILD_SHARED)
+#define CQT_API __declspec(dllexport)
+#else
+#define CQT_API
+#endif
+
+typedef struct cqt_quantizer cqt_quantizer;
+
+// Pixel formats, 8 bits per channel.
+enum
+{
+    CQT_FORMAT_RGB8 = 0,
+    CQT_FORMAT_RGBA8 = 1,
+    CQT_FORMAT_BGR8 = 2,
+    CQT_FORMAT_BGRA8 = 3
+};
+
+CQT_API cqt_quantizer *cqt_quantizer_new(unsigned num_colors, int dither);
+CQT_API void cqt_quantizer_free(cqt_quantizer *quantizer);
+CQT_API void cqt_quantizer_set_colors(cqt_quantizer *quantizer, unsigned num_colors);
+CQT_API void cqt_quantizer_set_dither(cqt_quantizer *quantizer, int dither);
+CQT_API void cqt_quantizer_set_sample_budget(cqt_quantizer *quantizer, uint64_t pixels);
+// Palette construction by name: "pca" (the default), "pca-moments", "wu" or "octree".
+CQT_API unsigned cqt_quantizer_set_engine(cqt_quantizer *quantizer, const char *name);
+
+// Receives `completed` of `total` steps of `stage` (a static string), a few times per second at most.
+typedef void (*cqt_progress_callback)(void *user, const char *stage, unsigned completed, unsigned total);
+// Called during cqt_quantize() on the calling thread; NULL removes the callback.
+CQT_API void cqt_quantizer_set_progress(cqt_quantizer *quantizer, cqt_progress_callback callback, void *user);
+
+// `stride` is the distance between rows in bytes, 0 for tightly packed rows.
+CQT_API unsigned cqt_quantize(cqt_quantizer *quantizer, const unsigned char *pixels, unsigned width, unsigned height,
+                              size_t stride, int format);
+CQT_API unsigned cqt_remap(cqt_quantizer *quantizer, const unsigned char *pixels, unsigned width, unsigned height,
+                           size_t stride, int format);
+
+// RGBA entries, 4 bytes each; `size` receives the number of entries.
+CQT_API const unsigned char *cqt_palette(const cqt_quantizer *quantizer, unsigned *size);
+// One palette index per pixel, row by row; `count` receives the number of pixels.
+CQT_API const unsigned char *cqt_indices(const cqt_quantizer *quantizer, size_t *count);
+
+CQT_API const char *cqt_error_text(unsigned error);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,10 +3,14 @@
 #include "quantization.h"
 #include "palette.h"
 #include "dither.h"
+#include "parallel.h"
+#include "timings.h"
 
 void floyd_steinberg_dither(MatrixRgb &originalMatrix, const std::vector<Pixel> colorPalette, const unsigned width)
 {
-    std::cout << "Dithering... ";
+    StageTimer timer(STAGE_DITHER);
+    if (consoleOutput)
+        std::cout << "Dithering... ";
 
     double red_error, green_error, blue_error;
 
@@ -52,5 +56,290 @@ void floyd_steinberg_dither(MatrixRgb &originalMatrix, const std::vector<Pixel>
         }
     }
 
-    std::cout << "done." << std::endl;
-}
\ No newline at end of file
+    if (consoleOutput)
+        std::cout << "done." << std::endl;
+}
+/*
+ * Dithers one horizontal band of tiles. Every tile is diffused independently inside a scratch buffer that
+ * extends `apron` pixels above, to the left and to the right of the tile, using the original (undithered)
+ * values for the apron. Error is allowed to flow from the apron into the tile so that the error state is
+ * "warmed up" when the scan reaches the tile's own pixels, and any error that would leave the scratch
+ * buffer is dropped. Only the tile's own pixels are written to `bandIndices`.
+ *
+ * Because a tile never reads the output of another tile, the result does not depend on the order in which
+ * tiles are processed or on the number of threads.
+ *
+ * `band` holds the band's pixels row by row, `aboveRows` holds up to `apron` undithered image rows that
+ * directly precede the band (empty for the first band). Pixels whose first component is NaN (transparent
+ * ones) are skipped: they get DITHER_SKIPPED_INDEX, pass no error on, and any error pushed onto them is lost.
+ */
+void dither_tile_band(const Eigen::Ref<const MatrixRgb> &band, const Eigen::Ref<const MatrixRgb> &aboveRows,
+                      const std::vector<Pixel> &colorPalette, const unsigned width, const TiledDitherSettings &settings,
+                      std::vector<unsigned short> &bandIndices)
+{
+    assert(band.rows() % width == 0 && aboveRows.rows() % width == 0 && "Band is not a whole number of rows!");
+
+    const unsigned tileSize = std::max(settings.tileSize, 1u);
+    const unsigned tilesAcross = (width + tileSize - 1) / tileSize;
+
+    bandIndices.resize(band.rows());
+
+    parallel_for(tilesAcross, settings.numThreads, [&](unsigned tile)
+                 { dither_tile(band, aboveRows, colorPalette, width, settings, tile, bandIndices); });
+}
+
+/*
+ * Dithers tile number `tile` (counted from the left) of a band, as dither_tile_band() does for every tile. Only
+ * the tile's entries of `bandIndices`, which must hold one entry per pixel of the band, are written.
+ */
+void dither_tile(const Eigen::Ref<const MatrixRgb> &band, const Eigen::Ref<const MatrixRgb> &aboveRows,
+                 const std::vector<Pixel> &colorPalette, const unsigned width, const TiledDitherSettings &settings,
+                 const unsigned tile, std::vector<unsigned short> &bandIndices)
+{
+    const unsigned bandHeight = band.rows() / width;
+    const unsigned aboveHeight = aboveRows.rows() / width;
+    const unsigned tileSize = std::max(settings.tileSize, 1u);
+
+    const unsigned x0 = tile * tileSize;
+    const unsigned x1 = std::min(width, x0 + tileSize);
+    const unsigned left = x0 - std::min(x0, settings.apron);
+    const unsigned right = std::min(width, x1 + settings.apron);
+    const unsigned top = std::min(aboveHeight, settings.apron);
+
+    const unsigned cols = right - left;
+    const unsigned rows = top + bandHeight;
+
+    // Gather the tile and its apron into a scratch buffer; this is the only per-tile allocation.
+    MatrixRgb scratch(rows * cols, 3);
+    for (unsigned y = 0; y < rows; ++y)
+    {
+        const auto &source = y < top ? aboveRows.middleRows((aboveHeight - top + y) * width + left, cols)
+                                     : band.middleRows((y - top) * width + left, cols);
+        scratch.middleRows(y * cols, cols) = source;
+    }
+
+    for (unsigned y = 0; y < rows; ++y)
+    {
+        for (unsigned x = 0; x < cols; ++x)
+        {
+            const unsigned pixel = y * cols + x;
+            const bool inTile = y >= top && left + x >= x0 && left + x < x1;
+
+            if (std::isnan(scratch(pixel, 0)))
+            {
+                if (inTile)
+                    bandIndices[(y - top) * width + left + x] = DITHER_SKIPPED_INDEX;
+                continue;
+            }
+
+            const unsigned index = find_closest_palette_index(scratch.row(pixel), colorPalette);
+            const Pixel error = scratch.row(pixel) - colorPalette[index];
+
+            if (inTile)
+                bandIndices[(y - top) * width + left + x] = static_cast<unsigned short>(index);
+
+            // Push quantization error onto neighboring pixels that lie inside the scratch buffer.
+            if (x + 1 < cols)
+                scratch.row(pixel + 1) += error * 7 / 16;
+
+            if (y + 1 < rows)
+            {
+                if (x > 0)
+                    scratch.row(pixel + cols - 1) += error * 3 / 16;
+
+                scratch.row(pixel + cols) += error * 5 / 16;
+
+                if (x + 1 < cols)
+                    scratch.row(pixel + cols + 1) += error * 1 / 16;
+            }
+        }
+    }
+}
+
+/*
+ * Serial Floyd-Steinberg dithering of the next band of an image that is processed top to bottom. The error pushed
+ * below the band's last row is kept in `state.carriedError` and added to the next band, so splitting the image
+ * into bands does not change the result. Transparent pixels (NaN) are skipped as in dither_tile().
+ */
+void dither_serial_band(TiledDitherState &state, const Eigen::Ref<const MatrixRgb> &band,
+                        const std::vector<Pixel> &colorPalette, const unsigned width)
+{
+    assert(band.rows() % width == 0 && "Band is not a whole number of rows!");
+
+    const unsigned rows = band.rows() / width;
+    MatrixRgb scratch = band;
+    if (state.carriedError.rows() == width)
+        scratch.topRows(width) += state.carriedError;
+
+    MatrixRgb belowError = MatrixRgb::Zero(width, 3);
+    state.indices.resize(band.rows());
+
+    for (unsigned y = 0; y < rows; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+        {
+            const unsigned pixel = y * width + x;
+
+            if (std::isnan(scratch(pixel, 0)))
+            {
+                state.indices[pixel] = DITHER_SKIPPED_INDEX;
+                continue;
+            }
+
+            const unsigned index = find_closest_palette_index(scratch.row(pixel), colorPalette);
+            const Pixel error = scratch.row(pixel) - colorPalette[index];
+            state.indices[pixel] = static_cast<unsigned short>(index);
+
+            if (x + 1 < width)
+                scratch.row(pixel + 1) += error * 7 / 16;
+
+            // The row below is either in this band or the first row of the next one.
+            auto below = y + 1 < rows ? scratch.middleRows(pixel + width - x, width) : belowError.middleRows(0, width);
+            if (x > 0)
+                below.row(x - 1) += error * 3 / 16;
+
+            below.row(x) += error * 5 / 16;
+
+            if (x + 1 < width)
+                below.row(x + 1) += error * 1 / 16;
+        }
+    }
+
+    state.carriedError.swap(belowError);
+}
+
+/*
+ * Dithers the next band of an image that is processed top to bottom. The undithered apron rows (or, when
+ * dithering serially, the carried error) needed by the following band are kept in `state`, so the caller may
+ * overwrite or discard the band afterwards. The palette index of every pixel of the band is left in
+ * `state.indices`.
+ */
+void dither_next_band(TiledDitherState &state, const Eigen::Ref<const MatrixRgb> &band, const std::vector<Pixel> &colorPalette,
+                      const unsigned width, const TiledDitherSettings &settings)
+{
+    StageTimer timer(STAGE_DITHER);
+    assert(colorPalette.size() < DITHER_SKIPPED_INDEX && "Palette too large for tiled dithering!");
+
+    if (settings.tileSize == 0)
+    {
+        dither_serial_band(state, band, colorPalette, width);
+        return;
+    }
+
+    dither_tile_band(band, state.aboveRows, colorPalette, width, settings, state.indices);
+
+    const Eigen::Index apronRows = std::min<Eigen::Index>(settings.apron * width, state.aboveRows.rows() + band.rows());
+    const Eigen::Index fromBand = std::min(apronRows, band.rows());
+
+    MatrixRgb aboveRows(apronRows, 3);
+    aboveRows.topRows(apronRows - fromBand) = state.aboveRows.bottomRows(apronRows - fromBand);
+    aboveRows.bottomRows(fromBand) = band.bottomRows(fromBand);
+    state.aboveRows.swap(aboveRows);
+}
+
+/*
+ * Floyd-Steinberg dithering over independent tiles, processed band by band on a thread pool. Besides the
+ * scratch buffer of each tile, only one band of palette indices and the apron rows above the current band
+ * are kept, so the extra memory is bounded by the tile size and the image width rather than by the full
+ * image. The output is reproducible for any thread count.
+ */
+void tiled_floyd_steinberg_dither(MatrixRgb &originalMatrix, const std::vector<Pixel> &colorPalette, const unsigned width,
+                                  const TiledDitherSettings &settings)
+{
+    if (consoleOutput)
+        std::cout << "Dithering (tiled)... ";
+
+    const unsigned height = originalMatrix.rows() / width;
+    const unsigned bandRows = settings.tileSize > 0 ? settings.tileSize : STREAM_BAND_ROWS;
+
+    TiledDitherState state;
+
+    for (unsigned y0 = 0; y0 < height; y0 += bandRows)
+    {
+        const unsigned bandPixels = std::min(bandRows, height - y0) * width;
+
+        dither_next_band(state, originalMatrix.middleRows(y0 * width, bandPixels), colorPalette, width, settings);
+
+        for (unsigned pixel = 0; pixel < bandPixels; ++pixel)
+            originalMatrix.row(y0 * width + pixel) = colorPalette[state.indices[pixel]];
+    }
+
+    if (consoleOutput)
+        std::cout << "done." << std::endl;
+}
+
+/*
+ * Dithers the next band of packed 8-bit RGB or RGBA pixels in place (see tiled_floyd_steinberg_dither_pixels()).
+ */
+void dither_pixels_band(TiledDitherState &state, unsigned char *pixels, const size_t numPixels, const unsigned channels,
+                        const std::vector<Pixel> &colorPalette, const unsigned width, const TiledDitherSettings &settings)
+{
+    StageTimer timer(STAGE_DITHER);
+    const Eigen::Map<MatrixXuc, 0, Eigen::OuterStride<>> colors(pixels, numPixels, 3, Eigen::OuterStride<>(channels));
+    MatrixRgb band = colors.cast<double>();
+
+    if (channels == 4)
+    {
+        for (size_t pixel = 0; pixel < numPixels; ++pixel)
+        {
+            if (pixels[pixel * 4 + 3] == 0)
+                band(pixel, 0) = std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+
+    dither_next_band(state, band, colorPalette, width, settings);
+
+    for (size_t pixel = 0; pixel < numPixels; ++pixel)
+    {
+        unsigned char *out = pixels + pixel * channels;
+        const unsigned short index = state.indices[pixel];
+
+        if (index == DITHER_SKIPPED_INDEX)
+        {
+            out[0] = out[1] = out[2] = 0;
+            continue;
+        }
+
+        const Pixel &color = colorPalette[index];
+        out[0] = static_cast<unsigned char>(color(0));
+        out[1] = static_cast<unsigned char>(color(1));
+        out[2] = static_cast<unsigned char>(color(2));
+    }
+}
+
+/*
+ * Tiled dithering of packed 8-bit RGB or RGBA pixels. Only one band of `bandRows` rows is converted to floating
+ * point at a time. Alpha is kept; fully transparent pixels take no part in the error diffusion and are
+ * normalized to (0, 0, 0, 0).
+ */
+void tiled_floyd_steinberg_dither_pixels(std::vector<unsigned char> &pixels, const unsigned channels,
+                                         const std::vector<Pixel> &colorPalette, const unsigned width,
+                                         const unsigned bandRows, const TiledDitherSettings &settings)
+{
+    if (consoleOutput)
+        std::cout << "Dithering (tiled)... ";
+
+    const size_t numPixels = pixels.size() / channels;
+    const size_t pixelsPerBand = static_cast<size_t>(std::max(bandRows, 1u)) * width;
+
+    TiledDitherState state;
+
+    for (size_t first = 0; first < numPixels; first += pixelsPerBand)
+    {
+        const size_t bandPixels = std::min(pixelsPerBand, numPixels - first);
+        dither_pixels_band(state, pixels.data() + first * channels, bandPixels, channels, colorPalette, width, settings);
+    }
+
+    if (consoleOutput)
+        std::cout << "done." << std::endl;
+}
+
+/*
+ * Dither settings for a quantization run. Without a tile size the image is dithered serially, carrying the error
+ * from band to band, and only the bands (of `bandRows` rows) bound the working set.
+ */
+TiledDitherSettings dither_settings_for(const Options &options, unsigned &bandRows)
+{
+    bandRows = options.tileSize > 0 ? options.tileSize : STREAM_BAND_ROWS;
+    return TiledDitherSettings{options.tileSize, DITHER_APRON, options.numThreads};
+}
@@ -2,4 +2,39 @@
 
 #include "shared.h"
 
-void floyd_steinberg_dither(MatrixRgb &originalMatrix, const std::vector<Pixel> colorPalette, const unsigned width);
\ No newline at end of file
+typedef struct
+{
+    unsigned tileSize;   // width and height of a tile in pixels; 0 dithers serially (see dither_serial_band())
+    unsigned apron;      // overlap in pixels read around each tile to carry error across seams
+    unsigned numThreads; // 0 uses every hardware thread
+} TiledDitherSettings;
+
+// Index written by the tiled ditherer for pixels that are excluded from dithering (see dither_tile_band()).
+#define DITHER_SKIPPED_INDEX 0xFFFF
+
+typedef struct
+{
+    MatrixRgb aboveRows = MatrixRgb(0, 3);  // undithered rows directly above the next band
+    MatrixRgb carriedError = MatrixRgb(0, 3); // serial dithering: error diffused into the first row of the next band
+    std::vector<unsigned short> indices; // palette index of every pixel of the last band
+} TiledDitherState;
+
+void floyd_steinberg_dither(MatrixRgb &originalMatrix, const std::vector<Pixel> colorPalette, const unsigned width);
+void dither_tile_band(const Eigen::Ref<const MatrixRgb> &band, const Eigen::Ref<const MatrixRgb> &aboveRows,
+                      const std::vector<Pixel> &colorPalette, const unsigned width, const TiledDitherSettings &settings,
+                      std::vector<unsigned short> &bandIndices);
+void dither_tile(const Eigen::Ref<const MatrixRgb> &band, const Eigen::Ref<const MatrixRgb> &aboveRows,
+                 const std::vector<Pixel> &colorPalette, const unsigned width, const TiledDitherSettings &settings,
+                 const unsigned tile, std::vector<unsigned short> &bandIndices);
+void dither_serial_band(TiledDitherState &state, const Eigen::Ref<const MatrixRgb> &band,
+                        const std::vector<Pixel> &colorPalette, const unsigned width);
+void dither_next_band(TiledDitherState &state, const Eigen::Ref<const MatrixRgb> &band, const std::vector<Pixel> &colorPalette,
+                      const unsigned width, const TiledDitherSettings &settings);
+void tiled_floyd_steinberg_dither(MatrixRgb &originalMatrix, const std::vector<Pixel> &colorPalette, const unsigned width,
+                                  const TiledDitherSettings &settings);
+void dither_pixels_band(TiledDitherState &state, unsigned char *pixels, const size_t numPixels, const unsigned channels,
+                        const std::vector<Pixel> &colorPalette, const unsigned width, const TiledDitherSettings &settings);
+void tiled_floyd_steinberg_dither_pixels(std::vector<unsigned char> &pixels, const unsigned channels,
+                                         const std::vector<Pixel> &colorPalette, const unsigned width,
+                                         const unsigned bandRows, const TiledDitherSettings &settings);
+TiledDitherSettings dither_settings_for(const Options &options, unsigned &bandRows);
@@ -0,0 +1,133 @@
+#include "pch/cqt_pch.h"
+
+#include "engine.h"
+#include "quantization.h"
+#include "wu.h"
+#include "octree.h"
+
+// Principal component analysis and linear discriminant analysis on the colors themselves (see partition()).
+class PcaEngine : public PaletteEngine
+{
+public:
+    const char *name() const override { return "pca"; }
+
+    std::vector<std::vector<Pixel>> build_palettes(const PixelSubset &subset, const std::vector<unsigned> &colorCounts) const override
+    {
+        return ::build_palettes(subset, colorCounts);
+    }
+};
+
+// The same criteria on boxes of the color cube, from cumulative moment tables (see build_box_palettes()).
+class PcaMomentsEngine : public PaletteEngine
+{
+public:
+    const char *name() const override { return "pca-moments"; }
+
+    std::vector<std::vector<Pixel>> build_palettes(const PixelSubset &subset, const std::vector<unsigned> &colorCounts) const override
+    {
+        return build_box_palettes(subset, colorCounts, true);
+    }
+};
+
+// Wu's variance-minimizing box splitting on cumulative moment tables.
+class WuEngine : public PaletteEngine
+{
+public:
+    const char *name() const override { return "wu"; }
+
+    std::vector<std::vector<Pixel>> build_palettes(const PixelSubset &subset, const std::vector<unsigned> &colorCounts) const override
+    {
+        return build_box_palettes(subset, colorCounts, false);
+    }
+};
+
+/*
+ * Octree quantization in a fixed node pool (see Octree). From a subset it is no cheaper than the others; its use
+ * is streaming, where execute() feeds the decoded bands straight into the tree and never builds a histogram.
+ */
+class OctreeEngine : public PaletteEngine
+{
+public:
+    const char *name() const override { return "octree"; }
+
+    std::vector<std::vector<Pixel>> build_palettes(const PixelSubset &subset, const std::vector<unsigned> &colorCounts) const override
+    {
+        Octree tree;
+        const bool weighted = subset.weights.size() > 0;
+        for (Eigen::Index row = 0; row < subset.data.rows(); ++row)
+        {
+            // A color whose weight rounds to no pixels would still take a leaf, and could become an empty entry.
+            const uint64_t count = weighted ? static_cast<uint64_t>(subset.weights(row) + 0.5) : 1;
+            if (count == 0)
+                continue;
+            tree.add_color(static_cast<unsigned char>(subset.data(row, 0)), static_cast<unsigned char>(subset.data(row, 1)),
+                           static_cast<unsigned char>(subset.data(row, 2)), count);
+        }
+
+        std::vector<std::vector<Pixel>> palettes;
+        for (unsigned colors : colorCounts)
+            palettes.push_back(tree.palette(colors));
+        return palettes;
+    }
+};
+
+const PaletteEngine &pca_engine()
+{
+    static const PcaEngine engine;
+    return engine;
+}
+
+const PaletteEngine &pca_moments_engine()
+{
+    static const PcaMomentsEngine engine;
+    return engine;
+}
+
+const PaletteEngine &wu_engine()
+{
+    static const WuEngine engine;
+    return engine;
+}
+
+const PaletteEngine &octree_engine()
+{
+    static const OctreeEngine engine;
+    return engine;
+}
+
+static const std::vector<const PaletteEngine *> &registered_engines()
+{
+    static const std::vector<const PaletteEngine *> engines = {&pca_engine(), &pca_moments_engine(), &wu_engine(), &octree_engine()};
+    return engines;
+}
+
+const PaletteEngine *find_palette_engine(const std::string &name)
+{
+    for (const PaletteEngine *engine : registered_engines())
+    {
+        if (name == engine->name())
+            return engine;
+    }
+
+    return nullptr;
+}
+
+// Names of all engines separated by commas, for messages.
+std::string palette_engine_names()
+{
+    std::string names;
+    for (const PaletteEngine *engine : registered_engines())
+        names += (names.empty() ? "" : ", ") + std::string(engine->name());
+    return names;
+}
+
+// The selected engine, pca unless --engine chose another.
+const PaletteEngine &palette_engine()
+{
+    return selectedEngine ? *selectedEngine : pca_engine();
+}
+
+void select_palette_engine(const PaletteEngine &engine)
+{
+    selectedEngine = &engine;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "shared.h"
+
+/*
+ * A method of building a palette from the weighted distinct colors of an image (see histogram_to_subset()), or
+ * from raw pixels. Palettes for several color counts come from one run, each being what a run for that count
+ * alone returns.
+ */
+class PaletteEngine
+{
+public:
+    virtual ~PaletteEngine() = default;
+
+    virtual const char *name() const = 0;
+    // Palettes in the order of `colorCounts`, with fewer colors where the subset has fewer distinct ones.
+    virtual std::vector<std::vector<Pixel>> build_palettes(const PixelSubset &subset, const std::vector<unsigned> &colorCounts) const = 0;
+
+    std::vector<Pixel> build_palette(const PixelSubset &subset, unsigned colors) const
+    {
+        return build_palettes(subset, {colors}).front();
+    }
+};
+
+const PaletteEngine &pca_engine();
+const PaletteEngine &pca_moments_engine();
+const PaletteEngine &wu_engine();
+const PaletteEngine &octree_engine();
+
+const PaletteEngine *find_palette_engine(const std::string &name);
+std::string palette_engine_names();
+
+/*
+ * The engine the command line selected with --engine, used wherever an image's palette is built. Set once
+ * before any work starts, like timingsEnabled.
+ */
+inline const PaletteEngine *selectedEngine = nullptr;
+
+const PaletteEngine &palette_engine();
+void select_palette_engine(const PaletteEngine &engine);
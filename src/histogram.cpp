@@ -0,0 +1,153 @@
+#include "pch/cqt_pch.h"
+
+#include "histogram.h"
+#include "timings.h"
+
+#include <cmath>
+
+// Untimed body of add_to_histogram(), for callers that time a whole band themselves.
+static void count_pixels(ColorHistogram &histogram, const unsigned char *pixels, size_t numPixels, unsigned channels)
+{
+    if (numPixels == 0)
+        return;
+
+    // Neighboring pixels are often identical, so runs are counted before touching the hash map.
+    uint32_t runColor = (pixels[0] << 16) | (pixels[1] << 8) | pixels[2];
+    uint64_t runLength = 0;
+
+    for (size_t pixel = 0; pixel < numPixels; ++pixel, pixels += channels)
+    {
+        if (channels == 4 && pixels[3] != 255)
+        {
+            if (pixels[3] == 0)
+            {
+                histogram.transparentPixels++;
+                continue;
+            }
+            histogram.translucentPixels++;
+        }
+
+        uint32_t color = (pixels[0] << 16) | (pixels[1] << 8) | pixels[2];
+
+        // A run is only flushed once it holds pixels; transparent leading pixels must not leave an empty entry.
+        if (color != runColor)
+        {
+            if (runLength > 0)
+                histogram.counts[runColor] += runLength;
+            runColor = color;
+            runLength = 0;
+        }
+        runLength++;
+    }
+
+    if (runLength > 0)
+        histogram.counts[runColor] += runLength;
+    histogram.totalPixels += numPixels;
+}
+
+void add_to_histogram(ColorHistogram &histogram, const unsigned char *pixels, size_t numPixels, unsigned channels)
+{
+    StageTimer timer(STAGE_HISTOGRAM);
+    count_pixels(histogram, pixels, numPixels, channels);
+}
+
+/*
+ * Chooses the smallest cell size that brings the number of sampled pixels within `pixelBudget`. A budget of 0,
+ * or one the image already fits in, keeps every pixel.
+ */
+SpatialSampler make_spatial_sampler(unsigned width, unsigned height, uint64_t pixelBudget)
+{
+    const uint64_t numPixels = static_cast<uint64_t>(width) * height;
+    unsigned step = 1;
+
+    if (pixelBudget > 0)
+    {
+        // The square root is a lower bound, since partial cells at the edges are sampled too.
+        step = static_cast<unsigned>(std::ceil(std::sqrt(static_cast<double>(numPixels) / pixelBudget)));
+        while (static_cast<uint64_t>((width + step - 1) / step) * ((height + step - 1) / step) > pixelBudget)
+            step++;
+    }
+
+    return SpatialSampler{width, height, std::max(step, 1u)};
+}
+
+// Fixed pseudo-random offset within a cell, so that samples do not line up on a regular grid.
+static inline unsigned cell_offset(unsigned cellX, unsigned cellY, unsigned salt, unsigned cellSize)
+{
+    uint32_t hash = cellX * 0x9E3779B1u ^ cellY * 0x85EBCA77u ^ salt * 0xC2B2AE3Du;
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+    return hash % cellSize;
+}
+
+/*
+ * Adds the sampled pixels of a band of rows (see SpatialSampler) to the histogram. Bands may have any height.
+ */
+void add_sampled_to_histogram(ColorHistogram &histogram, const SpatialSampler &sampler, const unsigned char *pixels,
+                              unsigned firstRow, unsigned rows, unsigned channels)
+{
+    StageTimer timer(STAGE_HISTOGRAM);
+    if (sampler.step <= 1)
+    {
+        count_pixels(histogram, pixels, static_cast<size_t>(rows) * sampler.width, channels);
+        return;
+    }
+
+    const unsigned step = sampler.step;
+    const unsigned cellsAcross = (sampler.width + step - 1) / step;
+
+    for (unsigned y = firstRow; y < firstRow + rows; ++y)
+    {
+        const unsigned cellY = y / step;
+        const unsigned cellHeight = std::min(step, sampler.height - cellY * step);
+        const unsigned char *row = pixels + static_cast<size_t>(y - firstRow) * sampler.width * channels;
+
+        for (unsigned cellX = 0; cellX < cellsAcross; ++cellX)
+        {
+            if (cellY * step + cell_offset(cellX, cellY, 1, cellHeight) != y)
+                continue;
+
+            const unsigned cellWidth = std::min(step, sampler.width - cellX * step);
+            const unsigned x = cellX * step + cell_offset(cellX, cellY, 2, cellWidth);
+            count_pixels(histogram, row + static_cast<size_t>(x) * channels, 1, channels);
+        }
+    }
+}
+
+/*
+ * Adds the counts of `other` to `histogram`, as if its pixels had been added directly.
+ */
+void merge_histograms(ColorHistogram &histogram, const ColorHistogram &other)
+{
+    for (const auto &entry : other.counts)
+        histogram.counts[entry.first] += entry.second;
+
+    histogram.totalPixels += other.totalPixels;
+    histogram.transparentPixels += other.transparentPixels;
+    histogram.translucentPixels += other.translucentPixels;
+}
+
+/*
+ * Converts the histogram into a weighted subset holding one row per distinct color, with the number of
+ * pixels of that color as its weight. Colors are sorted so that the result does not depend on hash order.
+ */
+PixelSubset histogram_to_subset(const ColorHistogram &histogram)
+{
+    StageTimer timer(STAGE_HISTOGRAM);
+    std::vector<std::pair<uint32_t, uint64_t>> entries(histogram.counts.begin(), histogram.counts.end());
+    std::sort(entries.begin(), entries.end());
+
+    PixelSubset subset;
+    subset.data.resize(entries.size(), 3);
+    subset.weights.resize(entries.size());
+
+    for (size_t row = 0; row < entries.size(); ++row)
+    {
+        const uint32_t color = entries[row].first;
+        subset.data.row(row) << ((color >> 16) & 0xFF), ((color >> 8) & 0xFF), (color & 0xFF);
+        subset.weights(row) = static_cast<double>(entries[row].second);
+    }
+
+    return subset;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "shared.h"
+
+#include <unordered_map>
+
+/*
+ * Exact color histogram of an 8-bit RGB or RGBA image, keyed by 0xRRGGBB. It is filled band by band while the
+ * image is decoded, so palette construction never needs the full-resolution pixels. Fully transparent pixels
+ * have no visible color and are only counted; partially transparent ones contribute their color.
+ */
+typedef struct
+{
+    std::unordered_map<uint32_t, uint64_t> counts;
+    uint64_t totalPixels = 0;       // every pixel added, transparent ones included
+    uint64_t transparentPixels = 0; // alpha 0
+    uint64_t translucentPixels = 0; // alpha strictly between 0 and 255
+} ColorHistogram;
+
+/*
+ * Stratified spatial sampling of an image for palette construction. The image is divided into square cells of
+ * `step` x `step` pixels and one pixel at a pseudo-random but fixed position is taken from every cell, so the
+ * proxy covers the whole image evenly while keeping exact colors (unlike a box filter, which blends them).
+ */
+typedef struct
+{
+    unsigned width;
+    unsigned height;
+    unsigned step; // 1 keeps every pixel
+} SpatialSampler;
+
+void add_to_histogram(ColorHistogram &histogram, const unsigned char *pixels, size_t numPixels, unsigned channels = 3);
+SpatialSampler make_spatial_sampler(unsigned width, unsigned height, uint64_t pixelBudget);
+void add_sampled_to_histogram(ColorHistogram &histogram, const SpatialSampler &sampler, const unsigned char *pixels,
+                              unsigned firstRow, unsigned rows, unsigned channels);
+void merge_histograms(ColorHistogram &histogram, const ColorHistogram &other);
+PixelSubset histogram_to_subset(const ColorHistogram &histogram);
@@ -1,34 +1,51 @@
 #include "pch/cqt_pch.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 #include "shared.h"
 #include "lodepng.h"
 #include "image.h"
+#include "input.h"
+#include "codec.h"
 
 // Flatten the image by concatenating the RGB values of each pixel row-wise, resulting in
 // a matrix where each row represents a pixel and each column represents a color channel.
-MatrixRgb to_matrix(std::vector<unsigned char> rgbImage)
+MatrixRgb to_matrix(const std::vector<unsigned char> &rgbImage)
 {
     const int rows = rgbImage.size() / 3;
     const int cols = 3;
 
-    Eigen::Map<MatrixXuc> result(rgbImage.data(), rows, cols);
+    Eigen::Map<const MatrixXuc> result(rgbImage.data(), rows, cols);
 
     return result.cast<double>();
 }
 
 MatrixRgb import_png_as_matrix(const char *filename, unsigned &width, unsigned &height)
 {
-    std::vector<unsigned char> png;
+    std::vector<unsigned char> png;   // only filled when the file cannot be memory-mapped
     std::vector<unsigned char> image; // the raw pixels
     lodepng::State state;             // optionally customize this
+    InputFile input;
 
     state.info_raw.colortype = LCT_RGB; // RGB format (no alpha channel)
 
-    unsigned error = lodepng::load_file(png, filename); // load image with given filename
+    unsigned error = input.open(filename);
 
     if (!error)
     {
+        size_t size;
+        const unsigned char *data = input.remaining(png, size);
+
         // Decode pixels into the vector `image`, 3 bytes per pixel, ordered RGBRGB...
-        error = lodepng::decode(image, width, height, state, png);
+        error = lodepng::decode(image, width, height, state, data, size);
     }
 
     if (error)
@@ -46,17 +63,87 @@ std::vector<unsigned char> to_char_vector(MatrixRgb &matrixRgb)
     return result;
 }
 
-int write_image_to_file(const char *filename, MatrixRgb &matrixRgb, unsigned width, unsigned height)
+int write_image_to_file(const char *filename, MatrixRgb &matrixRgb, unsigned width, unsigned height, const EncodeSettings &settings)
 {
     assert(matrixRgb.rows() == width * height && "Image dimensions do not match!");
 
-    unsigned error = lodepng::encode(filename, to_char_vector(matrixRgb), width, height, LCT_RGB);
+    return write_rgb_to_file(filename, to_char_vector(matrixRgb), width, height, settings);
+}
+
+int write_rgb_to_file(const char *filename, const std::vector<unsigned char> &rgb, unsigned width, unsigned height, const EncodeSettings &settings)
+{
+    return write_pixels_to_file(filename, rgb, 3, width, height, NO_OUTPUT_PALETTE, settings);
+}
+
+/*
+ * Writes packed 8-bit RGB or RGBA pixels in the format chosen by the extension of `filename`. `palette` lets
+ * indexed formats skip the color analysis of a quantized image.
+ */
+int write_pixels_to_file(const char *filename, const std::vector<unsigned char> &pixels, unsigned channels, unsigned width,
+                         unsigned height, const OutputPalette &palette, const EncodeSettings &settings)
+{
+    assert(pixels.size() == static_cast<size_t>(width) * height * channels && "Image dimensions do not match!");
+
+    std::vector<unsigned char> encoded;
+    unsigned error = encode_image(encoded, filename, pixels.data(), channels, width, height, palette, settings);
+
+    if (!error)
+    {
+        std::FILE *file = open_output_file(filename);
+        if (!file || std::fwrite(encoded.data(), 1, encoded.size(), file) != encoded.size())
+            error = 79;
+        if (close_output_file(file) != 0 && !error)
+            error = 79;
+    }
 
     if (error)
     {
-        std::cout << "encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+        std::cout << "encoder error " << error << ": " << codec_error_text(error) << std::endl;
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+static std::FILE *imageOutput = nullptr; // standard output once reserved for image data
+
+/*
+ * Reserves standard output for image data written to "-". Everything else printed afterwards, whether through
+ * std::cout or printf, goes to standard error so it cannot end up inside the image.
+ */
+bool reserve_stdout_for_image()
+{
+    std::fflush(stdout);
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+        return false;
+    imageOutput = fdopen(fd, "wb");
+#else
+    // Without descriptor duplication console output is redirected at the stream level only.
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    imageOutput = stdout;
+    std::cout.rdbuf(std::cerr.rdbuf());
+#endif
+    return imageOutput != nullptr;
+}
+
+// Opens `filename` for writing; "-" is standard output.
+std::FILE *open_output_file(const char *filename)
+{
+    if (std::strcmp(filename, "-") == 0)
+        return imageOutput ? imageOutput : stdout;
+    return std::fopen(filename, "wb");
+}
+
+// Closes a file from open_output_file(); standard output is only flushed. Returns 0 on success.
+int close_output_file(std::FILE *file)
+{
+    if (!file)
+        return EOF;
+    if (file == imageOutput || file == stdout)
+        return std::fflush(file);
+    return std::fclose(file);
+}
@@ -1,8 +1,19 @@
 #pragma once
 
 #include "shared.h"
+#include "png_encode.h"
 
-MatrixRgb to_matrix(std::vector<unsigned char> rgbImage);
+#include <cstdio>
+
+MatrixRgb to_matrix(const std::vector<unsigned char> &rgbImage);
 MatrixRgb import_png_as_matrix(const char *filename, unsigned &width, unsigned &height);
 std::vector<unsigned char> to_char_vector(MatrixRgb &matrixRgb);
-int write_image_to_file(const char *filename, MatrixRgb &matrixRgb, unsigned width, unsigned height);
\ No newline at end of file
+int write_image_to_file(const char *filename, MatrixRgb &matrixRgb, unsigned width, unsigned height,
+                        const EncodeSettings &settings = DEFAULT_ENCODE_SETTINGS);
+int write_rgb_to_file(const char *filename, const std::vector<unsigned char> &rgb, unsigned width, unsigned height,
+                      const EncodeSettings &settings = DEFAULT_ENCODE_SETTINGS);
+int write_pixels_to_file(const char *filename, const std::vector<unsigned char> &pixels, unsigned channels, unsigned width,
+                         unsigned height, const OutputPalette &palette, const EncodeSettings &settings);
+bool reserve_stdout_for_image();
+std::FILE *open_output_file(const char *filename);
+int close_output_file(std::FILE *file);
@@ -0,0 +1,473 @@
+#pragma once
+
+#include "shared.h"
+
+// Adler-32 checksum of zlib streams (RFC 1950), continued from `adler` for data that arrives in pieces.
+inline uint32_t adler32(const unsigned char *data, size_t size, uint32_t adler = 1)
+{
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+
+    while (size > 0)
+    {
+        // 5552 is the largest run for which b cannot overflow before the modulo.
+        size_t run = std::min<size_t>(size, 5552);
+        size -= run;
+        while (run--)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+/*
+ * Canonical Huffman decoding table for one deflate alphabet. Codes of up to FAST_BITS bits are resolved with a
+ * single table lookup, longer codes fall back to walking the code length counts one bit at a time.
+ */
+struct HuffmanTable
+{
+    static const unsigned FAST_BITS = 9;
+
+    unsigned short counts[16];
+    unsigned short symbols[288];
+    unsigned short fast[1 << FAST_BITS]; // (length << 9) | symbol, 0 when the code is longer than FAST_BITS
+
+    bool build(const unsigned char *lengths, unsigned numSymbols)
+    {
+        unsigned short offsets[16];
+
+        std::fill(std::begin(counts), std::end(counts), 0);
+        std::fill(std::begin(fast), std::end(fast), 0);
+
+        for (unsigned symbol = 0; symbol < numSymbols; ++symbol)
+            counts[lengths[symbol]]++;
+
+        counts[0] = 0;
+        offsets[1] = 0;
+        for (unsigned length = 1; length < 15; ++length)
+            offsets[length + 1] = offsets[length] + counts[length];
+
+        for (unsigned symbol = 0; symbol < numSymbols; ++symbol)
+        {
+            if (lengths[symbol] != 0)
+                symbols[offsets[lengths[symbol]]++] = symbol;
+        }
+
+        // Fill the lookup table. Deflate stores codes most significant bit first inside an LSB-first stream,
+        // so every code is bit-reversed before use as an index.
+        unsigned code = 0, index = 0;
+        for (unsigned length = 1; length <= FAST_BITS; ++length)
+        {
+            for (unsigned i = 0; i < counts[length]; ++i, ++code, ++index)
+            {
+                unsigned reversed = 0;
+                for (unsigned bit = 0; bit < length; ++bit)
+                    reversed |= ((code >> bit) & 1u) << (length - 1 - bit);
+
+                for (unsigned entry = reversed; entry < (1u << FAST_BITS); entry += 1u << length)
+                    fast[entry] = static_cast<unsigned short>((length << 9) | symbols[index]);
+            }
+            code <<= 1;
+        }
+
+        return true;
+    }
+};
+
+/*
+ * Incremental zlib/deflate decoder (RFC 1950/1951). Compressed input is pulled on demand from a ByteReader and
+ * output is produced in caller-sized pieces, so neither the compressed nor the decompressed stream has to be
+ * held in memory in full. Only the 32 KiB back-reference window is retained.
+ */
+class StreamInflater
+{
+public:
+    explicit StreamInflater(ByteReader input) : input(std::move(input)), window(WINDOW_SIZE) {}
+
+    // Produces up to `size` bytes. Returns the number produced, which is less than `size` only at the end of
+    // the stream or on error.
+    size_t inflate(unsigned char *out, size_t size)
+    {
+        size_t produced = 0;
+
+        if (!headerRead && !read_zlib_header())
+            return 0;
+
+        while (produced < size && errorCode == 0)
+        {
+            if (matchLength > 0)
+            {
+                while (matchLength > 0 && produced < size)
+                {
+                    emit(out, produced, window[(windowPos - matchDistance) & WINDOW_MASK]);
+                    matchLength--;
+                }
+                continue;
+            }
+
+            if (blockType == NO_BLOCK)
+            {
+                if (finalBlock)
+                    break;
+                if (!read_block_header())
+                    break;
+                continue;
+            }
+
+            if (blockType == STORED)
+            {
+                while (storedRemaining > 0 && produced < size)
+                {
+                    emit(out, produced, static_cast<unsigned char>(get_bits(8)));
+                    storedRemaining--;
+                }
+                if (storedRemaining == 0)
+                    blockType = NO_BLOCK;
+                continue;
+            }
+
+            decode_symbol(out, produced);
+        }
+
+        adler = adler32(out, produced, adler);
+        if (finalBlock && blockType == NO_BLOCK && matchLength == 0 && !trailerRead && errorCode == 0)
+            read_zlib_trailer();
+
+        return produced;
+    }
+
+    /*
+     * Inflates whatever is left of the stream, discarding it, and checks the Adler-32 trailer against every byte
+     * produced, as lodepng does once a stream is complete. Returns the error code, 0 if the stream was intact.
+     */
+    unsigned finish()
+    {
+        unsigned char discard[4096];
+        while (!trailerRead && errorCode == 0 && inflate(discard, sizeof(discard)) > 0)
+            ;
+
+        if (!trailerRead && errorCode == 0)
+            errorCode = 23;
+        return errorCode;
+    }
+
+    unsigned error() const { return errorCode; }
+
+private:
+    static const unsigned WINDOW_SIZE = 32768;
+    static const unsigned WINDOW_MASK = WINDOW_SIZE - 1;
+    static const unsigned INPUT_BUFFER_SIZE = 65536;
+
+    enum BlockType
+    {
+        NO_BLOCK,
+        STORED,
+        HUFFMAN
+    };
+
+    void emit(unsigned char *out, size_t &produced, unsigned char value)
+    {
+        out[produced++] = value;
+        window[windowPos & WINDOW_MASK] = value;
+        windowPos++;
+    }
+
+    // Keeps at least `count` (<= 32) bits in the bit buffer, padding with zeros past the end of the input.
+    void need_bits(unsigned count)
+    {
+        while (bitCount < count)
+        {
+            if (inputPos == inputEnd)
+            {
+                inputEnd = input(inputBuffer.data(), inputBuffer.size());
+                inputPos = 0;
+                if (inputEnd == 0)
+                {
+                    overrun += 8;
+                    bitCount += 8;
+                    continue;
+                }
+            }
+            bitBuffer |= static_cast<uint64_t>(inputBuffer[inputPos++]) << bitCount;
+            bitCount += 8;
+        }
+    }
+
+    unsigned get_bits(unsigned count)
+    {
+        if (count == 0)
+            return 0;
+
+        need_bits(count);
+        unsigned value = static_cast<unsigned>(bitBuffer & ((1ull << count) - 1));
+        bitBuffer >>= count;
+        bitCount -= count;
+        return value;
+    }
+
+    unsigned decode(const HuffmanTable &table)
+    {
+        need_bits(15);
+
+        unsigned entry = table.fast[bitBuffer & ((1u << HuffmanTable::FAST_BITS) - 1)];
+        if (entry != 0)
+        {
+            unsigned length = entry >> 9;
+            bitBuffer >>= length;
+            bitCount -= length;
+            return entry & 0x1FF;
+        }
+
+        // Slow path for long codes: walk the canonical code one bit at a time.
+        int code = 0, first = 0, index = 0;
+        for (unsigned length = 1; length < 16; ++length)
+        {
+            code |= static_cast<int>(get_bits(1));
+            int count = table.counts[length];
+            if (code - count < first)
+                return table.symbols[index + (code - first)];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+
+        errorCode = 11;
+        return 0;
+    }
+
+    bool read_zlib_header()
+    {
+        headerRead = true;
+        unsigned cmf = get_bits(8);
+        unsigned flg = get_bits(8);
+
+        if (overrun)
+            errorCode = 53;
+        else if ((cmf * 256 + flg) % 31 != 0)
+            errorCode = 24;
+        else if ((cmf & 15) != 8 || (cmf >> 4) > 7)
+            errorCode = 25;
+        else if (flg & 32)
+            errorCode = 26;
+
+        return errorCode == 0;
+    }
+
+    // The big-endian Adler-32 of the inflated bytes follows the final block on a byte boundary.
+    void read_zlib_trailer()
+    {
+        trailerRead = true;
+        get_bits(bitCount & 7);
+
+        uint32_t expected = 0;
+        for (unsigned i = 0; i < 4; ++i)
+            expected = (expected << 8) | get_bits(8);
+
+        // Padding past the end of the input is loaded last, so the trailer was cut short if any of it was used.
+        if (overrun > bitCount || expected != adler)
+            errorCode = 58;
+    }
+
+    bool read_block_header()
+    {
+        finalBlock = get_bits(1) != 0;
+        unsigned type = get_bits(2);
+
+        if (type == 0)
+        {
+            // Stored block: skip to the byte boundary, then LEN and its ones' complement.
+            get_bits(bitCount & 7);
+            unsigned length = get_bits(16);
+            unsigned complement = get_bits(16);
+            if ((length ^ 0xFFFF) != complement)
+            {
+                errorCode = 21;
+                return false;
+            }
+            storedRemaining = length;
+            blockType = STORED;
+        }
+        else if (type == 1)
+        {
+            unsigned char lengths[320];
+            std::fill(lengths, lengths + 144, 8);
+            std::fill(lengths + 144, lengths + 256, 9);
+            std::fill(lengths + 256, lengths + 280, 7);
+            std::fill(lengths + 280, lengths + 288, 8);
+            std::fill(lengths + 288, lengths + 320, 5);
+            literals.build(lengths, 288);
+            distances.build(lengths + 288, 32);
+            blockType = HUFFMAN;
+        }
+        else if (type == 2)
+        {
+            if (!read_dynamic_tables())
+                return false;
+            blockType = HUFFMAN;
+        }
+        else
+        {
+            errorCode = 20;
+            return false;
+        }
+
+        if (overrun > 64)
+            errorCode = 23;
+
+        return errorCode == 0;
+    }
+
+    bool read_dynamic_tables()
+    {
+        static const unsigned char ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+        unsigned numLiterals = get_bits(5) + 257;
+        unsigned numDistances = get_bits(5) + 1;
+        unsigned numCodeLengths = get_bits(4) + 4;
+
+        if (numLiterals > 286 || numDistances > 30)
+        {
+            errorCode = 13;
+            return false;
+        }
+
+        unsigned char lengths[320] = {0};
+        for (unsigned i = 0; i < numCodeLengths; ++i)
+            lengths[ORDER[i]] = static_cast<unsigned char>(get_bits(3));
+
+        HuffmanTable codeLengths;
+        codeLengths.build(lengths, 19);
+
+        std::fill(std::begin(lengths), std::end(lengths), 0);
+        unsigned index = 0;
+        while (index < numLiterals + numDistances)
+        {
+            unsigned symbol = decode(codeLengths);
+            if (errorCode)
+                return false;
+
+            if (symbol < 16)
+            {
+                lengths[index++] = static_cast<unsigned char>(symbol);
+                continue;
+            }
+
+            unsigned repeat, value = 0;
+            if (symbol == 16)
+            {
+                if (index == 0)
+                {
+                    errorCode = 54;
+                    return false;
+                }
+                value = lengths[index - 1];
+                repeat = 3 + get_bits(2);
+            }
+            else if (symbol == 17)
+                repeat = 3 + get_bits(3);
+            else
+                repeat = 11 + get_bits(7);
+
+            if (index + repeat > numLiterals + numDistances)
+            {
+                errorCode = 14;
+                return false;
+            }
+            while (repeat--)
+                lengths[index++] = static_cast<unsigned char>(value);
+        }
+
+        if (lengths[256] == 0)
+        {
+            errorCode = 64;
+            return false;
+        }
+
+        // Distance lengths follow the literal/length lengths; copy them to their own array.
+        unsigned char distanceLengths[32] = {0};
+        std::copy(lengths + numLiterals, lengths + numLiterals + numDistances, distanceLengths);
+        std::fill(lengths + numLiterals, lengths + 320, 0);
+
+        literals.build(lengths, 288);
+        distances.build(distanceLengths, 32);
+
+        return true;
+    }
+
+    void decode_symbol(unsigned char *out, size_t &produced)
+    {
+        static const unsigned short LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                       35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const unsigned char LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                       3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const unsigned short DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                                         193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                                         6145, 8193, 12289, 16385, 24577};
+        static const unsigned char DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                                         6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        unsigned symbol = decode(literals);
+
+        if (overrun > 64)
+            errorCode = 10;
+        if (errorCode)
+            return;
+
+        if (symbol < 256)
+        {
+            emit(out, produced, static_cast<unsigned char>(symbol));
+            return;
+        }
+
+        if (symbol == 256)
+        {
+            blockType = NO_BLOCK;
+            return;
+        }
+
+        symbol -= 257;
+        if (symbol >= 29)
+        {
+            errorCode = 16;
+            return;
+        }
+        matchLength = LENGTH_BASE[symbol] + get_bits(LENGTH_EXTRA[symbol]);
+
+        unsigned distanceSymbol = decode(distances);
+        if (distanceSymbol >= 30)
+        {
+            errorCode = 18;
+            return;
+        }
+        matchDistance = DISTANCE_BASE[distanceSymbol] + get_bits(DISTANCE_EXTRA[distanceSymbol]);
+
+        if (matchDistance > windowPos)
+            errorCode = 52;
+    }
+
+    ByteReader input;
+    std::vector<unsigned char> inputBuffer = std::vector<unsigned char>(INPUT_BUFFER_SIZE);
+    size_t inputPos = 0, inputEnd = 0;
+    uint64_t bitBuffer = 0;
+    unsigned bitCount = 0;
+    unsigned overrun = 0;
+
+    std::vector<unsigned char> window;
+    uint64_t windowPos = 0;
+
+    HuffmanTable literals, distances;
+    BlockType blockType = NO_BLOCK;
+    bool headerRead = false;
+    bool trailerRead = false;
+    uint32_t adler = 1;
+    bool finalBlock = false;
+    unsigned storedRemaining = 0;
+    unsigned matchLength = 0;
+    unsigned matchDistance = 0;
+    unsigned errorCode = 0;
+};
@@ -0,0 +1,167 @@
+#include "pch/cqt_pch.h"
+
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CQT_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "input.h"
+#include "log.h"
+
+InputFile::~InputFile()
+{
+    close();
+}
+
+unsigned InputFile::open(const char *filename, bool allowMapping, bool rewindable)
+{
+    close();
+
+    auto start = std::chrono::steady_clock::now();
+    const bool standardInput = std::strcmp(filename, "-") == 0;
+
+#ifdef CQT_HAVE_MMAP
+    // Standard input is duplicated so that it is closed like any other file; redirected files can still be mapped.
+    int fd = standardInput ? dup(STDIN_FILENO) : ::open(filename, O_RDONLY);
+    if (fd < 0)
+        return 78;
+
+    struct stat info;
+    const bool regular = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+    if (allowMapping && regular && info.st_size > 0)
+    {
+        void *address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            madvise(address, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+            mapping = static_cast<unsigned char *>(address);
+            mappingSize = static_cast<size_t>(info.st_size);
+        }
+    }
+
+    // The mapping stays valid after the descriptor is closed; anything that could not be mapped is read.
+    if (mapping)
+        ::close(fd);
+    else
+        file = fdopen(fd, "rb");
+
+    if (file && rewindable && !regular)
+        spool = std::tmpfile();
+#else
+    (void)allowMapping;
+#ifdef _WIN32
+    if (standardInput)
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    file = standardInput ? stdin : std::fopen(filename, "rb");
+
+    if (file && rewindable && standardInput)
+        spool = std::tmpfile();
+#endif
+
+    readSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return (mapping || file) ? 0 : 78;
+}
+
+void InputFile::close()
+{
+#ifdef CQT_HAVE_MMAP
+    if (mapping)
+        munmap(mapping, mappingSize);
+#endif
+    if (file && file != stdin)
+        std::fclose(file);
+    if (spool)
+        std::fclose(spool);
+
+    mapping = nullptr;
+    mappingSize = 0;
+    offset = 0;
+    file = nullptr;
+    spool = nullptr;
+}
+
+unsigned InputFile::rewind()
+{
+    if (mapping)
+    {
+        offset = 0;
+        return 0;
+    }
+
+    // A stream that cannot seek is replaced by its spooled copy. It holds everything read so far, which covers a
+    // whole image once it has been decoded.
+    if (spool)
+    {
+        if (file != stdin)
+            std::fclose(file);
+        file = spool;
+        spool = nullptr;
+        if (std::fflush(file) != 0)
+            return 78;
+    }
+
+    return file && std::fseek(file, 0, SEEK_SET) == 0 ? 0 : 78;
+}
+
+size_t InputFile::read(unsigned char *buffer, size_t size)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t count = 0;
+
+    if (mapping)
+    {
+        count = std::min(size, mappingSize - offset);
+        std::memcpy(buffer, mapping + offset, count);
+        offset += count;
+    }
+    else if (file)
+    {
+        count = std::fread(buffer, 1, size, file);
+        if (spool && count > 0 && std::fwrite(buffer, 1, count, spool) != count)
+        {
+            std::fclose(spool);
+            spool = nullptr;
+        }
+    }
+
+    bytesRead += count;
+    readSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return count;
+}
+
+const unsigned char *InputFile::remaining(std::vector<unsigned char> &storage, size_t &size)
+{
+    if (mapping)
+    {
+        size = mappingSize - offset;
+        bytesRead += size;
+        offset = mappingSize;
+        return mapping + offset - size;
+    }
+
+    unsigned char buffer[65536];
+    for (size_t count = read(buffer, sizeof(buffer)); count > 0; count = read(buffer, sizeof(buffer)))
+        storage.insert(storage.end(), buffer, buffer + count);
+
+    size = storage.size();
+    return storage.data();
+}
+
+void log_input_stats(const InputFile &input)
+{
+    std::cout << "Input: " << std::fixed << std::setprecision(2) << input.bytes_read() / 1048576.0 << " MiB "
+              << (input.is_mapped() ? "(mapped)" : "(buffered)") << ", read " << std::setprecision(3)
+              << input.read_seconds() * 1000.0 << " ms, RSS " << std::setprecision(1)
+              << current_rss_bytes() / 1048576.0 << " MiB" << std::defaultfloat << std::endl;
+}
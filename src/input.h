@@ -0,0 +1,65 @@
+#pragma once
+
+#include "shared.h"
+#include "codec.h"
+
+#include <cstdio>
+
+/*
+ * Read-only view of an input file. Regular files are memory-mapped with a sequential access hint, so their
+ * bytes reach the decoder straight from the page cache without a heap copy of the whole file. Pipes, terminals
+ * and platforms without mmap fall back to buffered reads. The name "-" reads standard input the same way. Time
+ * spent opening and reading is accumulated for instrumentation.
+ */
+class InputFile
+{
+public:
+    InputFile() = default;
+    InputFile(const InputFile &) = delete;
+    InputFile &operator=(const InputFile &) = delete;
+    ~InputFile();
+
+    // Opens `filename`. Returns 0 on success or lodepng's error code 78 (failed to open file for reading).
+    // Without `allowMapping` the file is always read through a buffer, so it never adds to the resident set.
+    // With `rewindable`, input that cannot seek (a pipe) is copied to an unlinked temporary file as it is read.
+    unsigned open(const char *filename, bool allowMapping = true, bool rewindable = false);
+    void close();
+
+    // Starts over at the first byte. Returns 0 on success or 78 if the input cannot be read again.
+    unsigned rewind();
+
+    // Copies up to `size` of the next bytes into `buffer`; returns the number copied, 0 at the end.
+    size_t read(unsigned char *buffer, size_t size);
+
+    // Returns the remaining bytes as one contiguous span, reading them into `storage` when not mapped.
+    const unsigned char *remaining(std::vector<unsigned char> &storage, size_t &size);
+
+    ByteReader reader()
+    {
+        return [this](unsigned char *buffer, size_t size)
+        { return read(buffer, size); };
+    }
+
+    // Remaining input as a codec source; mapped files expose their bytes directly.
+    ImageSource source()
+    {
+        return ImageSource{reader(), mapping ? mapping + offset : nullptr, mapping ? mappingSize - offset : 0};
+    }
+
+    bool is_mapped() const { return mapping != nullptr; }
+    // Bytes delivered so far; a mapped file counts in full since decoders may read it without copying.
+    size_t bytes_read() const { return mapping ? mappingSize : bytesRead; }
+    double read_seconds() const { return readSeconds; }
+
+private:
+    unsigned char *mapping = nullptr;
+    size_t mappingSize = 0;
+    size_t offset = 0;
+    std::FILE *file = nullptr;
+    std::FILE *spool = nullptr;
+
+    size_t bytesRead = 0;
+    double readSeconds = 0;
+};
+
+void log_input_stats(const InputFile &input);
@@ -1735,7 +1735,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize) {
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, unsigned flush) {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
 
@@ -1746,7 +1746,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     unsigned char firstbyte;
     size_t pos = out->size;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = !flush && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     LEN = 65535;
@@ -2065,17 +2065,18 @@ static unsigned deflateFixed(LodePNGBitWriter* writer, Hash* hash,
   return error;
 }
 
+/*flush: no block is final, and an empty stored block ends the output on a byte boundary (a sync flush)*/
 static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings) {
+                                 const LodePNGCompressSettings* settings, unsigned flush) {
   unsigned error = 0;
-  size_t i, blocksize, numdeflateblocks;
+  size_t i, blocksize = 0, numdeflateblocks;
   Hash hash;
   LodePNGBitWriter writer;
 
   LodePNGBitWriter_init(&writer, out);
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
+  else if(settings->btype == 0) error = deflateNoCompression(out, in, insize, flush);
   else if(settings->btype == 1) blocksize = insize;
   else /*if(settings->btype == 2)*/ {
     /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
@@ -2084,24 +2085,36 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     if(blocksize > 262144) blocksize = 262144;
   }
 
-  numdeflateblocks = (insize + blocksize - 1) / blocksize;
-  if(numdeflateblocks == 0) numdeflateblocks = 1;
+  if(settings->btype != 0) {
+    numdeflateblocks = (insize + blocksize - 1) / blocksize;
+    if(numdeflateblocks == 0) numdeflateblocks = 1;
 
-  error = hash_init(&hash, settings->windowsize);
+    error = hash_init(&hash, settings->windowsize);
 
-  if(!error) {
-    for(i = 0; i != numdeflateblocks && !error; ++i) {
-      unsigned final = (i == numdeflateblocks - 1);
-      size_t start = i * blocksize;
-      size_t end = start + blocksize;
-      if(end > insize) end = insize;
-
-      if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, final);
-      else if(settings->btype == 2) error = deflateDynamic(&writer, &hash, in, start, end, settings, final);
+    if(!error) {
+      for(i = 0; i != numdeflateblocks && !error; ++i) {
+        unsigned final = !flush && (i == numdeflateblocks - 1);
+        size_t start = i * blocksize;
+        size_t end = start + blocksize;
+        if(end > insize) end = insize;
+
+        if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, final);
+        else if(settings->btype == 2) error = deflateDynamic(&writer, &hash, in, start, end, settings, final);
+      }
     }
+
+    hash_cleanup(&hash);
   }
 
-  hash_cleanup(&hash);
+  if(!error && flush) {
+    /*empty stored block: BFINAL 0 and BTYPE 00, padding to the byte boundary, LEN 0 and NLEN 0xFFFF*/
+    static const unsigned char EMPTY_STORED[4] = {0x00, 0x00, 0xFF, 0xFF};
+    size_t pos;
+    writeBits(&writer, 0, 3);
+    pos = out->size;
+    if(!ucvector_resize(out, pos + 4)) return 83; /*alloc fail*/
+    lodepng_memcpy(out->data + pos, EMPTY_STORED, 4);
+  }
 
   return error;
 }
@@ -2110,7 +2123,17 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings) {
   ucvector v = ucvector_init(*out, *outsize);
-  unsigned error = lodepng_deflatev(&v, in, insize, settings);
+  unsigned error = lodepng_deflatev(&v, in, insize, settings, 0);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
+unsigned lodepng_deflate_flush(unsigned char** out, size_t* outsize,
+                               const unsigned char* in, size_t insize,
+                               const LodePNGCompressSettings* settings) {
+  ucvector v = ucvector_init(*out, *outsize);
+  unsigned error = lodepng_deflatev(&v, in, insize, settings, 1);
   *out = v.data;
   *outsize = v.size;
   return error;
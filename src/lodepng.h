@@ -1058,6 +1058,15 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings);
 
+/*
+Like lodepng_deflate, but no block is marked final and the output ends with an
+empty stored block, as zlib's Z_SYNC_FLUSH does: it stops on a byte boundary and
+more deflate data can be appended to it.
+*/
+unsigned lodepng_deflate_flush(unsigned char** out, size_t* outsize,
+                               const unsigned char* in, size_t insize,
+                               const LodePNGCompressSettings* settings);
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
@@ -2,6 +2,12 @@
 
 #include "shared.h"
 
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
 enum LogOptions
 {
     FILENAME = 1 << 0,
@@ -10,8 +16,33 @@ enum LogOptions
     TARGET_PALETTE = 1 << 3
 };
 
+/*
+ * Stream buffer that discards everything written to it. Installed as std::cout's buffer while several images are
+ * processed concurrently, whose log lines would otherwise interleave.
+ */
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+};
+
+// Silences the quantization stages on the calling thread for the lifetime of the scope.
+class QuietScope
+{
+public:
+    QuietScope() : previous(consoleOutput) { consoleOutput = false; }
+    ~QuietScope() { consoleOutput = previous; }
+
+private:
+    const bool previous;
+};
+
 void static inline LogInfo(Options options, int bit)
 {
+    if (!consoleOutput)
+        return;
+
     if (bit & FILENAME)
     {
         std::cout << "Image: " << options.filename << std::endl;
@@ -29,3 +60,41 @@ void static inline LogInfo(Options options, int bit)
         std::cout << "Target palette: " << options.paletteFileName << std::endl;
     }
 }
+
+/*
+ * Current resident set size in bytes, or 0 where it cannot be determined.
+ */
+size_t static inline current_rss_bytes()
+{
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return std::stoul(line.substr(6)) * 1024;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * Peak resident set size of the process in bytes, or 0 where it cannot be determined. A single system call, so
+ * that stage timers can take it on entry and exit.
+ */
+size_t static inline peak_rss_bytes()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss); // bytes on macOS
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
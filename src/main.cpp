@@ -1,13 +1,32 @@
 #include "pch/cqt_pch.h"
 
+#include <cctype>
+#include <cmath>
+#include <optional>
+
 #include "shared.h"
 #include "image.h"
 #include "quantization.h"
 #include "dither.h"
+#include "engine.h"
+#include "palette.h"
+#include "histogram.h"
+#include "codec.h"
+#include "input.h"
+#include "out_of_core.h"
+#include "batch.h"
+#include "sequence.h"
+#include "serve.h"
+#include "cache.h"
+#include "progress.h"
+#include "timings.h"
+#include "variants.h"
+#include "octree.h"
+#include "log.h"
 
 using namespace std;
 
-void execute(Options &options)
+void execute(Options &options, ResultCache *cache, const std::string &splitTreePath, double targetMse)
 {
     if (options.filename.empty())
     {
@@ -15,33 +34,325 @@ void execute(Options &options)
         return;
     }
 
-    MatrixRgb matrixRgb = import_png_as_matrix(options.filename.c_str(), options.width, options.height);
+    // Decode band by band; the histogram is built as the bands arrive and the pixels are kept as 8-bit RGB, or
+    // RGBA when the input carries alpha, unless the memory budget calls for a second decoding pass instead.
+    ColorHistogram histogram;
+    std::vector<unsigned char> image;
+    unsigned channels = 3;
+    SpatialSampler sampler{0, 0, 1};
+    MemoryPlan plan{};
+    bool histogramOverflow = false;
+    InputFile input;
+
+    // The octree engine takes the bands as they are decoded, in memory that does not depend on the image.
+    const bool streamingPalette = &palette_engine() == &octree_engine();
+    std::optional<Octree> octree;
+    if (streamingPalette)
+        octree.emplace();
+
+    // Under a memory budget the input is read through a buffer, since mapped pages add to the resident set, and
+    // piped input is kept in a temporary file in case it has to be decoded a second time.
+    const bool allowMapping = options.maxMemory == 0;
+    unsigned error = input.open(options.filename.c_str(), allowMapping, !allowMapping);
+    ImageSource source = input.source();
+
+    // A cached result for the same input bytes and settings is written as it is, without decoding.
+    std::vector<unsigned char> inputBytes, encoded;
+    std::string cacheKey;
+
+    if (!error && cache && allowMapping)
+    {
+        size_t size;
+        const unsigned char *bytes = input.remaining(inputBytes, size);
+        cacheKey = result_cache_key(bytes, size, options, options.outputFileName, targetMse);
+
+        if (cache->lookup(cacheKey, encoded))
+        {
+            error = write_batch_output(options.outputFileName, encoded);
+            if (error)
+                cout << "error " << error << ": " << codec_error_text(error) << endl;
+            else
+                cout << "Cache hit " << cacheKey << ": " << encoded.size() << " bytes written" << endl;
+            return;
+        }
+        source = memory_source(bytes, size);
+    }
+
+    if (!error)
+    {
+        error = decode_image_bands(source, STREAM_BAND_ROWS, true, options.width, options.height, channels,
+                                   [&](const unsigned char *pixels, unsigned firstRow, unsigned rows)
+                                   {
+                                       const size_t numPixels = static_cast<size_t>(rows) * options.width;
+                                       if (firstRow == 0)
+                                       {
+                                           plan = plan_memory(options, options.width, options.height, channels);
+                                           sampler = make_spatial_sampler(options.width, options.height, plan.sampleBudget);
+                                           if (!plan.outOfCore)
+                                               image.reserve(static_cast<size_t>(options.width) * options.height * channels);
+                                       }
+
+                                       // The palette is built from a proxy of sampled pixels; all of them are mapped.
+                                       if (streamingPalette)
+                                       {
+                                           octree->add_pixels(pixels, numPixels, channels);
+                                       }
+                                       else if (!histogramOverflow)
+                                       {
+                                           add_sampled_to_histogram(histogram, sampler, pixels, firstRow, rows, channels);
+                                           // Past the budget's share of colors, the histogram is rebuilt from a
+                                           // sample below.
+                                           if (plan.maxColors > 0 && histogram.counts.size() > plan.maxColors)
+                                           {
+                                               histogramOverflow = true;
+                                               histogram = ColorHistogram();
+                                           }
+                                       }
+                                       if (!plan.outOfCore)
+                                           image.insert(image.end(), pixels, pixels + numPixels * channels);
+                                   });
+    }
+
+    if (!error && histogramOverflow)
+    {
+        const uint64_t budget = options.sampleBudget ? std::min(options.sampleBudget, plan.maxColors) : plan.maxColors;
+        sampler = make_spatial_sampler(options.width, options.height, budget);
+        cout << "Histogram exceeds the memory budget of " << plan.maxColors << " colors: building the palette from a sample" << endl;
+
+        if (!plan.outOfCore)
+        {
+            add_sampled_to_histogram(histogram, sampler, image.data(), 0, options.height, channels);
+        }
+        else
+        {
+            unsigned width, height, sampleChannels;
+            error = input.rewind();
+            if (!error)
+                error = decode_image_bands(input.source(), STREAM_BAND_ROWS, true, width, height, sampleChannels,
+                                           [&](const unsigned char *pixels, unsigned firstRow, unsigned rows)
+                                           { add_sampled_to_histogram(histogram, sampler, pixels, firstRow, rows, sampleChannels); });
+        }
+    }
+
+    log_input_stats(input);
+
+    if (sampler.step > 1 && !streamingPalette)
+        cout << "Sampling: 1 pixel per " << sampler.step << "x" << sampler.step << " cell (" << histogram.totalPixels << " pixels)" << endl;
+
+    if (error)
+    {
+        cout << "decoder error " << error << ": " << codec_error_text(error) << endl;
+        return;
+    }
+
+    EncodeSettings encodeSettings{options.encodeEffort, options.parallelEncode ? options.numThreads : 1};
+
+    if (streamingPalette)
+    {
+        histogram.transparentPixels = octree->transparentPixels;
+        histogram.translucentPixels = octree->translucentPixels;
+        cout << "Octree: " << octree->leaf_count() << " leaves in " << octree->node_count() << " nodes ("
+             << octree->pool_bytes() / 1024 << " KiB pool)" << endl;
+    }
+
+    // Partially transparent pixels keep their own alpha, which a palette of opaque colors cannot express.
+    OutputPalette palette = NO_OUTPUT_PALETTE;
+    palette.transparent = histogram.transparentPixels > 0;
+    const bool indexable = histogram.translucentPixels == 0;
+
+    if (streamingPalette)
+    {
+        LogInfo(options, (FILENAME | DIMENSIONS | TARGET_NCOLORS | TARGET_PALETTE));
+        palette.colors = octree->palette(options.targetNumColors);
+    }
 
-    quantize(matrixRgb, options);
+    if (!plan.outOfCore)
+    {
+        if (streamingPalette)
+            apply_palette(image, channels, palette.colors, options);
+        else
+            palette.colors = quantize_pixels(image, channels, histogram, options, splitTreePath, targetMse);
 
-    write_image_to_file(options.outputFileName.c_str(), matrixRgb, options.width, options.height);
+        if (cacheKey.empty())
+        {
+            write_pixels_to_file(options.outputFileName.c_str(), image, channels, options.width, options.height,
+                                 indexable ? palette : NO_OUTPUT_PALETTE, encodeSettings);
+            return;
+        }
+
+        error = encode_image(encoded, options.outputFileName, image.data(), channels, options.width, options.height,
+                             indexable ? palette : NO_OUTPUT_PALETTE, encodeSettings);
+        if (!error)
+        {
+            cache->store(cacheKey, encoded);
+            error = write_batch_output(options.outputFileName, encoded);
+        }
+        if (error)
+            cout << "encoder error " << error << ": " << codec_error_text(error) << endl;
+        return;
+    }
+
+    if (!streamingPalette)
+        palette.colors = build_histogram_palette(histogram, options, splitTreePath, targetMse);
+    histogram = ColorHistogram();
+
+    cout << "Out-of-core: second pass in bands of " << plan.bandRows << " rows" << endl;
+
+    error = input.rewind();
+    if (!error)
+        error = write_quantized_bands(input.source(), plan, palette.colors, indexable ? palette : NO_OUTPUT_PALETTE, options);
+
+    if (error)
+        cout << "error " << error << ": " << codec_error_text(error) << endl;
+    else
+        cout << "Finished. Peak RSS " << std::fixed << std::setprecision(1) << peak_rss_bytes() / 1048576.0 << " MiB"
+             << std::defaultfloat << endl;
 }
 
-int main(int argc, char *argv[])
+/*
+ * Quantizes one image to every count in `colorCounts` (--colors 16,64,256) from one decode and one partitioning
+ * run, writing each variant next to the output name with its count appended (see quantize_variants()).
+ */
+int execute_variants(const Options &options, const std::vector<unsigned> &colorCounts)
 {
-    if (argc != 3)
+    InputFile input;
+    unsigned error = input.open(options.filename.c_str());
+
+    std::vector<VariantResult> results;
+    if (!error)
+        error = quantize_variants(input.source(), options, colorCounts, results);
+
+    log_input_stats(input);
+
+    if (error)
     {
-        std::cerr << "Usage: cq.exe <path-to-image.png> <number-of-colors>\n";
+        cout << "decoder error " << error << ": " << codec_error_text(error) << endl;
         return 1;
     }
 
-    std::string imagePath = argv[1];
-    int numberOfColors = std::atoi(argv[2]);
+    int status = 0;
+    for (const VariantResult &result : results)
+    {
+        if (result.error)
+        {
+            cout << result.colors << " colors: error " << result.error << ": " << codec_error_text(result.error) << endl;
+            status = 1;
+            continue;
+        }
+        cout << result.colors << " colors: " << result.output << " (" << result.paletteSize << " colors, "
+             << result.outputBytes << " bytes)" << endl;
+    }
+
+    return status;
+}
 
-    if (numberOfColors <= 0)
+// Parses a comma-separated list of color counts such as "16,64,256".
+static bool parse_color_counts(const string &text, std::vector<unsigned> &counts)
+{
+    std::vector<unsigned> parsed;
+    std::stringstream stream(text);
+    string item;
+
+    while (std::getline(stream, item, ','))
+    {
+        try
+        {
+            size_t pos;
+            const unsigned long count = std::stoul(item, &pos);
+            if (pos < item.size() || count < 1 || count > 256)
+                return false;
+            parsed.push_back(static_cast<unsigned>(count));
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
+
+    // `counts` is left as it was unless the whole list is valid.
+    if (parsed.empty())
+        return false;
+    counts.swap(parsed);
+    return true;
+}
+
+// Parses a whole non-negative integer of at most `max`; signs, trailing characters and overflow are rejected.
+static bool parse_unsigned(const string &text, uint64_t max, uint64_t &value)
+{
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0])))
+        return false;
+
+    try
+    {
+        size_t pos;
+        const unsigned long long parsed = std::stoull(text, &pos);
+        if (pos < text.size() || parsed > max)
+            return false;
+        value = parsed;
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+// Parses a whole finite decimal number; trailing characters are rejected.
+static bool parse_number(const string &text, double &value)
+{
+    try
+    {
+        size_t pos;
+        const double parsed = std::stod(text, &pos);
+        if (pos < text.size() || !std::isfinite(parsed))
+            return false;
+        value = parsed;
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+/*
+ * Batch mode: quantizes every image listed by `source` (a directory or a manifest, see collect_batch_items())
+ * into the directory given with -o, in one process. With `sharedPalette` all images are first streamed into
+ * one histogram and then mapped to the single palette built from it. With `sequence` the images are frames
+ * that are quantized in order, each reusing what it can from the previous one (see run_sequence()).
+ */
+int execute_batch(const std::string &source, const Options &options, bool sharedPalette, bool sequence, double maxDrift,
+                  ResultCache *cache)
+{
+    std::vector<BatchItem> items;
+    if (!collect_batch_items(source, options.outputFileName, items))
     {
-        std::cerr << "Invalid number of colors. It must be a positive integer.\n";
+        cerr << "Cannot read batch " << source << " or write to " << options.outputFileName << endl;
         return 1;
     }
 
-    
+    if (sequence)
+    {
+        BatchSummary summary = run_sequence(items, options, maxDrift);
+        log_batch_summary(summary);
+        return summary.failed > 0 ? 1 : 0;
+    }
 
-    return 0;
+    OutputPalette palette = NO_OUTPUT_PALETTE;
+    if (sharedPalette)
+    {
+        const ColorHistogram histogram = collect_batch_histogram(items, options);
+        palette = build_shared_palette(histogram, options);
+        cout << "Shared palette: " << palette.colors.size() << " colors from " << histogram.counts.size()
+             << " distinct colors in " << items.size() << " images" << endl;
+    }
+
+    BatchSummary summary = run_batch(items, options, sharedPalette ? &palette : nullptr, cache);
+    log_batch_summary(summary);
+    if (cache && !sharedPalette)
+        cout << "Cache: " << cache->hits() << " hits, " << cache->misses() << " misses" << endl;
+
+    return summary.failed > 0 ? 1 : 0;
 }
 
 int main(int argc, char *argv[])
@@ -55,16 +366,36 @@ int main(int argc, char *argv[])
 
     string filename;
     string paletteFileName;
+    string batchSource;
+    string socketPath;
+    string splitTreePath;
 
     // Default settings
     unsigned numColors = 16;
+    bool colorsGiven = false;
+    double targetMse = 0;
     string outputFilename = "output.png";
+    bool outputGiven = false;
+    bool sharedPalette = false;
+    bool sequence = false;
+    double maxDrift = SEQUENCE_DEFAULT_DRIFT;
+    bool dither = false;
+    unsigned tileSize = 0;
+    unsigned numThreads = 0;
+    EncodeEffort encodeEffort = EFFORT_BALANCED;
+    bool parallelEncode = false;
+    uint64_t sampleBudget = 0;
+    uint64_t maxMemory = 0;
+    string cacheDirectory;
+    bool timings = false;
+    bool timingsJson = false;
+    std::vector<unsigned> colorCounts;
+    uint64_t cacheSize = RESULT_CACHE_DEFAULT_BYTES;
 
     // Process command line arguments
     for (int i = 1; i < argc; ++i)
     {
         string arg = argv[i];
-        string png = ".png";
         string palettes = "palettes/";
 
         // Check for specific arguments
@@ -82,7 +413,154 @@ int main(int argc, char *argv[])
             // Use custom color palette
             paletteFileName = argv[i + 1];
         }
-        else if (arg.find(png) != string::npos && arg.find(palettes) == string::npos)
+        else if (arg == "--dither")
+        {
+            dither = true;
+        }
+        else if (arg == "--colors" && i + 1 < argc)
+        {
+            // One color count, or several separated by commas that are all produced from one partitioning run.
+            if (!parse_color_counts(argv[++i], colorCounts))
+            {
+                std::cerr << "Invalid color counts: " << argv[i] << '\n';
+            }
+            else
+            {
+                if (colorCounts.size() == 1)
+                    numColors = colorCounts.front();
+                colorsGiven = true;
+            }
+        }
+        else if (arg == "--engine" && i + 1 < argc)
+        {
+            // Palette construction: pca (the default), pca-moments, wu or octree (see palette_engine_names()).
+            const PaletteEngine *engine = find_palette_engine(argv[++i]);
+            if (engine)
+                select_palette_engine(*engine);
+            else
+                std::cerr << "Unknown engine: " << argv[i] << " (one of " << palette_engine_names() << ")" << '\n';
+        }
+        else if (arg == "--tile-size" && i + 1 < argc)
+        {
+            // Dither in independent tiles of this edge length (0 dithers the whole image serially).
+            uint64_t value;
+            if (parse_unsigned(argv[++i], std::numeric_limits<unsigned>::max(), value))
+                tileSize = static_cast<unsigned>(value);
+            else
+                std::cerr << "Invalid tile size: " << argv[i] << '\n';
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            // Worker threads for parallel stages (0 uses every core).
+            uint64_t value;
+            if (parse_unsigned(argv[++i], std::numeric_limits<unsigned>::max(), value))
+                numThreads = static_cast<unsigned>(value);
+            else
+                std::cerr << "Invalid thread count: " << argv[i] << '\n';
+        }
+        else if (arg == "--effort" && i + 1 < argc)
+        {
+            // PNG encoder preset: store, fast, balanced or max.
+            if (!parse_encode_effort(argv[++i], encodeEffort))
+                std::cerr << "Unknown effort: " << argv[i] << '\n';
+        }
+        else if (arg == "--parallel-encode")
+        {
+            parallelEncode = true;
+        }
+        else if (arg == "--sample-budget" && i + 1 < argc)
+        {
+            // Build the palette from at most this many pixels, spread evenly over the image (0 uses all).
+            if (!parse_unsigned(argv[++i], std::numeric_limits<uint64_t>::max(), sampleBudget))
+                std::cerr << "Invalid sample budget: " << argv[i] << '\n';
+        }
+        else if (arg == "--max-memory" && i + 1 < argc)
+        {
+            // Memory budget such as 512M; larger images are decoded twice instead of being kept in memory.
+            if (!parse_byte_size(argv[++i], maxMemory))
+                std::cerr << "Invalid size: " << argv[i] << '\n';
+        }
+        else if (arg == "--cache" && i + 1 < argc)
+        {
+            // Directory of results keyed by input bytes and settings, reused by later runs.
+            cacheDirectory = argv[++i];
+        }
+        else if (arg == "--cache-size" && i + 1 < argc)
+        {
+            // Size the cache directory is kept under by deleting the least recently used results.
+            if (!parse_byte_size(argv[++i], cacheSize))
+                std::cerr << "Invalid size: " << argv[i] << '\n';
+        }
+        else if (arg == "--progress" && i + 1 < argc)
+        {
+            // auto, bar, quiet or json (one object per line on standard error).
+            ProgressMode mode;
+            if (parse_progress_mode(argv[++i], mode))
+                set_progress_mode(mode);
+            else
+                std::cerr << "Unknown progress mode: " << argv[i] << '\n';
+        }
+        else if (arg == "--timings")
+        {
+            // Time every stage and print a table at the end, or one line of JSON with "--timings json".
+            timings = true;
+            if (i + 1 < argc && (string(argv[i + 1]) == "json" || string(argv[i + 1]) == "table"))
+                timingsJson = string(argv[++i]) == "json";
+        }
+        else if ((arg == "--target-mse" || arg == "--target-psnr") && i + 1 < argc)
+        {
+            // Stop splitting once the palette reaches this error; the color count becomes an upper bound.
+            double target;
+            targetMse = 0;
+            if (parse_number(argv[++i], target))
+                targetMse = arg == "--target-mse" ? target : psnr_to_mse(target);
+            if (!(targetMse > 0))
+            {
+                targetMse = 0;
+                std::cerr << "Invalid error target: " << argv[i] << '\n';
+            }
+        }
+        else if (arg == "--split-tree" && i + 1 < argc)
+        {
+            // Sidecar file of the partitioning: reused for any smaller color count of the same image, else written.
+            splitTreePath = argv[++i];
+        }
+        else if (arg == "--batch" && i + 1 < argc)
+        {
+            // Directory or manifest of images to quantize in one process; -o names the output directory.
+            batchSource = argv[++i];
+        }
+        else if (arg == "--shared-palette")
+        {
+            // In batch mode, quantize all images to one palette built from all of them.
+            sharedPalette = true;
+        }
+        else if (arg == "--sequence")
+        {
+            // In batch mode, treat the images as consecutive frames and reuse palette and unchanged tiles.
+            sequence = true;
+        }
+        else if (arg == "--drift" && i + 1 < argc)
+        {
+            // Share of changed colors (0 to 1) up to which a frame keeps the previous frame's palette.
+            double drift;
+            if (parse_number(argv[++i], drift) && drift >= 0 && drift <= 1)
+                maxDrift = drift;
+            else
+                std::cerr << "Invalid drift: " << argv[i] << " (0 to 1)" << '\n';
+        }
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            // Answer quantization requests on this Unix domain socket until interrupted.
+            socketPath = argv[++i];
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            // Output file; its extension selects the format (.png, .ppm, .pam or .qoi), "-" writes PNG to stdout.
+            outputFilename = argv[++i];
+            outputGiven = true;
+        }
+        else if (arg == "-" || (find_codec_for_extension(arg) && arg.find(palettes) == string::npos))
         {
             filename = arg;
         }
@@ -92,6 +570,7 @@ int main(int argc, char *argv[])
             {
                 std::size_t pos;
                 numColors = std::stoi(arg, &pos);
+                colorsGiven = true;
                 if (pos < arg.size())
                 {
                     std::cerr << "Trailing characters after number: " << arg << '\n';
@@ -108,10 +587,79 @@ int main(int argc, char *argv[])
         }
     }
 
-    Options options{filename, numColors, outputFilename, paletteFileName};
+    // With an error target and no color count, the palette may grow to the largest one.
+    if (targetMse > 0 && !colorsGiven)
+        numColors = 256;
+
+    Options options{filename, numColors, outputFilename, paletteFileName, {}, 0, 0, dither, tileSize, numThreads, encodeEffort, parallelEncode, sampleBudget, maxMemory};
+
+    if (!socketPath.empty())
+        return serve(socketPath, options);
+
+    if (timings)
+        enable_timings();
+
+    ResultCache cache;
+    if (!cacheDirectory.empty() && !cache.open(cacheDirectory, cacheSize))
+    {
+        cerr << "Cannot use cache directory " << cacheDirectory << endl;
+        return 1;
+    }
+    ResultCache *resultCache = cacheDirectory.empty() ? nullptr : &cache;
+
+    if (!batchSource.empty())
+    {
+        if (!outputGiven || outputFilename == "-")
+        {
+            cerr << "--batch needs an output directory: -o DIR" << endl;
+            return 1;
+        }
+        if (colorCounts.size() > 1 || !splitTreePath.empty() || targetMse > 0)
+        {
+            cerr << "--batch takes a single color count and no --split-tree or error target" << endl;
+            return 1;
+        }
+        const int status = execute_batch(batchSource, options, sharedPalette, sequence, maxDrift, resultCache);
+        if (timings)
+            log_timings(collect_timings(), timingsJson);
+        return status;
+    }
+
+    if (colorCounts.size() > 1)
+    {
+        if (filename.empty() || outputFilename == "-" || maxMemory > 0 || resultCache || !splitTreePath.empty() || targetMse > 0)
+        {
+            cerr << "Several --colors need an input file and an output file, and cannot be combined with --max-memory, --cache, --split-tree or an error target" << endl;
+            return 1;
+        }
+        const int status = execute_variants(options, colorCounts);
+        if (timings)
+            log_timings(collect_timings(), timingsJson);
+        return status;
+    }
+
+    if (targetMse > 0 && !splitTreePath.empty())
+    {
+        cerr << "--split-tree cannot be combined with an error target" << endl;
+        return 1;
+    }
+    if ((targetMse > 0 || !splitTreePath.empty()) && &palette_engine() != &pca_engine())
+    {
+        cerr << "--split-tree and error targets need the pca engine" << endl;
+        return 1;
+    }
+
+    if (outputFilename == "-" && !reserve_stdout_for_image())
+    {
+        cerr << "Cannot write to standard output" << endl;
+        return 1;
+    }
 
     if (!filename.empty())
-        execute(options);
+        execute(options, resultCache, splitTreePath, targetMse);
+
+    if (timings)
+        log_timings(collect_timings(), timingsJson);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "pch/cqt_pch.h"
+
+#include "octree.h"
+#include "timings.h"
+
+Octree::Octree(unsigned maxNodes)
+{
+    pool.resize(std::max(maxNodes, static_cast<unsigned>(OCTREE_MIN_NODES)));
+    for (uint32_t node = static_cast<uint32_t>(pool.size()); node-- > 0;)
+    {
+        pool[node].next = freeNodes;
+        freeNodes = node;
+    }
+    freeCount = static_cast<unsigned>(pool.size());
+    std::fill(reducible, reducible + OCTREE_DEPTH, OCTREE_NONE);
+
+    allocate_node(0);
+}
+
+// Takes a node from the pool. Nodes on the last level are leaves; the others are listed for reduction.
+uint32_t Octree::allocate_node(unsigned level)
+{
+    const uint32_t index = freeNodes;
+    OctreeNode &node = pool[index];
+    freeNodes = node.next;
+    freeCount--;
+
+    node.count = 0;
+    std::fill(node.sum, node.sum + 3, 0);
+    std::fill(node.children, node.children + 8, OCTREE_NONE);
+    node.level = static_cast<uint8_t>(level);
+    node.leaf = level == OCTREE_DEPTH;
+    node.next = OCTREE_NONE;
+
+    if (node.leaf)
+    {
+        leaves++;
+    }
+    else
+    {
+        node.next = reducible[level];
+        reducible[level] = index;
+    }
+    return index;
+}
+
+/*
+ * Turns the internal node with the fewest pixels on the deepest level that has any into a leaf. Its children are
+ * leaves, since no internal node lies deeper, and its count and sums already include theirs, so they are simply
+ * returned to the pool.
+ */
+void Octree::reduce()
+{
+    int level = OCTREE_DEPTH - 1;
+    while (level >= 0 && reducible[level] == OCTREE_NONE)
+        level--;
+    if (level < 0)
+        return;
+
+    uint32_t *link = &reducible[level], *smallest = link;
+    for (; *link != OCTREE_NONE; link = &pool[*link].next)
+    {
+        if (pool[*link].count < pool[*smallest].count)
+            smallest = link;
+    }
+
+    const uint32_t index = *smallest;
+    OctreeNode &node = pool[index];
+    *smallest = node.next;
+
+    for (uint32_t &child : node.children)
+    {
+        if (child == OCTREE_NONE)
+            continue;
+        pool[child].next = freeNodes;
+        freeNodes = child;
+        freeCount++;
+        leaves--;
+        child = OCTREE_NONE;
+    }
+
+    node.leaf = true;
+    node.next = OCTREE_NONE;
+    leaves++;
+}
+
+/*
+ * Adds `count` pixels of one color. Every node on its path counts them, down to the leaf that holds the color;
+ * missing nodes on the way are created, after reducing the tree if the pool could run out.
+ */
+void Octree::add_color(unsigned char r, unsigned char g, unsigned char b, uint64_t count)
+{
+    while (freeCount < OCTREE_DEPTH)
+        reduce();
+
+    uint32_t index = 0;
+    for (unsigned level = 0;; ++level)
+    {
+        OctreeNode &node = pool[index];
+        node.count += count;
+        node.sum[0] += count * r;
+        node.sum[1] += count * g;
+        node.sum[2] += count * b;
+
+        if (node.leaf)
+            return;
+
+        const unsigned shift = 7 - level;
+        const unsigned child = (((r >> shift) & 1) << 2) | (((g >> shift) & 1) << 1) | ((b >> shift) & 1);
+        if (node.children[child] == OCTREE_NONE)
+        {
+            const uint32_t created = allocate_node(level + 1);
+            pool[index].children[child] = created;
+        }
+        index = pool[index].children[child];
+    }
+}
+
+void Octree::add_pixels(const unsigned char *pixels, size_t numPixels, unsigned channels)
+{
+    StageTimer timer(STAGE_HISTOGRAM);
+    totalPixels += numPixels;
+
+    for (size_t pixel = 0; pixel < numPixels; ++pixel, pixels += channels)
+    {
+        if (channels == 4 && pixels[3] < 255)
+        {
+            if (pixels[3] == 0)
+            {
+                transparentPixels++;
+                continue;
+            }
+            translucentPixels++;
+        }
+        add_color(pixels[0], pixels[1], pixels[2], 1);
+    }
+}
+
+std::vector<Pixel> Octree::palette(unsigned colors) const
+{
+    Octree reduced = *this;
+    {
+        StageTimer timer(STAGE_PARTITION);
+        while (reduced.leaves > std::max(colors, 1u) && reduced.reducible[0] != OCTREE_NONE)
+            reduced.reduce();
+    }
+
+    StageTimer timer(STAGE_REDUCE);
+    std::vector<Pixel> palette;
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty())
+    {
+        const OctreeNode &node = reduced.pool[stack.back()];
+        stack.pop_back();
+
+        if (node.leaf)
+        {
+            if (node.count == 0)
+                continue;
+            Pixel color(3);
+            color << static_cast<double>(node.sum[0]) / node.count, static_cast<double>(node.sum[1]) / node.count,
+                static_cast<double>(node.sum[2]) / node.count;
+            palette.push_back(color);
+            continue;
+        }
+
+        for (unsigned child = 8; child-- > 0;)
+        {
+            if (node.children[child] != OCTREE_NONE)
+                stack.push_back(node.children[child]);
+        }
+    }
+    return palette;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "shared.h"
+
+// Levels below the root: one per bit of the 8-bit channels, so nodes at the last level hold single colors.
+#define OCTREE_DEPTH 8
+// Default node pool, about 1 MiB; a few thousand leaves are left before the palette is reduced from them.
+#define OCTREE_DEFAULT_NODES 16384
+// Smallest pool, enough to insert any color after reducing.
+#define OCTREE_MIN_NODES 64
+#define OCTREE_NONE 0xFFFFFFFFu
+
+/*
+ * Node of the octree: the pixel count and channel sums of every color that reached it, and its children by the
+ * next bit of red, green and blue. `next` links internal nodes of the same level for reduction, and free nodes
+ * of the pool.
+ */
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum[3];
+    uint32_t children[8];
+    uint32_t next;
+    uint8_t level;
+    bool leaf;
+} OctreeNode;
+
+/*
+ * Octree color quantizer (Gervautz and Purgathofer, 1988) in a fixed pool of nodes. The pool is allocated once,
+ * when the tree is created, and nodes are taken from and returned to it, so memory does not depend on the size
+ * of the image or on the number of colors in it. Whenever a color could not be inserted with the nodes left, the
+ * tree is reduced: the internal node with the fewest pixels on the deepest level becomes a leaf and its children
+ * go back to the pool. Pixels are added in bands as a streaming decoder delivers them (see decode_image_bands()).
+ */
+class Octree
+{
+public:
+    explicit Octree(unsigned maxNodes = OCTREE_DEFAULT_NODES);
+
+    // Adds packed 8-bit RGB or RGBA pixels; fully transparent ones are only counted.
+    void add_pixels(const unsigned char *pixels, size_t numPixels, unsigned channels);
+    void add_color(unsigned char r, unsigned char g, unsigned char b, uint64_t count);
+
+    // Mean colors of the leaves after reducing a copy of the tree to at most `colors` leaves.
+    std::vector<Pixel> palette(unsigned colors) const;
+
+    unsigned leaf_count() const { return leaves; }
+    unsigned node_count() const { return static_cast<unsigned>(pool.size()) - freeCount; }
+    size_t pool_bytes() const { return pool.capacity() * sizeof(OctreeNode); }
+
+    uint64_t totalPixels = 0;       // every pixel added, transparent ones included
+    uint64_t transparentPixels = 0; // alpha 0
+    uint64_t translucentPixels = 0; // alpha strictly between 0 and 255
+
+private:
+    uint32_t allocate_node(unsigned level);
+    void reduce();
+
+    std::vector<OctreeNode> pool;
+    uint32_t freeNodes = OCTREE_NONE;
+    unsigned freeCount = 0;
+    uint32_t reducible[OCTREE_DEPTH]; // internal nodes of every level
+    unsigned leaves = 0;
+};
@@ -0,0 +1,170 @@
+#include "pch/cqt_pch.h"
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+
+#include "out_of_core.h"
+#include "image.h"
+#include "dither.h"
+#include "palette.h"
+#include "log.h"
+#include "timings.h"
+
+// Bytes per pixel column of a second-pass band: the decoded band, its copy being mapped, the filtered row and the
+// compressed output, plus the floating point copy made for dithering.
+#define BAND_BYTES_PER_SAMPLE 4
+#define DITHER_BYTES_PER_PIXEL 48
+// Bytes per palette cache entry, including the hash table's own overhead.
+#define CACHE_BYTES_PER_ENTRY 64
+
+/*
+ * Splits `options.maxMemory` between the histogram and the pixels. Whatever the process already occupies is
+ * taken off the budget first. Half of the rest bounds the histogram to `maxColors` distinct colors; only an image
+ * that actually has more is sampled instead (see execute()), so images with fewer colors come out as they would
+ * without a budget. The pixels stay in memory only if the decoded image and the encoder's copies of it (about
+ * three times its size) fit into the other half.
+ */
+MemoryPlan plan_memory(const Options &options, unsigned width, unsigned height, unsigned channels)
+{
+    MemoryPlan plan{false, STREAM_BAND_ROWS, options.sampleBudget, 0, std::numeric_limits<size_t>::max()};
+
+    if (options.maxMemory == 0)
+        return plan;
+
+    const uint64_t used = current_rss_bytes();
+    const uint64_t available = options.maxMemory > used ? options.maxMemory - used : options.maxMemory / 4;
+    const uint64_t numPixels = static_cast<uint64_t>(width) * height;
+
+    plan.maxColors = std::max<uint64_t>(available / 2 / HISTOGRAM_BYTES_PER_COLOR, 1);
+
+    const uint64_t pixelBudget = available / 2;
+    const uint64_t imageBytes = numPixels * channels;
+    plan.outOfCore = imageBytes * 3 > pixelBudget;
+
+    if (plan.outOfCore)
+    {
+        const uint64_t rowBytes = static_cast<uint64_t>(width) *
+                                  (channels * BAND_BYTES_PER_SAMPLE + (options.dither ? DITHER_BYTES_PER_PIXEL : 0));
+        plan.bandRows = static_cast<unsigned>(std::min<uint64_t>(std::max<uint64_t>(pixelBudget / 2 / rowBytes, 1), 4096));
+        plan.cacheEntries = static_cast<size_t>(std::max<uint64_t>(pixelBudget / 2 / CACHE_BYTES_PER_ENTRY, 4096));
+
+        // Dithering runs in bands of its own; whole ones keep the output identical to the in-core path.
+        if (options.dither)
+        {
+            unsigned ditherRows;
+            dither_settings_for(options, ditherRows);
+            plan.bandRows = std::max(plan.bandRows / ditherRows, 1u) * ditherRows;
+        }
+    }
+
+    return plan;
+}
+
+/*
+ * Parses a byte count with an optional K, M or G suffix (powers of 1024), e.g. "512M".
+ */
+bool parse_byte_size(const std::string &text, uint64_t &bytes)
+{
+    size_t end = 0;
+    double value;
+
+    try
+    {
+        value = std::stod(text, &end);
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+
+    const std::string suffix = text.substr(end);
+    double scale = 1.0;
+
+    if (suffix == "K" || suffix == "k")
+        scale = 1024.0;
+    else if (suffix == "M" || suffix == "m")
+        scale = 1024.0 * 1024.0;
+    else if (suffix == "G" || suffix == "g")
+        scale = 1024.0 * 1024.0 * 1024.0;
+    else if (!suffix.empty())
+        return false;
+
+    // std::stod also accepts "nan", "inf" and huge exponents; 2^64 and above do not fit the conversion.
+    const double scaled = value * scale;
+    if (!std::isfinite(scaled) || scaled < 0 || scaled >= 18446744073709551616.0)
+        return false;
+
+    bytes = static_cast<uint64_t>(scaled);
+    return true;
+}
+
+/*
+ * Second out-of-core pass: decodes `source` again, maps (or dithers) it to `palette` and encodes it band by
+ * band into `options.outputFileName` ("-" for standard output). Returns a codec error code.
+ */
+unsigned write_quantized_bands(const ImageSource &source, const MemoryPlan &plan, const std::vector<Pixel> &palette,
+                               const OutputPalette &outputPalette, const Options &options)
+{
+    std::FILE *file = open_output_file(options.outputFileName.c_str());
+    if (!file)
+        return 79;
+
+    ByteWriter writer = [file](const unsigned char *data, size_t size)
+    { return std::fwrite(data, 1, size, file) == size; };
+
+    const ImageCodec *codec = find_codec_for_extension(options.outputFileName);
+    const EncodeSettings encodeSettings{options.encodeEffort, options.parallelEncode ? options.numThreads : 1};
+
+    unsigned ditherRows;
+    const TiledDitherSettings ditherSettings = dither_settings_for(options, ditherRows);
+    TiledDitherState ditherState;
+
+    std::unique_ptr<BandEncoder> encoder;
+    std::vector<unsigned char> band;
+    PaletteCache cache;
+    unsigned width, height, channels, encodeError = 0;
+
+    unsigned error = decode_image_bands(source, plan.bandRows, true, width, height, channels,
+                                        [&](const unsigned char *pixels, unsigned, unsigned rows)
+                                        {
+        if (encodeError)
+            return;
+        if (!encoder)
+            encoder = (codec ? *codec : png_codec()).begin_encode(writer, channels, width, height, outputPalette, encodeSettings);
+
+        const size_t rowPixels = width;
+        band.assign(pixels, pixels + rows * rowPixels * channels);
+
+        if (!options.dither || palette.empty())
+        {
+            if (cache.size() > plan.cacheEntries)
+                cache.clear();
+            map_pixels_to_palette(band.data(), rows * rowPixels, channels, palette, cache);
+        }
+        else
+        {
+            for (unsigned row = 0; row < rows; row += ditherRows)
+            {
+                dither_pixels_band(ditherState, band.data() + row * rowPixels * channels,
+                                   std::min(ditherRows, rows - row) * rowPixels, channels, palette, width,
+                                   ditherSettings);
+            }
+        }
+
+        StageTimer timer(STAGE_ENCODE);
+        encodeError = encoder->write_rows(band.data(), rows); });
+
+    if (!error)
+        error = encodeError;
+    if (!error && encoder)
+    {
+        StageTimer timer(STAGE_ENCODE);
+        error = encoder->finish();
+    }
+
+    if (close_output_file(file) != 0 && !error)
+        error = 79;
+
+    return error;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "shared.h"
+#include "codec.h"
+
+// Estimated bytes per distinct color while the palette is built: the histogram entry plus the matrix row, weight
+// and sorted copies made while partitioning.
+#define HISTOGRAM_BYTES_PER_COLOR 160
+
+/*
+ * How an image is processed within a memory budget. In-core, the decoded pixels are kept between building the
+ * palette and mapping them. Out-of-core, the input is decoded twice instead: the first pass only fills the
+ * histogram, the second maps, dithers and encodes one band at a time, so the working set depends on the image
+ * width but not on its height.
+ */
+typedef struct
+{
+    bool outOfCore;
+    unsigned bandRows;     // rows per band of the second pass
+    uint64_t sampleBudget; // pixels sampled for the histogram, 0 for all of them
+    uint64_t maxColors;    // distinct colors the histogram may hold before it is rebuilt from a sample, 0 for any
+    size_t cacheEntries;   // palette lookups remembered across bands of the second pass
+} MemoryPlan;
+
+MemoryPlan plan_memory(const Options &options, unsigned width, unsigned height, unsigned channels);
+bool parse_byte_size(const std::string &text, uint64_t &bytes);
+unsigned write_quantized_bands(const ImageSource &source, const MemoryPlan &plan, const std::vector<Pixel> &palette,
+                               const OutputPalette &outputPalette, const Options &options);
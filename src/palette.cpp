@@ -1,27 +1,32 @@
 #include "pch/cqt_pch.h"
 
 #include "palette.h"
+#include "quantization.h"
+#include "timings.h"
 
 std::vector<Pixel> get_reduced_palette(const std::vector<PixelSubset> &subsets)
 {
-    std::cout << "\nReducing palette...";
+    StageTimer timer(STAGE_REDUCE);
+    if (consoleOutput)
+        std::cout << "Reducing palette...";
 
     std::vector<Pixel> palette;
 
     for (unsigned i = 0; i < subsets.size(); ++i)
     {
-        Pixel color = subsets[i].data.colwise().mean();
+        Pixel color = calculate_subset_mean(subsets[i]);
         palette.emplace_back(color);
     }
 
-    std::cout << " done." << std::endl;
+    if (consoleOutput)
+        std::cout << " done." << std::endl;
 
     return palette;
 }
 
-Pixel find_closest_pixel_value(const Pixel &targetColor, const std::vector<Pixel> &colorPalette)
+unsigned find_closest_palette_index(const Pixel &targetColor, const std::vector<Pixel> &colorPalette)
 {
-    int closestIndex = 0;
+    unsigned closestIndex = 0;
     double minDistance = MAX_DOUBLE;
 
     // Lambda for calculating Euclidean distance between two RGB values.
@@ -43,11 +48,18 @@ Pixel find_closest_pixel_value(const Pixel &targetColor, const std::vector<Pixel
         }
     }
 
-    return colorPalette[closestIndex];
+    return closestIndex;
+}
+
+Pixel find_closest_pixel_value(const Pixel &targetColor, const std::vector<Pixel> &colorPalette)
+{
+    return colorPalette[find_closest_palette_index(targetColor, colorPalette)];
 }
 
 void map_to_palette(MatrixRgb &originalImage, std::vector<Pixel> &palette)
 {
+    StageTimer timer(STAGE_MAP);
+
     for (Eigen::Index pixel = 0; pixel < originalImage.rows(); ++pixel)
     {
         Pixel newColor = find_closest_pixel_value(originalImage.row(pixel), palette);
@@ -55,4 +67,86 @@ void map_to_palette(MatrixRgb &originalImage, std::vector<Pixel> &palette)
     }
 }
 
-// TODO: figure out the problem of mapping between palettes and using all colors
\ No newline at end of file
+/*
+ * Maps packed 8-bit RGB or RGBA pixels to the palette in place. Each distinct color is searched for only once;
+ * later occurrences reuse the cached palette index. Alpha is left untouched, except that fully transparent
+ * pixels are normalized to (0, 0, 0, 0) so that they all share the reserved transparent palette entry.
+ */
+void map_pixels_to_palette(unsigned char *rgb, size_t numPixels, unsigned channels, const std::vector<Pixel> &palette)
+{
+    PaletteCache cache;
+    map_pixels_to_palette(rgb, numPixels, channels, palette, cache);
+}
+
+// Variant that keeps the cache across calls, for images that are mapped band by band.
+void map_pixels_to_palette(unsigned char *rgb, size_t numPixels, unsigned channels, const std::vector<Pixel> &palette,
+                           PaletteCache &cache)
+{
+    StageTimer timer(STAGE_MAP);
+    Pixel color(3);
+
+    for (size_t pixel = 0; pixel < numPixels; ++pixel, rgb += channels)
+    {
+        if (channels == 4 && rgb[3] == 0)
+        {
+            rgb[0] = rgb[1] = rgb[2] = 0;
+            continue;
+        }
+
+        // A sample of only transparent pixels leaves no colors to map to; opaque pixels then keep their own.
+        if (palette.empty())
+            continue;
+
+        uint32_t key = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+        auto cached = cache.find(key);
+
+        if (cached == cache.end())
+        {
+            color << rgb[0], rgb[1], rgb[2];
+            cached = cache.emplace(key, find_closest_palette_index(color, palette)).first;
+        }
+
+        const Pixel &newColor = palette[cached->second];
+        rgb[0] = static_cast<unsigned char>(newColor(0));
+        rgb[1] = static_cast<unsigned char>(newColor(1));
+        rgb[2] = static_cast<unsigned char>(newColor(2));
+    }
+}
+
+/*
+ * Mean squared error per color channel between two packed 8-bit images, ignoring fully transparent pixels.
+ */
+double mean_squared_error(const unsigned char *original, const unsigned char *quantized, size_t numPixels, unsigned channels)
+{
+    double sum = 0.0;
+    size_t counted = 0;
+
+    for (size_t pixel = 0; pixel < numPixels; ++pixel, original += channels, quantized += channels)
+    {
+        if (channels == 4 && original[3] == 0)
+            continue;
+
+        for (unsigned channel = 0; channel < 3; ++channel)
+        {
+            const double difference = static_cast<double>(original[channel]) - quantized[channel];
+            sum += difference * difference;
+        }
+        counted++;
+    }
+
+    return counted > 0 ? sum / (3.0 * counted) : 0.0;
+}
+
+// TODO: figure out the problem of mapping between palettes and using all colors
+
+// Peak signal-to-noise ratio in dB of 8-bit channels with the given mean squared error; infinite for no error.
+double mse_to_psnr(double mse)
+{
+    return mse > 0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+}
+
+// The mean squared error of 8-bit channels at the given PSNR in dB.
+double psnr_to_mse(double psnr)
+{
+    return 255.0 * 255.0 / std::pow(10.0, psnr / 10.0);
+}
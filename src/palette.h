@@ -1,6 +1,18 @@
 #pragma once
 #include "shared.h"
 
+#include <unordered_map>
+
+// Palette index of every 0xRRGGBB color looked up so far.
+typedef std::unordered_map<uint32_t, unsigned> PaletteCache;
+
 std::vector<Pixel> get_reduced_palette(const std::vector<PixelSubset> &subsets);
+unsigned find_closest_palette_index(const Pixel &targetColor, const std::vector<Pixel> &colorPalette);
 Pixel find_closest_pixel_value(const Pixel &targetColor, const std::vector<Pixel> &colorPalette);
-void map_to_palette(MatrixRgb &originalImage, std::vector<Pixel> &palette);
\ No newline at end of file
+void map_to_palette(MatrixRgb &originalImage, std::vector<Pixel> &palette);
+void map_pixels_to_palette(unsigned char *pixels, size_t numPixels, unsigned channels, const std::vector<Pixel> &palette);
+void map_pixels_to_palette(unsigned char *pixels, size_t numPixels, unsigned channels, const std::vector<Pixel> &palette,
+                           PaletteCache &cache);
+double mean_squared_error(const unsigned char *original, const unsigned char *quantized, size_t numPixels, unsigned channels);
+double mse_to_psnr(double mse);
+double psnr_to_mse(double psnr);
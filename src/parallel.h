@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Number of worker threads to use when the caller passes 0 ("use every core").
+ */
+unsigned static inline resolve_thread_count(unsigned requested)
+{
+    if (requested > 0)
+        return requested;
+
+    unsigned hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+/*
+ * Runs func(i) for every i in [0, count) on up to numThreads threads. Work items are handed out through a
+ * shared atomic counter, so the order in which items complete is unspecified; callers that need reproducible
+ * output must make each item independent of the others.
+ */
+template <typename Func>
+void parallel_for(unsigned count, unsigned numThreads, Func &&func)
+{
+    unsigned workers = std::min(resolve_thread_count(numThreads), count);
+
+    if (workers <= 1)
+    {
+        for (unsigned i = 0; i < count; ++i)
+            func(i);
+        return;
+    }
+
+    std::atomic<unsigned> next{0};
+
+    auto worker = [&]()
+    {
+        for (unsigned i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+            func(i);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+
+    for (unsigned t = 1; t < workers; ++t)
+        threads.emplace_back(worker);
+
+    worker();
+
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+/*
+ * Runs func(i, worker) for every i in [0, count) on up to numThreads threads. `worker` identifies the calling
+ * thread, below min(resolve_thread_count(numThreads), count), so that callers can keep scratch state per thread.
+ *
+ * Every worker starts on its own contiguous share of the items. Once its share is done it steals single items
+ * from the far end of the others' shares, so items of very different cost (e.g. files of different sizes)
+ * still balance, while workers only contend when one of them runs dry.
+ */
+template <typename Func>
+void parallel_for_stealing(unsigned count, unsigned numThreads, Func &&func)
+{
+    unsigned workers = std::min(resolve_thread_count(numThreads), count);
+
+    if (workers <= 1)
+    {
+        for (unsigned i = 0; i < count; ++i)
+            func(i, 0u);
+        return;
+    }
+
+    struct alignas(64) Share
+    {
+        std::mutex mutex;
+        unsigned begin;
+        unsigned end;
+    };
+    std::unique_ptr<Share[]> shares(new Share[workers]);
+
+    for (unsigned w = 0; w < workers; ++w)
+    {
+        shares[w].begin = static_cast<unsigned>(static_cast<uint64_t>(count) * w / workers);
+        shares[w].end = static_cast<unsigned>(static_cast<uint64_t>(count) * (w + 1) / workers);
+    }
+
+    auto worker = [&](unsigned self)
+    {
+        for (;;)
+        {
+            unsigned item = count;
+            {
+                std::lock_guard<std::mutex> lock(shares[self].mutex);
+                if (shares[self].begin < shares[self].end)
+                    item = shares[self].begin++;
+            }
+
+            for (unsigned offset = 1; item == count && offset < workers; ++offset)
+            {
+                Share &victim = shares[(self + offset) % workers];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.begin < victim.end)
+                    item = --victim.end;
+            }
+
+            // Shares only ever shrink, so once every one of them is empty there is nothing left to steal.
+            if (item == count)
+                return;
+
+            func(item, self);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+
+    for (unsigned t = 1; t < workers; ++t)
+        threads.emplace_back(worker, t);
+
+    worker(0);
+
+    for (std::thread &thread : threads)
+        thread.join();
+}
@@ -1,5 +1,7 @@
 // PCH
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <iomanip>
 #include <chrono>
@@ -7,5 +9,7 @@
 #include <string>
 #include <vector>
 #include <numeric>
+#include <limits>
 #include <cstdio>
+#include <functional>
 #include <map>
\ No newline at end of file
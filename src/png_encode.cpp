@@ -0,0 +1,455 @@
+#include "pch/cqt_pch.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "png_encode.h"
+#include "inflate.h"
+#include "parallel.h"
+
+#include <unordered_map>
+
+// Filtered scanline bytes compressed by one worker. Smaller chunks parallelize better but lose the matches
+// that would have crossed a chunk boundary.
+#define PARALLEL_DEFLATE_CHUNK (256 * 1024)
+
+/*
+ * Maps an effort preset onto lodepng's encoder settings. "balanced" is lodepng's default configuration.
+ */
+void apply_encode_effort(LodePNGEncoderSettings &settings, EncodeEffort effort)
+{
+    lodepng_encoder_settings_init(&settings);
+
+    switch (effort)
+    {
+    case EFFORT_STORE:
+        settings.zlibsettings.btype = 0;
+        settings.zlibsettings.use_lz77 = 0;
+        settings.filter_strategy = LFS_ZERO;
+        break;
+    case EFFORT_FAST:
+        settings.zlibsettings.windowsize = 1024;
+        settings.zlibsettings.nicematch = 16;
+        settings.zlibsettings.lazymatching = 0;
+        break;
+    case EFFORT_BALANCED:
+        break;
+    case EFFORT_MAX:
+        settings.zlibsettings.windowsize = 32768;
+        settings.zlibsettings.nicematch = 258;
+        settings.filter_strategy = LFS_ENTROPY;
+        break;
+    }
+}
+
+bool parse_encode_effort(const std::string &name, EncodeEffort &effort)
+{
+    static const std::map<std::string, EncodeEffort> EFFORTS = {
+        {"store", EFFORT_STORE}, {"fast", EFFORT_FAST}, {"balanced", EFFORT_BALANCED}, {"max", EFFORT_MAX}};
+
+    auto found = EFFORTS.find(name);
+    if (found == EFFORTS.end())
+        return false;
+
+    effort = found->second;
+    return true;
+}
+
+/*
+ * Deflates `in` in fixed-size chunks on a thread pool (no match crosses a chunk). Every chunk but the last ends in
+ * a sync flush, so the next one can follow it on a byte boundary; with `flushLast` the last one does too and more
+ * deflate data can follow the whole.
+ */
+static unsigned deflate_chunks(std::vector<unsigned char> &deflated, const unsigned char *in, size_t insize,
+                               const LodePNGCompressSettings &settings, unsigned numThreads, bool flushLast)
+{
+    const size_t numChunks = std::max<size_t>(1, (insize + PARALLEL_DEFLATE_CHUNK - 1) / PARALLEL_DEFLATE_CHUNK);
+    std::vector<std::vector<unsigned char>> pieces(numChunks);
+    std::vector<unsigned> errors(numChunks, 0);
+
+    parallel_for(numChunks, numThreads, [&](unsigned chunk)
+                 {
+        const size_t begin = chunk * static_cast<size_t>(PARALLEL_DEFLATE_CHUNK);
+        const size_t size = std::min<size_t>(PARALLEL_DEFLATE_CHUNK, insize - begin);
+
+        unsigned char *piece = nullptr;
+        size_t pieceSize = 0;
+        if (flushLast || chunk + 1 < numChunks)
+            errors[chunk] = lodepng_deflate_flush(&piece, &pieceSize, in + begin, size, &settings);
+        else
+            errors[chunk] = lodepng_deflate(&piece, &pieceSize, in + begin, size, &settings);
+
+        if (!errors[chunk])
+            pieces[chunk].assign(piece, piece + pieceSize);
+        std::free(piece); });
+
+    deflated.clear();
+    for (size_t chunk = 0; chunk < numChunks; ++chunk)
+    {
+        if (errors[chunk])
+            return errors[chunk];
+        deflated.insert(deflated.end(), pieces[chunk].begin(), pieces[chunk].end());
+    }
+
+    return 0;
+}
+
+/*
+ * zlib compressor for lodepng's `custom_zlib` hook. The filtered image data is deflated in chunks by
+ * deflate_chunks() and stitched into one valid zlib stream. `settings->custom_context` points to the number of
+ * threads to use.
+ */
+unsigned parallel_zlib_compress(unsigned char **out, size_t *outsize, const unsigned char *in, size_t insize,
+                                const LodePNGCompressSettings *settings)
+{
+    LodePNGCompressSettings chunkSettings = *settings;
+    chunkSettings.custom_zlib = nullptr;
+    chunkSettings.custom_deflate = nullptr;
+
+    const unsigned numThreads = settings->custom_context ? *static_cast<const unsigned *>(settings->custom_context) : 0;
+    if (insize <= PARALLEL_DEFLATE_CHUNK)
+        return lodepng_zlib_compress(out, outsize, in, insize, &chunkSettings);
+
+    std::vector<unsigned char> deflated;
+    unsigned error = deflate_chunks(deflated, in, insize, chunkSettings, numThreads, false);
+    if (error)
+        return error;
+
+    // lodepng releases the output with free(), so it has to come from malloc().
+    const size_t total = 2 + deflated.size() + 4;
+    unsigned char *result = static_cast<unsigned char *>(std::malloc(total));
+    if (!result)
+        return 83;
+
+    size_t position = 0;
+    result[position++] = 0x78; // CMF: deflate, 32K window
+    result[position++] = 0x01; // FLG: check bits, fastest compression level
+    std::memcpy(result + position, deflated.data(), deflated.size());
+    position += deflated.size();
+
+    uint32_t checksum = adler32(in, insize);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        result[position++] = static_cast<unsigned char>(checksum >> shift);
+
+    *out = result;
+    *outsize = total;
+
+    return 0;
+}
+
+/*
+ * Encodes 8-bit pixels of the given color type as PNG with the requested effort. With more than one thread
+ * the zlib stream is produced by parallel_zlib_compress().
+ */
+static unsigned encode_with_state(std::vector<unsigned char> &png, const unsigned char *image, unsigned width,
+                                  unsigned height, lodepng::State &state, const EncodeSettings &settings)
+{
+    const unsigned numThreads = resolve_thread_count(settings.numThreads);
+    if (numThreads > 1 && settings.effort != EFFORT_STORE)
+    {
+        state.encoder.zlibsettings.custom_zlib = parallel_zlib_compress;
+        state.encoder.zlibsettings.custom_context = &numThreads;
+    }
+
+    png.clear(); // lodepng appends to the output
+    return lodepng::encode(png, image, width, height, state);
+}
+
+unsigned encode_png(std::vector<unsigned char> &png, const unsigned char *image, unsigned width, unsigned height,
+                    LodePNGColorType colortype, const EncodeSettings &settings)
+{
+    lodepng::State state;
+    apply_encode_effort(state.encoder, settings.effort);
+
+    state.info_raw.colortype = colortype;
+    state.info_raw.bitdepth = 8;
+
+    return encode_with_state(png, image, width, height, state, settings);
+}
+
+/*
+ * Encodes an image whose pixels all come from `palette` as an indexed PNG with the smallest bit depth that fits,
+ * bypassing lodepng's automatic color analysis. The reserved transparent entry comes first, so the tRNS chunk
+ * lodepng writes for it is a single byte. Returns lodepng error 82 if a pixel is not in the palette.
+ */
+unsigned encode_indexed_png(std::vector<unsigned char> &png, const unsigned char *image, unsigned width, unsigned height,
+                            LodePNGColorType colortype, const OutputPalette &palette, const EncodeSettings &settings)
+{
+    const size_t numEntries = palette.colors.size() + (palette.transparent ? 1 : 0);
+    if (numEntries == 0 || numEntries > 256)
+        return 82;
+
+    lodepng::State state;
+    apply_encode_effort(state.encoder, settings.effort);
+
+    state.info_raw.colortype = colortype;
+    state.info_raw.bitdepth = 8;
+
+    LodePNGColorMode &mode = state.info_png.color;
+    mode.colortype = LCT_PALETTE;
+    mode.bitdepth = numEntries <= 2 ? 1 : numEntries <= 4 ? 2 : numEntries <= 16 ? 4 : 8;
+
+    if (palette.transparent)
+        lodepng_palette_add(&mode, 0, 0, 0, 0);
+
+    for (const Pixel &color : palette.colors)
+    {
+        lodepng_palette_add(&mode, static_cast<unsigned char>(color(0)), static_cast<unsigned char>(color(1)),
+                            static_cast<unsigned char>(color(2)), 255);
+    }
+
+    state.encoder.auto_convert = 0;
+
+    return encode_with_state(png, image, width, height, state, settings);
+}
+
+PngBandWriter::PngBandWriter(ByteWriter out, unsigned width, unsigned height, unsigned channels, const OutputPalette &palette,
+                             const EncodeSettings &settings)
+    : out(std::move(out)), width(width), height(height), channels(channels), settings(settings)
+{
+    LodePNGEncoderSettings encoder;
+    apply_encode_effort(encoder, settings.effort);
+    zlibSettings = encoder.zlibsettings;
+    filterRows = encoder.filter_strategy != LFS_ZERO;
+
+    const size_t numEntries = palette.colors.size() + (palette.transparent ? 1 : 0);
+    if (!palette.colors.empty() && numEntries <= 256)
+    {
+        // Same layout as encode_indexed_png(): the reserved transparent entry first.
+        if (palette.transparent)
+            paletteEntries.insert(paletteEntries.end(), {0, 0, 0, 0});
+
+        for (const Pixel &color : palette.colors)
+        {
+            paletteEntries.insert(paletteEntries.end(), {static_cast<unsigned char>(color(0)), static_cast<unsigned char>(color(1)),
+                                                         static_cast<unsigned char>(color(2)), 255});
+        }
+
+        for (size_t entry = numEntries; entry-- > 0;)
+        {
+            const unsigned char *rgba = &paletteEntries[entry * 4];
+            paletteIndex[(rgba[0] << 24) | (rgba[1] << 16) | (rgba[2] << 8) | rgba[3]] = static_cast<unsigned char>(entry);
+        }
+
+        bitDepth = numEntries <= 2 ? 1 : numEntries <= 4 ? 2 : numEntries <= 16 ? 4 : 8;
+    }
+
+    const size_t rowBytes = paletteEntries.empty() ? static_cast<size_t>(width) * channels : (static_cast<size_t>(width) * bitDepth + 7) / 8;
+    previousRow.assign(rowBytes, 0);
+    currentRow.resize(rowBytes);
+}
+
+bool PngBandWriter::write_chunk(const char *type, const unsigned char *data, size_t size)
+{
+    std::vector<unsigned char> chunk(12 + size);
+
+    for (unsigned i = 0; i < 4; ++i)
+        chunk[i] = static_cast<unsigned char>(size >> (24 - 8 * i));
+    std::memcpy(chunk.data() + 4, type, 4);
+    if (size > 0)
+        std::memcpy(chunk.data() + 8, data, size);
+
+    const unsigned crc = lodepng_crc32(chunk.data() + 4, size + 4);
+    for (unsigned i = 0; i < 4; ++i)
+        chunk[8 + size + i] = static_cast<unsigned char>(crc >> (24 - 8 * i));
+
+    return out(chunk.data(), chunk.size());
+}
+
+unsigned PngBandWriter::write_header()
+{
+    static const unsigned char SIGNATURE[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+    const LodePNGColorType colortype = !paletteEntries.empty() ? LCT_PALETTE : channels == 4 ? LCT_RGBA : LCT_RGB;
+    unsigned char header[13] = {0};
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        header[i] = static_cast<unsigned char>(width >> (24 - 8 * i));
+        header[4 + i] = static_cast<unsigned char>(height >> (24 - 8 * i));
+    }
+    header[8] = static_cast<unsigned char>(bitDepth);
+    header[9] = static_cast<unsigned char>(colortype);
+
+    if (!out(SIGNATURE, sizeof(SIGNATURE)) || !write_chunk("IHDR", header, sizeof(header)))
+        return 79;
+
+    if (!paletteEntries.empty())
+    {
+        std::vector<unsigned char> rgb, alpha;
+        for (size_t entry = 0; entry < paletteEntries.size() / 4; ++entry)
+        {
+            rgb.insert(rgb.end(), &paletteEntries[entry * 4], &paletteEntries[entry * 4 + 3]);
+            alpha.push_back(paletteEntries[entry * 4 + 3]);
+        }
+        while (!alpha.empty() && alpha.back() == 255)
+            alpha.pop_back();
+
+        if (!write_chunk("PLTE", rgb.data(), rgb.size()) || (!alpha.empty() && !write_chunk("tRNS", alpha.data(), alpha.size())))
+            return 79;
+    }
+
+    return 0;
+}
+
+/*
+ * Appends the filter type byte and the filtered `currentRow` to `filtered`. Indexed rows are left unfiltered, as
+ * the PNG specification recommends; truecolor rows use the filter with the smallest sum of absolute values,
+ * lodepng's default heuristic.
+ */
+void PngBandWriter::filter_row(std::vector<unsigned char> &filtered)
+{
+    const size_t length = currentRow.size();
+
+    if (!paletteEntries.empty() || !filterRows)
+    {
+        filtered.push_back(0);
+        filtered.insert(filtered.end(), currentRow.begin(), currentRow.end());
+        return;
+    }
+
+    const unsigned char *row = currentRow.data();
+    const unsigned char *up = previousRow.data();
+    std::vector<unsigned char> candidate(length);
+    std::vector<unsigned char> best;
+    size_t bestSum = std::numeric_limits<size_t>::max();
+    unsigned bestType = 0;
+
+    for (unsigned type = 0; type < 5; ++type)
+    {
+        size_t sum = 0;
+        for (size_t i = 0; i < length; ++i)
+        {
+            const int left = i >= channels ? row[i - channels] : 0;
+            const int upLeft = i >= channels ? up[i - channels] : 0;
+            int predicted = 0;
+
+            switch (type)
+            {
+            case 1:
+                predicted = left;
+                break;
+            case 2:
+                predicted = up[i];
+                break;
+            case 3:
+                predicted = (left + up[i]) >> 1;
+                break;
+            case 4:
+            {
+                const int p = left + up[i] - upLeft;
+                const int pa = std::abs(p - left), pb = std::abs(p - up[i]), pc = std::abs(p - upLeft);
+                predicted = pa <= pb && pa <= pc ? left : pb <= pc ? up[i] : upLeft;
+                break;
+            }
+            }
+
+            candidate[i] = static_cast<unsigned char>(row[i] - predicted);
+            sum += type == 0 ? candidate[i] : std::abs(static_cast<signed char>(candidate[i]));
+        }
+
+        if (sum < bestSum)
+        {
+            bestSum = sum;
+            bestType = type;
+            best.swap(candidate);
+            candidate.resize(length);
+        }
+    }
+
+    filtered.push_back(static_cast<unsigned char>(bestType));
+    filtered.insert(filtered.end(), best.begin(), best.end());
+}
+
+/*
+ * Filters and deflates the next `rows` rows and writes them as one IDAT chunk. Pixels of indexed output must be
+ * exact palette colors (fully transparent ones as 0, 0, 0, 0); anything else is lodepng error 82.
+ */
+unsigned PngBandWriter::write_rows(const unsigned char *pixels, unsigned rows)
+{
+    if (rowsWritten == 0)
+    {
+        unsigned error = write_header();
+        if (error)
+            return error;
+    }
+
+    rows = std::min(rows, height - rowsWritten);
+    if (rows == 0)
+        return 0;
+
+    std::vector<unsigned char> filtered;
+    filtered.reserve(rows * (currentRow.size() + 1));
+
+    for (unsigned row = 0; row < rows; ++row, pixels += static_cast<size_t>(width) * channels)
+    {
+        if (paletteEntries.empty())
+        {
+            std::memcpy(currentRow.data(), pixels, currentRow.size());
+        }
+        else
+        {
+            std::fill(currentRow.begin(), currentRow.end(), 0);
+            for (unsigned x = 0; x < width; ++x)
+            {
+                const unsigned char *pixel = pixels + static_cast<size_t>(x) * channels;
+                const uint32_t key = (pixel[0] << 24) | (pixel[1] << 16) | (pixel[2] << 8) | (channels == 4 ? pixel[3] : 255);
+                auto found = paletteIndex.find(key);
+                if (found == paletteIndex.end())
+                    return 82;
+
+                // Samples narrower than a byte are packed from the most significant bit.
+                const size_t bit = static_cast<size_t>(x) * bitDepth;
+                currentRow[bit / 8] |= static_cast<unsigned char>(found->second << (8 - bitDepth - bit % 8));
+            }
+        }
+
+        filter_row(filtered);
+        previousRow.swap(currentRow);
+    }
+
+    adler = adler32(filtered.data(), filtered.size(), adler);
+
+    // Each band ends in a sync flush, so the bands concatenate into one deflate stream.
+    unsigned error = 0;
+    std::vector<unsigned char> piece;
+    const unsigned numThreads = resolve_thread_count(settings.numThreads);
+
+    if (numThreads > 1 && settings.effort != EFFORT_STORE)
+    {
+        error = deflate_chunks(piece, filtered.data(), filtered.size(), zlibSettings, numThreads, true);
+    }
+    else
+    {
+        unsigned char *deflated = nullptr;
+        size_t deflatedSize = 0;
+        error = lodepng_deflate_flush(&deflated, &deflatedSize, filtered.data(), filtered.size(), &zlibSettings);
+        if (!error)
+            piece.assign(deflated, deflated + deflatedSize);
+        std::free(deflated);
+    }
+
+    if (rowsWritten == 0)
+        piece.insert(piece.begin(), {0x78, 0x01}); // zlib header, as in parallel_zlib_compress()
+
+    if (!error && !write_chunk("IDAT", piece.data(), piece.size()))
+        error = 79;
+
+    rowsWritten += rows;
+    return error;
+}
+
+unsigned PngBandWriter::finish()
+{
+    if (rowsWritten != height)
+        return 84;
+
+    // A final empty stored block ends the deflate stream, followed by the checksum of all filtered rows.
+    unsigned char end[9] = {0x01, 0x00, 0x00, 0xFF, 0xFF};
+    for (unsigned i = 0; i < 4; ++i)
+        end[5 + i] = static_cast<unsigned char>(adler >> (24 - 8 * i));
+
+    if (!write_chunk("IDAT", end, sizeof(end)) || !write_chunk("IEND", nullptr, 0))
+        return 79;
+
+    return 0;
+}
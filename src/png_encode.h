@@ -0,0 +1,63 @@
+#pragma once
+
+#include "shared.h"
+#include "lodepng.h"
+
+#include <unordered_map>
+
+typedef struct
+{
+    EncodeEffort effort;
+    unsigned numThreads; // threads for parallel deflate; 1 uses lodepng's serial compressor
+} EncodeSettings;
+
+const EncodeSettings DEFAULT_ENCODE_SETTINGS = {EFFORT_BALANCED, 1};
+const OutputPalette NO_OUTPUT_PALETTE = {{}, false};
+
+void apply_encode_effort(LodePNGEncoderSettings &settings, EncodeEffort effort);
+bool parse_encode_effort(const std::string &name, EncodeEffort &effort);
+unsigned parallel_zlib_compress(unsigned char **out, size_t *outsize, const unsigned char *in, size_t insize,
+                                const LodePNGCompressSettings *settings);
+unsigned encode_png(std::vector<unsigned char> &png, const unsigned char *image, unsigned width, unsigned height,
+                    LodePNGColorType colortype, const EncodeSettings &settings);
+unsigned encode_indexed_png(std::vector<unsigned char> &png, const unsigned char *image, unsigned width, unsigned height,
+                            LodePNGColorType colortype, const OutputPalette &palette, const EncodeSettings &settings);
+
+/*
+ * Writes a PNG incrementally from bands of packed 8-bit RGB or RGBA rows, for images that are never held in memory
+ * as a whole. Every band is filtered and deflated on its own (on several threads if requested) and the pieces are
+ * stitched into one zlib stream, written as one IDAT chunk per band. Matches cannot cross bands, so tall bands
+ * compress better. With a usable palette the output is indexed, laid out like encode_indexed_png().
+ */
+class PngBandWriter
+{
+public:
+    PngBandWriter(ByteWriter out, unsigned width, unsigned height, unsigned channels, const OutputPalette &palette,
+                  const EncodeSettings &settings);
+
+    // Returns a lodepng error code; 79 if the output could not be written.
+    unsigned write_rows(const unsigned char *pixels, unsigned rows);
+    unsigned finish();
+
+private:
+    unsigned write_header();
+    bool write_chunk(const char *type, const unsigned char *data, size_t size);
+    void filter_row(std::vector<unsigned char> &filtered);
+
+    ByteWriter out;
+    const unsigned width;
+    const unsigned height;
+    const unsigned channels;
+    const EncodeSettings settings;
+    LodePNGCompressSettings zlibSettings;
+    bool filterRows;
+
+    std::vector<unsigned char> paletteEntries; // RGBA per entry, empty for truecolor output
+    std::unordered_map<uint32_t, unsigned char> paletteIndex;
+    unsigned bitDepth = 8;
+
+    std::vector<unsigned char> previousRow;
+    std::vector<unsigned char> currentRow;
+    uint32_t adler = 1;
+    unsigned rowsWritten = 0;
+};
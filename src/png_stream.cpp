@@ -0,0 +1,321 @@
+#include "pch/cqt_pch.h"
+
+#include <cstring>
+
+#include "png_stream.h"
+#include "inflate.h"
+#include "input.h"
+
+static unsigned read_uint32_be(const unsigned char *bytes)
+{
+    return (static_cast<unsigned>(bytes[0]) << 24) | (static_cast<unsigned>(bytes[1]) << 16) |
+           (static_cast<unsigned>(bytes[2]) << 8) | static_cast<unsigned>(bytes[3]);
+}
+
+static unsigned char paeth_predictor(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return static_cast<unsigned char>(a);
+    return static_cast<unsigned char>(pb <= pc ? b : c);
+}
+
+PngBandReader::PngBandReader(ByteReader input, bool keepAlpha) : input(std::move(input)), keepAlpha(keepAlpha) {}
+
+PngBandReader::~PngBandReader() = default;
+
+bool PngBandReader::read_exact(unsigned char *buffer, size_t size)
+{
+    while (size > 0)
+    {
+        size_t count = input(buffer, size);
+        if (count == 0)
+            return false;
+        buffer += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool PngBandReader::skip(size_t size)
+{
+    unsigned char scratch[4096];
+    while (size > 0)
+    {
+        size_t count = std::min(size, sizeof(scratch));
+        if (!read_exact(scratch, count))
+            return false;
+        size -= count;
+    }
+    return true;
+}
+
+unsigned PngBandReader::open()
+{
+    // Signature and IHDR are handed to lodepng_inspect(), which validates them exactly like a full decode.
+    headerChunks.resize(33);
+    if (!read_exact(headerChunks.data(), headerChunks.size()))
+        return errorCode = 27;
+
+    errorCode = lodepng_inspect(&imageWidth, &imageHeight, &state, headerChunks.data(), headerChunks.size());
+    if (errorCode)
+        return errorCode;
+
+    // Walk the chunks up to the first IDAT, keeping only the ones that affect color conversion.
+    unsigned char chunkHeader[8];
+    bool foundIdat = false;
+
+    while (!foundIdat && read_exact(chunkHeader, 8))
+    {
+        unsigned length = read_uint32_be(chunkHeader);
+        if (length > 2147483647u)
+            return errorCode = 63;
+
+        if (std::memcmp(chunkHeader + 4, "IDAT", 4) == 0)
+        {
+            idatRemaining = length;
+            foundIdat = true;
+        }
+        else if (std::memcmp(chunkHeader + 4, "PLTE", 4) == 0 || std::memcmp(chunkHeader + 4, "tRNS", 4) == 0)
+        {
+            const size_t start = headerChunks.size();
+            headerChunks.resize(start + 12 + length);
+            std::copy(chunkHeader, chunkHeader + 8, headerChunks.begin() + start);
+            if (!read_exact(headerChunks.data() + start + 8, length + 4))
+                return errorCode = 30;
+
+            errorCode = lodepng_inspect_chunk(&state, start, headerChunks.data(), headerChunks.size());
+            if (errorCode)
+                return errorCode;
+        }
+        else if (std::memcmp(chunkHeader + 4, "IEND", 4) == 0 || !skip(length + 4))
+        {
+            break;
+        }
+    }
+
+    if (!foundIdat)
+        return errorCode = 30;
+
+    inflater.reset(new StreamInflater([this](unsigned char *buffer, size_t size)
+                                      { return read_idat(buffer, size); }));
+
+    const size_t rowBytes = (static_cast<size_t>(imageWidth) * lodepng_get_bpp(&state.info_png.color) + 7) / 8;
+    previousRow.assign(rowBytes, 0);
+    currentRow.assign(rowBytes + 1, 0);
+
+    return errorCode;
+}
+
+/*
+ * Adam7 interlaced images spread every row over seven passes, so they cannot be decoded row by row. Their IDAT
+ * payload is gathered behind the retained header chunks and decoded in full by lodepng instead.
+ */
+unsigned PngBandReader::decode_interlaced()
+{
+    std::vector<unsigned char> png = headerChunks;
+    std::vector<unsigned char> idat;
+    unsigned char buffer[65536];
+
+    for (size_t count = read_idat(buffer, sizeof(buffer)); count > 0; count = read_idat(buffer, sizeof(buffer)))
+        idat.insert(idat.end(), buffer, buffer + count);
+
+    auto appendChunk = [&png](const char *type, const std::vector<unsigned char> &data)
+    {
+        const size_t start = png.size();
+        const size_t length = data.size();
+        png.resize(start + 12 + length);
+        for (unsigned i = 0; i < 4; ++i)
+            png[start + i] = static_cast<unsigned char>(length >> (24 - 8 * i));
+        std::memcpy(png.data() + start + 4, type, 4);
+        std::copy(data.begin(), data.end(), png.begin() + start + 8);
+        lodepng_chunk_generate_crc(png.data() + start);
+    };
+
+    appendChunk("IDAT", idat);
+    appendChunk("IEND", {});
+
+    lodepng::State decodeState;
+    decodeState.info_raw.colortype = channels() == 4 ? LCT_RGBA : LCT_RGB;
+    decodeState.info_raw.bitdepth = 8;
+
+    return lodepng::decode(interlacedImage, imageWidth, imageHeight, decodeState, png);
+}
+
+/*
+ * Supplies the concatenated payload of consecutive IDAT chunks to the inflater, skipping chunk CRCs.
+ */
+size_t PngBandReader::read_idat(unsigned char *buffer, size_t size)
+{
+    while (idatRemaining == 0)
+    {
+        unsigned char chunkHeader[8];
+
+        if (idatFinished || !skip(4) || !read_exact(chunkHeader, 8) || std::memcmp(chunkHeader + 4, "IDAT", 4) != 0)
+        {
+            idatFinished = true;
+            return 0;
+        }
+        idatRemaining = read_uint32_be(chunkHeader);
+    }
+
+    size_t count = input(buffer, std::min(size, idatRemaining));
+    if (count == 0)
+        idatFinished = true;
+    idatRemaining -= count;
+    return count;
+}
+
+/*
+ * Reverses the PNG scanline filter of `currentRow` (filter type byte followed by the row) against
+ * `previousRow` and stores the result in `previousRow`.
+ */
+unsigned PngBandReader::unfilter_row()
+{
+    const size_t length = previousRow.size();
+    const size_t byteWidth = (lodepng_get_bpp(&state.info_png.color) + 7) / 8;
+    const unsigned char *in = currentRow.data() + 1;
+    unsigned char *out = previousRow.data(); // updated in place: out[i] is "up" until it is overwritten
+
+    switch (currentRow[0])
+    {
+    case 0:
+        std::copy(in, in + length, out);
+        break;
+    case 1:
+        for (size_t i = 0; i < length; ++i)
+            out[i] = static_cast<unsigned char>(in[i] + (i >= byteWidth ? out[i - byteWidth] : 0));
+        break;
+    case 2:
+        for (size_t i = 0; i < length; ++i)
+            out[i] = static_cast<unsigned char>(in[i] + out[i]);
+        break;
+    case 3:
+        for (size_t i = 0; i < length; ++i)
+        {
+            unsigned left = i >= byteWidth ? out[i - byteWidth] : 0;
+            out[i] = static_cast<unsigned char>(in[i] + ((left + out[i]) >> 1));
+        }
+        break;
+    case 4:
+    {
+        // Paeth needs the unmodified upper-left byte, which has already been overwritten in place.
+        unsigned char upperLeft[8] = {0};
+        for (size_t i = 0; i < length; ++i)
+        {
+            int left = i >= byteWidth ? out[i - byteWidth] : 0;
+            int up = out[i];
+            int upLeft = i >= byteWidth ? upperLeft[i % byteWidth] : 0;
+            upperLeft[i % byteWidth] = static_cast<unsigned char>(up);
+            out[i] = static_cast<unsigned char>(in[i] + paeth_predictor(left, up, upLeft));
+        }
+        break;
+    }
+    default:
+        return 36;
+    }
+
+    return 0;
+}
+
+unsigned PngBandReader::read_rows(std::vector<unsigned char> &pixels, unsigned maxRows)
+{
+    if (errorCode || !inflater)
+        return 0;
+
+    const unsigned rows = std::min(maxRows, imageHeight - rowsDecoded);
+    if (rows == 0)
+        return 0;
+
+    const size_t rowStride = static_cast<size_t>(imageWidth) * channels();
+    pixels.resize(rows * rowStride);
+
+    if (interlaced())
+    {
+        if (interlacedImage.empty() && (errorCode = decode_interlaced()) != 0)
+            return 0;
+
+        const unsigned char *first = interlacedImage.data() + rowsDecoded * rowStride;
+        std::copy(first, first + rows * rowStride, pixels.begin());
+        rowsDecoded += rows;
+        return rows;
+    }
+
+    // Rows are converted straight from the stored color type to the output layout, alpha included.
+    const LodePNGColorMode outputMode = lodepng_color_mode_make(channels() == 4 ? LCT_RGBA : LCT_RGB, 8);
+
+    for (unsigned row = 0; row < rows; ++row)
+    {
+        if (inflater->inflate(currentRow.data(), currentRow.size()) != currentRow.size())
+        {
+            errorCode = inflater->error() ? inflater->error() : 23;
+            return 0;
+        }
+
+        errorCode = unfilter_row();
+        if (!errorCode)
+        {
+            errorCode = lodepng_convert(pixels.data() + row * rowStride, previousRow.data(), &outputMode,
+                                        &state.info_png.color, imageWidth, 1);
+        }
+        if (errorCode)
+            return 0;
+    }
+
+    // The checksum covers the whole stream, so it is checked once the last row is in.
+    if (rowsDecoded + rows == imageHeight && (errorCode = inflater->finish()) != 0)
+        return 0;
+
+    rowsDecoded += rows;
+    return rows;
+}
+
+/*
+ * Decodes a PNG from `input` and hands it to `consumer` in bands of at most `bandRows` rows. `channels` is set to
+ * 4 if `keepAlpha` is requested and the image carries alpha, and to 3 otherwise.
+ */
+unsigned stream_png_bands(ByteReader input, unsigned bandRows, bool keepAlpha, unsigned &width, unsigned &height,
+                          unsigned &channels, const BandConsumer &consumer)
+{
+    PngBandReader reader(std::move(input), keepAlpha);
+    unsigned error = reader.open();
+
+    width = reader.width();
+    height = reader.height();
+    channels = reader.channels();
+
+    std::vector<unsigned char> band;
+    unsigned firstRow = 0;
+
+    while (error == 0)
+    {
+        unsigned rows = reader.read_rows(band, std::max(bandRows, 1u));
+        error = reader.error();
+        if (rows == 0)
+            break;
+
+        consumer(band.data(), firstRow, rows);
+        firstRow += rows;
+    }
+
+    return error;
+}
+
+unsigned stream_png_bands(ByteReader input, unsigned bandRows, unsigned &width, unsigned &height, const BandConsumer &consumer)
+{
+    unsigned channels;
+    return stream_png_bands(std::move(input), bandRows, false, width, height, channels, consumer);
+}
+
+unsigned stream_png_file_bands(const char *filename, unsigned bandRows, unsigned &width, unsigned &height, const BandConsumer &consumer)
+{
+    InputFile input;
+    unsigned error = input.open(filename);
+
+    if (error)
+        return error;
+
+    return stream_png_bands(input.reader(), bandRows, width, height, consumer);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "shared.h"
+#include "lodepng.h"
+
+#include <memory>
+
+class StreamInflater;
+
+/*
+ * Decodes a non-interlaced PNG scanline by scanline. Only the compressed bytes of the current IDAT chunk, the
+ * 32 KiB deflate window and two scanlines are held in memory, so the cost of decoding is independent of the
+ * image height. Errors use lodepng's error codes and can be printed with lodepng_error_text().
+ */
+class PngBandReader
+{
+public:
+    // With `keepAlpha`, images that carry alpha (an alpha channel or a tRNS chunk) are decoded as RGBA.
+    explicit PngBandReader(ByteReader input, bool keepAlpha = false);
+    ~PngBandReader();
+
+    // Reads the PNG header and metadata up to the first IDAT chunk. Returns a lodepng error code.
+    unsigned open();
+
+    // Decodes up to `maxRows` scanlines as 8-bit RGB or RGBA (see channels()) into `pixels`. Returns the
+    // number of rows decoded, 0 at the end of the image or after an error.
+    unsigned read_rows(std::vector<unsigned char> &pixels, unsigned maxRows);
+
+    unsigned width() const { return imageWidth; }
+    unsigned height() const { return imageHeight; }
+    unsigned channels() const { return keepAlpha && lodepng_can_have_alpha(&state.info_png.color) ? 4 : 3; }
+    bool interlaced() const { return state.info_png.interlace_method != 0; }
+    unsigned error() const { return errorCode; }
+
+private:
+    size_t read_idat(unsigned char *buffer, size_t size);
+    bool read_exact(unsigned char *buffer, size_t size);
+    bool skip(size_t size);
+    unsigned unfilter_row();
+    unsigned decode_interlaced();
+
+    ByteReader input;
+    bool keepAlpha;
+    lodepng::State state;
+    std::unique_ptr<StreamInflater> inflater;
+
+    unsigned imageWidth = 0;
+    unsigned imageHeight = 0;
+    unsigned rowsDecoded = 0;
+    size_t idatRemaining = 0;
+    bool idatFinished = false;
+    unsigned errorCode = 0;
+
+    std::vector<unsigned char> headerChunks; // signature, IHDR, PLTE and tRNS as read from the input
+    std::vector<unsigned char> previousRow;
+    std::vector<unsigned char> currentRow;
+    std::vector<unsigned char> interlacedImage;
+};
+
+/*
+ * Callback receiving `rows` consecutive rows of packed 8-bit pixels starting at image row `firstRow`. Pixels are
+ * RGB unless the decoder reported 4 channels, in which case they are RGBA.
+ */
+typedef std::function<void(const unsigned char *pixels, unsigned firstRow, unsigned rows)> BandConsumer;
+
+unsigned stream_png_bands(ByteReader input, unsigned bandRows, bool keepAlpha, unsigned &width, unsigned &height,
+                          unsigned &channels, const BandConsumer &consumer);
+unsigned stream_png_bands(ByteReader input, unsigned bandRows, unsigned &width, unsigned &height, const BandConsumer &consumer);
+unsigned stream_png_file_bands(const char *filename, unsigned bandRows, unsigned &width, unsigned &height, const BandConsumer &consumer);
@@ -0,0 +1,262 @@
+#include "pch/cqt_pch.h"
+
+#include <cstring>
+
+#include "codec.h"
+
+/*
+ * Netpbm formats: binary PPM (P6) and PAM (P7). Both store uncompressed samples after a short text header,
+ * so 8-bit RGB (and RGB_ALPHA) files need no decoding at all; when the input is mapped their rows are handed
+ * to the consumer straight from the mapping.
+ */
+class NetpbmCodec : public ImageCodec
+{
+public:
+    explicit NetpbmCodec(bool pam) : pam(pam) {}
+
+    const char *name() const override { return pam ? "PAM" : "PPM"; }
+
+    bool matches_extension(const std::string &extension) const override
+    {
+        return pam ? extension == ".pam" : (extension == ".ppm" || extension == ".pnm");
+    }
+
+    bool matches_magic(const unsigned char *bytes, size_t size) const override
+    {
+        return size >= 3 && bytes[0] == 'P' && bytes[1] == (pam ? '7' : '6') && std::isspace(bytes[2]);
+    }
+
+    unsigned decode_bands(const ImageSource &source, unsigned bandRows, bool keepAlpha, unsigned &width,
+                          unsigned &height, unsigned &channels, const BandConsumer &consumer) const override
+    {
+        SourceCursor cursor(source);
+        unsigned depth = 3, maxValue = 255;
+
+        unsigned error = pam ? read_pam_header(cursor, width, height, depth, maxValue)
+                             : read_ppm_header(cursor, width, height, maxValue);
+        if (error)
+            return error;
+
+        if (depth < 1 || depth > 4 || maxValue < 1 || maxValue > 65535)
+            return CODEC_ERROR_UNSUPPORTED;
+        if (width == 0 || height == 0)
+            return CODEC_ERROR_TOO_LARGE;
+
+        // Only one band is held at a time, so the image may be of any size as long as a band, at up to four 16-bit
+        // samples per pixel, can be addressed.
+        bandRows = std::min(std::max(bandRows, 1u), height);
+        if (static_cast<uint64_t>(width) * 8 > std::numeric_limits<size_t>::max() / bandRows)
+            return CODEC_ERROR_TOO_LARGE;
+
+        const unsigned bytesPerSample = maxValue > 255 ? 2 : 1;
+        const size_t rowBytes = static_cast<size_t>(width) * depth * bytesPerSample;
+        const bool hasAlpha = depth == 2 || depth == 4;
+        channels = keepAlpha && hasAlpha ? 4 : 3;
+        const bool passThrough = depth == channels && maxValue == 255;
+        std::vector<unsigned char> samples, pixels;
+
+        for (unsigned row = 0; row < height; row += bandRows)
+        {
+            const unsigned rows = std::min(bandRows, height - row);
+            const size_t bandBytes = rows * rowBytes;
+
+            const unsigned char *band = cursor.span(bandBytes);
+            if (!band)
+            {
+                samples.resize(bandBytes);
+                if (!cursor.read(samples.data(), bandBytes))
+                    return CODEC_ERROR_TRUNCATED;
+                band = samples.data();
+            }
+
+            if (passThrough)
+            {
+                consumer(band, row, rows);
+                continue;
+            }
+
+            // Expand gray, add or drop alpha and rescale to 8 bits.
+            const size_t numPixels = static_cast<size_t>(rows) * width;
+            const unsigned colorChannels = depth >= 3 ? 3 : 1;
+            pixels.resize(numPixels * channels);
+
+            for (size_t pixel = 0; pixel < numPixels; ++pixel)
+            {
+                for (unsigned channel = 0; channel < channels; ++channel)
+                {
+                    unsigned value = maxValue; // opaque when the file has no alpha
+                    if (channel < 3 || hasAlpha)
+                    {
+                        const unsigned inputChannel = channel == 3 ? depth - 1 : colorChannels == 3 ? channel : 0;
+                        const size_t sample = (pixel * depth + inputChannel) * bytesPerSample;
+                        value = bytesPerSample == 2 ? (band[sample] << 8) | band[sample + 1] : band[sample];
+                    }
+                    pixels[pixel * channels + channel] = static_cast<unsigned char>((std::min(value, maxValue) * 255 + maxValue / 2) / maxValue);
+                }
+            }
+
+            consumer(pixels.data(), row, rows);
+        }
+
+        return 0;
+    }
+
+    unsigned encode(std::vector<unsigned char> &out, const unsigned char *pixels, unsigned channels, unsigned width,
+                    unsigned height, const OutputPalette &palette, const EncodeSettings &settings) const override
+    {
+        out.reserve(static_cast<size_t>(width) * height * channels + 128);
+        return encode_with_band_encoder(*this, out, pixels, channels, width, height, palette, settings);
+    }
+
+    std::unique_ptr<BandEncoder> begin_encode(ByteWriter out, unsigned channels, unsigned width, unsigned height,
+                                              const OutputPalette &, const EncodeSettings &) const override
+    {
+        return std::unique_ptr<BandEncoder>(new Encoder(std::move(out), pam, channels, width, height));
+    }
+
+private:
+    class Encoder : public BandEncoder
+    {
+    public:
+        Encoder(ByteWriter out, bool pam, unsigned channels, unsigned width, unsigned height)
+            : out(std::move(out)), channels(channels), width(width), depth(pam ? channels : 3)
+        {
+            std::ostringstream text;
+
+            // PPM has no alpha channel, so RGBA input loses it; PAM stores it as RGB_ALPHA.
+            if (pam)
+                text << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH " << depth
+                     << "\nMAXVAL 255\nTUPLTYPE " << (depth == 4 ? "RGB_ALPHA" : "RGB") << "\nENDHDR\n";
+            else
+                text << "P6\n" << width << " " << height << "\n255\n";
+
+            header = text.str();
+        }
+
+        unsigned write_rows(const unsigned char *pixels, unsigned rows) override
+        {
+            if (!header.empty())
+            {
+                if (!out(reinterpret_cast<const unsigned char *>(header.data()), header.size()))
+                    return 79;
+                header.clear();
+            }
+
+            const size_t numPixels = static_cast<size_t>(rows) * width;
+            if (depth == channels)
+                return out(pixels, numPixels * depth) ? 0 : 79;
+
+            std::vector<unsigned char> rgb(numPixels * 3);
+            for (size_t pixel = 0; pixel < numPixels; ++pixel)
+                std::memcpy(&rgb[pixel * 3], pixels + pixel * channels, 3);
+
+            return out(rgb.data(), rgb.size()) ? 0 : 79;
+        }
+
+        unsigned finish() override { return 0; }
+
+    private:
+        ByteWriter out;
+        const unsigned channels;
+        const unsigned width;
+        const unsigned depth;
+        std::string header;
+    };
+
+    // Skips whitespace and comments, then reads a decimal number. Consumes the single character after it.
+    static bool read_number(SourceCursor &cursor, unsigned &value)
+    {
+        int c = cursor.get();
+        while (c == '#' || std::isspace(c))
+        {
+            if (c == '#')
+            {
+                while (c != '\n' && c != -1)
+                    c = cursor.get();
+            }
+            c = cursor.get();
+        }
+
+        if (!std::isdigit(c))
+            return false;
+
+        uint64_t number = 0;
+        while (std::isdigit(c))
+        {
+            number = number * 10 + static_cast<unsigned>(c - '0');
+            if (number > 0xFFFFFFFFull)
+                return false;
+            c = cursor.get();
+        }
+
+        value = static_cast<unsigned>(number);
+        return std::isspace(c);
+    }
+
+    static unsigned read_ppm_header(SourceCursor &cursor, unsigned &width, unsigned &height, unsigned &maxValue)
+    {
+        if (cursor.get() != 'P' || cursor.get() != '6')
+            return CODEC_ERROR_BAD_HEADER;
+
+        if (!read_number(cursor, width) || !read_number(cursor, height) || !read_number(cursor, maxValue))
+            return CODEC_ERROR_BAD_HEADER;
+
+        return 0;
+    }
+
+    static unsigned read_pam_header(SourceCursor &cursor, unsigned &width, unsigned &height, unsigned &depth,
+                                    unsigned &maxValue)
+    {
+        if (cursor.get() != 'P' || cursor.get() != '7' || cursor.get() != '\n')
+            return CODEC_ERROR_BAD_HEADER;
+
+        width = height = depth = maxValue = 0;
+
+        for (std::string line; line != "ENDHDR";)
+        {
+            line.clear();
+            for (int c = cursor.get(); c != '\n'; c = cursor.get())
+            {
+                if (c == -1 || line.size() > 256)
+                    return CODEC_ERROR_BAD_HEADER;
+                line.push_back(static_cast<char>(c));
+            }
+
+            std::istringstream fields(line);
+            std::string key;
+            fields >> key;
+
+            if (fields.fail())
+                continue; // blank line
+
+            if (key == "WIDTH")
+                fields >> width;
+            else if (key == "HEIGHT")
+                fields >> height;
+            else if (key == "DEPTH")
+                fields >> depth;
+            else if (key == "MAXVAL")
+                fields >> maxValue;
+
+            if (key != "ENDHDR" && fields.fail())
+                return CODEC_ERROR_BAD_HEADER;
+            line = key;
+        }
+
+        return 0;
+    }
+
+    const bool pam;
+};
+
+const ImageCodec &pnm_codec()
+{
+    static const NetpbmCodec codec(false);
+    return codec;
+}
+
+const ImageCodec &pam_codec()
+{
+    static const NetpbmCodec codec(true);
+    return codec;
+}
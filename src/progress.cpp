@@ -0,0 +1,131 @@
+#include "pch/cqt_pch.h"
+
+#include "progress.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <io.h>
+#endif
+
+static ProgressMode progressMode = PROGRESS_AUTO;
+
+// Throttling state of the calling thread's current stage.
+typedef struct
+{
+    ProgressHook hook = {nullptr, nullptr};
+    const char *stage = nullptr;
+    unsigned completed = 0;
+    std::chrono::steady_clock::time_point last;
+} ProgressState;
+
+static thread_local ProgressState progressState;
+
+bool parse_progress_mode(const std::string &text, ProgressMode &mode)
+{
+    static const std::pair<const char *, ProgressMode> names[] = {
+        {"auto", PROGRESS_AUTO}, {"bar", PROGRESS_BAR}, {"quiet", PROGRESS_QUIET}, {"json", PROGRESS_JSON}};
+
+    for (const auto &name : names)
+    {
+        if (text == name.first)
+        {
+            mode = name.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sets the console mode for all threads; call before any work starts.
+void set_progress_mode(ProgressMode mode)
+{
+    progressMode = mode;
+}
+
+static bool stdout_is_terminal()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    return isatty(STDOUT_FILENO);
+#elif defined(_WIN32)
+    return _isatty(_fileno(stdout));
+#else
+    return false;
+#endif
+}
+
+static void print_bar(const char *stage, unsigned completed, unsigned total, bool last)
+{
+    const double fraction = total > 0 ? std::min(static_cast<double>(completed) / total, 1.0) : 1.0;
+    const int lpad = static_cast<int>(fraction * PBWIDTH);
+
+    std::cout << '\r' << stage << ": " << std::setw(3) << completed << " / " << std::setw(3) << total << " ["
+              << std::string(PBSTR, lpad) << std::string(PBWIDTH - lpad, ' ') << ']';
+    if (last)
+        std::cout << '\n';
+    std::cout << std::flush;
+}
+
+/*
+ * Reports that `completed` of `total` steps of `stage` are done. Updates are throttled per thread: the first
+ * and last update of a stage always pass, the ones in between only every PROGRESS_INTERVAL_MS, so that callers
+ * may report every iteration of a loop without writing to the console each time. `stage` should be a string
+ * literal; a different pointer, or a smaller count, starts a new stage.
+ */
+void report_progress(const char *stage, unsigned completed, unsigned total)
+{
+    ProgressState &state = progressState;
+    const bool console = consoleOutput && progressMode != PROGRESS_QUIET;
+
+    if (!console && !state.hook.callback)
+        return;
+
+    const bool first = stage != state.stage || completed < state.completed;
+    const bool last = completed >= total;
+    const auto now = std::chrono::steady_clock::now();
+
+    state.stage = stage;
+    state.completed = completed;
+
+    if (!first && !last && now - state.last < std::chrono::milliseconds(PROGRESS_INTERVAL_MS))
+        return;
+    state.last = now;
+
+    if (state.hook.callback)
+        state.hook.callback(state.hook.user, stage, completed, total);
+    if (!console)
+        return;
+
+    static const bool terminal = stdout_is_terminal();
+
+    switch (progressMode)
+    {
+    case PROGRESS_JSON:
+    {
+        // One write per line, so that lines of concurrent runs do not interleave.
+        std::ostringstream line;
+        line << "{\"stage\":\"" << stage << "\",\"completed\":" << completed << ",\"total\":" << total << "}\n";
+        std::cerr << line.str();
+        break;
+    }
+    case PROGRESS_BAR:
+        print_bar(stage, completed, total, last);
+        break;
+    default:
+        if (terminal)
+            print_bar(stage, completed, total, last);
+        else if (last)
+            std::cout << stage << ": " << completed << " / " << total << std::endl;
+        break;
+    }
+}
+
+ProgressScope::ProgressScope(const ProgressHook &hook) : previous(progressState.hook)
+{
+    progressState.hook = hook;
+}
+
+ProgressScope::~ProgressScope()
+{
+    progressState.hook = previous;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "shared.h"
+
+// Minimum time between two progress updates of the same stage, except for its last one.
+#define PROGRESS_INTERVAL_MS 100
+
+enum ProgressMode
+{
+    PROGRESS_AUTO,  // a bar on a terminal, otherwise one line when a stage completes
+    PROGRESS_BAR,   // a bar redrawn in place on standard output
+    PROGRESS_QUIET, // nothing on the console
+    PROGRESS_JSON   // one JSON object per update on standard error
+};
+
+// Receives progress updates, at most one per PROGRESS_INTERVAL_MS and stage plus the last one of each stage.
+typedef void (*ProgressCallback)(void *user, const char *stage, unsigned completed, unsigned total);
+
+/*
+ * Where progress goes on the calling thread: the console (unless consoleOutput is off or the mode is quiet)
+ * and the callback, if any. Set for a scope with ProgressScope.
+ */
+typedef struct
+{
+    ProgressCallback callback;
+    void *user;
+} ProgressHook;
+
+bool parse_progress_mode(const std::string &text, ProgressMode &mode);
+void set_progress_mode(ProgressMode mode);
+void report_progress(const char *stage, unsigned completed, unsigned total);
+
+// Installs a progress callback on the calling thread for the lifetime of the scope.
+class ProgressScope
+{
+public:
+    explicit ProgressScope(const ProgressHook &hook);
+    ~ProgressScope();
+
+private:
+    const ProgressHook previous;
+};
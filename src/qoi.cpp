@@ -0,0 +1,265 @@
+#include "pch/cqt_pch.h"
+
+#include <cstring>
+
+#include "codec.h"
+
+// Opcodes of the "Quite OK Image" format, see https://qoiformat.org/qoi-specification.pdf
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+#define QOI_MASK_2 0xC0
+#define QOI_MAX_PIXELS 400000000ull
+#define QOI_FLUSH_BYTES 65536
+
+static inline unsigned qoi_hash(const unsigned char *rgba)
+{
+    return (rgba[0] * 3 + rgba[1] * 5 + rgba[2] * 7 + rgba[3] * 11) % 64;
+}
+
+/*
+ * QOI: a fast, lossless single-pass format. Decoding is a byte-at-a-time state machine, so it streams
+ * band by band without ever holding more than one band of pixels.
+ */
+class QoiCodec : public ImageCodec
+{
+public:
+    const char *name() const override { return "QOI"; }
+
+    bool matches_extension(const std::string &extension) const override { return extension == ".qoi"; }
+
+    bool matches_magic(const unsigned char *bytes, size_t size) const override
+    {
+        return size >= 4 && std::memcmp(bytes, "qoif", 4) == 0;
+    }
+
+    unsigned decode_bands(const ImageSource &source, unsigned bandRows, bool keepAlpha, unsigned &width,
+                          unsigned &height, unsigned &channels, const BandConsumer &consumer) const override
+    {
+        SourceCursor cursor(source);
+        unsigned char header[14];
+
+        if (!cursor.read(header, sizeof(header)) || std::memcmp(header, "qoif", 4) != 0)
+            return CODEC_ERROR_BAD_HEADER;
+
+        width = (header[4] << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+        height = (header[8] << 24) | (header[9] << 16) | (header[10] << 8) | header[11];
+
+        if (header[12] < 3 || header[12] > 4 || header[13] > 1)
+            return CODEC_ERROR_BAD_HEADER;
+        if (width == 0 || height == 0 || static_cast<uint64_t>(width) * height > QOI_MAX_PIXELS)
+            return CODEC_ERROR_TOO_LARGE;
+
+        channels = keepAlpha && header[12] == 4 ? 4 : 3;
+
+        unsigned char index[64][4] = {{0}};
+        unsigned char pixel[4] = {0, 0, 0, 255};
+        unsigned run = 0;
+
+        bandRows = std::max(bandRows, 1u);
+        std::vector<unsigned char> pixels;
+
+        for (unsigned row = 0; row < height; row += bandRows)
+        {
+            const unsigned rows = std::min(bandRows, height - row);
+            const size_t numPixels = static_cast<size_t>(rows) * width;
+            pixels.resize(numPixels * channels);
+
+            for (size_t i = 0; i < numPixels; ++i)
+            {
+                if (run > 0)
+                {
+                    run--;
+                }
+                else
+                {
+                    int op = cursor.get();
+                    if (op < 0)
+                        return CODEC_ERROR_TRUNCATED;
+
+                    if (op == QOI_OP_RGB || op == QOI_OP_RGBA)
+                    {
+                        if (!cursor.read(pixel, op == QOI_OP_RGB ? 3 : 4))
+                            return CODEC_ERROR_TRUNCATED;
+                    }
+                    else if ((op & QOI_MASK_2) == QOI_OP_INDEX)
+                    {
+                        std::memcpy(pixel, index[op], 4);
+                    }
+                    else if ((op & QOI_MASK_2) == QOI_OP_DIFF)
+                    {
+                        pixel[0] += ((op >> 4) & 0x03) - 2;
+                        pixel[1] += ((op >> 2) & 0x03) - 2;
+                        pixel[2] += (op & 0x03) - 2;
+                    }
+                    else if ((op & QOI_MASK_2) == QOI_OP_LUMA)
+                    {
+                        int next = cursor.get();
+                        if (next < 0)
+                            return CODEC_ERROR_TRUNCATED;
+                        int greenDiff = (op & 0x3F) - 32;
+                        pixel[0] += greenDiff - 8 + ((next >> 4) & 0x0F);
+                        pixel[1] += greenDiff;
+                        pixel[2] += greenDiff - 8 + (next & 0x0F);
+                    }
+                    else
+                    {
+                        run = op & 0x3F;
+                    }
+
+                    std::memcpy(index[qoi_hash(pixel)], pixel, 4);
+                }
+
+                std::memcpy(&pixels[i * channels], pixel, channels);
+            }
+
+            consumer(pixels.data(), row, rows);
+        }
+
+        return 0;
+    }
+
+    unsigned encode(std::vector<unsigned char> &out, const unsigned char *pixels, unsigned channels, unsigned width,
+                    unsigned height, const OutputPalette &palette, const EncodeSettings &settings) const override
+    {
+        if (static_cast<uint64_t>(width) * height > QOI_MAX_PIXELS)
+            return CODEC_ERROR_TOO_LARGE;
+
+        out.reserve(14 + static_cast<size_t>(width) * height * 4 + 8);
+        return encode_with_band_encoder(*this, out, pixels, channels, width, height, palette, settings);
+    }
+
+    std::unique_ptr<BandEncoder> begin_encode(ByteWriter out, unsigned channels, unsigned width, unsigned height,
+                                              const OutputPalette &, const EncodeSettings &) const override
+    {
+        return std::unique_ptr<BandEncoder>(new Encoder(std::move(out), channels, width, height));
+    }
+
+private:
+    /*
+     * The encoder state (previous pixel, color index and pending run) carries over from one band to the next;
+     * the opcodes of each band are buffered and written in one piece.
+     */
+    class Encoder : public BandEncoder
+    {
+    public:
+        Encoder(ByteWriter out, unsigned channels, unsigned width, unsigned height)
+            : out(std::move(out)), channels(channels), pixelsLeft(static_cast<uint64_t>(width) * height), width(width)
+        {
+            bytes.insert(bytes.end(), {'q', 'o', 'i', 'f'});
+            for (unsigned value : {width, height})
+            {
+                for (int shift = 24; shift >= 0; shift -= 8)
+                    bytes.push_back(static_cast<unsigned char>(value >> shift));
+            }
+            bytes.push_back(static_cast<unsigned char>(channels));
+            bytes.push_back(0); // sRGB with linear alpha
+        }
+
+        unsigned write_rows(const unsigned char *pixels, unsigned rows) override
+        {
+            if (pixelsLeft > QOI_MAX_PIXELS)
+                return CODEC_ERROR_TOO_LARGE;
+
+            const size_t numPixels = std::min<uint64_t>(static_cast<uint64_t>(rows) * width, pixelsLeft);
+
+            for (size_t i = 0; i < numPixels; ++i)
+            {
+                if (bytes.size() >= QOI_FLUSH_BYTES && flush())
+                    return 79;
+
+                std::memcpy(pixel, pixels + i * channels, channels);
+                pixelsLeft--;
+
+                if (std::memcmp(pixel, previous, 4) == 0)
+                {
+                    run++;
+                    if (run == 62 || pixelsLeft == 0)
+                    {
+                        bytes.push_back(static_cast<unsigned char>(QOI_OP_RUN | (run - 1)));
+                        run = 0;
+                    }
+                    continue;
+                }
+
+                if (run > 0)
+                {
+                    bytes.push_back(static_cast<unsigned char>(QOI_OP_RUN | (run - 1)));
+                    run = 0;
+                }
+
+                unsigned hash = qoi_hash(pixel);
+                if (std::memcmp(index[hash], pixel, 4) == 0)
+                {
+                    bytes.push_back(static_cast<unsigned char>(QOI_OP_INDEX | hash));
+                }
+                else
+                {
+                    std::memcpy(index[hash], pixel, 4);
+
+                    const bool sameAlpha = pixel[3] == previous[3];
+                    const int dr = static_cast<signed char>(pixel[0] - previous[0]);
+                    const int dg = static_cast<signed char>(pixel[1] - previous[1]);
+                    const int db = static_cast<signed char>(pixel[2] - previous[2]);
+                    const int drg = dr - dg, dbg = db - dg;
+
+                    if (!sameAlpha)
+                    {
+                        bytes.insert(bytes.end(), {QOI_OP_RGBA, pixel[0], pixel[1], pixel[2], pixel[3]});
+                    }
+                    else if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                    {
+                        bytes.push_back(static_cast<unsigned char>(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+                    }
+                    else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+                    {
+                        bytes.push_back(static_cast<unsigned char>(QOI_OP_LUMA | (dg + 32)));
+                        bytes.push_back(static_cast<unsigned char>(((drg + 8) << 4) | (dbg + 8)));
+                    }
+                    else
+                    {
+                        bytes.insert(bytes.end(), {QOI_OP_RGB, pixel[0], pixel[1], pixel[2]});
+                    }
+                }
+
+                std::memcpy(previous, pixel, 4);
+            }
+
+            return flush();
+        }
+
+        unsigned finish() override
+        {
+            bytes.insert(bytes.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+            return flush();
+        }
+
+    private:
+        unsigned flush()
+        {
+            bool written = out(bytes.data(), bytes.size());
+            bytes.clear();
+            return written ? 0 : 79;
+        }
+
+        ByteWriter out;
+        const unsigned channels;
+        uint64_t pixelsLeft;
+        const unsigned width;
+        std::vector<unsigned char> bytes;
+
+        unsigned char index[64][4] = {{0}};
+        unsigned char previous[4] = {0, 0, 0, 255};
+        unsigned char pixel[4] = {0, 0, 0, 255};
+        unsigned run = 0;
+    };
+};
+
+const ImageCodec &qoi_codec()
+{
+    static const QoiCodec codec;
+    return codec;
+}
@@ -4,7 +4,11 @@
 #include "dither.h"
 #include "quantization.h"
 #include "palette.h"
+#include "histogram.h"
 #include "log.h"
+#include "progress.h"
+#include "timings.h"
+#include "engine.h"
 
 // #define NDEBUG
 
@@ -24,6 +28,41 @@ CovMatrix calculate_covariance_matrix(const Eigen::MatrixXd &data)
     return covariance;
 }
 
+/*
+ * Weighted variant of calculate_covariance_matrix() for subsets whose rows are distinct colors, each row
+ * standing in for `weights(i)` pixels of that color.
+ */
+CovMatrix calculate_weighted_covariance_matrix(const Eigen::MatrixXd &data, const Eigen::VectorXd &weights)
+{
+    const double totalWeight = weights.sum();
+    Eigen::RowVectorXd mean = (weights.transpose() * data) / totalWeight;
+    Eigen::MatrixXd mat = data.rowwise() - mean;
+
+    return (mat.transpose() * weights.asDiagonal() * mat) / std::max(totalWeight - 1.0, 1.0);
+}
+
+/*
+ * Component-wise mean of the pixels in a subset, taking per-row weights into account when present.
+ */
+Pixel calculate_subset_mean(const PixelSubset &subset)
+{
+    if (subset.weights.size() == 0)
+        return subset.data.colwise().mean();
+
+    return (subset.weights.transpose() * subset.data) / subset.weights.sum();
+}
+
+/*
+ * Sum of the squared distances of a subset's pixels from its mean over all three channels, with per-row weights
+ * when present. Summed over all subsets and divided by three times the pixel count, this is the mean squared
+ * error per channel (see mean_squared_error()) of replacing every pixel by the mean of its subset.
+ */
+double subset_squared_error(const PixelSubset &subset)
+{
+    const Eigen::VectorXd distances = (subset.data.rowwise() - calculate_subset_mean(subset)).rowwise().squaredNorm();
+    return subset.weights.size() > 0 ? subset.weights.dot(distances) : distances.sum();
+}
+
 /*
  * Calculates the first (largest) eigenvalue and corresponding eigenvalue from a given covariance matrix.
  */
@@ -51,7 +90,7 @@ void get_largest_eigenv(const CovMatrix &covariance, double &largestEigenvalue,
 Eigen::VectorXd calculate_pca_scores(const PixelSubset &targetSubset)
 {
     Eigen::VectorXd vec = Eigen::VectorXd::Constant(targetSubset.data.rows(), 1.0);
-    return (targetSubset.data - (vec * targetSubset.data.colwise().mean())) * targetSubset.largestEigenvector;
+    return (targetSubset.data - (vec * calculate_subset_mean(targetSubset))) * targetSubset.largestEigenvector;
 }
 
 /*
@@ -115,14 +154,58 @@ int find_cutting_point_index(const Eigen::VectorXd &sortedPcaScores)
     return 0;
 }
 
-// TODO: cleanup
-void sort_data_by_pca_score(MatrixRgb &pixels, Eigen::VectorXd pcaScores, MatrixRgb &sortedPixels, Eigen::VectorXd &sortedPcaScores)
+/*
+ * Weighted counterpart of find_cutting_point_index() for subsets of distinct colors. With prefix sums of the
+ * weights and weighted scores, G(d) is evaluated at every candidate point in constant time, so the exact
+ * maximum is found in a single linear scan. Returns the number of leading rows that form the lower subset,
+ * which is always between 1 and n - 1.
+ */
+int find_weighted_cutting_point(const Eigen::VectorXd &sortedPcaScores, const Eigen::VectorXd &sortedWeights)
+{
+    const Eigen::Index n = sortedPcaScores.size();
+    const double totalWeight = sortedWeights.sum();
+    const double totalScore = sortedWeights.dot(sortedPcaScores);
+
+    double w1 = 0, s1 = 0;
+    double bestSeparability = -1;
+    int bestCount = 1;
+
+    for (Eigen::Index i = 0; i + 1 < n; ++i)
+    {
+        w1 += sortedWeights(i);
+        s1 += sortedWeights(i) * sortedPcaScores(i);
+
+        const double w2 = totalWeight - w1;
+        const double difference = s1 / w1 - (totalScore - s1) / w2;
+        const double separability = w1 * w2 * difference * difference;
+
+        if (separability > bestSeparability)
+        {
+            bestSeparability = separability;
+            bestCount = static_cast<int>(i + 1);
+        }
+    }
+
+    return bestCount;
+}
+
+/*
+ * Returns the row order that sorts the PCA scores ascending.
+ */
+std::vector<int> sort_indices_by_pca_score(const Eigen::VectorXd &pcaScores)
 {
-    // Sort the pixel indices by PCA score and use to slice into new matrix.
     std::vector<int> indices(pcaScores.size());
     std::iota(indices.begin(), indices.end(), 0);
     std::sort(indices.begin(), indices.end(), [&pcaScores](int i, int j)
-              { return pcaScores(i) < pcaScores(j); }); // doesn't work on MatrixXd, so we sort the indices instead
+              { return pcaScores(i) < pcaScores(j); });
+    return indices;
+}
+
+// TODO: cleanup
+void sort_data_by_pca_score(MatrixRgb &pixels, Eigen::VectorXd pcaScores, MatrixRgb &sortedPixels, Eigen::VectorXd &sortedPcaScores)
+{
+    // Sort the pixel indices by PCA score and use to slice into new matrix.
+    std::vector<int> indices = sort_indices_by_pca_score(pcaScores); // sorting doesn't work on MatrixXd directly
     sortedPixels = pixels(indices, Eigen::all);
 
     // Sorting PCA scores in ascending order.
@@ -152,11 +235,14 @@ int determine_optimal_subset(std::vector<PixelSubset> &subsets)
 
     for (unsigned x = 0; x < subsets.size(); ++x)
     {
-        subsets[x].covariance = calculate_covariance_matrix(subsets[x].data);
+        const bool weighted = subsets[x].weights.size() > 0;
+
+        subsets[x].covariance = weighted ? calculate_weighted_covariance_matrix(subsets[x].data, subsets[x].weights)
+                                         : calculate_covariance_matrix(subsets[x].data);
 
         get_largest_eigenv(subsets[x].covariance, subsets[x].largestEigenvalue, subsets[x].largestEigenvector);
 
-        value = subsets[x].largestEigenvalue * subsets[x].data.rows();
+        value = subsets[x].largestEigenvalue * (weighted ? subsets[x].weights.sum() : subsets[x].data.rows());
 
         if (value > largestValue)
         {
@@ -168,83 +254,330 @@ int determine_optimal_subset(std::vector<PixelSubset> &subsets)
     return largestSubsetIndex;
 }
 
+// PCA score halfway between the last row of the lower half and the first row of the upper half.
+static double cutting_threshold(const Eigen::VectorXd &sortedPcaScores, int cuttingPointIndex)
+{
+    if (cuttingPointIndex <= 0)
+        return sortedPcaScores(0);
+    if (cuttingPointIndex >= sortedPcaScores.size())
+        return sortedPcaScores(sortedPcaScores.size() - 1);
+    return (sortedPcaScores(cuttingPointIndex - 1) + sortedPcaScores(cuttingPointIndex)) / 2;
+}
+
 /*
  * Utilizes Linear Discriminant Analysis (LDA) to select an optimal subset of pixels out of the data and partition
- * it on the basis of the of the PCA scores that maximize the separability.
+ * it on the basis of the of the PCA scores that maximize the separability. Returns false when the selected
+ * subset holds fewer than two rows and cannot be split. With `record`, the split is described there (see
+ * SplitRecord) before the subset is replaced by its two halves.
  * TODO: cleanup
  */
-void partition(std::vector<PixelSubset> &subsets)
+bool partition(std::vector<PixelSubset> &subsets, SplitRecord *record)
 {
     // idea: store indices of subsets and use those speed up palette mapping
     int subsetIndex = determine_optimal_subset(subsets);
 
+    if (subsets[subsetIndex].data.rows() < 2)
+        return false;
+
     Eigen::VectorXd pcaScores = calculate_pca_scores(subsets[subsetIndex]);
 
-    MatrixRgb sortedPixels;
-    Eigen::VectorXd sortedPcaScores(pcaScores.size());
+    PixelSubset pixelSubsetA, pixelSubsetB;
 
-    sort_data_by_pca_score(subsets[subsetIndex].data, pcaScores, sortedPixels, sortedPcaScores);
+    if (subsets[subsetIndex].weights.size() == 0)
+    {
+        MatrixRgb sortedPixels;
+        Eigen::VectorXd sortedPcaScores(pcaScores.size());
 
-    int cuttingPointIndex = find_cutting_point_index(pcaScores);
+        sort_data_by_pca_score(subsets[subsetIndex].data, pcaScores, sortedPixels, sortedPcaScores);
 
-    PixelSubset pixelSubsetA, pixelSubsetB;
-    pixelSubsetA.data = sortedPixels.topRows(cuttingPointIndex);
-    pixelSubsetB.data = sortedPixels.bottomRows(sortedPixels.rows() - cuttingPointIndex);
+        int cuttingPointIndex = find_cutting_point_index(sortedPcaScores);
+        if (record)
+            record->threshold = cutting_threshold(sortedPcaScores, cuttingPointIndex);
+
+        pixelSubsetA.data = sortedPixels.topRows(cuttingPointIndex);
+        pixelSubsetB.data = sortedPixels.bottomRows(sortedPixels.rows() - cuttingPointIndex);
+    }
+    else
+    {
+        const PixelSubset &target = subsets[subsetIndex];
+        std::vector<int> order = sort_indices_by_pca_score(pcaScores);
+
+        int lowerCount = find_weighted_cutting_point(pcaScores(order), target.weights(order));
+        if (record)
+            record->threshold = cutting_threshold(pcaScores(order), lowerCount);
+
+        std::vector<int> lower(order.begin(), order.begin() + lowerCount);
+        std::vector<int> upper(order.begin() + lowerCount, order.end());
+
+        pixelSubsetA.data = target.data(lower, Eigen::all);
+        pixelSubsetA.weights = target.weights(lower);
+        pixelSubsetB.data = target.data(upper, Eigen::all);
+        pixelSubsetB.weights = target.weights(upper);
+    }
+
+    if (record)
+    {
+        record->subsetIndex = subsetIndex;
+        record->eigenvalue = subsets[subsetIndex].largestEigenvalue;
+        record->axis = subsets[subsetIndex].largestEigenvector;
+    }
 
     subsets.erase(subsets.begin() + subsetIndex);
 
     subsets.emplace_back(pixelSubsetA);
     subsets.emplace_back(pixelSubsetB);
+
+    return true;
 }
 
 /*
-    Color quantization method based on principal component analysis and linear discriminant analysis
-    for palette-based image generation.
-*/
-void quantize(MatrixRgb &originalImage, const Options &options)
+ * Partitions the initial subset until `targetNumColors` subsets exist, or until no subset can be split any
+ * further, and returns the reduced palette.
+ */
+std::vector<Pixel> build_palette(const PixelSubset &initialSubset, unsigned targetNumColors)
 {
-    std::vector<PixelSubset> subsets;
+    return build_palettes(initialSubset, {targetNumColors}).front();
+}
 
-    LogInfo(options, (FILENAME | DIMENSIONS | TARGET_NCOLORS | TARGET_PALETTE));
+// Appends the node for a new subset to `tree` and returns its index.
+static uint32_t add_split_node(SplitTree &tree, const PixelSubset &subset)
+{
+    SplitNode node{};
+    const Pixel mean = calculate_subset_mean(subset);
+    for (unsigned c = 0; c < 3; ++c)
+        node.mean[c] = mean(c);
+    node.weight = subset.weights.size() > 0 ? subset.weights.sum() : static_cast<double>(subset.data.rows());
+    node.children[0] = node.children[1] = SPLIT_TREE_LEAF;
+    node.splitOrder = SPLIT_TREE_LEAF;
+
+    tree.nodes.push_back(node);
+    return static_cast<uint32_t>(tree.nodes.size() - 1);
+}
 
-#ifdef LOG_TIME
-    std::chrono::_V2::system_clock::time_point start, stop;
-    start = std::chrono::high_resolution_clock::now();
-#endif
+/*
+ * Builds the palettes for several color counts in one partitioning run. Splitting is greedy and never revisits
+ * a split, so the subsets for K colors are exactly those after the first K - 1 splits towards any larger count:
+ * the leaves are snapshotted as each requested count is reached, and every palette equals what build_palette()
+ * returns for its count alone. Palettes are returned in the order of `colorCounts`.
+ *
+ * With `tree`, every split is also recorded there, so that the palette of any smaller count can be derived
+ * later without the pixels (see split_tree_palette()).
+ *
+ * With a `targetMse` above 0, splitting also stops as soon as the mean squared error per channel of the subsets
+ * against their means is at most `targetMse`; the requested counts are then only upper bounds. The error is kept
+ * as a running sum over the subsets, so each split only adds the errors of its two halves.
+ */
+std::vector<std::vector<Pixel>> build_palettes(const PixelSubset &initialSubset, const std::vector<unsigned> &colorCounts,
+                                               SplitTree *tree, double targetMse)
+{
+    std::vector<unsigned> targets = colorCounts;
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    const unsigned targetNumColors = targets.back();
 
-    // Initialize the vector for holding matrix subsets with the original matrix as the first element.
-    PixelSubset initialSubset;
-    initialSubset.data = originalImage;
+    std::map<unsigned, std::vector<Pixel>> snapshots;
+    std::vector<PixelSubset> subsets;
     subsets.emplace_back(initialSubset);
 
+    std::vector<uint32_t> nodes; // tree node of every subset
+    if (tree)
+    {
+        *tree = SplitTree{};
+        nodes.push_back(add_split_node(*tree, initialSubset));
+    }
+
+    // Squared error of every subset against its mean, and their sum over all channels of all pixels.
+    const bool errorTarget = targetMse > 0;
+    std::vector<double> errors;
+    double totalError = 0, numValues = 0;
+    if (errorTarget)
+    {
+        errors.push_back(subset_squared_error(initialSubset));
+        totalError = errors.front();
+        numValues = 3.0 * (initialSubset.weights.size() > 0 ? initialSubset.weights.sum() : initialSubset.data.rows());
+    }
+
     unsigned safeguard = 0;
+    size_t nextTarget = 0;
+    bool exhausted = false;
 
-    while (subsets.size() < options.targetNumColors)
+    while (true)
     {
+        for (; nextTarget < targets.size() && targets[nextTarget] <= subsets.size(); ++nextTarget)
+            snapshots[targets[nextTarget]] = get_reduced_palette(subsets);
+
+        if (subsets.size() >= targetNumColors)
+            break;
+
+        if (errorTarget && totalError <= targetMse * numValues)
+            break;
+
         // Loop should only execute N times for N colors.
-        if (safeguard > options.targetNumColors)
+        if (safeguard > targetNumColors)
             break;
 
-        partition(subsets);
+        SplitRecord record;
+        {
+            StageTimer timer(STAGE_PARTITION);
+            if (!partition(subsets, tree || errorTarget ? &record : nullptr))
+            {
+                exhausted = true;
+                break;
+            }
+
+            if (errorTarget)
+            {
+                totalError -= errors[record.subsetIndex];
+                errors.erase(errors.begin() + record.subsetIndex);
+                for (size_t child = subsets.size() - 2; child < subsets.size(); ++child)
+                {
+                    errors.push_back(subset_squared_error(subsets[child]));
+                    totalError += errors.back();
+                }
+            }
+        }
 
-        printProgress("Partitioning", subsets.size(), options.targetNumColors);
+        if (tree)
+        {
+            const uint32_t parent = nodes[record.subsetIndex];
+            tree->nodes[parent].eigenvalue = record.eigenvalue;
+            for (unsigned c = 0; c < 3; ++c)
+                tree->nodes[parent].axis[c] = record.axis(c);
+            tree->nodes[parent].threshold = record.threshold;
+            tree->nodes[parent].splitOrder = tree->splits++;
+
+            nodes.erase(nodes.begin() + record.subsetIndex);
+            for (unsigned child = 0; child < 2; ++child)
+            {
+                const uint32_t node = add_split_node(*tree, subsets[subsets.size() - 2 + child]);
+                tree->nodes[parent].children[child] = node;
+                nodes.push_back(node);
+            }
+        }
+
+        report_progress("Partitioning", subsets.size(), targetNumColors);
 
         safeguard++;
     }
 
-    // Get the reduced color palette from the partitioned subsets.
-    std::vector<Pixel> palette = get_reduced_palette(subsets);
+    if (errorTarget && consoleOutput)
+    {
+        const double mse = totalError / numValues;
+        std::cout << "Error target MSE " << std::fixed << std::setprecision(2) << targetMse
+                  << (mse <= targetMse ? " reached" : " not reached") << " with " << subsets.size() << " colors (MSE " << mse
+                  << ", PSNR " << mse_to_psnr(mse) << " dB)" << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+
+    // Subsets that cannot be split any further, or that meet the error target, end the stage early; larger counts
+    // get every subset there is.
+    if (subsets.size() < targetNumColors)
+    {
+        if (tree)
+            tree->complete = exhausted;
+        report_progress("Partitioning", subsets.size(), subsets.size());
+        const std::vector<Pixel> palette = get_reduced_palette(subsets);
+        for (; nextTarget < targets.size(); ++nextTarget)
+            snapshots[targets[nextTarget]] = palette;
+    }
+
+    std::vector<std::vector<Pixel>> palettes;
+    for (unsigned colors : colorCounts)
+        palettes.push_back(snapshots[colors]);
+    return palettes;
+}
+
+/*
+    Color quantization method based on principal component analysis and linear discriminant analysis
+    for palette-based image generation.
+*/
+std::vector<Pixel> quantize(MatrixRgb &originalImage, const Options &options)
+{
+    LogInfo(options, (FILENAME | DIMENSIONS | TARGET_NCOLORS | TARGET_PALETTE));
 
-    map_to_palette(originalImage, palette);
+    // The original matrix is the single subset that partitioning starts from.
+    PixelSubset initialSubset;
+    initialSubset.data = originalImage;
 
-// OPTIONAL LOGGING
-#ifndef LOG_TIME
-    std::cout << "Finished." << std::endl;
-#endif
-#ifdef LOG_TIME
-    stop = chrono::high_resolution_clock::now();
-    // Print execution time in seconds
-    auto duration = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-    std::cout << "Finished color quantization to " << options.targetNumColors << " colors finished in " << duration.count() << " seconds." << std::endl;
-#endif
-}
\ No newline at end of file
+    std::vector<Pixel> palette = build_palette(initialSubset, options.targetNumColors);
+
+    if (!options.dither)
+    {
+        map_to_palette(originalImage, palette);
+    }
+    else if (options.tileSize > 0)
+    {
+        TiledDitherSettings settings{options.tileSize, DITHER_APRON, options.numThreads};
+        tiled_floyd_steinberg_dither(originalImage, palette, options.width, settings);
+    }
+    else
+    {
+        floyd_steinberg_dither(originalImage, palette, options.width);
+    }
+
+    if (consoleOutput)
+        std::cout << "Finished." << std::endl;
+
+    return palette;
+}
+
+/*
+ * Builds the palette for an image from its color histogram with the selected engine (see palette_engine()).
+ * Returns an empty palette for a fully transparent image, which has no colors to build one from. With
+ * `splitTreePath`, the palette comes from that split tree sidecar when it matches, and is built and recorded there
+ * otherwise (see build_palette_with_split_tree()). With a `targetMse` above 0, the palette has only as many of
+ * `options.targetNumColors` colors as that error needs. Split trees and error targets always use the pca engine.
+ */
+std::vector<Pixel> build_histogram_palette(const ColorHistogram &histogram, const Options &options, const std::string &splitTreePath,
+                                           double targetMse)
+{
+    LogInfo(options, (FILENAME | DIMENSIONS | TARGET_NCOLORS | TARGET_PALETTE));
+
+    if (histogram.transparentPixels > 0 && consoleOutput)
+        std::cout << "Transparent pixels: " << histogram.transparentPixels << std::endl;
+
+    if (histogram.counts.empty())
+        return {};
+
+    if (targetMse > 0)
+        return build_palettes(histogram_to_subset(histogram), {options.targetNumColors}, nullptr, targetMse).front();
+
+    if (!splitTreePath.empty())
+        return build_palette_with_split_tree(histogram_to_subset(histogram), options.targetNumColors, splitTreePath);
+
+    return palette_engine().build_palette(histogram_to_subset(histogram), options.targetNumColors);
+}
+
+/*
+ * Quantizes a packed 8-bit RGB or RGBA image in place. The palette is built from the image's color histogram,
+ * which holds one weighted row per distinct color instead of one row per pixel, and the pixels themselves are
+ * only touched again when they are mapped (or dithered) to the palette. Alpha is carried through unchanged;
+ * fully transparent pixels are left out of the palette and end up as (0, 0, 0, 0).
+ */
+std::vector<Pixel> quantize_pixels(std::vector<unsigned char> &image, unsigned channels, const ColorHistogram &histogram,
+                                   const Options &options, const std::string &splitTreePath, double targetMse)
+{
+    std::vector<Pixel> palette = build_histogram_palette(histogram, options, splitTreePath, targetMse);
+    apply_palette(image, channels, palette, options);
+    return palette;
+}
+
+/*
+ * Maps a packed 8-bit RGB or RGBA image in place to `palette`, or dithers it when `options` ask for that, as the
+ * last step of quantize_pixels() or after a palette built elsewhere.
+ */
+void apply_palette(std::vector<unsigned char> &image, unsigned channels, const std::vector<Pixel> &palette, const Options &options)
+{
+    if (!options.dither || palette.empty())
+    {
+        map_pixels_to_palette(image.data(), image.size() / channels, channels, palette);
+    }
+    else
+    {
+        unsigned bandRows;
+        TiledDitherSettings settings = dither_settings_for(options, bandRows);
+        tiled_floyd_steinberg_dither_pixels(image, channels, palette, options.width, bandRows, settings);
+    }
+
+    if (consoleOutput)
+        std::cout << "Finished." << std::endl;
+}
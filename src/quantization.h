@@ -1,14 +1,42 @@
 #pragma once
 
 #include "shared.h"
+#include "histogram.h"
+#include "split_tree.h"
 
 using namespace Eigen;
 
 void get_largest_eigenv(const CovMatrix &covariance, double &largestEigenvalue, VectorXd &largestEigenvector);
 CovMatrix calculate_covariance_matrix(const MatrixXd &data);
+CovMatrix calculate_weighted_covariance_matrix(const MatrixXd &data, const VectorXd &weights);
+Pixel calculate_subset_mean(const PixelSubset &subset);
+double subset_squared_error(const PixelSubset &subset);
 Eigen::VectorXd calculate_pca_scores(const PixelSubset &targetSubset);
 int find_cutting_point_index(const VectorXd &sortedPcaScores);
+int find_weighted_cutting_point(const VectorXd &sortedPcaScores, const VectorXd &sortedWeights);
+std::vector<int> sort_indices_by_pca_score(const VectorXd &pcaScores);
 void sort_data_by_pca_score(MatrixRgb &pixels, VectorXd pcaScores, MatrixRgb &sortedPixels, VectorXd &sortedPcaScores);
-void partition(std::vector<PixelSubset> &subsets);
+/*
+ * How partition() split a subset: which one, and along which line. Colors whose PCA score, (color - mean) . axis
+ * with the subset's mean, lies below `threshold` went to the first of the two new subsets, those above it to the
+ * second.
+ */
+typedef struct
+{
+    int subsetIndex;
+    double eigenvalue;
+    Eigen::VectorXd axis;
+    double threshold;
+} SplitRecord;
+
+bool partition(std::vector<PixelSubset> &subsets, SplitRecord *record = nullptr);
 int determine_optimal_subset(std::vector<PixelSubset> &subsets);
-void quantize(MatrixRgb &originalImage, const Options &options);
\ No newline at end of file
+std::vector<Pixel> build_palette(const PixelSubset &initialSubset, unsigned targetNumColors);
+std::vector<std::vector<Pixel>> build_palettes(const PixelSubset &initialSubset, const std::vector<unsigned> &colorCounts,
+                                               SplitTree *tree = nullptr, double targetMse = 0);
+std::vector<Pixel> quantize(MatrixRgb &originalImage, const Options &options);
+std::vector<Pixel> build_histogram_palette(const ColorHistogram &histogram, const Options &options,
+                                           const std::string &splitTreePath = "", double targetMse = 0);
+std::vector<Pixel> quantize_pixels(std::vector<unsigned char> &image, unsigned channels, const ColorHistogram &histogram,
+                                   const Options &options, const std::string &splitTreePath = "", double targetMse = 0);
+void apply_palette(std::vector<unsigned char> &image, unsigned channels, const std::vector<Pixel> &palette, const Options &options);
\ No newline at end of file
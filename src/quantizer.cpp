@@ -0,0 +1,212 @@
+#include "pch/cqt_pch.h"
+
+#include "quantizer.h"
+#include "quantization.h"
+#include "log.h"
+#include "timings.h"
+
+// Byte offsets of red and blue within a pixel, its size, and whether it carries alpha.
+typedef struct
+{
+    unsigned red;
+    unsigned blue;
+    unsigned channels;
+    bool alpha;
+} PixelLayout;
+
+static PixelLayout layout_of(PixelFormat format)
+{
+    switch (format)
+    {
+    case PIXEL_FORMAT_RGBA8:
+        return PixelLayout{0, 2, 4, true};
+    case PIXEL_FORMAT_BGR8:
+        return PixelLayout{2, 0, 3, false};
+    case PIXEL_FORMAT_BGRA8:
+        return PixelLayout{2, 0, 4, true};
+    default:
+        return PixelLayout{0, 2, 3, false};
+    }
+}
+
+static bool is_valid(const PixelBuffer &image)
+{
+    const size_t rowBytes = static_cast<size_t>(image.width) * layout_of(image.format).channels;
+    return image.pixels && image.width > 0 && image.height > 0 && image.format <= PIXEL_FORMAT_BGRA8 &&
+           (image.stride == 0 || image.stride >= rowBytes);
+}
+
+static const unsigned char *row_of(const PixelBuffer &image, unsigned y)
+{
+    const size_t stride = image.stride ? image.stride : static_cast<size_t>(image.width) * layout_of(image.format).channels;
+    return image.pixels + y * stride;
+}
+
+// Whether any pixel of `image` has alpha 0, including those a spatial sample skips.
+static bool has_transparent_pixels(const PixelBuffer &image)
+{
+    const PixelLayout layout = layout_of(image.format);
+    if (!layout.alpha)
+        return false;
+
+    for (unsigned y = 0; y < image.height; ++y)
+    {
+        const unsigned char *pixel = row_of(image, y);
+        for (unsigned x = 0; x < image.width; ++x, pixel += layout.channels)
+        {
+            if (pixel[3] == 0)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+Quantizer::Quantizer(const QuantizerSettings &settings) : config(settings) {}
+
+unsigned Quantizer::quantize(const PixelBuffer &image)
+{
+    if (!is_valid(image))
+        return QUANTIZER_ERROR_INVALID_BUFFER;
+
+    QuietScope quiet;
+    ProgressScope progress(progressHook);
+    const PixelLayout layout = layout_of(image.format);
+    const SpatialSampler sampler = make_spatial_sampler(image.width, image.height, config.sampleBudget);
+
+    histogram.counts.clear();
+    histogram.totalPixels = histogram.transparentPixels = histogram.translucentPixels = 0;
+
+    // RGB and RGBA rows are read where they are; BGR rows are swizzled one at a time.
+    for (unsigned y = 0; y < image.height; ++y)
+    {
+        const unsigned char *pixels = row_of(image, y);
+
+        if (layout.red != 0)
+        {
+            row.assign(pixels, pixels + static_cast<size_t>(image.width) * layout.channels);
+            for (size_t i = 0; i < row.size(); i += layout.channels)
+                std::swap(row[i], row[i + 2]);
+            pixels = row.data();
+        }
+
+        add_sampled_to_histogram(histogram, sampler, pixels, y, 1, layout.channels);
+    }
+
+    // A sample may miss every transparent pixel; they still need their entry when mapping.
+    transparent = histogram.transparentPixels > 0 || (sampler.step > 1 && has_transparent_pixels(image));
+    const unsigned maxColors = transparent ? 255 : 256;
+    const unsigned numColors = std::max(std::min(config.numColors, maxColors), 1u);
+
+    paletteColors.clear();
+    if (!histogram.counts.empty())
+        paletteColors = paletteEngine->build_palette(histogram_to_subset(histogram), numColors);
+
+    paletteRgba.clear();
+    if (transparent)
+        paletteRgba.insert(paletteRgba.end(), {0, 0, 0, 0});
+    for (const Pixel &color : paletteColors)
+    {
+        paletteRgba.insert(paletteRgba.end(), {static_cast<unsigned char>(color(0)), static_cast<unsigned char>(color(1)),
+                                               static_cast<unsigned char>(color(2)), 255});
+    }
+
+    return config.dither && !paletteColors.empty() ? dither(image) : map(image);
+}
+
+unsigned Quantizer::remap(const PixelBuffer &image)
+{
+    if (!is_valid(image))
+        return QUANTIZER_ERROR_INVALID_BUFFER;
+    if (!transparent && has_transparent_pixels(image))
+        return QUANTIZER_ERROR_NO_TRANSPARENT_ENTRY;
+
+    QuietScope quiet;
+    return config.dither && !paletteColors.empty() ? dither(image) : map(image);
+}
+
+/*
+ * Nearest palette entry for every pixel. The lookup table remembers the index of every color seen so far.
+ */
+unsigned Quantizer::map(const PixelBuffer &image)
+{
+    StageTimer timer(STAGE_MAP);
+    const PixelLayout layout = layout_of(image.format);
+    const unsigned first = transparent ? 1 : 0;
+    Pixel color(3);
+
+    cache.clear();
+    indexBuffer.resize(static_cast<size_t>(image.width) * image.height);
+    unsigned char *out = indexBuffer.data();
+
+    for (unsigned y = 0; y < image.height; ++y)
+    {
+        const unsigned char *pixel = row_of(image, y);
+
+        for (unsigned x = 0; x < image.width; ++x, pixel += layout.channels)
+        {
+            if ((layout.alpha && pixel[3] == 0) || paletteColors.empty())
+            {
+                *out++ = 0;
+                continue;
+            }
+
+            const uint32_t key = (pixel[layout.red] << 16) | (pixel[1] << 8) | pixel[layout.blue];
+            auto cached = cache.find(key);
+
+            if (cached == cache.end())
+            {
+                color << pixel[layout.red], pixel[1], pixel[layout.blue];
+                cached = cache.emplace(key, find_closest_palette_index(color, paletteColors)).first;
+            }
+
+            *out++ = static_cast<unsigned char>(first + cached->second);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Serial Floyd-Steinberg dithering band by band, as the command line tool does without a tile size. Only one
+ * band is held in floating point.
+ */
+unsigned Quantizer::dither(const PixelBuffer &image)
+{
+    StageTimer timer(STAGE_DITHER);
+    const PixelLayout layout = layout_of(image.format);
+    const unsigned first = transparent ? 1 : 0;
+    const TiledDitherSettings settings{0, DITHER_APRON, 1};
+
+    ditherState.carriedError.resize(0, 3);
+    indexBuffer.resize(static_cast<size_t>(image.width) * image.height);
+
+    for (unsigned y0 = 0; y0 < image.height; y0 += STREAM_BAND_ROWS)
+    {
+        const unsigned rows = std::min<unsigned>(STREAM_BAND_ROWS, image.height - y0);
+        band.resize(static_cast<Eigen::Index>(rows) * image.width, 3);
+
+        for (unsigned y = 0; y < rows; ++y)
+        {
+            const unsigned char *pixel = row_of(image, y0 + y);
+            for (unsigned x = 0; x < image.width; ++x, pixel += layout.channels)
+            {
+                const Eigen::Index i = static_cast<Eigen::Index>(y) * image.width + x;
+                band(i, 0) = layout.alpha && pixel[3] == 0 ? std::numeric_limits<double>::quiet_NaN() : pixel[layout.red];
+                band(i, 1) = pixel[1];
+                band(i, 2) = pixel[layout.blue];
+            }
+        }
+
+        dither_next_band(ditherState, band, paletteColors, image.width, settings);
+
+        unsigned char *out = indexBuffer.data() + static_cast<size_t>(y0) * image.width;
+        for (size_t i = 0; i < ditherState.indices.size(); ++i)
+        {
+            const unsigned short index = ditherState.indices[i];
+            out[i] = index == DITHER_SKIPPED_INDEX ? 0 : static_cast<unsigned char>(first + index);
+        }
+    }
+
+    return 0;
+}
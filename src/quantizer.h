@@ -0,0 +1,96 @@
+#pragma once
+
+#include "shared.h"
+#include "histogram.h"
+#include "palette.h"
+#include "dither.h"
+#include "engine.h"
+#include "progress.h"
+
+// Returned by Quantizer::quantize() for a null, empty or inconsistent PixelBuffer.
+#define QUANTIZER_ERROR_INVALID_BUFFER 210
+// Returned by cqt_quantizer_set_engine() for a name that is not a palette engine.
+#define QUANTIZER_ERROR_UNKNOWN_ENGINE 211
+// Returned by Quantizer::remap() for fully transparent pixels when the palette has no transparent entry.
+#define QUANTIZER_ERROR_NO_TRANSPARENT_ENTRY 212
+
+enum PixelFormat
+{
+    PIXEL_FORMAT_RGB8,
+    PIXEL_FORMAT_RGBA8,
+    PIXEL_FORMAT_BGR8,
+    PIXEL_FORMAT_BGRA8
+};
+
+/*
+ * Caller-owned 8-bit pixels. `stride` is the distance between the starts of two rows in bytes (0 for tightly
+ * packed rows), so images inside larger buffers or with padded rows are read where they are.
+ */
+typedef struct
+{
+    const unsigned char *pixels;
+    unsigned width;
+    unsigned height;
+    size_t stride;
+    PixelFormat format;
+} PixelBuffer;
+
+typedef struct
+{
+    unsigned numColors;    // at most 256 palette entries, including the transparent one
+    bool dither;           // Floyd-Steinberg dithering when computing the indices
+    uint64_t sampleBudget; // pixels sampled for the palette, 0 uses all of them
+} QuantizerSettings;
+
+const QuantizerSettings DEFAULT_QUANTIZER_SETTINGS = {16, false, 0};
+
+/*
+ * Embeddable quantizer. Each call reads the caller's pixels in place and produces an RGBA palette and one 8-bit
+ * palette index per pixel; both stay valid until the next call. Histogram, lookup table and index buffers are
+ * kept across calls, so a long-lived Quantizer stops allocating once it has seen its largest image. Nothing is
+ * printed. A Quantizer is not thread-safe; use one per thread.
+ *
+ * Fully transparent pixels (alpha 0) get a reserved transparent entry at index 0. Other alpha values are not
+ * represented in the palette.
+ */
+class Quantizer
+{
+public:
+    explicit Quantizer(const QuantizerSettings &settings = DEFAULT_QUANTIZER_SETTINGS);
+
+    // Builds a palette for `image` and maps every pixel to it. Returns 0 or an error code.
+    unsigned quantize(const PixelBuffer &image);
+    // Maps `image` to the palette of the previous quantize() call, e.g. for further frames of an animation. Fully
+    // transparent pixels need a palette built from an image that had some.
+    unsigned remap(const PixelBuffer &image);
+
+    const QuantizerSettings &settings() const { return config; }
+    void set_settings(const QuantizerSettings &settings) { config = settings; }
+    // Palette construction used by quantize() (see PaletteEngine); pca unless set otherwise.
+    const PaletteEngine &engine() const { return *paletteEngine; }
+    void set_engine(const PaletteEngine &engine) { paletteEngine = &engine; }
+    // Called from quantize() on the calling thread as palette construction proceeds; nullptr for none.
+    void set_progress_callback(ProgressCallback callback, void *user) { progressHook = ProgressHook{callback, user}; }
+
+    unsigned palette_size() const { return static_cast<unsigned>(paletteRgba.size() / 4); }
+    const std::vector<unsigned char> &palette() const { return paletteRgba; } // RGBA, 4 bytes per entry
+    const std::vector<unsigned char> &indices() const { return indexBuffer; } // width * height, row by row
+    const std::vector<Pixel> &colors() const { return paletteColors; }       // opaque entries as used for mapping
+
+private:
+    unsigned map(const PixelBuffer &image);
+    unsigned dither(const PixelBuffer &image);
+
+    QuantizerSettings config;
+    const PaletteEngine *paletteEngine = &pca_engine();
+    ProgressHook progressHook = {nullptr, nullptr};
+    ColorHistogram histogram;
+    PaletteCache cache;
+    TiledDitherState ditherState;
+    MatrixRgb band;
+    std::vector<unsigned char> row;
+    std::vector<Pixel> paletteColors;
+    std::vector<unsigned char> paletteRgba;
+    std::vector<unsigned char> indexBuffer;
+    bool transparent = false;
+};
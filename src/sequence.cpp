@@ -0,0 +1,329 @@
+#include "pch/cqt_pch.h"
+
+#include <cstring>
+
+#include "sequence.h"
+#include "codec.h"
+#include "dither.h"
+#include "engine.h"
+#include "input.h"
+#include "parallel.h"
+#include "quantization.h"
+#include "timings.h"
+
+// Dithered tiles read their apron from the neighboring tiles only, which holds while tiles are at least as large.
+static unsigned sequence_tile_size(const Options &options)
+{
+    return std::max(options.tileSize > 0 ? options.tileSize : SEQUENCE_TILE_SIZE, static_cast<unsigned>(DITHER_APRON));
+}
+
+// Adds or removes (`add` false) pixels of the previous frame's histogram, keeping the drift up to date.
+static void update_histogram(SequenceState &state, const unsigned char *pixels, size_t numPixels, unsigned channels, bool add)
+{
+    ColorHistogram &histogram = state.histogram;
+
+    for (size_t pixel = 0; pixel < numPixels; ++pixel, pixels += channels)
+    {
+        if (channels == 4 && pixels[3] != 255)
+        {
+            if (pixels[3] == 0)
+            {
+                add ? histogram.transparentPixels++ : histogram.transparentPixels--;
+                continue;
+            }
+            add ? histogram.translucentPixels++ : histogram.translucentPixels--;
+        }
+
+        const uint32_t color = (pixels[0] << 16) | (pixels[1] << 8) | pixels[2];
+        const auto reference = state.paletteCounts.find(color);
+        const uint64_t target = reference == state.paletteCounts.end() ? 0 : reference->second;
+
+        // Moving a count away from the palette's histogram adds to the distance, moving it closer removes from it.
+        if (add)
+        {
+            uint64_t &count = histogram.counts[color];
+            if (count >= target)
+                state.drift++;
+            else
+                state.drift--;
+            count++;
+        }
+        else
+        {
+            auto count = histogram.counts.find(color);
+            if (count->second > target)
+                state.drift--;
+            else
+                state.drift++;
+            if (--count->second == 0)
+                histogram.counts.erase(count);
+        }
+    }
+}
+
+// Band rows as floating point, with NaN marking transparent pixels as the tiled ditherer expects.
+static void band_to_matrix(const unsigned char *pixels, size_t numPixels, unsigned channels, MatrixRgb &band)
+{
+    band.resize(numPixels, 3);
+
+    for (size_t pixel = 0; pixel < numPixels; ++pixel, pixels += channels)
+    {
+        band(pixel, 0) = channels == 4 && pixels[3] == 0 ? std::numeric_limits<double>::quiet_NaN() : pixels[0];
+        band(pixel, 1) = pixels[1];
+        band(pixel, 2) = pixels[2];
+    }
+}
+
+/*
+ * Quantizes the next frame of a sequence. Tiles that are byte for byte identical to the previous frame keep
+ * their quantized pixels; only changed tiles update the histogram, and only they are mapped again (with
+ * dithering also the neighbors whose apron they are part of). The palette is kept as long as the colors drift
+ * less than `maxDrift` from those it was built from, measured as the share of visible pixels whose color
+ * would have to change to turn one histogram into the other (0 identical, 1 disjoint). A different frame size
+ * or new transparent pixels also start a new palette.
+ *
+ * The result is the frame quantized to `state.palette` exactly as a full run with tiles of the same size would
+ * do it; it is left in `state.output`. The decoded frame is swapped into the state, so `frame` returns the
+ * previous frame's buffer for reuse.
+ */
+SequenceFrameStats quantize_frame(SequenceState &state, std::vector<unsigned char> &frame, unsigned width, unsigned height,
+                                  unsigned channels, const Options &options, double maxDrift)
+{
+    const unsigned tileSize = sequence_tile_size(options);
+    const unsigned tilesAcross = (width + tileSize - 1) / tileSize;
+    const unsigned tilesDown = (height + tileSize - 1) / tileSize;
+    const size_t stride = static_cast<size_t>(width) * channels;
+
+    SequenceFrameStats stats{false, 0, 0, tilesAcross * tilesDown, 0};
+    const bool sameShape = state.width == width && state.height == height && state.channels == channels;
+
+    state.changed.assign(stats.tiles, !sameShape);
+
+    if (!sameShape)
+    {
+        state.width = width;
+        state.height = height;
+        state.channels = channels;
+        state.histogram = ColorHistogram();
+        add_to_histogram(state.histogram, frame.data(), static_cast<size_t>(width) * height, channels);
+        stats.tilesChanged = stats.tiles;
+    }
+    else
+    {
+        for (unsigned tile = 0; tile < stats.tiles; ++tile)
+        {
+            const unsigned x0 = tile % tilesAcross * tileSize, x1 = std::min(width, x0 + tileSize);
+            const unsigned y0 = tile / tilesAcross * tileSize, y1 = std::min(height, y0 + tileSize);
+            const size_t offset = static_cast<size_t>(x0) * channels, bytes = static_cast<size_t>(x1 - x0) * channels;
+
+            bool differs = false;
+            for (unsigned y = y0; y < y1 && !differs; ++y)
+                differs = std::memcmp(&frame[y * stride + offset], &state.frame[y * stride + offset], bytes) != 0;
+
+            if (!differs)
+                continue;
+
+            state.changed[tile] = true;
+            stats.tilesChanged++;
+
+            for (unsigned y = y0; y < y1; ++y)
+            {
+                update_histogram(state, &state.frame[y * stride + offset], x1 - x0, channels, false);
+                update_histogram(state, &frame[y * stride + offset], x1 - x0, channels, true);
+            }
+        }
+    }
+
+    const ColorHistogram &histogram = state.histogram;
+    const uint64_t visiblePixels = histogram.totalPixels - histogram.transparentPixels;
+    stats.drift = visiblePixels > 0 ? state.drift / (2.0 * visiblePixels) : 0;
+    stats.newPalette = !sameShape || stats.drift > maxDrift || (histogram.transparentPixels > 0 && !state.palette.transparent);
+
+    if (stats.newPalette)
+    {
+        state.palette.transparent = histogram.transparentPixels > 0;
+        state.palette.colors.clear();
+        if (visiblePixels > 0)
+            state.palette.colors = palette_engine().build_palette(histogram_to_subset(histogram), options.targetNumColors);
+
+        state.paletteCounts = histogram.counts;
+        state.drift = 0;
+        state.paletteCache.clear();
+        state.output.resize(frame.size());
+    }
+    else if (state.paletteCache.size() > SHARED_PALETTE_CACHE_ENTRIES)
+    {
+        state.paletteCache.clear();
+    }
+
+    const std::vector<Pixel> &palette = state.palette.colors;
+    const bool dither = options.dither && !palette.empty();
+
+    // A dithered tile also reads the tiles left and right of it and the three above it.
+    state.dirty.assign(stats.tiles, stats.newPalette);
+    for (unsigned tile = 0; tile < stats.tiles && !stats.newPalette; ++tile)
+    {
+        if (!state.changed[tile])
+            continue;
+
+        const unsigned tx = tile % tilesAcross, ty = tile / tilesAcross;
+        state.dirty[tile] = true;
+
+        if (!dither)
+            continue;
+
+        for (unsigned y = ty; y <= std::min(ty + 1, tilesDown - 1); ++y)
+        {
+            for (unsigned x = tx > 0 ? tx - 1 : 0; x <= std::min(tx + 1, tilesAcross - 1); ++x)
+                state.dirty[y * tilesAcross + x] = true;
+        }
+    }
+
+    if (!dither)
+    {
+        for (unsigned tile = 0; tile < stats.tiles; ++tile)
+        {
+            if (!state.dirty[tile])
+                continue;
+
+            const unsigned x0 = tile % tilesAcross * tileSize, x1 = std::min(width, x0 + tileSize);
+            const unsigned y0 = tile / tilesAcross * tileSize, y1 = std::min(height, y0 + tileSize);
+            const size_t offset = static_cast<size_t>(x0) * channels, bytes = static_cast<size_t>(x1 - x0) * channels;
+
+            for (unsigned y = y0; y < y1; ++y)
+            {
+                unsigned char *out = &state.output[y * stride + offset];
+                std::memcpy(out, &frame[y * stride + offset], bytes);
+                map_pixels_to_palette(out, x1 - x0, channels, palette, state.paletteCache);
+            }
+            stats.tilesRemapped++;
+        }
+    }
+    else
+    {
+        const TiledDitherSettings settings{tileSize, DITHER_APRON, 1};
+        MatrixRgb band, aboveRows;
+        std::vector<unsigned short> indices;
+        std::vector<unsigned> tiles;
+
+        for (unsigned ty = 0; ty < tilesDown; ++ty)
+        {
+            tiles.clear();
+            for (unsigned tx = 0; tx < tilesAcross; ++tx)
+            {
+                if (state.dirty[ty * tilesAcross + tx])
+                    tiles.push_back(tx);
+            }
+            if (tiles.empty())
+                continue;
+
+            const unsigned y0 = ty * tileSize, rows = std::min(tileSize, height - y0);
+            const unsigned above = std::min(y0, settings.apron);
+
+            band_to_matrix(&frame[y0 * stride], static_cast<size_t>(rows) * width, channels, band);
+            band_to_matrix(&frame[(y0 - above) * stride], static_cast<size_t>(above) * width, channels, aboveRows);
+            indices.resize(static_cast<size_t>(rows) * width);
+
+            parallel_for(static_cast<unsigned>(tiles.size()), options.numThreads, [&](unsigned i)
+                         {
+                StageTimer timer(STAGE_DITHER);
+                const unsigned x0 = tiles[i] * tileSize, x1 = std::min(width, x0 + tileSize);
+                dither_tile(band, aboveRows, palette, width, settings, tiles[i], indices);
+
+                for (unsigned y = 0; y < rows; ++y)
+                {
+                    for (unsigned x = x0; x < x1; ++x)
+                    {
+                        const size_t pixel = static_cast<size_t>(y) * width + x;
+                        const unsigned char *in = &frame[y0 * stride + pixel * channels];
+                        unsigned char *out = &state.output[y0 * stride + pixel * channels];
+                        const unsigned short index = indices[pixel];
+
+                        if (channels == 4)
+                            out[3] = in[3];
+
+                        if (index == DITHER_SKIPPED_INDEX)
+                        {
+                            out[0] = out[1] = out[2] = 0;
+                            continue;
+                        }
+
+                        out[0] = static_cast<unsigned char>(palette[index](0));
+                        out[1] = static_cast<unsigned char>(palette[index](1));
+                        out[2] = static_cast<unsigned char>(palette[index](2));
+                    }
+                } });
+
+            stats.tilesRemapped += static_cast<unsigned>(tiles.size());
+        }
+    }
+
+    state.frame.swap(frame);
+    return stats;
+}
+
+/*
+ * Sequence mode: quantizes the items in order as frames of one sequence (see quantize_frame()), writing one
+ * output per frame and a line per frame telling whether its palette was kept and how many tiles were mapped.
+ * Frames that fail are reported on std::cerr and skipped; the next frame is compared with the last good one.
+ */
+BatchSummary run_sequence(const std::vector<BatchItem> &items, const Options &options, double maxDrift)
+{
+    SequenceState state;
+    std::vector<unsigned char> frame, encoded;
+    BatchSummary summary{0, 0, 0, 0, 0, 0};
+
+    // The palette stages would print their progress for every new palette.
+    const bool console = consoleOutput;
+    consoleOutput = false;
+    auto start = std::chrono::steady_clock::now();
+
+    for (const BatchItem &item : items)
+    {
+        InputFile input;
+        unsigned width = 0, height = 0, channels = 3;
+        SequenceFrameStats stats{false, 0, 0, 0, 0};
+
+        frame.clear();
+        unsigned error = input.open(item.input.c_str());
+        if (!error)
+            error = decode_image_bands(input.source(), STREAM_BAND_ROWS, true, width, height, channels,
+                                       [&](const unsigned char *pixels, unsigned, unsigned rows)
+                                       { frame.insert(frame.end(), pixels, pixels + static_cast<size_t>(rows) * width * channels); });
+
+        summary.inputBytes += input.bytes_read();
+        input.close();
+
+        if (!error)
+        {
+            stats = quantize_frame(state, frame, width, height, channels, options, maxDrift);
+
+            const bool indexable = state.histogram.translucentPixels == 0;
+            const EncodeSettings encodeSettings{options.encodeEffort, options.parallelEncode ? options.numThreads : 1};
+            error = encode_image(encoded, item.output, state.output.data(), channels, width, height,
+                                 indexable ? state.palette : NO_OUTPUT_PALETTE, encodeSettings);
+        }
+        if (!error)
+            error = write_batch_output(item.output, encoded);
+
+        if (error)
+        {
+            summary.failed++;
+            std::cerr << item.input << ": error " << error << ": " << codec_error_text(error) << std::endl;
+            continue;
+        }
+
+        summary.succeeded++;
+        summary.outputBytes += encoded.size();
+        summary.pixels += static_cast<uint64_t>(width) * height;
+
+        std::cout << item.input << ": " << (stats.newPalette ? "new palette" : "palette kept") << ", drift "
+                  << std::fixed << std::setprecision(3) << stats.drift << std::defaultfloat << ", "
+                  << stats.tilesRemapped << " / " << stats.tiles << " tiles mapped" << std::endl;
+    }
+
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    consoleOutput = console;
+
+    return summary;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "shared.h"
+#include "histogram.h"
+#include "palette.h"
+#include "batch.h"
+
+// Edge length of the tiles compared between frames when no --tile-size is given.
+#define SEQUENCE_TILE_SIZE 64
+// Color drift (see quantize_frame()) above which a frame gets a palette of its own.
+#define SEQUENCE_DEFAULT_DRIFT 0.05
+
+/*
+ * State carried from one frame of a sequence to the next. `frame` holds the decoded pixels of the previous
+ * frame and `output` its quantized pixels, which unchanged tiles keep. `histogram` always describes the
+ * previous frame; `paletteCounts` is the histogram the current palette was built from, and `drift` the L1
+ * distance between the two in pixels, both kept up to date from the changed tiles only.
+ */
+typedef struct
+{
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned channels = 0;
+    std::vector<unsigned char> frame;
+    std::vector<unsigned char> output;
+    ColorHistogram histogram;
+    std::unordered_map<uint32_t, uint64_t> paletteCounts;
+    uint64_t drift = 0;
+    OutputPalette palette = NO_OUTPUT_PALETTE;
+    PaletteCache paletteCache;
+    std::vector<bool> changed; // per tile, row by row
+    std::vector<bool> dirty;   // per tile: output must be recomputed
+} SequenceState;
+
+typedef struct
+{
+    bool newPalette;
+    unsigned tilesChanged;
+    unsigned tilesRemapped;
+    unsigned tiles;
+    double drift;
+} SequenceFrameStats;
+
+SequenceFrameStats quantize_frame(SequenceState &state, std::vector<unsigned char> &frame, unsigned width, unsigned height,
+                                  unsigned channels, const Options &options, double maxDrift);
+BatchSummary run_sequence(const std::vector<BatchItem> &items, const Options &options, double maxDrift);
@@ -0,0 +1,322 @@
+#include "pch/cqt_pch.h"
+
+#include "serve.h"
+#include "batch.h"
+#include "codec.h"
+#include "input.h"
+#include "log.h"
+#include "parallel.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool read_exact(int fd, unsigned char *buffer, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t count = ::read(fd, buffer, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        buffer += count;
+        size -= static_cast<size_t>(count);
+    }
+    return true;
+}
+
+static bool write_exact(int fd, const unsigned char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t count = ::write(fd, data, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        data += count;
+        size -= static_cast<size_t>(count);
+    }
+    return true;
+}
+
+static void put_le(std::vector<unsigned char> &out, uint32_t value, unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; ++i)
+        out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+}
+
+/*
+ * Builds the reply for a quantized image in `reply`, leaving room for the length prefix at its start.
+ */
+static unsigned build_reply(std::vector<unsigned char> &reply, BatchScratch &scratch, const QuantizedImage &image,
+                            bool indices, const Options &options)
+{
+    const std::vector<Pixel> &colors = image.palette.colors;
+    const unsigned first = image.palette.transparent ? 1 : 0;
+    const unsigned paletteSize = first + static_cast<unsigned>(colors.size());
+    const size_t numPixels = static_cast<size_t>(image.width) * image.height;
+    const unsigned kind = !indices ? SERVE_REPLY_PNG : paletteSize > 256 ? SERVE_REPLY_INDICES_16 : SERVE_REPLY_INDICES_8;
+
+    unsigned error = 0;
+    if (kind == SERVE_REPLY_PNG)
+    {
+        const EncodeSettings encodeSettings{options.encodeEffort, 1};
+        error = png_codec().encode(scratch.encoded, scratch.image.data(), image.channels, image.width, image.height,
+                                   image.indexable ? image.palette : NO_OUTPUT_PALETTE, encodeSettings);
+        if (error)
+            return error;
+    }
+
+    put_le(reply, 0, 4);
+    put_le(reply, image.width, 4);
+    put_le(reply, image.height, 4);
+    put_le(reply, paletteSize, 2);
+    reply.push_back(static_cast<unsigned char>(kind));
+    reply.push_back(static_cast<unsigned char>(image.channels));
+
+    if (first)
+        reply.insert(reply.end(), {0, 0, 0, 0});
+    for (const Pixel &color : colors)
+        reply.insert(reply.end(), {static_cast<unsigned char>(color(0)), static_cast<unsigned char>(color(1)),
+                                   static_cast<unsigned char>(color(2)), 255});
+
+    if (kind == SERVE_REPLY_PNG)
+    {
+        reply.insert(reply.end(), scratch.encoded.begin(), scratch.encoded.end());
+        return 0;
+    }
+
+    // Quantized pixels hold exactly the truncated palette colors, so an exact lookup finds their index. Partially
+    // transparent pixels get the index of their color; their alpha is not part of an index reply.
+    PaletteCache &lookup = scratch.paletteCache;
+    lookup.clear();
+    for (unsigned i = 0; i < colors.size(); ++i)
+    {
+        const uint32_t key = (static_cast<uint32_t>(static_cast<unsigned char>(colors[i](0))) << 16) |
+                             (static_cast<unsigned char>(colors[i](1)) << 8) | static_cast<unsigned char>(colors[i](2));
+        lookup.emplace(key, first + i);
+    }
+
+    const unsigned char *pixels = scratch.image.data();
+    const unsigned indexBytes = kind == SERVE_REPLY_INDICES_16 ? 2 : 1;
+    reply.reserve(reply.size() + numPixels * indexBytes);
+
+    for (size_t pixel = 0; pixel < numPixels; ++pixel, pixels += image.channels)
+    {
+        unsigned index = 0;
+        if (image.channels != 4 || pixels[3] != 0)
+        {
+            auto entry = lookup.find((pixels[0] << 16) | (pixels[1] << 8) | pixels[2]);
+            index = entry != lookup.end() ? entry->second : 0;
+        }
+        put_le(reply, index, indexBytes);
+    }
+
+    return 0;
+}
+
+/*
+ * Answers requests on one connection until the client closes it or sends a malformed length.
+ */
+static void serve_client(int client, BatchScratch &scratch, std::vector<unsigned char> &request,
+                         std::vector<unsigned char> &reply, const Options &options)
+{
+    for (;;)
+    {
+        unsigned char prefix[4];
+        if (!read_exact(client, prefix, 4))
+            return;
+
+        const uint32_t length = prefix[0] | (prefix[1] << 8) | (prefix[2] << 16) | (static_cast<uint32_t>(prefix[3]) << 24);
+        if (length < 4 || length > SERVE_MAX_REQUEST_BYTES)
+            return;
+
+        request.resize(length);
+        if (!read_exact(client, request.data(), length))
+            return;
+
+        const unsigned source = request[0];
+        const unsigned flags = request[1];
+        const unsigned colors = request[2] | (request[3] << 8);
+        const unsigned char *payload = request.data() + 4;
+        const size_t payloadSize = length - 4;
+
+        const Options requestOptions{"", colors > 0 ? colors : options.targetNumColors, "", options.paletteFileName,
+                                     options.targetPalette, 0, 0, (flags & SERVE_FLAG_DITHER) != 0, options.tileSize, 1,
+                                     options.encodeEffort, false, options.sampleBudget, 0};
+
+        QuantizedImage image;
+        InputFile input;
+        unsigned error = 0;
+
+        // Like --colors, at most 256; larger counts could also wrap the reply's 16-bit palette size.
+        if (colors > 256)
+        {
+            error = CODEC_ERROR_UNSUPPORTED;
+        }
+        else if (source == SERVE_SOURCE_INLINE)
+        {
+            error = quantize_source(memory_source(payload, payloadSize), "(inline)", scratch, requestOptions, image);
+        }
+        else if (source == SERVE_SOURCE_PATH)
+        {
+            const std::string path(reinterpret_cast<const char *>(payload), payloadSize);
+            error = input.open(path.c_str());
+            if (!error)
+                error = quantize_source(input.source(), path, scratch, requestOptions, image);
+            input.close();
+        }
+        else
+        {
+            error = CODEC_ERROR_UNSUPPORTED;
+        }
+
+        reply.assign(4, 0);
+        if (!error)
+            error = build_reply(reply, scratch, image, (flags & SERVE_FLAG_INDICES) != 0, requestOptions);
+
+        if (error)
+        {
+            reply.assign(4, 0);
+            put_le(reply, error, 4);
+            put_le(reply, 0, 12);
+        }
+
+        const uint32_t replyLength = static_cast<uint32_t>(reply.size() - 4);
+        for (unsigned i = 0; i < 4; ++i)
+            reply[i] = static_cast<unsigned char>(replyLength >> (8 * i));
+
+        if (!write_exact(client, reply.data(), reply.size()))
+            return;
+    }
+}
+
+/*
+ * Creates a listening Unix domain socket at `path`, replacing a stale socket left by an earlier server. The socket
+ * is made accessible to its owner only before it listens, so no other user can connect in between. Returns the
+ * descriptor or -1.
+ */
+int open_server_socket(const std::string &path)
+{
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path))
+        return -1;
+
+    address.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), address.sun_path);
+
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+        unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || chmod(path.c_str(), 0600) != 0 ||
+        listen(fd, 64) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Accepts and answers connections on `options.numThreads` long-lived workers, each with its own scratch buffers,
+ * until `listenFd` is shut down. A worker serves one connection at a time, and drops it once a read or write has
+ * waited `timeoutSeconds`.
+ */
+void serve_connections(int listenFd, const Options &options, unsigned timeoutSeconds)
+{
+    timeval timeout{};
+    timeout.tv_sec = static_cast<time_t>(timeoutSeconds);
+
+    const unsigned workers = resolve_thread_count(options.numThreads);
+
+    parallel_for(workers, workers, [&](unsigned)
+                 {
+        BatchScratch scratch;
+        std::vector<unsigned char> request, reply;
+
+        for (;;)
+        {
+            int client = accept(listenFd, nullptr, nullptr);
+            if (client < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return;
+            }
+
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            serve_client(client, scratch, request, reply, options);
+            close(client);
+        } });
+}
+
+static volatile sig_atomic_t serverFd = -1;
+
+static void stop_server(int)
+{
+    // shutdown() is async-signal-safe and wakes every worker blocked in accept().
+    if (serverFd >= 0)
+        shutdown(serverFd, SHUT_RDWR);
+}
+
+/*
+ * Runs the server at `path` until SIGINT or SIGTERM. Returns the process exit code.
+ */
+int serve(const std::string &path, const Options &options)
+{
+    int fd = open_server_socket(path);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot listen on " << path << std::endl;
+        return 1;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    serverFd = fd;
+    std::signal(SIGINT, stop_server);
+    std::signal(SIGTERM, stop_server);
+
+    std::cout << "Serving on " << path << " with " << resolve_thread_count(options.numThreads) << " workers" << std::endl;
+
+    NullBuffer discard;
+    std::streambuf *console = std::cout.rdbuf(&discard);
+    serve_connections(fd, options);
+    std::cout.rdbuf(console);
+
+    close(fd);
+    unlink(path.c_str());
+    std::cout << "Server stopped" << std::endl;
+
+    return 0;
+}
+
+#else
+
+int open_server_socket(const std::string &)
+{
+    return -1;
+}
+
+void serve_connections(int, const Options &, unsigned) {}
+
+int serve(const std::string &, const Options &)
+{
+    std::cerr << "--serve needs Unix domain sockets, which this platform does not provide" << std::endl;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "shared.h"
+
+// Largest request payload accepted; larger length prefixes close the connection.
+#define SERVE_MAX_REQUEST_BYTES (1u << 30)
+// Seconds a connection may stall in a read or write before it is closed, so an idle client cannot keep a worker.
+#define SERVE_TIMEOUT_SECONDS 30
+
+#define SERVE_SOURCE_PATH 0   // payload names a file readable by the server
+#define SERVE_SOURCE_INLINE 1 // payload is the encoded image itself
+
+#define SERVE_FLAG_DITHER 1
+#define SERVE_FLAG_INDICES 2 // answer with palette indices instead of an encoded PNG
+
+#define SERVE_REPLY_PNG 0
+#define SERVE_REPLY_INDICES_8 1
+#define SERVE_REPLY_INDICES_16 2
+
+/*
+ * Quantization server on a Unix domain socket. Every message in either direction is a little-endian uint32
+ * byte count followed by that many bytes, and a connection may carry any number of requests in turn.
+ *
+ * Request:  uint8 source (SERVE_SOURCE_*), uint8 flags (SERVE_FLAG_*), uint16 colors (up to 256, 0 for the
+ *           server's default), then the input path or the encoded image.
+ * Response: uint32 status (0 or a codec error code), uint32 width, uint32 height, uint16 palette size,
+ *           uint8 reply kind (SERVE_REPLY_*), uint8 input channels, the palette as RGBA quadruples, then the PNG
+ *           or one index per pixel (16-bit little-endian when the palette has more than 256 entries). A
+ *           transparent entry, if any, comes first. Failed requests have an empty palette and body.
+ *
+ * The worker threads live as long as the server and keep their scratch buffers and lookup tables between
+ * requests, so a request costs only the quantization itself.
+ *
+ * Path requests open files with the server's permissions, so the socket is created accessible to its owner only.
+ */
+int open_server_socket(const std::string &path);
+void serve_connections(int listenFd, const Options &options, unsigned timeoutSeconds = SERVE_TIMEOUT_SECONDS);
+int serve(const std::string &path, const Options &options);
@@ -10,6 +10,8 @@
 #define PBWIDTH 60
 #define MAX_DOUBLE 1.79769e+308
 #define MIN_DOUBLE 2.22507e-308
+#define DITHER_APRON 16
+#define STREAM_BAND_ROWS 64
 
 typedef Eigen::MatrixXd MatrixRgb;
 typedef Eigen::RowVectorXd Pixel;
@@ -18,6 +20,13 @@ typedef Eigen::Matrix<unsigned char, Eigen::Dynamic, 3, Eigen::RowMajor> MatrixX
 
 const std::string VERSION = "1.1";
 
+/*
+ * Pull-based byte input for streaming decoders. Fills `buffer` with up to `size` bytes and returns the number
+ * of bytes written; returning 0 signals the end of the input.
+ */
+typedef std::function<size_t(unsigned char *buffer, size_t size)> ByteReader;
+typedef std::function<bool(const unsigned char *data, size_t size)> ByteWriter; // false if the bytes could not be written
+
 typedef struct
 {
     MatrixRgb data;
@@ -25,8 +34,28 @@ typedef struct
     double largestEigenvalue;
     Eigen::VectorXd largestEigenvector;
     std::vector<int> indices;
+    Eigen::VectorXd weights; // pixel count per row when `data` holds distinct colors, empty for raw pixels
 } PixelSubset;
 
+/*
+ * Colors of a quantized image, handed to the encoders so that indexed formats can be written without searching
+ * the pixels for distinct colors. Pixels use exactly these colors after truncation to 8 bits. With
+ * `transparent`, fully transparent pixels are stored as (0, 0, 0, 0) and get a reserved palette index.
+ */
+typedef struct
+{
+    std::vector<Pixel> colors;
+    bool transparent;
+} OutputPalette;
+
+enum EncodeEffort
+{
+    EFFORT_STORE,
+    EFFORT_FAST,
+    EFFORT_BALANCED,
+    EFFORT_MAX
+};
+
 typedef struct
 {
     const std::string filename;
@@ -37,25 +66,19 @@ typedef struct
     unsigned width;
     unsigned height;
     bool dither;
+    unsigned tileSize;
+    unsigned numThreads;
+    EncodeEffort encodeEffort;
+    bool parallelEncode;
+    uint64_t sampleBudget; // pixels sampled for palette construction, 0 uses all of them
+    uint64_t maxMemory;    // bytes the working set should stay within, 0 for no limit
 } Options;
 
-void static inline printProgress(double percentage)
-{
-    int val = static_cast<int>(percentage * 100.0);
-    int lpad = static_cast<int>(percentage * static_cast<double>(PBWIDTH));
-    int rpad = PBWIDTH - lpad;
-    printf("\r%3d%% [%.*s%*s]", val, lpad, PBSTR, rpad, "");
-    fflush(stdout);
-}
-
-void static inline printProgress(const char *action, int completed, int total)
-{
-    double percentage = static_cast<double>(completed) / static_cast<double>(total);
-    int lpad = static_cast<int>(percentage * static_cast<double>(PBWIDTH));
-    int rpad = PBWIDTH - lpad;
-    printf("\r%s: %3d / %3d [%.*s%*s]", action, completed, total, lpad, PBSTR, rpad, "");
-    fflush(stdout);
-}
+/*
+ * Whether the quantization stages report on the console. It is per thread, so code embedding the library (see
+ * Quantizer) silences its own calls without affecting the rest of the process.
+ */
+inline thread_local bool consoleOutput = true;
 
 void static inline log_color_hex_values(std::vector<Pixel> &colors)
 {
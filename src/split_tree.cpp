@@ -0,0 +1,195 @@
+#include "pch/cqt_pch.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "split_tree.h"
+#include "cache.h"
+#include "quantization.h"
+
+static const char SPLIT_TREE_MAGIC[4] = {'C', 'Q', 'S', 'T'};
+static const size_t HEADER_BYTES = 28;
+static const size_t NODE_BYTES = 9 * 8 + 3 * 4;
+
+// Hash of the rows and weights a palette is built from; equal hashes give equal partitionings.
+uint64_t hash_subset(const PixelSubset &subset)
+{
+    const uint64_t data = hash_bytes(reinterpret_cast<const unsigned char *>(subset.data.data()), subset.data.size() * sizeof(double));
+    return hash_bytes(reinterpret_cast<const unsigned char *>(subset.weights.data()), subset.weights.size() * sizeof(double), data);
+}
+
+bool split_tree_covers(const SplitTree &tree, unsigned colors)
+{
+    return !tree.nodes.empty() && (tree.complete || colors <= tree.splits + 1);
+}
+
+/*
+ * The palette build_palette() returns for `colors`, from the tree alone: the first `colors` - 1 splits are
+ * replayed on the list of subsets in the order partition() keeps it, and the means of the resulting leaves are
+ * the palette. Takes time in the number of colors only.
+ */
+std::vector<Pixel> split_tree_palette(const SplitTree &tree, unsigned colors)
+{
+    if (tree.nodes.empty())
+        return {};
+
+    std::vector<uint32_t> leaves = {0};
+    const uint32_t splits = std::min<uint32_t>(tree.splits, colors > 0 ? colors - 1 : 0);
+
+    for (uint32_t split = 0; split < splits; ++split)
+    {
+        auto node = std::find_if(leaves.begin(), leaves.end(), [&](uint32_t index)
+                                 { return tree.nodes[index].splitOrder == split; });
+        if (node == leaves.end())
+            break;
+
+        const SplitNode &parent = tree.nodes[*node];
+        leaves.erase(node);
+        leaves.push_back(parent.children[0]);
+        leaves.push_back(parent.children[1]);
+    }
+
+    std::vector<Pixel> palette;
+    for (uint32_t index : leaves)
+    {
+        Pixel color(3);
+        color << tree.nodes[index].mean[0], tree.nodes[index].mean[1], tree.nodes[index].mean[2];
+        palette.push_back(color);
+    }
+    return palette;
+}
+
+static void put_u32(std::vector<unsigned char> &out, uint32_t value)
+{
+    for (unsigned i = 0; i < 4; ++i)
+        out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+}
+
+static void put_u64(std::vector<unsigned char> &out, uint64_t value)
+{
+    for (unsigned i = 0; i < 8; ++i)
+        out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+}
+
+static void put_double(std::vector<unsigned char> &out, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, 8);
+    put_u64(out, bits);
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+    return get_u32(p) | (static_cast<uint64_t>(get_u32(p + 4)) << 32);
+}
+
+static double get_double(const unsigned char *p)
+{
+    const uint64_t bits = get_u64(p);
+    double value;
+    std::memcpy(&value, &bits, 8);
+    return value;
+}
+
+/*
+ * Writes the tree as a little-endian binary file: the magic "CQST", the version, the histogram hash, the
+ * complete flag, the number of splits and of nodes, then every node as nine doubles (mean, weight, eigenvalue,
+ * axis, threshold) and three 32-bit integers (children, split order). 84 bytes per node, about 43 KB for a
+ * 256-color tree. Returns false if the file cannot be written.
+ */
+bool save_split_tree(const std::string &path, const SplitTree &tree)
+{
+    std::vector<unsigned char> out(SPLIT_TREE_MAGIC, SPLIT_TREE_MAGIC + 4);
+    put_u32(out, SPLIT_TREE_VERSION);
+    put_u64(out, tree.histogramHash);
+    put_u32(out, tree.complete);
+    put_u32(out, tree.splits);
+    put_u32(out, static_cast<uint32_t>(tree.nodes.size()));
+
+    for (const SplitNode &node : tree.nodes)
+    {
+        for (double value : {node.mean[0], node.mean[1], node.mean[2], node.weight, node.eigenvalue, node.axis[0],
+                             node.axis[1], node.axis[2], node.threshold})
+            put_double(out, value);
+        put_u32(out, node.children[0]);
+        put_u32(out, node.children[1]);
+        put_u32(out, node.splitOrder);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(out.data()), out.size());
+    return static_cast<bool>(file.flush());
+}
+
+// Reads a file written by save_split_tree(). Returns false if it is missing, of another version or inconsistent.
+bool load_split_tree(const std::string &path, SplitTree &tree)
+{
+    std::ifstream file(path, std::ios::binary);
+    const std::vector<unsigned char> in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (in.size() < HEADER_BYTES || std::memcmp(in.data(), SPLIT_TREE_MAGIC, 4) != 0 || get_u32(&in[4]) != SPLIT_TREE_VERSION)
+        return false;
+
+    const uint32_t count = get_u32(&in[24]);
+    if (count == 0 || in.size() != HEADER_BYTES + static_cast<size_t>(count) * NODE_BYTES)
+        return false;
+
+    tree.histogramHash = get_u64(&in[8]);
+    tree.complete = get_u32(&in[16]) != 0;
+    tree.splits = get_u32(&in[20]);
+    tree.nodes.resize(count);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const unsigned char *p = &in[HEADER_BYTES + static_cast<size_t>(i) * NODE_BYTES];
+        SplitNode &node = tree.nodes[i];
+        double *values[9] = {&node.mean[0], &node.mean[1], &node.mean[2], &node.weight, &node.eigenvalue,
+                             &node.axis[0], &node.axis[1], &node.axis[2], &node.threshold};
+        for (unsigned v = 0; v < 9; ++v)
+            *values[v] = get_double(p + 8 * v);
+        node.children[0] = get_u32(p + 72);
+        node.children[1] = get_u32(p + 76);
+        node.splitOrder = get_u32(p + 80);
+
+        // Split nodes need both children, and the replay must find every split among them.
+        const bool split = node.splitOrder != SPLIT_TREE_LEAF;
+        if (split && (node.splitOrder >= tree.splits || node.children[0] >= count || node.children[1] >= count))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * The palette for `colors` from the split tree sidecar at `path` when it was built from the same colors and
+ * reaches that far, which takes microseconds; otherwise partitions `subset` as build_palette() does and writes
+ * the tree of that run to `path` for later calls.
+ */
+std::vector<Pixel> build_palette_with_split_tree(const PixelSubset &subset, unsigned colors, const std::string &path)
+{
+    const uint64_t hash = hash_subset(subset);
+    SplitTree tree;
+
+    if (load_split_tree(path, tree) && tree.histogramHash == hash && split_tree_covers(tree, colors))
+    {
+        if (consoleOutput)
+            std::cout << "Palette from split tree " << path << " (" << tree.splits << " splits)" << std::endl;
+        return split_tree_palette(tree, colors);
+    }
+
+    std::vector<Pixel> palette = build_palettes(subset, {colors}, &tree).front();
+    tree.histogramHash = hash;
+
+    if (!save_split_tree(path, tree))
+        std::cout << "Cannot write split tree " << path << std::endl;
+    else if (consoleOutput)
+        std::cout << "Split tree written to " << path << " (" << tree.splits << " splits)" << std::endl;
+
+    return palette;
+}
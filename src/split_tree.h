@@ -0,0 +1,44 @@
+#pragma once
+
+#include "shared.h"
+
+// Marks a missing child, or a node that was never split.
+#define SPLIT_TREE_LEAF 0xFFFFFFFFu
+// Bumped whenever the file layout changes.
+#define SPLIT_TREE_VERSION 1
+
+/*
+ * One subset of the partitioning: its mean color and pixel count, and for subsets that were split the line they
+ * were split along (see SplitRecord) and the two halves.
+ */
+typedef struct
+{
+    double mean[3];
+    double weight;
+    double eigenvalue;
+    double axis[3];
+    double threshold;
+    uint32_t children[2];
+    uint32_t splitOrder; // position in the split sequence, SPLIT_TREE_LEAF if never split
+} SplitNode;
+
+/*
+ * The complete record of one partitioning run (see build_palettes()), node 0 being the initial subset. The
+ * palette for any K up to `splits` + 1 follows from replaying the first K - 1 splits, or for any K at all when
+ * the run was `complete`, i.e. ended because nothing could be split any further. `histogramHash` identifies the
+ * colors it was built from.
+ */
+typedef struct
+{
+    uint64_t histogramHash = 0;
+    bool complete = false;
+    uint32_t splits = 0;
+    std::vector<SplitNode> nodes;
+} SplitTree;
+
+uint64_t hash_subset(const PixelSubset &subset);
+bool split_tree_covers(const SplitTree &tree, unsigned colors);
+std::vector<Pixel> split_tree_palette(const SplitTree &tree, unsigned colors);
+bool save_split_tree(const std::string &path, const SplitTree &tree);
+bool load_split_tree(const std::string &path, SplitTree &tree);
+std::vector<Pixel> build_palette_with_split_tree(const PixelSubset &subset, unsigned colors, const std::string &path);
@@ -0,0 +1,144 @@
+#include "pch/cqt_pch.h"
+
+#include "timings.h"
+#include "log.h"
+
+static const char *const STAGE_NAMES[STAGE_COUNT] = {"decode", "histogram", "partition", "reduce", "map", "dither", "encode"};
+
+static std::atomic<uint64_t> stageNanoseconds[STAGE_COUNT];
+static std::atomic<uint64_t> stageCalls[STAGE_COUNT];
+static std::atomic<uint64_t> stageAllocations[STAGE_COUNT];
+static std::atomic<uint64_t> stageAllocatedBytes[STAGE_COUNT];
+static std::atomic<uint64_t> stagePeakGrowth[STAGE_COUNT];
+static std::atomic<uint64_t> longestSplit{0};
+static std::chrono::steady_clock::time_point timingsStart;
+
+static thread_local StageTimer *innermostTimer = nullptr;
+
+StageTimer::StageTimer(TimingStage stage) : stage(stage)
+{
+    if (!timingsEnabled)
+        return;
+
+    outer = innermostTimer;
+    innermostTimer = this;
+    startAllocations = threadAllocations;
+    startAllocatedBytes = threadAllocatedBytes;
+    // The peak resident set costs a system call to read, so only the outermost timer on a thread samples it.
+    if (!outer)
+        startPeak = peak_rss_bytes();
+    start = std::chrono::steady_clock::now();
+}
+
+StageTimer::~StageTimer()
+{
+    if (!timingsEnabled)
+        return;
+
+    const uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    const uint64_t own = elapsed - std::min(elapsed, innerNanoseconds);
+
+    // Allocation counters only grow; the peak resident set may have been raised by another thread meanwhile,
+    // which is attributed to whichever outermost stages were running.
+    const uint64_t allocations = threadAllocations - startAllocations;
+    const uint64_t allocatedBytes = threadAllocatedBytes - startAllocatedBytes;
+
+    stageNanoseconds[stage] += own;
+    stageCalls[stage]++;
+    stageAllocations[stage] += allocations - innerAllocations;
+    stageAllocatedBytes[stage] += allocatedBytes - innerAllocatedBytes;
+    if (!outer)
+        stagePeakGrowth[stage] += peak_rss_bytes() - startPeak;
+
+    if (stage == STAGE_PARTITION)
+    {
+        uint64_t longest = longestSplit;
+        while (own > longest && !longestSplit.compare_exchange_weak(longest, own))
+        {
+        }
+    }
+
+    innermostTimer = outer;
+    if (outer)
+    {
+        outer->innerNanoseconds += elapsed;
+        outer->innerAllocations += allocations;
+        outer->innerAllocatedBytes += allocatedBytes;
+    }
+}
+
+// Starts recording; the wall time of the report is measured from here.
+void enable_timings()
+{
+    timingsStart = std::chrono::steady_clock::now();
+    timingsEnabled = true;
+}
+
+TimingReport collect_timings()
+{
+    TimingReport report{};
+    for (unsigned stage = 0; stage < STAGE_COUNT; ++stage)
+    {
+        report.nanoseconds[stage] = stageNanoseconds[stage];
+        report.calls[stage] = stageCalls[stage];
+        report.allocations[stage] = stageAllocations[stage];
+        report.allocatedBytes[stage] = stageAllocatedBytes[stage];
+        report.peakGrowth[stage] = stagePeakGrowth[stage];
+    }
+    report.longestSplit = longestSplit;
+    report.wallNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timingsStart).count();
+    report.peakRss = peak_rss_bytes();
+    return report;
+}
+
+/*
+ * Prints the stage times as a table, or as one JSON object on a single line. With several worker threads the
+ * stage times are summed over the threads and may exceed the wall time. Allocations are left out when this
+ * process does not count them; peak growth is how much each stage raised the process's peak resident set, so
+ * the stage that sets the peak stands out.
+ */
+void log_timings(const TimingReport &report, bool json)
+{
+    if (json)
+    {
+        std::ostringstream line;
+        line << "{\"wall_ns\":" << report.wallNanoseconds << ",\"stages\":{";
+        for (unsigned stage = 0; stage < STAGE_COUNT; ++stage)
+        {
+            line << (stage ? "," : "") << '"' << STAGE_NAMES[stage] << "\":{\"ns\":" << report.nanoseconds[stage]
+                 << ",\"calls\":" << report.calls[stage];
+            if (allocationsCounted)
+                line << ",\"allocs\":" << report.allocations[stage] << ",\"alloc_bytes\":" << report.allocatedBytes[stage];
+            line << ",\"peak_growth_bytes\":" << report.peakGrowth[stage] << '}';
+        }
+        line << "},\"longest_split_ns\":" << report.longestSplit << ",\"peak_rss_bytes\":" << report.peakRss << '}';
+        std::cout << line.str() << std::endl;
+        return;
+    }
+
+    const double wall = std::max<double>(report.wallNanoseconds, 1);
+
+    std::cout << std::left << std::setw(10) << "stage" << std::right << std::setw(11) << "ms" << std::setw(10) << "share"
+              << std::setw(8) << "calls" << std::setw(10) << "allocs" << std::setw(11) << "alloc MiB" << std::setw(11)
+              << "peak +MiB" << std::endl;
+    for (unsigned stage = 0; stage < STAGE_COUNT; ++stage)
+    {
+        std::cout << std::left << std::setw(10) << STAGE_NAMES[stage] << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(11) << report.nanoseconds[stage] / 1e6 << std::setprecision(1) << std::setw(9)
+                  << 100.0 * report.nanoseconds[stage] / wall << '%' << std::setw(8) << report.calls[stage];
+        if (allocationsCounted)
+            std::cout << std::setw(10) << report.allocations[stage] << std::setw(11) << report.allocatedBytes[stage] / 1048576.0;
+        else
+            std::cout << std::setw(10) << "-" << std::setw(11) << "-";
+        std::cout << std::setw(11) << report.peakGrowth[stage] / 1048576.0 << std::endl;
+    }
+    std::cout << std::left << std::setw(10) << "wall" << std::right << std::setprecision(3) << std::setw(11)
+              << report.wallNanoseconds / 1e6 << std::defaultfloat << std::endl;
+
+    if (report.calls[STAGE_PARTITION] > 0)
+        std::cout << "Longest split: " << std::fixed << std::setprecision(3) << report.longestSplit / 1e6 << " ms"
+                  << std::defaultfloat << std::endl;
+    if (report.peakRss > 0)
+        std::cout << "Peak RSS: " << std::fixed << std::setprecision(1) << report.peakRss / 1048576.0 << " MiB"
+                  << std::defaultfloat << std::endl;
+}
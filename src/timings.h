@@ -0,0 +1,77 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+
+enum TimingStage
+{
+    STAGE_DECODE,
+    STAGE_HISTOGRAM, // counting colors and turning them into the set of unique colors
+    STAGE_PARTITION, // one split per call
+    STAGE_REDUCE,
+    STAGE_MAP,
+    STAGE_DITHER,
+    STAGE_ENCODE,
+    STAGE_COUNT
+};
+
+/*
+ * Whether stage timers record anything. Set once by --timings before any work starts; while it is false a
+ * StageTimer costs one load and branch.
+ */
+inline bool timingsEnabled = false;
+
+/*
+ * Heap allocations made on the calling thread, counted by allocation_counter.cpp: with glibc it wraps the malloc
+ * family, which operator new and Eigen both allocate through, and elsewhere it replaces the global operator new.
+ * The executables link it; the library alone does not replace the allocator of the process that embeds it, and
+ * then `allocationsCounted` stays false.
+ */
+inline bool allocationsCounted = false;
+inline thread_local uint64_t threadAllocations = 0;
+inline thread_local uint64_t threadAllocatedBytes = 0;
+
+/*
+ * Measures the time between its construction and destruction and adds it to `stage`, summed over all threads,
+ * together with the allocations made meanwhile on the same thread and the growth of the process's peak resident
+ * set. Timers nest: what happens in an inner timer on the same thread counts for the inner stage only, so stage
+ * figures add up to the measured work without overlap (e.g. decoding excludes the histogram built from its bands).
+ * Peak growth is the exception: only the outermost timer samples it, so it includes that of nested stages.
+ */
+class StageTimer
+{
+public:
+    explicit StageTimer(TimingStage stage);
+    ~StageTimer();
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+    const TimingStage stage;
+    std::chrono::steady_clock::time_point start;
+    uint64_t startAllocations = 0;
+    uint64_t startAllocatedBytes = 0;
+    uint64_t startPeak = 0;
+    uint64_t innerNanoseconds = 0;
+    uint64_t innerAllocations = 0;
+    uint64_t innerAllocatedBytes = 0;
+    StageTimer *outer = nullptr;
+};
+
+typedef struct
+{
+    uint64_t nanoseconds[STAGE_COUNT];
+    uint64_t calls[STAGE_COUNT];
+    uint64_t allocations[STAGE_COUNT];
+    uint64_t allocatedBytes[STAGE_COUNT];
+    uint64_t peakGrowth[STAGE_COUNT]; // bytes the peak resident set grew by while the stage ran
+    uint64_t longestSplit; // nanoseconds
+    uint64_t wallNanoseconds;
+    uint64_t peakRss; // bytes, 0 where unknown
+} TimingReport;
+
+void enable_timings();
+TimingReport collect_timings();
+void log_timings(const TimingReport &report, bool json);
@@ -0,0 +1,102 @@
+#include "pch/cqt_pch.h"
+
+#include <filesystem>
+
+#include "variants.h"
+#include "batch.h"
+#include "dither.h"
+#include "engine.h"
+#include "log.h"
+#include "palette.h"
+#include "parallel.h"
+#include "quantization.h"
+
+namespace fs = std::filesystem;
+
+// The output path of the `colors` variant: "out.png" becomes "out-16.png".
+std::string variant_output_name(const std::string &path, unsigned colors)
+{
+    const fs::path output(path);
+    return (output.parent_path() / (output.stem().string() + "-" + std::to_string(colors) + output.extension().string())).string();
+}
+
+/*
+ * Quantizes one image to several color counts at once. The image is decoded once; partitioning runs once up to
+ * the largest count and its leaves are taken at every requested count (see PaletteEngine). The variants are
+ * then mapped or dithered, encoded and written in parallel, each from its own copy of the decoded pixels, into
+ * the file variant_output_name() gives for it. Every output is identical to a separate run with that count.
+ *
+ * Fills `results` in the order of `colorCounts` and returns the decoder's error code; errors of single variants
+ * are reported in their result.
+ */
+unsigned quantize_variants(const ImageSource &source, const Options &options, const std::vector<unsigned> &colorCounts,
+                           std::vector<VariantResult> &results)
+{
+    BatchScratch scratch;
+    unsigned width, height, channels;
+    unsigned error = decode_source(source, scratch, options.sampleBudget, false, width, height, channels);
+    if (error)
+        return error;
+
+    const ColorHistogram &histogram = scratch.histogram;
+    const Options imageOptions{options.filename, *std::max_element(colorCounts.begin(), colorCounts.end()),
+                               options.outputFileName, options.paletteFileName, options.targetPalette, width, height,
+                               options.dither, options.tileSize, options.numThreads, options.encodeEffort,
+                               options.parallelEncode, options.sampleBudget, 0};
+    LogInfo(imageOptions, (FILENAME | DIMENSIONS | TARGET_NCOLORS));
+
+    std::vector<std::vector<Pixel>> palettes(colorCounts.size());
+    if (!histogram.counts.empty())
+        palettes = palette_engine().build_palettes(histogram_to_subset(histogram), colorCounts);
+
+    // Variants run side by side; the threads left over go to the stages within each of them.
+    const unsigned variants = static_cast<unsigned>(colorCounts.size());
+    const unsigned threads = resolve_thread_count(options.numThreads);
+    const unsigned threadsPerVariant = std::max(1u, threads / std::min(threads, variants));
+
+    OutputPalette outputPalette = NO_OUTPUT_PALETTE;
+    outputPalette.transparent = histogram.transparentPixels > 0;
+    const bool indexable = histogram.translucentPixels == 0;
+
+    results.assign(variants, VariantResult{0, 0, "", 0, 0});
+    parallel_for(variants, threads, [&](unsigned variant)
+                 {
+                     QuietScope quiet;
+                     VariantResult &result = results[variant];
+                     const std::vector<Pixel> &palette = palettes[variant];
+
+                     result.colors = colorCounts[variant];
+                     result.paletteSize = static_cast<unsigned>(palette.size());
+                     result.output = variant_output_name(options.outputFileName, result.colors);
+
+                     std::vector<unsigned char> image = scratch.image;
+                     if (!options.dither || palette.empty())
+                     {
+                         PaletteCache cache;
+                         map_pixels_to_palette(image.data(), image.size() / channels, channels, palette, cache);
+                     }
+                     else
+                     {
+                         const Options variantOptions{options.filename, result.colors, result.output, options.paletteFileName,
+                                                      options.targetPalette, width, height, options.dither, options.tileSize,
+                                                      threadsPerVariant, options.encodeEffort, options.parallelEncode,
+                                                      options.sampleBudget, 0};
+                         unsigned bandRows;
+                         TiledDitherSettings settings = dither_settings_for(variantOptions, bandRows);
+                         tiled_floyd_steinberg_dither_pixels(image, channels, palette, width, bandRows, settings);
+                     }
+
+                     OutputPalette variantPalette = outputPalette;
+                     variantPalette.colors = palette;
+
+                     std::vector<unsigned char> encoded;
+                     const EncodeSettings encodeSettings{options.encodeEffort, options.parallelEncode ? threadsPerVariant : 1};
+                     result.error = encode_image(encoded, result.output, image.data(), channels, width, height,
+                                                 indexable ? variantPalette : NO_OUTPUT_PALETTE, encodeSettings);
+                     if (!result.error)
+                         result.error = write_batch_output(result.output, encoded);
+                     result.outputBytes = encoded.size();
+                 });
+
+    return 0;
+}
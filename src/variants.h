@@ -0,0 +1,18 @@
+#pragma once
+
+#include "shared.h"
+#include "codec.h"
+
+// One output of quantize_variants().
+typedef struct
+{
+    unsigned colors;      // requested color count
+    unsigned paletteSize; // colors in the palette, fewer when the image has fewer distinct colors
+    std::string output;
+    size_t outputBytes;
+    unsigned error; // codec error code of encoding or writing this variant
+} VariantResult;
+
+std::string variant_output_name(const std::string &path, unsigned colors);
+unsigned quantize_variants(const ImageSource &source, const Options &options, const std::vector<unsigned> &colorCounts,
+                           std::vector<VariantResult> &results);
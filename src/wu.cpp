@@ -0,0 +1,297 @@
+#include "pch/cqt_pch.h"
+
+#include "wu.h"
+#include "quantization.h"
+#include "progress.h"
+#include "timings.h"
+
+// A box of the partitioning, with the priority it is split by and, for principal-axis splits, its principal axis.
+typedef struct
+{
+    ColorBox box;
+    double priority; // 0 for boxes that cannot be split
+    Eigen::VectorXd axis;
+} MomentBox;
+
+static size_t cell_index(int r, int g, int b)
+{
+    return (static_cast<size_t>(r) * MOMENT_SIDE + g) * MOMENT_SIDE + b;
+}
+
+static void add_moments(ColorMoments &to, const ColorMoments &from, double sign)
+{
+    to.weight += sign * from.weight;
+    for (unsigned c = 0; c < 3; ++c)
+        to.sum[c] += sign * from.sum[c];
+    for (unsigned p = 0; p < 6; ++p)
+        to.products[p] += sign * from.products[p];
+}
+
+// Histogram bin of an 8-bit channel value, counted from 1.
+static int moment_bin(double value)
+{
+    return (std::min(std::max(static_cast<int>(value), 0), 255) >> (8 - MOMENT_BITS)) + 1;
+}
+
+/*
+ * Bins the colors of `subset` by their upper MOMENT_BITS bits, adds up their moments per bin and turns the bins
+ * into cumulative sums along all three axes. The moments keep the exact colors; only the boxes that can be cut
+ * are limited to the bin grid.
+ */
+void build_moment_table(const PixelSubset &subset, MomentTable &table)
+{
+    table.cells.assign(static_cast<size_t>(MOMENT_SIDE) * MOMENT_SIDE * MOMENT_SIDE, ColorMoments{});
+    const bool weighted = subset.weights.size() > 0;
+
+    for (Eigen::Index row = 0; row < subset.data.rows(); ++row)
+    {
+        const double weight = weighted ? subset.weights(row) : 1.0;
+        const double r = subset.data(row, 0), g = subset.data(row, 1), b = subset.data(row, 2);
+
+        ColorMoments &cell = table.cells[cell_index(moment_bin(r), moment_bin(g), moment_bin(b))];
+        cell.weight += weight;
+        cell.sum[0] += weight * r;
+        cell.sum[1] += weight * g;
+        cell.sum[2] += weight * b;
+        cell.products[0] += weight * r * r;
+        cell.products[1] += weight * g * g;
+        cell.products[2] += weight * b * b;
+        cell.products[3] += weight * r * g;
+        cell.products[4] += weight * r * b;
+        cell.products[5] += weight * g * b;
+    }
+
+    for (int r = 1; r < MOMENT_SIDE; ++r)
+        for (int g = 0; g < MOMENT_SIDE; ++g)
+            for (int b = 0; b < MOMENT_SIDE; ++b)
+                add_moments(table.cells[cell_index(r, g, b)], table.cells[cell_index(r - 1, g, b)], 1.0);
+
+    for (int r = 0; r < MOMENT_SIDE; ++r)
+        for (int g = 1; g < MOMENT_SIDE; ++g)
+            for (int b = 0; b < MOMENT_SIDE; ++b)
+                add_moments(table.cells[cell_index(r, g, b)], table.cells[cell_index(r, g - 1, b)], 1.0);
+
+    for (int r = 0; r < MOMENT_SIDE; ++r)
+        for (int g = 0; g < MOMENT_SIDE; ++g)
+            for (int b = 1; b < MOMENT_SIDE; ++b)
+                add_moments(table.cells[cell_index(r, g, b)], table.cells[cell_index(r, g, b - 1)], 1.0);
+}
+
+/*
+ * Moments of the colors inside `box` by inclusion and exclusion of the cumulative moments at its eight corners:
+ * corners with an odd number of lower coordinates are subtracted.
+ */
+ColorMoments box_moments(const MomentTable &table, const ColorBox &box)
+{
+    ColorMoments moments{};
+    for (unsigned corner = 0; corner < 8; ++corner)
+    {
+        int index[3];
+        unsigned lowerCoordinates = 0;
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            const bool upper = corner & (1u << axis);
+            index[axis] = upper ? box.upper[axis] : box.lower[axis];
+            lowerCoordinates += upper ? 0 : 1;
+        }
+        add_moments(moments, table.cells[cell_index(index[0], index[1], index[2])], lowerCoordinates % 2 ? -1.0 : 1.0);
+    }
+    return moments;
+}
+
+// Covariance of the colors with these moments, as calculate_weighted_covariance_matrix() computes it from the colors.
+CovMatrix moments_covariance(const ColorMoments &moments)
+{
+    static const unsigned PRODUCT[3][3] = {{0, 3, 4}, {3, 1, 5}, {4, 5, 2}};
+
+    CovMatrix covariance;
+    if (moments.weight <= 0)
+        return CovMatrix::Zero();
+
+    for (unsigned i = 0; i < 3; ++i)
+        for (unsigned j = 0; j < 3; ++j)
+            covariance(i, j) = (moments.products[PRODUCT[i][j]] - moments.sum[i] * moments.sum[j] / moments.weight) /
+                               std::max(moments.weight - 1.0, 1.0);
+    return covariance;
+}
+
+// Sum of squared distances of the colors from their mean, as subset_squared_error() computes it from the colors.
+double moments_squared_error(const ColorMoments &moments)
+{
+    if (moments.weight <= 0)
+        return 0;
+
+    const double squares = moments.products[0] + moments.products[1] + moments.products[2];
+    const double sumSquares = moments.sum[0] * moments.sum[0] + moments.sum[1] * moments.sum[1] + moments.sum[2] * moments.sum[2];
+    return std::max(squares - sumSquares / moments.weight, 0.0);
+}
+
+/*
+ * Priority of a box for the next split. Wu's criterion is the squared error of the box; the principal-axis one is
+ * that of determine_optimal_subset(), the largest eigenvalue of the covariance times the pixel count, with the
+ * covariance taken from the moments instead of the colors.
+ */
+static void prioritize_box(const MomentTable &table, MomentBox &target, bool principalAxis)
+{
+    const ColorMoments moments = box_moments(table, target.box);
+    bool cuttable = false;
+    for (unsigned axis = 0; axis < 3; ++axis)
+        cuttable = cuttable || target.box.upper[axis] - target.box.lower[axis] > 1;
+
+    target.priority = 0;
+    if (!cuttable || moments.weight <= 0)
+        return;
+
+    if (!principalAxis)
+    {
+        target.priority = moments_squared_error(moments);
+        return;
+    }
+
+    double eigenvalue;
+    get_largest_eigenv(moments_covariance(moments), eigenvalue, target.axis);
+    target.priority = std::max(eigenvalue, 0.0) * moments.weight;
+}
+
+/*
+ * Cuts `target` by the plane, across any of the three axes, that best separates its colors. Wu's criterion
+ * maximizes |sum1|^2 / w1 + |sum2|^2 / w2, i.e. minimizes the squared error of the two halves; the principal-axis
+ * one maximizes the separability of find_weighted_cutting_point(), w1 * w2 * (m1 - m2)^2, of the PCA scores. Both
+ * halves must hold colors. Returns false if no plane does.
+ */
+static bool cut_box(const MomentTable &table, const MomentBox &target, bool principalAxis, ColorBox &lower, ColorBox &upper)
+{
+    const ColorMoments whole = box_moments(table, target.box);
+    double bestScore = -1;
+
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        for (int cut = target.box.lower[axis] + 1; cut < target.box.upper[axis]; ++cut)
+        {
+            ColorBox half = target.box;
+            half.upper[axis] = cut;
+            const ColorMoments first = box_moments(table, half);
+            const double secondWeight = whole.weight - first.weight;
+            if (first.weight <= 0 || secondWeight <= 0)
+                continue;
+
+            double score = 0;
+            if (principalAxis)
+            {
+                double difference = 0;
+                for (unsigned c = 0; c < 3; ++c)
+                    difference += target.axis(c) * (first.sum[c] / first.weight - (whole.sum[c] - first.sum[c]) / secondWeight);
+                score = first.weight * secondWeight * difference * difference;
+            }
+            else
+            {
+                for (unsigned c = 0; c < 3; ++c)
+                {
+                    const double second = whole.sum[c] - first.sum[c];
+                    score += first.sum[c] * first.sum[c] / first.weight + second * second / secondWeight;
+                }
+            }
+
+            if (score > bestScore)
+            {
+                bestScore = score;
+                lower = half;
+                upper = target.box;
+                upper.lower[axis] = cut;
+            }
+        }
+    }
+
+    return bestScore >= 0;
+}
+
+static std::vector<Pixel> box_palette(const MomentTable &table, const std::vector<MomentBox> &boxes)
+{
+    StageTimer timer(STAGE_REDUCE);
+    std::vector<Pixel> palette;
+    for (const MomentBox &target : boxes)
+    {
+        const ColorMoments moments = box_moments(table, target.box);
+        Pixel color(3);
+        color << moments.sum[0] / moments.weight, moments.sum[1] / moments.weight, moments.sum[2] / moments.weight;
+        palette.push_back(color);
+    }
+    return palette;
+}
+
+/*
+ * Palettes from splitting boxes of the color cube, with every statistic read from cumulative moment tables in a
+ * constant number of lookups per box, however many colors it holds. Without `principalAxis` this is Wu's
+ * quantizer: the box with the largest squared error is cut where the two halves have the least. With it, boxes
+ * are chosen and cut by the PCA and LDA criteria of partition(), restricted to planes of the bin grid. Palette
+ * entries are the mean colors of the boxes. Palettes for several counts come from one run as in build_palettes().
+ */
+std::vector<std::vector<Pixel>> build_box_palettes(const PixelSubset &subset, const std::vector<unsigned> &colorCounts,
+                                                   bool principalAxis)
+{
+    std::vector<unsigned> targets = colorCounts;
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    const unsigned targetNumColors = targets.back();
+
+    MomentTable table;
+    {
+        StageTimer timer(STAGE_HISTOGRAM);
+        build_moment_table(subset, table);
+    }
+
+    std::map<unsigned, std::vector<Pixel>> snapshots;
+    std::vector<MomentBox> boxes;
+    if (subset.data.rows() > 0)
+    {
+        boxes.push_back(MomentBox{{{0, 0, 0}, {MOMENT_SIDE - 1, MOMENT_SIDE - 1, MOMENT_SIDE - 1}}, 0, {}});
+        prioritize_box(table, boxes.back(), principalAxis);
+    }
+
+    size_t nextTarget = 0;
+    while (true)
+    {
+        for (; nextTarget < targets.size() && targets[nextTarget] <= boxes.size(); ++nextTarget)
+            snapshots[targets[nextTarget]] = box_palette(table, boxes);
+
+        if (boxes.size() >= targetNumColors)
+            break;
+
+        StageTimer timer(STAGE_PARTITION);
+        auto next = std::max_element(boxes.begin(), boxes.end(), [](const MomentBox &a, const MomentBox &b)
+                                     { return a.priority < b.priority; });
+        if (next == boxes.end() || next->priority <= 0)
+            break;
+
+        ColorBox lower, upper;
+        if (!cut_box(table, *next, principalAxis, lower, upper))
+        {
+            next->priority = 0;
+            continue;
+        }
+
+        // The halves take the place of the box in the order partition() keeps subsets in.
+        boxes.erase(next);
+        for (const ColorBox &half : {lower, upper})
+        {
+            boxes.push_back(MomentBox{half, 0, {}});
+            prioritize_box(table, boxes.back(), principalAxis);
+        }
+
+        report_progress("Partitioning", static_cast<unsigned>(boxes.size()), targetNumColors);
+    }
+
+    // Boxes that cannot be split any further end the stage early; larger counts get every box there is.
+    if (boxes.size() < targetNumColors)
+    {
+        report_progress("Partitioning", static_cast<unsigned>(boxes.size()), static_cast<unsigned>(boxes.size()));
+        const std::vector<Pixel> palette = box_palette(table, boxes);
+        for (; nextTarget < targets.size(); ++nextTarget)
+            snapshots[targets[nextTarget]] = palette;
+    }
+
+    std::vector<std::vector<Pixel>> palettes;
+    for (unsigned colors : colorCounts)
+        palettes.push_back(snapshots[colors]);
+    return palettes;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "shared.h"
+
+// Histogram cells per channel: colors are binned by their upper 5 bits, plus one row of zeros for prefix sums.
+#define MOMENT_BITS 5
+#define MOMENT_SIDE ((1 << MOMENT_BITS) + 1)
+
+/*
+ * Zeroth, first and second moments of the colors in a region of the color cube: the pixel count, the sums of
+ * the channels and the sums of their pairwise products, which give mean and covariance of the region.
+ */
+typedef struct
+{
+    double weight;
+    double sum[3];
+    double products[6]; // rr, gg, bb, rg, rb, gb
+} ColorMoments;
+
+/*
+ * Cumulative moments over a MOMENT_SIDE^3 grid: the cell at (r, g, b) holds the moments of all colors in bins
+ * up to and including r, g and b. The moments of any box follow from eight of its cells (see box_moments()).
+ */
+typedef struct
+{
+    std::vector<ColorMoments> cells;
+} MomentTable;
+
+/*
+ * Box of histogram bins, from (not including) the lower corner up to and including the upper one, as in Wu's
+ * "Efficient Statistical Computations for Optimal Color Quantization" (Graphics Gems II, 1991).
+ */
+typedef struct
+{
+    int lower[3];
+    int upper[3];
+} ColorBox;
+
+void build_moment_table(const PixelSubset &subset, MomentTable &table);
+ColorMoments box_moments(const MomentTable &table, const ColorBox &box);
+CovMatrix moments_covariance(const ColorMoments &moments);
+double moments_squared_error(const ColorMoments &moments);
+
+std::vector<std::vector<Pixel>> build_box_palettes(const PixelSubset &subset, const std::vector<unsigned> &colorCounts,
+                                                   bool principalAxis);
@@ -0,0 +1,177 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/batch.h"
+#include "src/codec.h"
+#include "src/parallel.h"
+#include "lodepng.h"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+static std::vector<unsigned char> read_file(const fs::path &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void write_gradient(const fs::path &path, unsigned width, unsigned height, unsigned seed)
+{
+    std::vector<unsigned char> image;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+            image.insert(image.end(), {static_cast<unsigned char>(x * seed), static_cast<unsigned char>(y * 3), static_cast<unsigned char>((x + y) * seed)});
+    }
+
+    std::vector<unsigned char> encoded;
+    REQUIRE(encode_image(encoded, path.string(), image.data(), width, height, DEFAULT_ENCODE_SETTINGS) == 0);
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char *>(encoded.data()), encoded.size());
+}
+
+TEST_CASE("Work-stealing loop runs every item exactly once", "[batch]")
+{
+    for (unsigned numThreads : {1u, 3u, 8u})
+    {
+        const unsigned count = 1000;
+        std::vector<std::atomic<unsigned>> runs(count);
+        std::atomic<unsigned> badWorker{0};
+
+        parallel_for_stealing(count, numThreads, [&](unsigned i, unsigned worker)
+                              {
+            if (worker >= numThreads)
+                badWorker++;
+            // Uneven item cost makes early finishers steal.
+            if (i < count / numThreads)
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            runs[i]++; });
+
+        CHECK(badWorker == 0);
+        for (unsigned i = 0; i < count; ++i)
+            CHECK(runs[i] == 1);
+    }
+}
+
+TEST_CASE("Batch mode quantizes a directory like single runs", "[batch]")
+{
+    const fs::path inputDirectory = "batch_input", outputDirectory = "batch_output";
+    fs::remove_all(inputDirectory);
+    fs::remove_all(outputDirectory);
+    fs::create_directories(inputDirectory);
+
+    write_gradient(inputDirectory / "a.png", 40, 30, 5);
+    write_gradient(inputDirectory / "b.ppm", 23, 57, 11);
+    write_gradient(inputDirectory / "c.qoi", 64, 8, 3);
+    std::ofstream(inputDirectory / "notes.txt") << "not an image";
+
+    std::vector<BatchItem> items;
+    REQUIRE(collect_batch_items(inputDirectory.string(), outputDirectory.string(), items));
+    REQUIRE(items.size() == 3);
+    CHECK(fs::path(items[1].output) == outputDirectory / "b.ppm");
+
+    std::vector<BatchItem> inPlace;
+    CHECK_FALSE(collect_batch_items(inputDirectory.string(), inputDirectory.string(), inPlace));
+
+    for (bool dither : {false, true})
+    {
+        Options options{"", 8, outputDirectory.string(), "", {}, 0, 0, dither, 0, 3, EFFORT_FAST, false, 0, 0};
+
+        BatchSummary summary = run_batch(items, options);
+        CHECK(summary.succeeded == 3);
+        CHECK(summary.failed == 0);
+        CHECK(summary.pixels == 40 * 30 + 23 * 57 + 64 * 8);
+
+        // A fresh worker gives the reference output for every file; scratch reuse must not change it.
+        for (const BatchItem &item : items)
+        {
+            BatchScratch scratch;
+            BatchSummary single{0, 0, 0, 0, 0, 0};
+            const BatchItem reference{item.input, (outputDirectory / ("ref_" + fs::path(item.output).filename().string())).string()};
+
+            std::vector<unsigned char> batchOutput = read_file(item.output);
+            REQUIRE(quantize_batch_item(reference, scratch, options, single) == 0);
+            CHECK(read_file(reference.output) == batchOutput);
+        }
+    }
+
+    std::ofstream(inputDirectory / "manifest.txt") << "# inputs\n"
+                                                    << (inputDirectory / "a.png").string() << "\tnamed.png\n\n"
+                                                    << (inputDirectory / "missing.png").string() << "\n";
+    items.clear();
+    REQUIRE(collect_batch_items((inputDirectory / "manifest.txt").string(), outputDirectory.string(), items));
+    REQUIRE(items.size() == 2);
+    CHECK(fs::path(items[0].output) == outputDirectory / "named.png");
+
+    Options options{"", 8, outputDirectory.string(), "", {}, 0, 0, false, 0, 2, EFFORT_FAST, false, 0, 0};
+    BatchSummary summary = run_batch(items, options);
+    CHECK(summary.succeeded == 1);
+    CHECK(summary.failed == 1);
+    CHECK(fs::exists(outputDirectory / "named.png"));
+
+    fs::remove_all(inputDirectory);
+    fs::remove_all(outputDirectory);
+}
+
+TEST_CASE("Shared palette is built from all images of a batch", "[batch]")
+{
+    const fs::path inputDirectory = "batch_shared_input", outputDirectory = "batch_shared_output";
+    fs::remove_all(inputDirectory);
+    fs::remove_all(outputDirectory);
+    fs::create_directories(inputDirectory);
+
+    write_gradient(inputDirectory / "a.png", 40, 30, 5);
+    write_gradient(inputDirectory / "b.png", 23, 57, 11);
+    write_gradient(inputDirectory / "c.png", 64, 8, 3);
+
+    std::vector<BatchItem> items;
+    REQUIRE(collect_batch_items(inputDirectory.string(), outputDirectory.string(), items));
+    REQUIRE(items.size() == 3);
+
+    Options options{"", 12, outputDirectory.string(), "", {}, 0, 0, false, 0, 3, EFFORT_FAST, false, 0, 0};
+    const ColorHistogram histogram = collect_batch_histogram(items, options);
+    CHECK(histogram.totalPixels == 40 * 30 + 23 * 57 + 64 * 8);
+
+    // The same histogram as adding every image directly.
+    ColorHistogram reference;
+    for (const BatchItem &item : items)
+    {
+        std::vector<unsigned char> pixels;
+        unsigned width, height;
+        REQUIRE(lodepng::decode(pixels, width, height, item.input, LCT_RGB) == 0);
+        add_to_histogram(reference, pixels.data(), width * height, 3);
+    }
+    CHECK(histogram.counts == reference.counts);
+
+    const OutputPalette palette = build_shared_palette(histogram, options);
+    REQUIRE(palette.colors.size() == 12);
+    CHECK_FALSE(palette.transparent);
+
+    BatchSummary summary = run_batch(items, options, &palette);
+    CHECK(summary.succeeded == 3);
+
+    // Every output carries the same PLTE, in the order of the shared palette.
+    for (const BatchItem &item : items)
+    {
+        std::vector<unsigned char> indices;
+        unsigned width, height;
+        lodepng::State state;
+        state.decoder.color_convert = 0;
+        REQUIRE(lodepng::decode(indices, width, height, state, read_file(item.output)) == 0);
+        REQUIRE(state.info_png.color.colortype == LCT_PALETTE);
+        REQUIRE(state.info_png.color.palettesize == palette.colors.size());
+
+        for (size_t i = 0; i < palette.colors.size(); ++i)
+        {
+            CHECK(state.info_png.color.palette[4 * i] == static_cast<unsigned char>(palette.colors[i](0)));
+            CHECK(state.info_png.color.palette[4 * i + 1] == static_cast<unsigned char>(palette.colors[i](1)));
+            CHECK(state.info_png.color.palette[4 * i + 2] == static_cast<unsigned char>(palette.colors[i](2)));
+        }
+    }
+
+    fs::remove_all(inputDirectory);
+    fs::remove_all(outputDirectory);
+}
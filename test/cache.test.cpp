@@ -0,0 +1,146 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/cache.h"
+#include "src/batch.h"
+#include "src/codec.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+static uint64_t hash_text(const std::string &text)
+{
+    return hash_bytes(reinterpret_cast<const unsigned char *>(text.data()), text.size());
+}
+
+static std::vector<unsigned char> read_file(const fs::path &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("Input hash matches XXH64", "[cache]")
+{
+    CHECK(hash_text("") == 0xEF46DB3751D8E999ull);
+    CHECK(hash_text("abc") == 0x44BC2CF5AD770999ull);
+    CHECK(hash_text("Nobody inspects the spammish repetition") == 0xFBCEA83C8A378BF1ull);
+}
+
+TEST_CASE("Cache keys cover the input and every output setting", "[cache]")
+{
+    const std::vector<unsigned char> input = {1, 2, 3, 4, 5};
+    std::vector<unsigned char> other = input;
+    other[4] = 6;
+
+    Options options{"", 16, "", "", {}, 0, 0, false, 0, 1, EFFORT_FAST, false, 0, 0};
+    Options dithered{"", 16, "", "", {}, 0, 0, true, 0, 1, EFFORT_FAST, false, 0, 0};
+    Options fewer{"", 8, "", "", {}, 0, 0, false, 0, 1, EFFORT_FAST, false, 0, 0};
+    Options threads{"in.png", 16, "", "", {}, 0, 0, false, 0, 8, EFFORT_FAST, false, 0, 0};
+    Options parallelOneThread{"", 16, "", "", {}, 0, 0, false, 0, 1, EFFORT_FAST, true, 0, 0};
+    Options parallelThreads{"", 16, "", "", {}, 0, 0, false, 0, 8, EFFORT_FAST, true, 0, 0};
+
+    const std::string key = result_cache_key(input.data(), input.size(), options, "a.png");
+    CHECK(key.size() == 32);
+    CHECK(key == result_cache_key(input.data(), input.size(), options, "dir/b.PNG"));
+    CHECK(key == result_cache_key(input.data(), input.size(), threads, "a.png"));
+    // Parallel encoding on one thread writes what a serial encoder does.
+    CHECK(key == result_cache_key(input.data(), input.size(), parallelOneThread, "a.png"));
+    CHECK(key != result_cache_key(input.data(), input.size(), parallelThreads, "a.png"));
+    CHECK(key != result_cache_key(other.data(), other.size(), options, "a.png"));
+    CHECK(key != result_cache_key(input.data(), input.size(), dithered, "a.png"));
+    CHECK(key != result_cache_key(input.data(), input.size(), fewer, "a.png"));
+    CHECK(key != result_cache_key(input.data(), input.size(), options, "a.qoi"));
+    CHECK(key == result_cache_key(input.data(), input.size(), options, "a.png", 0));
+    CHECK(key != result_cache_key(input.data(), input.size(), options, "a.png", 50));
+    CHECK(result_cache_key(input.data(), input.size(), options, "a.png", 50) != result_cache_key(input.data(), input.size(), options, "a.png", 60));
+}
+
+TEST_CASE("Cache evicts the least recently used entries", "[cache]")
+{
+    const fs::path directory = "cache_test";
+    fs::remove_all(directory);
+
+    ResultCache cache;
+    REQUIRE(cache.open(directory.string(), 2500));
+
+    std::vector<unsigned char> result;
+    CHECK_FALSE(cache.lookup("a", result));
+
+    const std::vector<unsigned char> entry(1000, 7);
+    cache.store("a", entry);
+    cache.store("b", entry);
+
+    // Make "a" the most recently used; the next store exceeds the limit and evicts "b".
+    fs::last_write_time(directory / "b", fs::file_time_type::clock::now() - std::chrono::hours(1));
+    REQUIRE(cache.lookup("a", result));
+    CHECK(result == entry);
+    cache.store("c", entry);
+
+    CHECK(fs::exists(directory / "a"));
+    CHECK_FALSE(fs::exists(directory / "b"));
+    CHECK(fs::exists(directory / "c"));
+    CHECK(cache.hits() == 1);
+    CHECK(cache.misses() == 1);
+
+    // No temporary files are left behind.
+    unsigned files = 0;
+    for (const fs::directory_entry &file : fs::directory_iterator(directory))
+        files += file.is_regular_file();
+    CHECK(files == 2);
+
+    fs::remove_all(directory);
+}
+
+TEST_CASE("Batch workers share the result cache", "[cache]")
+{
+    const fs::path inputDirectory = "cache_input", outputDirectory = "cache_output", cacheDirectory = "cache_store";
+    fs::remove_all(inputDirectory);
+    fs::remove_all(outputDirectory);
+    fs::remove_all(cacheDirectory);
+    fs::create_directories(inputDirectory);
+
+    std::vector<unsigned char> rgb;
+    for (unsigned i = 0; i < 48 * 32; ++i)
+        rgb.insert(rgb.end(), {static_cast<unsigned char>(i * 7), static_cast<unsigned char>(i / 5), static_cast<unsigned char>(i % 200)});
+    for (const char *name : {"a.png", "b.png", "c.png"})
+    {
+        std::vector<unsigned char> encoded;
+        REQUIRE(encode_image(encoded, name, rgb.data(), 48, 32, DEFAULT_ENCODE_SETTINGS) == 0);
+        std::ofstream(inputDirectory / name, std::ios::binary).write(reinterpret_cast<const char *>(encoded.data()), encoded.size());
+        rgb[0] += 50; // a different image each time
+    }
+
+    std::vector<BatchItem> items;
+    REQUIRE(collect_batch_items(inputDirectory.string(), outputDirectory.string(), items));
+
+    Options options{"", 8, outputDirectory.string(), "", {}, 0, 0, true, 0, 3, EFFORT_FAST, false, 0, 0};
+    BatchSummary uncached = run_batch(items, options);
+    std::vector<std::vector<unsigned char>> expected;
+    for (const BatchItem &item : items)
+        expected.push_back(read_file(item.output));
+
+    ResultCache cache;
+    REQUIRE(cache.open(cacheDirectory.string(), RESULT_CACHE_DEFAULT_BYTES));
+    BatchSummary first = run_batch(items, options, nullptr, &cache);
+    CHECK(first.succeeded == 3);
+    CHECK(cache.misses() == 3);
+
+    fs::remove_all(outputDirectory);
+    fs::create_directories(outputDirectory);
+    BatchSummary second = run_batch(items, options, nullptr, &cache);
+    CHECK(second.succeeded == 3);
+    CHECK(second.pixels == 0);
+    CHECK(cache.hits() == 3);
+
+    for (size_t i = 0; i < items.size(); ++i)
+        CHECK(read_file(items[i].output) == expected[i]);
+    CHECK(uncached.succeeded == 3);
+
+    fs::remove_all(inputDirectory);
+    fs::remove_all(outputDirectory);
+    fs::remove_all(cacheDirectory);
+}
@@ -0,0 +1,197 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/codec.h"
+
+#include <cstring>
+
+static std::vector<unsigned char> make_image(unsigned width, unsigned height)
+{
+    std::vector<unsigned char> image;
+
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+        {
+            // Flat areas, small steps and jumps exercise every QOI opcode.
+            image.push_back(static_cast<unsigned char>(x < width / 2 ? 40 : x * 9));
+            image.push_back(static_cast<unsigned char>(y * 3));
+            image.push_back(static_cast<unsigned char>((x * y) % 7 == 0 ? 200 : 10));
+        }
+    }
+
+    return image;
+}
+
+static std::vector<unsigned char> decode_all(const ImageSource &source, unsigned &width, unsigned &height, unsigned &error)
+{
+    std::vector<unsigned char> decoded;
+
+    error = decode_image_bands(source, 5, width, height, [&](const unsigned char *rgb, unsigned, unsigned rows)
+                               { decoded.insert(decoded.end(), rgb, rgb + static_cast<size_t>(rows) * width * 3); });
+
+    return decoded;
+}
+
+static ImageSource stream_only(const std::vector<unsigned char> &bytes, size_t &offset)
+{
+    ByteReader read = [&bytes, &offset](unsigned char *buffer, size_t size)
+    {
+        size_t count = std::min({size, bytes.size() - offset, static_cast<size_t>(3)});
+        std::memcpy(buffer, bytes.data() + offset, count);
+        offset += count;
+        return count;
+    };
+
+    return ImageSource{read, nullptr, 0};
+}
+
+TEST_CASE("Codecs round-trip RGB images", "[codec]")
+{
+    const unsigned width = 23, height = 17;
+    std::vector<unsigned char> image = make_image(width, height);
+
+    for (const char *filename : {"out.png", "out.ppm", "out.pam", "out.qoi"})
+    {
+        std::vector<unsigned char> encoded;
+        unsigned w = 0, h = 0, error = 0;
+        size_t offset = 0;
+
+        REQUIRE(encode_image(encoded, filename, image.data(), width, height, DEFAULT_ENCODE_SETTINGS) == 0);
+        CHECK(find_codec_for_magic(encoded.data(), encoded.size()) == find_codec_for_extension(filename));
+
+        CHECK(decode_all(memory_source(encoded.data(), encoded.size()), w, h, error) == image);
+        CHECK(error == 0);
+        CHECK((w == width && h == height));
+
+        CHECK(decode_all(stream_only(encoded, offset), w, h, error) == image);
+        CHECK(error == 0);
+    }
+}
+
+TEST_CASE("PNM headers with comments and 16-bit grayscale PAM", "[codec]")
+{
+    unsigned w, h, error;
+
+    std::string ppm = "P6\n# comment\n2 1 # trailing\n255\n";
+    ppm += std::string("\x01\x02\x03\x04\x05\x06", 6);
+    std::vector<unsigned char> ppmBytes(ppm.begin(), ppm.end());
+
+    std::vector<unsigned char> decoded = decode_all(memory_source(ppmBytes.data(), ppmBytes.size()), w, h, error);
+    CHECK(error == 0);
+    CHECK(decoded == std::vector<unsigned char>{1, 2, 3, 4, 5, 6});
+
+    std::string pam = "P7\nWIDTH 2\nHEIGHT 1\nDEPTH 1\nMAXVAL 65535\nTUPLTYPE GRAYSCALE\nENDHDR\n";
+    pam += std::string("\xFF\xFF\x00\x00", 4);
+    std::vector<unsigned char> pamBytes(pam.begin(), pam.end());
+
+    decoded = decode_all(memory_source(pamBytes.data(), pamBytes.size()), w, h, error);
+    CHECK(error == 0);
+    CHECK(decoded == std::vector<unsigned char>{255, 255, 255, 0, 0, 0});
+}
+
+TEST_CASE("Unknown and truncated inputs are rejected", "[codec]")
+{
+    unsigned w, h, error;
+    std::vector<unsigned char> garbage = {'G', 'I', 'F', '8', '9', 'a'};
+
+    decode_all(memory_source(garbage.data(), garbage.size()), w, h, error);
+    CHECK(error == CODEC_ERROR_UNKNOWN_FORMAT);
+
+    std::vector<unsigned char> qoi;
+    std::vector<unsigned char> image = make_image(8, 8);
+    encode_image(qoi, "x.qoi", image.data(), 8, 8, DEFAULT_ENCODE_SETTINGS);
+    qoi.resize(qoi.size() / 2);
+
+    decode_all(memory_source(qoi.data(), qoi.size()), w, h, error);
+    CHECK(error == CODEC_ERROR_TRUNCATED);
+
+    // PPM is read band by band, so a header of 600 million pixels is accepted and only the missing data is an error.
+    const std::string header = "P6\n30000 20000\n255\n";
+    std::vector<unsigned char> huge(header.begin(), header.end());
+    huge.resize(huge.size() + 1000, 0);
+
+    decode_all(memory_source(huge.data(), huge.size()), w, h, error);
+    CHECK(error == CODEC_ERROR_TRUNCATED);
+    CHECK(w == 30000);
+    CHECK(h == 20000);
+}
+
+static std::vector<unsigned char> make_rgba_image(unsigned width, unsigned height)
+{
+    std::vector<unsigned char> rgb = make_image(width, height);
+    std::vector<unsigned char> image;
+
+    for (size_t pixel = 0; pixel < rgb.size() / 3; ++pixel)
+    {
+        image.insert(image.end(), rgb.begin() + pixel * 3, rgb.begin() + pixel * 3 + 3);
+        image.push_back(static_cast<unsigned char>(pixel % 5 == 0 ? 0 : pixel % 5 == 1 ? 128 : 255));
+    }
+
+    return image;
+}
+
+TEST_CASE("Codecs carry alpha when asked to", "[codec]")
+{
+    const unsigned width = 19, height = 11;
+    std::vector<unsigned char> image = make_rgba_image(width, height);
+
+    for (const char *filename : {"out.png", "out.pam", "out.qoi"})
+    {
+        std::vector<unsigned char> encoded, decoded;
+        unsigned w = 0, h = 0, channels = 0;
+
+        REQUIRE(encode_image(encoded, filename, image.data(), 4, width, height, NO_OUTPUT_PALETTE, DEFAULT_ENCODE_SETTINGS) == 0);
+
+        unsigned error = decode_image_bands(memory_source(encoded.data(), encoded.size()), 4, true, w, h, channels,
+                                            [&](const unsigned char *pixels, unsigned, unsigned rows)
+                                            { decoded.insert(decoded.end(), pixels, pixels + static_cast<size_t>(rows) * w * channels); });
+
+        CHECK(error == 0);
+        CHECK(channels == 4);
+        CHECK(decoded == image);
+    }
+
+    SECTION("PPM drops alpha")
+    {
+        std::vector<unsigned char> encoded;
+        unsigned w, h, error;
+
+        REQUIRE(encode_image(encoded, "out.ppm", image.data(), 4, width, height, NO_OUTPUT_PALETTE, DEFAULT_ENCODE_SETTINGS) == 0);
+        CHECK(decode_all(memory_source(encoded.data(), encoded.size()), w, h, error) == make_image(width, height));
+    }
+}
+
+TEST_CASE("Indexed PNG output reserves a transparent palette entry", "[codec]")
+{
+    Pixel red(3), blue(3);
+    red << 255, 0, 0;
+    blue << 0, 0, 255;
+
+    std::vector<unsigned char> image = {255, 0, 0, 255, 0, 0, 0, 0, 0, 0, 255, 255, 0, 0, 0, 0};
+    OutputPalette palette{{red, blue}, true};
+
+    std::vector<unsigned char> png;
+    REQUIRE(encode_image(png, "out.png", image.data(), 4, 2, 2, palette, DEFAULT_ENCODE_SETTINGS) == 0);
+
+    lodepng::State state;
+    state.info_raw.colortype = LCT_RGBA;
+    std::vector<unsigned char> decoded;
+    unsigned w, h;
+
+    REQUIRE(lodepng::decode(decoded, w, h, state, png) == 0);
+    CHECK(decoded == image);
+    CHECK(state.info_png.color.colortype == LCT_PALETTE);
+    CHECK(state.info_png.color.bitdepth == 2);
+    CHECK(state.info_png.color.palettesize == 3);
+    CHECK(state.info_png.color.palette[3] == 0); // reserved entry 0 is transparent
+
+    SECTION("Partially transparent pixels fall back to a full color type")
+    {
+        image[3] = 128;
+        REQUIRE(encode_image(png, "out.png", image.data(), 4, 2, 2, palette, DEFAULT_ENCODE_SETTINGS) == 0);
+        decoded.clear();
+        REQUIRE(lodepng::decode(decoded, w, h, png, LCT_RGBA) == 0);
+        CHECK(decoded == image);
+    }
+}
@@ -0,0 +1,127 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/dither.h"
+#include "src/palette.h"
+
+static MatrixRgb make_gradient(unsigned width, unsigned height)
+{
+    MatrixRgb m(width * height, 3);
+
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+        {
+            m.row(y * width + x) << 255.0 * x / width, 255.0 * y / height, 128.0;
+        }
+    }
+
+    return m;
+}
+
+TEST_CASE("Tiled dithering is independent of thread count", "[tiled_dither]")
+{
+    const unsigned width = 37, height = 29;
+    std::vector<Pixel> palette;
+    Pixel p1(3), p2(3), p3(3), p4(3);
+
+    p1 << 0, 0, 0;
+    p2 << 255, 0, 128;
+    p3 << 0, 255, 128;
+    p4 << 255, 255, 255;
+
+    palette = {p1, p2, p3, p4};
+
+    MatrixRgb single = make_gradient(width, height);
+    MatrixRgb multi = single;
+
+    tiled_floyd_steinberg_dither(single, palette, width, TiledDitherSettings{8, 4, 1});
+    tiled_floyd_steinberg_dither(multi, palette, width, TiledDitherSettings{8, 4, 4});
+
+    CHECK(single == multi);
+
+    SECTION("Every output pixel is a palette color")
+    {
+        for (Eigen::Index pixel = 0; pixel < single.rows(); ++pixel)
+        {
+            CHECK(find_closest_pixel_value(single.row(pixel), palette) == single.row(pixel));
+        }
+    }
+}
+
+TEST_CASE("Tiled dithering preserves average color like full-image dithering", "[tiled_dither]")
+{
+    const unsigned width = 64, height = 64;
+    std::vector<Pixel> palette;
+    Pixel black(3), white(3);
+
+    black << 0, 0, 0;
+    white << 255, 255, 255;
+    palette = {black, white};
+
+    MatrixRgb original = make_gradient(width, height);
+    MatrixRgb full = original;
+    MatrixRgb tiled = original;
+
+    floyd_steinberg_dither(full, palette, width);
+    tiled_floyd_steinberg_dither(tiled, palette, width, TiledDitherSettings{16, 8, 0});
+
+    double originalMean = original.mean();
+    double fullError = std::abs(full.mean() - originalMean);
+    double tiledError = std::abs(tiled.mean() - originalMean);
+
+    CHECK(tiledError < fullError + 2.0);
+}
+
+TEST_CASE("Tiled dithering skips transparent pixels", "[tiled_dither]")
+{
+    const unsigned width = 16, height = 12;
+    Pixel dark(3), light(3);
+    dark << 0, 0, 0;
+    light << 255, 255, 255;
+    const std::vector<Pixel> palette = {dark, light};
+
+    std::vector<unsigned char> pixels;
+    for (unsigned pixel = 0; pixel < width * height; ++pixel)
+    {
+        const unsigned char gray = static_cast<unsigned char>(pixel * 255 / (width * height));
+        pixels.insert(pixels.end(), {gray, gray, gray, static_cast<unsigned char>(pixel % 3 == 0 ? 0 : 255)});
+    }
+
+    tiled_floyd_steinberg_dither_pixels(pixels, 4, palette, width, 4, TiledDitherSettings{8, 4, 2});
+
+    for (unsigned pixel = 0; pixel < width * height; ++pixel)
+    {
+        const unsigned char *p = &pixels[pixel * 4];
+        if (pixel % 3 == 0)
+        {
+            CHECK((p[0] == 0 && p[1] == 0 && p[2] == 0 && p[3] == 0));
+        }
+        else
+        {
+            CHECK(((p[0] == 0 || p[0] == 255) && p[0] == p[1] && p[1] == p[2] && p[3] == 255));
+        }
+    }
+}
+
+TEST_CASE("Serial dithering gives the same result for any band height", "[tiled_dither]")
+{
+    const unsigned width = 23, height = 19;
+    Pixel dark(3), light(3);
+    dark << 0, 0, 0;
+    light << 255, 255, 255;
+    const std::vector<Pixel> palette = {dark, light};
+
+    std::vector<unsigned char> whole;
+    for (unsigned pixel = 0; pixel < width * height; ++pixel)
+    {
+        const unsigned char gray = static_cast<unsigned char>(pixel * 255 / (width * height));
+        whole.insert(whole.end(), {gray, gray, gray, static_cast<unsigned char>(pixel % 7 == 0 ? 0 : 255)});
+    }
+    std::vector<unsigned char> banded = whole;
+
+    tiled_floyd_steinberg_dither_pixels(whole, 4, palette, width, height, TiledDitherSettings{0, 4, 1});
+    tiled_floyd_steinberg_dither_pixels(banded, 4, palette, width, 4, TiledDitherSettings{0, 4, 1});
+
+    CHECK(whole == banded);
+}
@@ -0,0 +1,113 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include "src/shared.h"
+#include "src/engine.h"
+#include "src/wu.h"
+#include "src/cache.h"
+#include "src/histogram.h"
+#include "src/palette.h"
+#include "src/quantization.h"
+#include "test/test_images.h"
+
+static double mapped_error(const std::vector<unsigned char> &rgb, const std::vector<Pixel> &palette)
+{
+    std::vector<unsigned char> mapped = rgb;
+    map_pixels_to_palette(mapped.data(), rgb.size() / 3, 3, palette);
+    return mean_squared_error(rgb.data(), mapped.data(), rgb.size() / 3, 3);
+}
+
+TEST_CASE("Box statistics from moment tables match those of the colors", "[engine]")
+{
+    const std::vector<unsigned char> rgb = make_noisy_gradient(96, 64);
+    ColorHistogram histogram;
+    add_to_histogram(histogram, rgb.data(), 96 * 64, 3);
+    const PixelSubset subset = histogram_to_subset(histogram);
+
+    MomentTable table;
+    build_moment_table(subset, table);
+
+    for (const ColorBox &box : {ColorBox{{0, 0, 0}, {32, 32, 32}}, ColorBox{{4, 2, 0}, {20, 17, 9}}, ColorBox{{10, 0, 3}, {32, 30, 32}}})
+    {
+        // The colors whose bins lie inside the box.
+        std::vector<int> rows;
+        for (Eigen::Index row = 0; row < subset.data.rows(); ++row)
+        {
+            bool inside = true;
+            for (unsigned c = 0; c < 3; ++c)
+            {
+                const int bin = (static_cast<int>(subset.data(row, c)) >> 3) + 1;
+                inside = inside && bin > box.lower[c] && bin <= box.upper[c];
+            }
+            if (inside)
+                rows.push_back(static_cast<int>(row));
+        }
+        REQUIRE(rows.size() > 1);
+
+        PixelSubset inside;
+        inside.data = subset.data(rows, Eigen::all);
+        inside.weights = subset.weights(rows);
+
+        const ColorMoments moments = box_moments(table, box);
+        CHECK_THAT(moments.weight, Catch::Matchers::WithinAbs(inside.weights.sum(), 1e-6));
+        CHECK_THAT(moments_squared_error(moments), Catch::Matchers::WithinRel(subset_squared_error(inside), 1e-6));
+
+        const CovMatrix covariance = moments_covariance(moments);
+        const CovMatrix expected = calculate_weighted_covariance_matrix(inside.data, inside.weights);
+        CHECK((covariance - expected).cwiseAbs().maxCoeff() < 1e-6 * expected.cwiseAbs().maxCoeff());
+    }
+}
+
+TEST_CASE("Every engine builds palettes of the requested size in one run", "[engine]")
+{
+    const unsigned width = 96, height = 64;
+    const std::vector<unsigned char> rgb = make_noisy_gradient(width, height);
+    ColorHistogram histogram;
+    add_to_histogram(histogram, rgb.data(), width * height, 3);
+    const PixelSubset subset = histogram_to_subset(histogram);
+
+    const double pcaError = mapped_error(rgb, pca_engine().build_palette(subset, 32));
+
+    for (const PaletteEngine *engine : {&pca_engine(), &pca_moments_engine(), &wu_engine()})
+    {
+        CHECK(find_palette_engine(engine->name()) == engine);
+
+        const std::vector<unsigned> counts = {32, 4, 16};
+        const std::vector<std::vector<Pixel>> palettes = engine->build_palettes(subset, counts);
+        REQUIRE(palettes.size() == counts.size());
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            CHECK(palettes[i].size() == counts[i]);
+            CHECK(palettes[i] == engine->build_palette(subset, counts[i]));
+        }
+
+        // Box means are colors of the image's range, and the palettes are about as good as those of pca.
+        for (const Pixel &color : palettes[0])
+            CHECK((color.minCoeff() >= 0 && color.maxCoeff() <= 255));
+        CHECK(mapped_error(rgb, palettes[0]) < pcaError * 1.5);
+
+        // Colors in one bin cannot be told apart by the box engines, but every color there is is found.
+        const std::vector<unsigned char> few = {10, 20, 30, 10, 20, 30, 200, 0, 0, 90, 160, 250};
+        ColorHistogram fewHistogram;
+        add_to_histogram(fewHistogram, few.data(), 4, 3);
+        CHECK(engine->build_palette(histogram_to_subset(fewHistogram), 16).size() == 3);
+    }
+
+    CHECK(find_palette_engine("median-cut") == nullptr);
+}
+
+TEST_CASE("The selected engine is part of the cache key", "[engine]")
+{
+    const std::vector<unsigned char> input = {1, 2, 3, 4, 5};
+    const Options options{"", 16, "", "", {}, 0, 0, false, 0, 1, EFFORT_FAST, false, 0, 0};
+
+    CHECK(&palette_engine() == &pca_engine());
+    const std::string key = result_cache_key(input.data(), input.size(), options, "a.png");
+
+    select_palette_engine(wu_engine());
+    CHECK(&palette_engine() == &wu_engine());
+    CHECK(result_cache_key(input.data(), input.size(), options, "a.png") != key);
+
+    select_palette_engine(pca_engine());
+    CHECK(result_cache_key(input.data(), input.size(), options, "a.png") == key);
+}
@@ -3,8 +3,16 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
 
+#include <cstdio>
+#include <string>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
 #include "src/shared.h"
 #include "src/image.h"
+#include "src/input.h"
 
 TEST_CASE("Import .png and convert to Eigen Matrix", "[png_import]")
 {
@@ -60,4 +68,51 @@ TEST_CASE("Convert Eigen matrix to vector<unsigned char>", "[matrix_to_vector]")
     {
         CHECK(static_cast<double>(v[i]) == m.row(static_cast<int>(i / 3))(i % 3));
     }
-}
\ No newline at end of file
+}
+static std::string read_all(InputFile &input)
+{
+    std::string bytes;
+    unsigned char buffer[7];
+    for (size_t count = input.read(buffer, sizeof(buffer)); count > 0; count = input.read(buffer, sizeof(buffer)))
+        bytes.append(reinterpret_cast<const char *>(buffer), count);
+    return bytes;
+}
+
+TEST_CASE("InputFile reads its input again after rewind()", "[input]")
+{
+    const std::string contents = "P6\n1 1\n255\nabc and some more bytes";
+    const std::string fileName = "input_rewind.ppm";
+    std::FILE *file = std::fopen(fileName.c_str(), "wb");
+    std::fwrite(contents.data(), 1, contents.size(), file);
+    std::fclose(file);
+
+    for (bool allowMapping : {true, false})
+    {
+        InputFile input;
+        REQUIRE(input.open(fileName.c_str(), allowMapping) == 0);
+        CHECK(read_all(input) == contents);
+        REQUIRE(input.rewind() == 0);
+        CHECK(read_all(input) == contents);
+    }
+    std::remove(fileName.c_str());
+
+#ifdef __linux__
+    // A pipe cannot seek; with `rewindable` it is read again from its spooled copy.
+    for (bool rewindable : {true, false})
+    {
+        int fds[2];
+        REQUIRE(pipe(fds) == 0);
+        REQUIRE(write(fds[1], contents.data(), contents.size()) == static_cast<ssize_t>(contents.size()));
+        close(fds[1]);
+
+        InputFile input;
+        REQUIRE(input.open(("/dev/fd/" + std::to_string(fds[0])).c_str(), true, rewindable) == 0);
+        close(fds[0]);
+
+        CHECK(read_all(input) == contents);
+        CHECK(input.rewind() == (rewindable ? 0u : 78u));
+        if (rewindable)
+            CHECK(read_all(input) == contents);
+    }
+#endif
+}
@@ -0,0 +1,122 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/octree.h"
+#include "src/engine.h"
+#include "src/histogram.h"
+#include "src/palette.h"
+
+static std::vector<unsigned char> make_noise(size_t numPixels, uint32_t seed)
+{
+    std::vector<unsigned char> rgb(numPixels * 3);
+    uint32_t state = seed;
+    for (unsigned char &value : rgb)
+    {
+        state = state * 1664525u + 1013904223u;
+        value = static_cast<unsigned char>(state >> 24);
+    }
+    return rgb;
+}
+
+TEST_CASE("Octree memory does not depend on the image", "[octree]")
+{
+    Octree small(1024), large(1024);
+    const size_t poolBytes = small.pool_bytes();
+
+    const std::vector<unsigned char> few = make_noise(100, 1);
+    small.add_pixels(few.data(), 100, 3);
+
+    // Noise has as many colors as pixels; bands of it are added as a decoder would deliver them.
+    const std::vector<unsigned char> many = make_noise(1 << 18, 2);
+    for (size_t first = 0; first < (1 << 18); first += 4096)
+        large.add_pixels(many.data() + first * 3, 4096, 3);
+
+    CHECK(small.pool_bytes() == poolBytes);
+    CHECK(large.pool_bytes() == poolBytes);
+    CHECK(large.node_count() <= 1024);
+    CHECK(large.totalPixels == (1 << 18));
+
+    const std::vector<Pixel> palette = large.palette(64);
+    CHECK(palette.size() <= 64);
+    CHECK(palette.size() >= 32);
+    for (const Pixel &color : palette)
+        CHECK((color.minCoeff() >= 0 && color.maxCoeff() <= 255));
+
+    // Reducing for the palette leaves the tree itself as it was.
+    CHECK(large.palette(64) == palette);
+    CHECK(large.palette(8).size() <= 8);
+}
+
+TEST_CASE("Octree palettes keep the colors of images with few of them", "[octree]")
+{
+    const std::vector<unsigned char> rgba = {10, 20, 30, 255, 200, 0, 0, 255, 10, 20, 30, 255, 5, 5, 5, 0, 90, 160, 250, 128};
+    Octree tree;
+    tree.add_pixels(rgba.data(), 5, 4);
+
+    CHECK(tree.totalPixels == 5);
+    CHECK(tree.transparentPixels == 1);
+    CHECK(tree.translucentPixels == 1);
+    CHECK(tree.leaf_count() == 3);
+
+    std::vector<Pixel> palette = tree.palette(16);
+    REQUIRE(palette.size() == 3);
+    std::vector<uint32_t> colors;
+    for (const Pixel &color : palette)
+        colors.push_back((static_cast<uint32_t>(color(0)) << 16) | (static_cast<uint32_t>(color(1)) << 8) | static_cast<uint32_t>(color(2)));
+    std::sort(colors.begin(), colors.end());
+    CHECK(colors == std::vector<uint32_t>{0x0A141E, 0x5AA0FA, 0xC80000});
+
+    // Two leaves left: the pixel counts are kept in the merged mean.
+    CHECK(tree.palette(2).size() <= 2);
+    CHECK(Octree().palette(16).empty());
+}
+
+TEST_CASE("The octree engine maps about as well as the others", "[octree]")
+{
+    const unsigned width = 128, height = 96;
+    std::vector<unsigned char> rgb;
+    for (unsigned y = 0; y < height; ++y)
+        for (unsigned x = 0; x < width; ++x)
+            rgb.insert(rgb.end(), {static_cast<unsigned char>(x * 2), static_cast<unsigned char>(y * 2),
+                                   static_cast<unsigned char>((x + y) % 64 * 4)});
+
+    ColorHistogram histogram;
+    add_to_histogram(histogram, rgb.data(), width * height, 3);
+    const PixelSubset subset = histogram_to_subset(histogram);
+
+    auto mapped_error = [&](const std::vector<Pixel> &palette)
+    {
+        std::vector<unsigned char> mapped = rgb;
+        map_pixels_to_palette(mapped.data(), width * height, 3, palette);
+        return mean_squared_error(rgb.data(), mapped.data(), width * height, 3);
+    };
+
+    REQUIRE(find_palette_engine("octree") == &octree_engine());
+    const std::vector<Pixel> palette = octree_engine().build_palette(subset, 64);
+    CHECK(palette.size() <= 64);
+
+    // Fed straight from the pixels instead of the distinct colors, the tree ends up with as many leaves.
+    Octree streamed;
+    streamed.add_pixels(rgb.data(), width * height, 3);
+    CHECK(streamed.palette(64).size() == palette.size());
+
+    CHECK(mapped_error(palette) < 2.0 * mapped_error(pca_engine().build_palette(subset, 64)));
+}
+
+TEST_CASE("The octree engine ignores colors whose weight rounds to no pixels", "[octree]")
+{
+    // Three colors with pixels and, in other branches of the tree, three whose weights round to 0.
+    PixelSubset subset;
+    subset.data.resize(6, 3);
+    subset.data << 0, 0, 0, 255, 255, 255, 0, 255, 0, 128, 0, 0, 0, 0, 128, 128, 128, 128;
+    subset.weights.resize(6);
+    subset.weights << 10, 10, 10, 0.2, 0.2, 0.2;
+
+    const std::vector<Pixel> palette = octree_engine().build_palette(subset, 3);
+    REQUIRE(palette.size() == 3);
+    std::vector<uint32_t> colors;
+    for (const Pixel &color : palette)
+        colors.push_back((static_cast<uint32_t>(color(0)) << 16) | (static_cast<uint32_t>(color(1)) << 8) | static_cast<uint32_t>(color(2)));
+    std::sort(colors.begin(), colors.end());
+    CHECK(colors == std::vector<uint32_t>{0x000000, 0x00FF00, 0xFFFFFF});
+}
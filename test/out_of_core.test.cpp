@@ -0,0 +1,95 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/out_of_core.h"
+#include "src/quantization.h"
+#include "src/dither.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+static Options make_options(const std::string &outputFileName, bool dither, uint64_t maxMemory)
+{
+    return Options{"", 8, outputFileName, "", {}, 0, 0, dither, 0, 2, EFFORT_FAST, false, 0, maxMemory};
+}
+
+TEST_CASE("Byte sizes accept binary suffixes", "[out_of_core]")
+{
+    uint64_t bytes = 0;
+
+    CHECK((parse_byte_size("4096", bytes) && bytes == 4096));
+    CHECK((parse_byte_size("512M", bytes) && bytes == 512ull << 20));
+    CHECK((parse_byte_size("1.5G", bytes) && bytes == 3ull << 29));
+    CHECK_FALSE(parse_byte_size("12Q", bytes));
+    CHECK_FALSE(parse_byte_size("lots", bytes));
+    CHECK_FALSE(parse_byte_size("nan", bytes));
+    CHECK_FALSE(parse_byte_size("inf", bytes));
+    CHECK_FALSE(parse_byte_size("1e30", bytes));
+    CHECK_FALSE(parse_byte_size("17179869184G", bytes));
+}
+
+TEST_CASE("Memory plan keeps large images out of core", "[out_of_core]")
+{
+    Options unlimited = make_options("out.png", true, 0);
+    CHECK_FALSE(plan_memory(unlimited, 100000, 100000, 3).outOfCore);
+
+    Options limited = make_options("out.png", true, 4ull << 30);
+    CHECK_FALSE(plan_memory(limited, 640, 480, 3).outOfCore);
+
+    MemoryPlan plan = plan_memory(limited, 100000, 100000, 3);
+    unsigned ditherRows;
+    dither_settings_for(limited, ditherRows);
+
+    CHECK(plan.outOfCore);
+    CHECK(plan.bandRows % ditherRows == 0);
+    CHECK(plan.maxColors > 0);
+    CHECK(plan.maxColors * HISTOGRAM_BYTES_PER_COLOR <= limited.maxMemory / 2);
+
+    // Sampling is left to the histogram outgrowing the bound, so images with few colors are not sampled at all.
+    CHECK(plan.sampleBudget == 0);
+}
+
+TEST_CASE("Band-wise second pass matches in-core quantization", "[out_of_core]")
+{
+    const unsigned width = 61, height = 150;
+    std::vector<unsigned char> image;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+            image.insert(image.end(), {static_cast<unsigned char>(x * 4), static_cast<unsigned char>(y), static_cast<unsigned char>((x * y) % 97)});
+    }
+
+    std::vector<unsigned char> ppm;
+    REQUIRE(encode_image(ppm, "in.ppm", image.data(), width, height, DEFAULT_ENCODE_SETTINGS) == 0);
+
+    ColorHistogram histogram;
+    add_to_histogram(histogram, image.data(), width * height);
+
+    for (bool dither : {false, true})
+    {
+        const std::string outputFileName = "out_of_core_test.ppm";
+        Options options = make_options(outputFileName, dither, 1);
+        options.width = width;
+        options.height = height;
+
+        std::vector<unsigned char> expected = image;
+        std::vector<Pixel> palette = quantize_pixels(expected, 3, histogram, options);
+
+        MemoryPlan plan{true, dither ? 2u * STREAM_BAND_ROWS : 10u, 0, 0, 16};
+        REQUIRE(write_quantized_bands(memory_source(ppm.data(), ppm.size()), plan, palette, NO_OUTPUT_PALETTE, options) == 0);
+
+        std::ifstream file(outputFileName, std::ios::binary);
+        std::vector<unsigned char> written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::remove(outputFileName.c_str());
+
+        std::vector<unsigned char> decoded;
+        unsigned w, h, error;
+        error = decode_image_bands(memory_source(written.data(), written.size()), height, w, h,
+                                   [&](const unsigned char *rgb, unsigned, unsigned rows)
+                                   { decoded.insert(decoded.end(), rgb, rgb + static_cast<size_t>(rows) * w * 3); });
+
+        CHECK(error == 0);
+        CHECK(decoded == expected);
+    }
+}
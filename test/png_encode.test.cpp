@@ -0,0 +1,123 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/lodepng.h"
+#include "src/png_encode.h"
+
+static std::vector<unsigned char> make_noisy_image(unsigned width, unsigned height)
+{
+    std::vector<unsigned char> image;
+    unsigned seed = 12345;
+
+    for (unsigned i = 0; i < width * height; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        image.push_back(static_cast<unsigned char>(i % width));
+        image.push_back(static_cast<unsigned char>(i / width));
+        image.push_back(static_cast<unsigned char>((seed >> 16) & 0x0F));
+    }
+
+    return image;
+}
+
+static bool round_trips(const std::vector<unsigned char> &png, const std::vector<unsigned char> &image)
+{
+    std::vector<unsigned char> decoded;
+    unsigned width, height;
+
+    return lodepng::decode(decoded, width, height, png, LCT_RGB) == 0 && decoded == image;
+}
+
+TEST_CASE("Every encode effort produces a lossless PNG", "[png_encode]")
+{
+    const unsigned width = 97, height = 61;
+    std::vector<unsigned char> image = make_noisy_image(width, height);
+
+    for (EncodeEffort effort : {EFFORT_STORE, EFFORT_FAST, EFFORT_BALANCED, EFFORT_MAX})
+    {
+        std::vector<unsigned char> png;
+
+        CHECK(encode_png(png, image.data(), width, height, LCT_RGB, EncodeSettings{effort, 1}) == 0);
+        CHECK(round_trips(png, image));
+    }
+}
+
+TEST_CASE("Parallel deflate produces a valid zlib stream", "[png_encode]")
+{
+    // Large enough to be split into several independently deflated chunks.
+    const unsigned width = 640, height = 480;
+    std::vector<unsigned char> image = make_noisy_image(width, height);
+    std::vector<unsigned char> serial, parallel;
+
+    CHECK(encode_png(serial, image.data(), width, height, LCT_RGB, EncodeSettings{EFFORT_FAST, 1}) == 0);
+    CHECK(encode_png(parallel, image.data(), width, height, LCT_RGB, EncodeSettings{EFFORT_FAST, 4}) == 0);
+
+    CHECK(round_trips(parallel, image));
+    CHECK(parallel.size() < serial.size() * 11 / 10);
+}
+
+static std::vector<unsigned char> write_in_bands(const std::vector<unsigned char> &image, unsigned width, unsigned height,
+                                                 unsigned channels, unsigned bandRows, const OutputPalette &palette,
+                                                 const EncodeSettings &settings)
+{
+    std::vector<unsigned char> png;
+    PngBandWriter writer([&png](const unsigned char *data, size_t size)
+                         { png.insert(png.end(), data, data + size); return true; },
+                         width, height, channels, palette, settings);
+
+    for (unsigned row = 0; row < height; row += bandRows)
+    {
+        const unsigned rows = std::min(bandRows, height - row);
+        REQUIRE(writer.write_rows(image.data() + static_cast<size_t>(row) * width * channels, rows) == 0);
+    }
+    REQUIRE(writer.finish() == 0);
+
+    return png;
+}
+
+TEST_CASE("PNG band writer produces one valid stream from many bands", "[png_encode]")
+{
+    const unsigned width = 83, height = 57;
+    std::vector<unsigned char> image = make_noisy_image(width, height);
+
+    for (EncodeEffort effort : {EFFORT_STORE, EFFORT_BALANCED})
+    {
+        for (unsigned bandRows : {1u, 7u, height})
+        {
+            CHECK(round_trips(write_in_bands(image, width, height, 3, bandRows, NO_OUTPUT_PALETTE, EncodeSettings{effort, 1}), image));
+        }
+    }
+
+    CHECK(round_trips(write_in_bands(image, width, height, 3, 16, NO_OUTPUT_PALETTE, EncodeSettings{EFFORT_FAST, 3}), image));
+
+    SECTION("Indexed output with a transparent entry")
+    {
+        Pixel dark(3), light(3);
+        dark << 10, 20, 30;
+        light << 200, 210, 220;
+
+        std::vector<unsigned char> rgba;
+        for (unsigned pixel = 0; pixel < width * height; ++pixel)
+        {
+            if (pixel % 7 == 0)
+                rgba.insert(rgba.end(), {0, 0, 0, 0});
+            else if (pixel % 3 == 0)
+                rgba.insert(rgba.end(), {10, 20, 30, 255});
+            else
+                rgba.insert(rgba.end(), {200, 210, 220, 255});
+        }
+
+        std::vector<unsigned char> png = write_in_bands(rgba, width, height, 4, 5, OutputPalette{{dark, light}, true},
+                                                        DEFAULT_ENCODE_SETTINGS);
+
+        lodepng::State state;
+        state.info_raw.colortype = LCT_RGBA;
+        std::vector<unsigned char> decoded;
+        unsigned w, h;
+
+        REQUIRE(lodepng::decode(decoded, w, h, state, png) == 0);
+        CHECK(decoded == rgba);
+        CHECK(state.info_png.color.colortype == LCT_PALETTE);
+        CHECK(state.info_png.color.bitdepth == 2);
+    }
+}
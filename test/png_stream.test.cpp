@@ -0,0 +1,126 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/lodepng.h"
+#include "src/png_stream.h"
+
+#include <cstring>
+
+static std::vector<unsigned char> make_test_image(unsigned width, unsigned height, unsigned channels)
+{
+    std::vector<unsigned char> image;
+
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+        {
+            image.push_back(static_cast<unsigned char>(x * 255 / width));
+            image.push_back(static_cast<unsigned char>((x * y) & 0xFF));
+            image.push_back(static_cast<unsigned char>(y * 7));
+            if (channels == 4)
+                image.push_back(static_cast<unsigned char>(255 - x));
+        }
+    }
+
+    return image;
+}
+
+static std::vector<unsigned char> decode_by_bands(const std::vector<unsigned char> &png, unsigned bandRows, unsigned &width, unsigned &height, unsigned &error)
+{
+    size_t offset = 0;
+    auto readMemory = [&](unsigned char *buffer, size_t size)
+    {
+        // Hand out at most 7 bytes per call to exercise reads that straddle chunk boundaries.
+        size_t count = std::min({size, png.size() - offset, static_cast<size_t>(7)});
+        std::memcpy(buffer, png.data() + offset, count);
+        offset += count;
+        return count;
+    };
+
+    std::vector<unsigned char> decoded;
+    error = stream_png_bands(readMemory, bandRows, width, height, [&](const unsigned char *rgb, unsigned, unsigned rows)
+                             { decoded.insert(decoded.end(), rgb, rgb + static_cast<size_t>(rows) * width * 3); });
+
+    return decoded;
+}
+
+TEST_CASE("Streaming decode matches lodepng", "[png_stream]")
+{
+    const unsigned width = 53, height = 41;
+    std::vector<unsigned char> expected, png;
+    unsigned expectedWidth, expectedHeight, w = 0, h = 0, error = 0;
+
+    SECTION("RGB, default filters")
+    {
+        lodepng::encode(png, make_test_image(width, height, 3), width, height, LCT_RGB);
+    }
+
+    SECTION("RGBA input is flattened to RGB")
+    {
+        lodepng::encode(png, make_test_image(width, height, 4), width, height, LCT_RGBA);
+    }
+
+    SECTION("Palette image with uncompressed blocks")
+    {
+        lodepng::State state;
+        state.info_raw.colortype = LCT_RGB;
+        state.info_png.color.colortype = LCT_PALETTE;
+        state.info_png.color.bitdepth = 4;
+        state.encoder.auto_convert = 0;
+        state.encoder.zlibsettings.btype = 0;
+        std::vector<unsigned char> image(width * height * 3);
+        for (unsigned i = 0; i < width * height; ++i)
+        {
+            image[i * 3] = static_cast<unsigned char>((i % 5) * 50);
+            image[i * 3 + 1] = image[i * 3 + 2] = 10;
+        }
+        for (unsigned i = 0; i < 5; ++i)
+            lodepng_palette_add(&state.info_png.color, static_cast<unsigned char>(i * 50), 10, 10, 255);
+        lodepng::encode(png, image, width, height, state);
+    }
+
+    SECTION("Interlaced image")
+    {
+        lodepng::State state;
+        state.info_raw.colortype = LCT_RGB;
+        state.info_png.interlace_method = 1;
+        lodepng::encode(png, make_test_image(width, height, 3), width, height, state);
+    }
+
+    REQUIRE(lodepng::decode(expected, expectedWidth, expectedHeight, png, LCT_RGB) == 0);
+
+    std::vector<unsigned char> decoded = decode_by_bands(png, 8, w, h, error);
+
+    CHECK(error == 0);
+    CHECK(w == expectedWidth);
+    CHECK(h == expectedHeight);
+    CHECK(decoded == expected);
+}
+
+TEST_CASE("Streaming decode reports truncated input", "[png_stream]")
+{
+    std::vector<unsigned char> png;
+    unsigned w, h, error = 0;
+
+    lodepng::encode(png, make_test_image(16, 16, 3), 16, 16, LCT_RGB);
+    png.resize(png.size() / 2);
+
+    decode_by_bands(png, 4, w, h, error);
+
+    CHECK(error != 0);
+}
+
+TEST_CASE("Streaming decode checks the zlib checksum", "[png_stream]")
+{
+    std::vector<unsigned char> png;
+    unsigned w, h, error = 0;
+
+    lodepng::encode(png, make_test_image(16, 16, 3), 16, 16, LCT_RGB);
+
+    // The last byte of the Adler-32 trailer comes before the CRC of the last IDAT chunk and the 12-byte IEND chunk.
+    png[png.size() - 12 - 4 - 1] ^= 0x01;
+
+    decode_by_bands(png, 4, w, h, error);
+
+    CHECK(error == 58);
+}
@@ -0,0 +1,56 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/progress.h"
+#include "src/log.h"
+
+#include <thread>
+
+typedef struct
+{
+    std::vector<unsigned> completed;
+    std::vector<std::string> stages;
+} Updates;
+
+static void record(void *user, const char *stage, unsigned completed, unsigned)
+{
+    Updates *updates = static_cast<Updates *>(user);
+    updates->completed.push_back(completed);
+    updates->stages.push_back(stage);
+}
+
+TEST_CASE("Progress updates are throttled per stage", "[progress]")
+{
+    Updates updates;
+    QuietScope quiet;
+    {
+        ProgressScope scope(ProgressHook{record, &updates});
+
+        // A tight loop only reports its first and last step.
+        for (unsigned i = 1; i <= 100000; ++i)
+            report_progress("Counting", i, 100000);
+        REQUIRE(updates.completed.size() >= 2);
+        CHECK(updates.completed.front() == 1);
+        CHECK(updates.completed.back() == 100000);
+        CHECK(updates.completed.size() < 10);
+
+        // A new stage starts right away; a pause lets the next update through.
+        updates.completed.clear();
+        report_progress("Waiting", 1, 3);
+        report_progress("Waiting", 2, 3);
+        std::this_thread::sleep_for(std::chrono::milliseconds(PROGRESS_INTERVAL_MS + 20));
+        report_progress("Waiting", 3, 3);
+        CHECK(updates.completed == std::vector<unsigned>{1, 3});
+        CHECK(updates.stages.back() == "Waiting");
+    }
+
+    // The callback is removed with its scope.
+    updates.completed.clear();
+    report_progress("Counting", 1, 2);
+    CHECK(updates.completed.empty());
+
+    ProgressMode mode;
+    CHECK(parse_progress_mode("json", mode));
+    CHECK(mode == PROGRESS_JSON);
+    CHECK_FALSE(parse_progress_mode("loud", mode));
+}
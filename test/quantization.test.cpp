@@ -3,6 +3,8 @@
 
 #include "src/shared.h"
 #include "src/quantization.h"
+#include "src/palette.h"
+#include "test/test_images.h"
 
 TEST_CASE("Calculate covariance matrix", "[covariance_matrix]")
 {
@@ -115,4 +117,192 @@ TEST_CASE("Sort PCA scores and data matrix", "[sorting_by_pca]")
     CHECK((z.row(3)(0) == 1 && z.row(3)(1) == 2 && z.row(3)(2) == 5));
     CHECK((z.row(4)(0) == 4 && z.row(4)(1) == 2 && z.row(4)(2) == 7));
     CHECK((z.row(5)(0) == 0 && z.row(5)(1) == 7 && z.row(5)(2) == 8));
-}
\ No newline at end of file
+}
+TEST_CASE("Weighted covariance matches covariance of repeated rows", "[covariance_matrix]")
+{
+    using Catch::Matchers::WithinAbs;
+
+    MatrixRgb distinct(3, 3), repeated(6, 3);
+    Eigen::VectorXd weights(3);
+
+    distinct << 1.0, 2.0, 3.0,
+        2.0, 4.0, 1.0,
+        4.0, 1.0, 2.0;
+    weights << 1, 2, 3;
+
+    repeated << 1.0, 2.0, 3.0,
+        2.0, 4.0, 1.0,
+        2.0, 4.0, 1.0,
+        4.0, 1.0, 2.0,
+        4.0, 1.0, 2.0,
+        4.0, 1.0, 2.0;
+
+    CovMatrix weighted = calculate_weighted_covariance_matrix(distinct, weights);
+    CovMatrix expected = calculate_covariance_matrix(repeated);
+
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            CHECK_THAT(weighted(r, c), WithinAbs(expected(r, c), 1e-9));
+        }
+    }
+}
+
+TEST_CASE("Find weighted cutting point in PCA scores", "[cutting_point]")
+{
+    Eigen::VectorXd scores(5), even(5), heavy(5);
+
+    scores << -3.0, -2.0, 0.0, 2.0, 3.0;
+    even << 1, 1, 1, 1, 1;
+    heavy << 1, 1, 1, 1, 50;
+
+    CHECK(find_weighted_cutting_point(scores, even) == 2);
+    CHECK(find_weighted_cutting_point(scores, heavy) == 3);
+}
+
+TEST_CASE("Histogram leaves transparent pixels out of the color counts", "[histogram]")
+{
+    const unsigned char rgba[] = {10, 20, 30, 255, 10, 20, 30, 0, 99, 99, 99, 0, 10, 20, 30, 64, 1, 2, 3, 255};
+    ColorHistogram histogram;
+
+    add_to_histogram(histogram, rgba, 5, 4);
+
+    CHECK(histogram.totalPixels == 5);
+    CHECK(histogram.transparentPixels == 2);
+    CHECK(histogram.translucentPixels == 1);
+    CHECK(histogram.counts.size() == 2);
+    CHECK(histogram.counts.at(0x0A141E) == 2);
+    CHECK(histogram_to_subset(histogram).weights.sum() == 3);
+}
+
+TEST_CASE("A transparent first pixel adds no color to the histogram", "[histogram]")
+{
+    // Red and blue halves behind a transparent first pixel of another color.
+    std::vector<unsigned char> rgba = {77, 77, 77, 0};
+    for (unsigned pixel = 1; pixel < 64; ++pixel)
+        rgba.insert(rgba.end(), {static_cast<unsigned char>(pixel < 32 ? 255 : 0), 0, static_cast<unsigned char>(pixel < 32 ? 0 : 255), 255});
+
+    ColorHistogram histogram;
+    add_to_histogram(histogram, rgba.data(), 64, 4);
+
+    CHECK(histogram.transparentPixels == 1);
+    CHECK(histogram.counts.size() == 2);
+    CHECK(histogram.counts.count(0x4D4D4D) == 0);
+
+    const PixelSubset subset = histogram_to_subset(histogram);
+    CHECK(subset.data.rows() == 2);
+    CHECK((subset.weights.array() > 0).all());
+}
+
+TEST_CASE("Spatial sampling stays within the pixel budget", "[histogram]")
+{
+    const unsigned width = 301, height = 199;
+    std::vector<unsigned char> image = make_noisy_gradient(width, height);
+
+    SpatialSampler sampler = make_spatial_sampler(width, height, 5000);
+    CHECK(sampler.step > 1);
+
+    ColorHistogram inOneBand, inSmallBands;
+    add_sampled_to_histogram(inOneBand, sampler, image.data(), 0, height, 3);
+    for (unsigned row = 0; row < height; row += 7)
+    {
+        const unsigned rows = std::min(7u, height - row);
+        add_sampled_to_histogram(inSmallBands, sampler, image.data() + static_cast<size_t>(row) * width * 3, row, rows, 3);
+    }
+
+    const uint64_t cells = static_cast<uint64_t>((width + sampler.step - 1) / sampler.step) * ((height + sampler.step - 1) / sampler.step);
+    CHECK(inOneBand.totalPixels == cells);
+    CHECK(inOneBand.totalPixels <= 5000);
+    CHECK(inOneBand.counts == inSmallBands.counts);
+
+    CHECK(make_spatial_sampler(width, height, 0).step == 1);
+    CHECK(make_spatial_sampler(width, height, width * height).step == 1);
+}
+
+TEST_CASE("A palette from a sampled proxy is close to the full-resolution one", "[histogram]")
+{
+    const unsigned width = 320, height = 240;
+    const std::vector<unsigned char> image = make_noisy_gradient(width, height);
+
+    auto quantized_error = [&](uint64_t budget)
+    {
+        ColorHistogram histogram;
+        add_sampled_to_histogram(histogram, make_spatial_sampler(width, height, budget), image.data(), 0, height, 3);
+
+        std::vector<Pixel> palette = build_palette(histogram_to_subset(histogram), 16);
+        std::vector<unsigned char> mapped = image;
+        map_pixels_to_palette(mapped.data(), width * height, 3, palette);
+
+        return mean_squared_error(image.data(), mapped.data(), width * height, 3);
+    };
+
+    const double fullError = quantized_error(0);
+    const double proxyError = quantized_error(8000);
+
+    CHECK(proxyError <= fullError * 1.15);
+}
+
+TEST_CASE("An error target stops splitting once the palette is good enough", "[error_target]")
+{
+    const unsigned width = 160, height = 120;
+    const std::vector<unsigned char> image = make_noisy_gradient(width, height);
+    ColorHistogram histogram;
+    add_to_histogram(histogram, image.data(), width * height, 3);
+    const PixelSubset subset = histogram_to_subset(histogram);
+
+    // Distinct colors with weights have the squared error of the pixels they stand for.
+    PixelSubset pixels;
+    pixels.data.resize(width * height, 3);
+    for (unsigned i = 0; i < width * height; ++i)
+        pixels.data.row(i) << image[3 * i], image[3 * i + 1], image[3 * i + 2];
+    CHECK_THAT(subset_squared_error(subset), Catch::Matchers::WithinRel(subset_squared_error(pixels), 1e-9));
+
+    std::vector<Pixel> previous;
+    for (double targetMse : {400.0, 250.0, 180.0})
+    {
+        const std::vector<Pixel> palette = build_palettes(subset, {256}, nullptr, targetMse).front();
+        REQUIRE(palette.size() < 256);
+        CHECK(palette.size() > previous.size());
+
+        // The palette is the one build_palette() gives for its size; mapping to the nearest color only lowers the error.
+        CHECK(palette == build_palette(subset, static_cast<unsigned>(palette.size())));
+
+        std::vector<unsigned char> mapped = image;
+        map_pixels_to_palette(mapped.data(), width * height, 3, palette);
+        CHECK(mean_squared_error(image.data(), mapped.data(), width * height, 3) <= targetMse + 1.0);
+
+        previous = palette;
+    }
+
+    // The color count stays an upper bound.
+    CHECK(build_palettes(subset, {8}, nullptr, 0.01).front() == build_palette(subset, 8));
+
+    CHECK_THAT(psnr_to_mse(mse_to_psnr(42.0)), Catch::Matchers::WithinRel(42.0, 1e-12));
+    CHECK_THAT(mse_to_psnr(255.0 * 255.0), Catch::Matchers::WithinAbs(0.0, 1e-12));
+}
+
+TEST_CASE("A sample of only transparent pixels leaves opaque pixels as they are", "[histogram]")
+{
+    // One opaque pixel in a transparent 8x8 image; a budget of one pixel samples a transparent one.
+    const unsigned width = 8, height = 8;
+    std::vector<unsigned char> image(width * height * 4, 0);
+    const size_t opaque = (3 * width + 5) * 4;
+    image[opaque] = 200, image[opaque + 1] = 100, image[opaque + 2] = 50, image[opaque + 3] = 255;
+    image[4] = 9; // transparent, but not black
+
+    ColorHistogram histogram;
+    add_sampled_to_histogram(histogram, make_spatial_sampler(width, height, 1), image.data(), 0, height, 4);
+    REQUIRE(histogram.counts.empty());
+
+    for (bool dither : {false, true})
+    {
+        std::vector<unsigned char> quantized = image;
+        Options options{"", 4, "", "", {}, width, height, dither, 0, 1, EFFORT_FAST, false, 1, 0};
+        CHECK(quantize_pixels(quantized, 4, histogram, options).empty());
+
+        CHECK(std::vector<unsigned char>(quantized.begin() + opaque, quantized.begin() + opaque + 4) ==
+              std::vector<unsigned char>{200, 100, 50, 255});
+        CHECK(quantized[4] == 0);
+    }
+}
@@ -0,0 +1,244 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/quantizer.h"
+#include "src/quantization.h"
+#include "src/engine.h"
+#include "src/cqt.h"
+
+#include <cstring>
+#include <sstream>
+
+static std::vector<unsigned char> make_rgba(unsigned width, unsigned height)
+{
+    std::vector<unsigned char> rgba;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+            rgba.insert(rgba.end(), {static_cast<unsigned char>(x * 9), static_cast<unsigned char>(y * 5 + x),
+                                     static_cast<unsigned char>((x * y) % 251), static_cast<unsigned char>(x + y < 4 ? 0 : 255)});
+    }
+    return rgba;
+}
+
+// Colors of the indexed image, as packed RGBA.
+static std::vector<unsigned char> expand(const Quantizer &quantizer)
+{
+    std::vector<unsigned char> pixels;
+    for (unsigned char index : quantizer.indices())
+        pixels.insert(pixels.end(), quantizer.palette().begin() + 4 * index, quantizer.palette().begin() + 4 * index + 4);
+    return pixels;
+}
+
+TEST_CASE("Quantizer matches the command line pipeline", "[quantizer]")
+{
+    const unsigned width = 45, height = 70;
+    const std::vector<unsigned char> rgba = make_rgba(width, height);
+
+    for (bool dither : {false, true})
+    {
+        Quantizer quantizer(QuantizerSettings{12, dither, 0});
+
+        std::ostringstream console;
+        std::streambuf *previous = std::cout.rdbuf(console.rdbuf());
+        const unsigned error = quantizer.quantize(PixelBuffer{rgba.data(), width, height, 0, PIXEL_FORMAT_RGBA8});
+        std::cout.rdbuf(previous);
+
+        REQUIRE(error == 0);
+        CHECK(console.str().empty());
+        CHECK(consoleOutput);
+        CHECK(quantizer.palette_size() == 13);
+        CHECK(quantizer.indices().size() == width * height);
+
+        std::vector<unsigned char> image = rgba;
+        ColorHistogram histogram;
+        add_to_histogram(histogram, image.data(), width * height, 4);
+        Options options{"", 12, "", "", {}, width, height, dither, 0, 1, EFFORT_FAST, false, 0, 0};
+        quantize_pixels(image, 4, histogram, options);
+
+        // The ditherer leaves the alpha of transparent pixels; the palette's transparent entry is all zero.
+        for (size_t pixel = 0; pixel < width * height; ++pixel)
+        {
+            if (rgba[pixel * 4 + 3] == 0)
+                image[pixel * 4] = image[pixel * 4 + 1] = image[pixel * 4 + 2] = 0;
+        }
+        CHECK(expand(quantizer) == image);
+    }
+}
+
+TEST_CASE("Quantizer reads strided BGR buffers in place", "[quantizer]")
+{
+    const unsigned width = 31, height = 22, padding = 13;
+    const std::vector<unsigned char> rgba = make_rgba(width, height);
+
+    Quantizer reference(QuantizerSettings{8, false, 0});
+    REQUIRE(reference.quantize(PixelBuffer{rgba.data(), width, height, 0, PIXEL_FORMAT_RGBA8}) == 0);
+
+    // BGRA rows followed by padding, and the same image without alpha in BGR and RGB.
+    const size_t stride = width * 4 + padding;
+    std::vector<unsigned char> bgra(stride * height, 0xEE), bgr, rgb;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+        {
+            const unsigned char *in = &rgba[(y * width + x) * 4];
+            unsigned char *out = &bgra[y * stride + x * 4];
+            out[0] = in[2], out[1] = in[1], out[2] = in[0], out[3] = in[3];
+            bgr.insert(bgr.end(), {in[2], in[1], in[0]});
+            rgb.insert(rgb.end(), {in[0], in[1], in[2]});
+        }
+    }
+
+    Quantizer quantizer(QuantizerSettings{8, false, 0});
+    REQUIRE(quantizer.quantize(PixelBuffer{bgra.data(), width, height, stride, PIXEL_FORMAT_BGRA8}) == 0);
+    CHECK(quantizer.palette() == reference.palette());
+    CHECK(quantizer.indices() == reference.indices());
+
+    // Scratch buffers are reused across calls; results only depend on the input.
+    Quantizer opaque(QuantizerSettings{8, true, 0});
+    REQUIRE(opaque.quantize(PixelBuffer{bgr.data(), width, height, 0, PIXEL_FORMAT_BGR8}) == 0);
+    const std::vector<unsigned char> palette = opaque.palette(), indices = opaque.indices();
+    REQUIRE(opaque.quantize(PixelBuffer{bgra.data(), width, height, stride, PIXEL_FORMAT_BGRA8}) == 0);
+    REQUIRE(opaque.quantize(PixelBuffer{rgb.data(), width, height, 0, PIXEL_FORMAT_RGB8}) == 0);
+    CHECK(opaque.palette() == palette);
+    CHECK(opaque.indices() == indices);
+
+    REQUIRE(opaque.remap(PixelBuffer{bgr.data(), width, height / 2, 0, PIXEL_FORMAT_BGR8}) == 0);
+    CHECK(opaque.palette() == palette);
+    CHECK(opaque.indices().size() == width * (height / 2));
+
+    CHECK(opaque.quantize(PixelBuffer{nullptr, width, height, 0, PIXEL_FORMAT_RGB8}) == QUANTIZER_ERROR_INVALID_BUFFER);
+    CHECK(opaque.quantize(PixelBuffer{rgb.data(), width, height, width, PIXEL_FORMAT_RGB8}) == QUANTIZER_ERROR_INVALID_BUFFER);
+}
+
+TEST_CASE("Quantizer keeps transparent pixels off opaque palette entries", "[quantizer]")
+{
+    const unsigned width = 32, height = 24;
+    const std::vector<unsigned char> rgba = make_rgba(width, height);
+    std::vector<unsigned char> rgb;
+    for (size_t pixel = 0; pixel < width * height; ++pixel)
+        rgb.insert(rgb.end(), {rgba[pixel * 4], rgba[pixel * 4 + 1], rgba[pixel * 4 + 2]});
+
+    // A palette built without transparent pixels has no entry for them.
+    for (bool dither : {false, true})
+    {
+        Quantizer quantizer(QuantizerSettings{8, dither, 0});
+        REQUIRE(quantizer.quantize(PixelBuffer{rgb.data(), width, height, 0, PIXEL_FORMAT_RGB8}) == 0);
+        CHECK(quantizer.remap(PixelBuffer{rgba.data(), width, height, 0, PIXEL_FORMAT_RGBA8}) ==
+              QUANTIZER_ERROR_NO_TRANSPARENT_ENTRY);
+
+        REQUIRE(quantizer.quantize(PixelBuffer{rgba.data(), width, height, 0, PIXEL_FORMAT_RGBA8}) == 0);
+        CHECK(quantizer.remap(PixelBuffer{rgba.data(), width, height, 0, PIXEL_FORMAT_RGBA8}) == 0);
+    }
+
+    // A sample that misses every transparent pixel still reserves their entry.
+    std::vector<unsigned char> single = rgba;
+    for (size_t pixel = 0; pixel < width * height; ++pixel)
+        single[pixel * 4 + 3] = pixel == width * height - 1 ? 0 : 255;
+
+    Quantizer sampled(QuantizerSettings{8, false, 16});
+    REQUIRE(sampled.quantize(PixelBuffer{single.data(), width, height, 0, PIXEL_FORMAT_RGBA8}) == 0);
+    REQUIRE(sampled.palette_size() > 1);
+    CHECK(sampled.palette()[3] == 0);
+    CHECK(sampled.indices().back() == 0);
+    for (size_t pixel = 0; pixel + 1 < width * height; ++pixel)
+        CHECK(sampled.indices()[pixel] != 0);
+
+    CHECK(std::string(cqt_error_text(QUANTIZER_ERROR_NO_TRANSPARENT_ENTRY)) ==
+          "transparent pixels but no transparent palette entry");
+}
+
+TEST_CASE("Quantizer builds its palette with the engine it is given", "[quantizer]")
+{
+    const unsigned width = 40, height = 36;
+    const std::vector<unsigned char> rgba = make_rgba(width, height);
+    const PixelBuffer buffer{rgba.data(), width, height, 0, PIXEL_FORMAT_RGBA8};
+
+    ColorHistogram histogram;
+    add_to_histogram(histogram, rgba.data(), width * height, 4);
+    const PixelSubset subset = histogram_to_subset(histogram);
+
+    Quantizer quantizer(QuantizerSettings{9, false, 0});
+    CHECK(&quantizer.engine() == &pca_engine());
+
+    for (const PaletteEngine *engine : {&pca_engine(), &wu_engine(), &octree_engine()})
+    {
+        quantizer.set_engine(*engine);
+        REQUIRE(quantizer.quantize(buffer) == 0);
+
+        // The opaque entries are the engine's palette; the transparent one comes on top of them.
+        const std::vector<Pixel> expected = engine->build_palette(subset, 9);
+        REQUIRE(quantizer.colors().size() == expected.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+            CHECK(quantizer.colors()[i] == expected[i]);
+    }
+
+    cqt_quantizer *c = cqt_quantizer_new(9, 0);
+    CHECK(cqt_quantizer_set_engine(c, "octree") == 0);
+    REQUIRE(cqt_quantize(c, rgba.data(), width, height, 0, CQT_FORMAT_RGBA8) == 0);
+
+    unsigned paletteSize = 0;
+    const unsigned char *palette = cqt_palette(c, &paletteSize);
+    REQUIRE(paletteSize == quantizer.palette_size());
+    CHECK(std::memcmp(palette, quantizer.palette().data(), 4 * paletteSize) == 0);
+
+    CHECK(cqt_quantizer_set_engine(c, "median-cut") == QUANTIZER_ERROR_UNKNOWN_ENGINE);
+    CHECK(cqt_quantizer_set_engine(c, nullptr) == QUANTIZER_ERROR_UNKNOWN_ENGINE);
+    CHECK(std::string(cqt_error_text(QUANTIZER_ERROR_UNKNOWN_ENGINE)) == "unknown palette engine");
+    cqt_quantizer_free(c);
+}
+
+static void count_progress(void *user, const char *stage, unsigned completed, unsigned total)
+{
+    if (std::string(stage) == "Partitioning" && completed == total)
+        ++*static_cast<unsigned *>(user);
+}
+
+TEST_CASE("Quantizer reports progress to its callback", "[quantizer]")
+{
+    const std::vector<unsigned char> rgba = make_rgba(30, 30);
+    unsigned finished = 0;
+
+    Quantizer quantizer(QuantizerSettings{10, false, 0});
+    quantizer.set_progress_callback(count_progress, &finished);
+    REQUIRE(quantizer.quantize(PixelBuffer{rgba.data(), 30, 30, 0, PIXEL_FORMAT_RGBA8}) == 0);
+    CHECK(finished == 1);
+
+    cqt_quantizer *c = cqt_quantizer_new(10, 0);
+    cqt_quantizer_set_progress(c, count_progress, &finished);
+    REQUIRE(cqt_quantize(c, rgba.data(), 30, 30, 0, CQT_FORMAT_RGBA8) == 0);
+    CHECK(finished == 2);
+    cqt_quantizer_free(c);
+}
+
+TEST_CASE("C interface exposes the quantizer's buffers", "[quantizer]")
+{
+    const unsigned width = 20, height = 16;
+    const std::vector<unsigned char> rgba = make_rgba(width, height);
+
+    Quantizer reference(QuantizerSettings{6, true, 0});
+    REQUIRE(reference.quantize(PixelBuffer{rgba.data(), width, height, 0, PIXEL_FORMAT_RGBA8}) == 0);
+
+    cqt_quantizer *quantizer = cqt_quantizer_new(16, 0);
+    REQUIRE(quantizer != nullptr);
+    cqt_quantizer_set_colors(quantizer, 6);
+    cqt_quantizer_set_dither(quantizer, 1);
+    REQUIRE(cqt_quantize(quantizer, rgba.data(), width, height, 0, CQT_FORMAT_RGBA8) == 0);
+
+    unsigned paletteSize = 0;
+    size_t count = 0;
+    const unsigned char *palette = cqt_palette(quantizer, &paletteSize);
+    const unsigned char *indices = cqt_indices(quantizer, &count);
+
+    REQUIRE(paletteSize == reference.palette_size());
+    REQUIRE(count == width * height);
+    CHECK(std::memcmp(palette, reference.palette().data(), 4 * paletteSize) == 0);
+    CHECK(std::memcmp(indices, reference.indices().data(), count) == 0);
+
+    const unsigned error = cqt_quantize(quantizer, rgba.data(), width, height, 0, 7);
+    CHECK(error == QUANTIZER_ERROR_INVALID_BUFFER);
+    CHECK(std::string(cqt_error_text(error)) == "invalid pixel buffer");
+    CHECK(cqt_remap(quantizer, rgba.data(), width, height, 0, -1) == QUANTIZER_ERROR_INVALID_BUFFER);
+
+    cqt_quantizer_free(quantizer);
+}
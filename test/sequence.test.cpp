@@ -0,0 +1,94 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/sequence.h"
+#include "src/dither.h"
+#include "src/quantization.h"
+
+static std::vector<unsigned char> make_frame(unsigned width, unsigned height, unsigned shift)
+{
+    std::vector<unsigned char> rgba;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+            rgba.insert(rgba.end(), {static_cast<unsigned char>(x * 2 + shift), static_cast<unsigned char>(y * 3),
+                                     static_cast<unsigned char>((x ^ y) + shift), static_cast<unsigned char>(x > 70 && y > 60 ? 0 : 255)});
+    }
+    return rgba;
+}
+
+// The frame quantized from scratch to `palette` with the tiling the sequence uses.
+static std::vector<unsigned char> reference_output(std::vector<unsigned char> frame, unsigned width, const std::vector<Pixel> &palette,
+                                                   const Options &options)
+{
+    if (options.dither)
+        tiled_floyd_steinberg_dither_pixels(frame, 4, palette, width, options.tileSize, TiledDitherSettings{options.tileSize, DITHER_APRON, 1});
+    else
+        map_pixels_to_palette(frame.data(), frame.size() / 4, 4, palette);
+    return frame;
+}
+
+TEST_CASE("Sequence frames reuse palette and unchanged tiles", "[sequence]")
+{
+    const unsigned width = 100, height = 90;
+
+    for (bool dither : {false, true})
+    {
+        Options options{"", 10, "", "", {}, 0, 0, dither, 32, 2, EFFORT_FAST, false, 0, 0};
+        SequenceState state;
+
+        std::vector<unsigned char> first = make_frame(width, height, 0), frame = first;
+        SequenceFrameStats stats = quantize_frame(state, frame, width, height, 4, options, SEQUENCE_DEFAULT_DRIFT);
+        CHECK(stats.newPalette);
+        CHECK(stats.tiles == 4 * 3);
+        CHECK(stats.tilesRemapped == stats.tiles);
+        REQUIRE(state.palette.transparent);
+
+        ColorHistogram histogram;
+        add_to_histogram(histogram, first.data(), width * height, 4);
+        CHECK(state.palette.colors == build_palette(histogram_to_subset(histogram), 10));
+        CHECK(state.output == reference_output(first, width, state.palette.colors, options));
+
+        // A few pixels change inside one tile: the palette stays and only that tile (and, when dithering, the
+        // tiles that read it as apron) is mapped again.
+        std::vector<unsigned char> second = first;
+        for (unsigned y = 40; y < 44; ++y)
+        {
+            for (unsigned x = 40; x < 48; ++x)
+                second[(y * width + x) * 4] = 255;
+        }
+        frame = second;
+        stats = quantize_frame(state, frame, width, height, 4, options, SEQUENCE_DEFAULT_DRIFT);
+        CHECK_FALSE(stats.newPalette);
+        CHECK(stats.tilesChanged == 1);
+        CHECK(stats.tilesRemapped == (dither ? 6u : 1u));
+        CHECK(stats.drift > 0);
+        CHECK(stats.drift < SEQUENCE_DEFAULT_DRIFT);
+        CHECK(state.output == reference_output(second, width, state.palette.colors, options));
+
+        // The incrementally updated histogram is the second frame's.
+        ColorHistogram expected;
+        add_to_histogram(expected, second.data(), width * height, 4);
+        CHECK(state.histogram.counts == expected.counts);
+        CHECK(state.histogram.transparentPixels == expected.transparentPixels);
+
+        // Unchanged frame: nothing to do.
+        frame = second;
+        stats = quantize_frame(state, frame, width, height, 4, options, SEQUENCE_DEFAULT_DRIFT);
+        CHECK(stats.tilesChanged == 0);
+        CHECK(stats.tilesRemapped == 0);
+
+        // New colors everywhere start a new palette; so does a zero threshold on any change.
+        const std::vector<unsigned char> third = make_frame(width, height, 101);
+        frame = third;
+        stats = quantize_frame(state, frame, width, height, 4, options, SEQUENCE_DEFAULT_DRIFT);
+        CHECK(stats.newPalette);
+        CHECK(stats.drift > 0.5);
+        CHECK(state.output == reference_output(third, width, state.palette.colors, options));
+
+        frame = second;
+        stats = quantize_frame(state, frame, width, height, 4, options, 0);
+        CHECK(stats.newPalette);
+        CHECK(stats.tilesRemapped == stats.tiles);
+    }
+}
@@ -0,0 +1,165 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/serve.h"
+#include "src/batch.h"
+#include "src/codec.h"
+#include "lodepng.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+static uint32_t get_le(const unsigned char *bytes, unsigned count)
+{
+    uint32_t value = 0;
+    for (unsigned i = 0; i < count; ++i)
+        value |= static_cast<uint32_t>(bytes[i]) << (8 * i);
+    return value;
+}
+
+static int connect_to(const std::string &socketPath)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, socketPath.c_str());
+    REQUIRE(connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+    return fd;
+}
+
+static std::vector<unsigned char> round_trip(int fd, unsigned source, unsigned flags, unsigned colors,
+                                             const std::vector<unsigned char> &payload)
+{
+    const uint32_t length = static_cast<uint32_t>(payload.size() + 4);
+    std::vector<unsigned char> request = {static_cast<unsigned char>(length), static_cast<unsigned char>(length >> 8),
+                                          static_cast<unsigned char>(length >> 16), static_cast<unsigned char>(length >> 24),
+                                          static_cast<unsigned char>(source), static_cast<unsigned char>(flags),
+                                          static_cast<unsigned char>(colors), static_cast<unsigned char>(colors >> 8)};
+    request.insert(request.end(), payload.begin(), payload.end());
+    REQUIRE(write(fd, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+
+    unsigned char prefix[4];
+    REQUIRE(recv(fd, prefix, 4, MSG_WAITALL) == 4);
+    std::vector<unsigned char> reply(get_le(prefix, 4));
+    REQUIRE(recv(fd, reply.data(), reply.size(), MSG_WAITALL) == static_cast<ssize_t>(reply.size()));
+    return reply;
+}
+
+TEST_CASE("Server answers requests with encoded images and palette indices", "[serve]")
+{
+    const unsigned width = 37, height = 29;
+    std::vector<unsigned char> rgba;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+            rgba.insert(rgba.end(), {static_cast<unsigned char>(x * 7), static_cast<unsigned char>(y * 8),
+                                     static_cast<unsigned char>(x * y), static_cast<unsigned char>(x < 3 ? 0 : 255)});
+    }
+
+    std::vector<unsigned char> png;
+    REQUIRE(png_codec().encode(png, rgba.data(), 4, width, height, NO_OUTPUT_PALETTE, DEFAULT_ENCODE_SETTINGS) == 0);
+    const std::string imageFile = "serve_test.png";
+    std::ofstream(imageFile, std::ios::binary).write(reinterpret_cast<const char *>(png.data()), png.size());
+
+    // Reference: the same image quantized directly.
+    Options options{"", 16, "", "", {}, 0, 0, false, 0, 2, EFFORT_FAST, false, 0, 0};
+    BatchScratch scratch;
+    QuantizedImage expected;
+    REQUIRE(quantize_source(memory_source(png.data(), png.size()), "", scratch, options, expected) == 0);
+    REQUIRE(expected.palette.transparent);
+
+    const std::string socketPath = "serve_test.sock";
+    int listenFd = open_server_socket(socketPath);
+    REQUIRE(listenFd >= 0);
+    std::thread server([&]()
+                       { serve_connections(listenFd, options); });
+
+    // Path requests read files as the server, so only its owner may connect.
+    struct stat info;
+    REQUIRE(stat(socketPath.c_str(), &info) == 0);
+    CHECK((info.st_mode & 0777) == 0600);
+
+    int fd = connect_to(socketPath);
+
+    // Several requests on one connection: an inline image, a path and an index reply.
+    for (unsigned source : {SERVE_SOURCE_INLINE, SERVE_SOURCE_PATH})
+    {
+        const std::vector<unsigned char> payload = source == SERVE_SOURCE_INLINE ? png : std::vector<unsigned char>(imageFile.begin(), imageFile.end());
+        std::vector<unsigned char> reply = round_trip(fd, source, 0, 0, payload);
+
+        REQUIRE(reply.size() > 16);
+        CHECK(get_le(&reply[0], 4) == 0);
+        CHECK(get_le(&reply[4], 4) == width);
+        CHECK(get_le(&reply[8], 4) == height);
+        const unsigned paletteSize = get_le(&reply[12], 2);
+        CHECK(paletteSize == expected.palette.colors.size() + 1);
+        CHECK(reply[14] == SERVE_REPLY_PNG);
+        CHECK(reply[15] == 4);
+
+        std::vector<unsigned char> decoded;
+        unsigned w, h;
+        REQUIRE(lodepng::decode(decoded, w, h, reply.data() + 16 + 4 * paletteSize, reply.size() - 16 - 4 * paletteSize) == 0);
+        CHECK(decoded == scratch.image);
+    }
+
+    std::vector<unsigned char> reply = round_trip(fd, SERVE_SOURCE_INLINE, SERVE_FLAG_INDICES, 0, png);
+    REQUIRE(reply[14] == SERVE_REPLY_INDICES_8);
+    const unsigned paletteSize = get_le(&reply[12], 2);
+    const unsigned char *palette = reply.data() + 16;
+    const unsigned char *indices = palette + 4 * paletteSize;
+    REQUIRE(reply.size() == 16 + 4 * paletteSize + width * height);
+
+    for (size_t pixel = 0; pixel < width * height; ++pixel)
+        CHECK(std::memcmp(palette + 4 * indices[pixel], &scratch.image[pixel * 4], 4) == 0);
+
+    // Per-request color count, and an error status for too many colors or input that is not an image.
+    reply = round_trip(fd, SERVE_SOURCE_INLINE, SERVE_FLAG_DITHER, 4, png);
+    CHECK(get_le(&reply[12], 2) == 5);
+
+    reply = round_trip(fd, SERVE_SOURCE_INLINE, 0, 257, png);
+    CHECK(get_le(&reply[0], 4) == CODEC_ERROR_UNSUPPORTED);
+    CHECK(reply.size() == 16);
+
+    reply = round_trip(fd, SERVE_SOURCE_INLINE, 0, 0, {1, 2, 3});
+    CHECK(get_le(&reply[0], 4) == CODEC_ERROR_UNKNOWN_FORMAT);
+    CHECK(reply.size() == 16);
+
+    close(fd);
+    shutdown(listenFd, SHUT_RDWR);
+    server.join();
+    close(listenFd);
+    unlink(socketPath.c_str());
+    std::remove(imageFile.c_str());
+}
+TEST_CASE("Server drops a client that stalls in a request", "[serve]")
+{
+    const std::string socketPath = "serve_timeout_test.sock";
+    int listenFd = open_server_socket(socketPath);
+    REQUIRE(listenFd >= 0);
+
+    Options options{"", 16, "", "", {}, 0, 0, false, 0, 1, EFFORT_FAST, false, 0, 0};
+    std::thread server([&]()
+                       { serve_connections(listenFd, options, 1); });
+
+    // Half a length prefix, then nothing: the worker gives up after the timeout and closes the connection.
+    int fd = connect_to(socketPath);
+    const unsigned char partial[2] = {8, 0};
+    REQUIRE(write(fd, partial, sizeof(partial)) == 2);
+
+    unsigned char byte;
+    CHECK(recv(fd, &byte, 1, 0) == 0);
+
+    close(fd);
+    shutdown(listenFd, SHUT_RDWR);
+    server.join();
+    close(listenFd);
+    unlink(socketPath.c_str());
+}
+#endif
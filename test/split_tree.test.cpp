@@ -0,0 +1,106 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/split_tree.h"
+#include "src/quantization.h"
+#include "test/test_images.h"
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static PixelSubset make_subset(unsigned width, unsigned height, uint32_t seed)
+{
+    const std::vector<unsigned char> rgb = make_noisy_gradient(width, height, seed);
+    ColorHistogram histogram;
+    add_to_histogram(histogram, rgb.data(), width * height, 3);
+    return histogram_to_subset(histogram);
+}
+
+TEST_CASE("Split tree palettes match build_palette for every smaller color count", "[split_tree]")
+{
+    const PixelSubset subset = make_subset(64, 48, 7);
+    SplitTree tree;
+    const std::vector<Pixel> palette = build_palettes(subset, {64}, &tree).front();
+
+    CHECK(tree.splits == 63);
+    CHECK(tree.nodes.size() == 2 * 63 + 1);
+    CHECK_FALSE(tree.complete);
+    CHECK(split_tree_palette(tree, 64) == palette);
+
+    for (unsigned colors : {1u, 2u, 3u, 16u, 33u, 63u})
+    {
+        CHECK(split_tree_covers(tree, colors));
+        CHECK(split_tree_palette(tree, colors) == build_palette(subset, colors));
+    }
+    CHECK_FALSE(split_tree_covers(tree, 65));
+
+    // A run that ran out of colors to split covers every count.
+    const std::vector<unsigned char> flat = {10, 20, 30, 200, 0, 0, 5, 5, 5};
+    ColorHistogram few;
+    add_to_histogram(few, flat.data(), 3, 3);
+    SplitTree small;
+    build_palettes(histogram_to_subset(few), {16}, &small);
+    CHECK(small.complete);
+    CHECK(split_tree_covers(small, 256));
+    CHECK(split_tree_palette(small, 256).size() == 3);
+}
+
+TEST_CASE("Split trees survive a round trip through their file", "[split_tree]")
+{
+    const fs::path path = "split_tree_test.cqst";
+    fs::remove(path);
+
+    const PixelSubset subset = make_subset(40, 30, 3);
+    SplitTree tree;
+    build_palettes(subset, {32}, &tree);
+    tree.histogramHash = hash_subset(subset);
+    REQUIRE(save_split_tree(path.string(), tree));
+    CHECK(fs::file_size(path) == 28 + tree.nodes.size() * 84);
+
+    SplitTree loaded;
+    REQUIRE(load_split_tree(path.string(), loaded));
+    CHECK(loaded.histogramHash == tree.histogramHash);
+    CHECK(loaded.splits == tree.splits);
+    CHECK(loaded.complete == tree.complete);
+    REQUIRE(loaded.nodes.size() == tree.nodes.size());
+    for (unsigned colors = 1; colors <= 32; ++colors)
+        CHECK(split_tree_palette(loaded, colors) == split_tree_palette(tree, colors));
+
+    // Truncated files are rejected.
+    fs::resize_file(path, fs::file_size(path) - 1);
+    SplitTree truncated;
+    CHECK_FALSE(load_split_tree(path.string(), truncated));
+    CHECK_FALSE(load_split_tree("split_tree_missing.cqst", truncated));
+
+    fs::remove(path);
+}
+
+TEST_CASE("Split tree sidecars are reused only for the colors they were built from", "[split_tree]")
+{
+    const fs::path path = "split_tree_sidecar.cqst";
+    fs::remove(path);
+
+    const PixelSubset subset = make_subset(48, 40, 11);
+    CHECK(build_palette_with_split_tree(subset, 64, path.string()) == build_palette(subset, 64));
+    REQUIRE(fs::exists(path));
+
+    // Smaller counts come from the tree written by the first call.
+    CHECK(build_palette_with_split_tree(subset, 20, path.string()) == build_palette(subset, 20));
+    SplitTree tree;
+    REQUIRE(load_split_tree(path.string(), tree));
+    CHECK(tree.splits == 63);
+
+    // Larger counts, and other images, rebuild and replace it.
+    CHECK(build_palette_with_split_tree(subset, 100, path.string()) == build_palette(subset, 100));
+    REQUIRE(load_split_tree(path.string(), tree));
+    CHECK(tree.splits == 99);
+
+    const PixelSubset other = make_subset(48, 40, 12);
+    CHECK(build_palette_with_split_tree(other, 16, path.string()) == build_palette(other, 16));
+    REQUIRE(load_split_tree(path.string(), tree));
+    CHECK(tree.histogramHash == hash_subset(other));
+    CHECK(tree.splits == 15);
+
+    fs::remove(path);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "src/shared.h"
+
+/*
+ * Photo-like 8-bit RGB test image: red and green ramp across and down the image, and blue is noise from a linear
+ * congruential generator started at `seed`, so the image has thousands of distinct colors in a few clusters.
+ */
+inline std::vector<unsigned char> make_noisy_gradient(unsigned width, unsigned height, uint32_t seed = 12345)
+{
+    std::vector<unsigned char> rgb;
+    uint32_t state = seed;
+
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+        {
+            state = state * 1664525u + 1013904223u;
+            rgb.insert(rgb.end(), {static_cast<unsigned char>(x * 255 / width), static_cast<unsigned char>(y * 255 / height),
+                                   static_cast<unsigned char>((state >> 24) & 0x7F)});
+        }
+    }
+
+    return rgb;
+}
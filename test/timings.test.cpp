@@ -0,0 +1,71 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/timings.h"
+#include "src/codec.h"
+
+#include <thread>
+
+TEST_CASE("Stage timers exclude nested stages", "[timings]")
+{
+    const bool enabled = timingsEnabled;
+    enable_timings();
+    const TimingReport before = collect_timings();
+
+    {
+        StageTimer decode(STAGE_DECODE);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        {
+            StageTimer histogram(STAGE_HISTOGRAM);
+            std::this_thread::sleep_for(std::chrono::milliseconds(40));
+        }
+    }
+
+    const TimingReport after = collect_timings();
+    const uint64_t decode = after.nanoseconds[STAGE_DECODE] - before.nanoseconds[STAGE_DECODE];
+    const uint64_t histogram = after.nanoseconds[STAGE_HISTOGRAM] - before.nanoseconds[STAGE_HISTOGRAM];
+
+    CHECK(histogram >= 40000000u);
+    CHECK(decode >= 20000000u);
+    CHECK(decode < 40000000u);
+    CHECK(after.calls[STAGE_DECODE] == before.calls[STAGE_DECODE] + 1);
+    CHECK(after.wallNanoseconds >= decode + histogram);
+
+    // Encoding through the codec layer is timed as such.
+    std::vector<unsigned char> rgb(64 * 64 * 3, 90), encoded;
+    REQUIRE(encode_image(encoded, "timed.png", rgb.data(), 64, 64, DEFAULT_ENCODE_SETTINGS) == 0);
+    CHECK(collect_timings().calls[STAGE_ENCODE] == after.calls[STAGE_ENCODE] + 1);
+
+    timingsEnabled = enabled;
+}
+
+TEST_CASE("Stage timers count the allocations of their own stage", "[timings]")
+{
+    REQUIRE(allocationsCounted);
+    const bool enabled = timingsEnabled;
+    enable_timings();
+    const TimingReport before = collect_timings();
+
+    {
+        StageTimer reduce(STAGE_REDUCE);
+        std::vector<unsigned char> outer(1 << 20, 1);
+        {
+            StageTimer map(STAGE_MAP);
+            std::vector<unsigned char> inner(3 << 20, 2);
+            CHECK(inner[5] == 2);
+        }
+        CHECK(outer[5] == 1);
+    }
+
+    const TimingReport after = collect_timings();
+    const uint64_t reduceBytes = after.allocatedBytes[STAGE_REDUCE] - before.allocatedBytes[STAGE_REDUCE];
+    const uint64_t mapBytes = after.allocatedBytes[STAGE_MAP] - before.allocatedBytes[STAGE_MAP];
+
+    CHECK(reduceBytes >= (1u << 20));
+    CHECK(reduceBytes < (2u << 20));
+    CHECK(mapBytes >= (3u << 20));
+    CHECK(after.allocations[STAGE_REDUCE] - before.allocations[STAGE_REDUCE] >= 1);
+    CHECK(after.peakRss >= (4u << 20));
+
+    timingsEnabled = enabled;
+}
@@ -0,0 +1,88 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "src/shared.h"
+#include "src/variants.h"
+#include "src/batch.h"
+#include "src/quantization.h"
+#include "test/test_images.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+TEST_CASE("Palettes of several color counts come from one partitioning run", "[variants]")
+{
+    const std::vector<unsigned char> rgb = make_noisy_gradient(64, 48);
+    ColorHistogram histogram;
+    add_to_histogram(histogram, rgb.data(), 64 * 48, 3);
+    const PixelSubset subset = histogram_to_subset(histogram);
+
+    const std::vector<unsigned> counts = {64, 4, 16, 4};
+    const std::vector<std::vector<Pixel>> palettes = build_palettes(subset, counts);
+
+    REQUIRE(palettes.size() == counts.size());
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        CHECK(palettes[i].size() == counts[i]);
+        CHECK(palettes[i] == build_palette(subset, counts[i]));
+    }
+
+    // Counts beyond the distinct colors get every color there is.
+    const std::vector<unsigned char> flat = {10, 20, 30, 10, 20, 30, 200, 0, 0, 5, 5, 5};
+    ColorHistogram few;
+    add_to_histogram(few, flat.data(), 4, 3);
+    const std::vector<std::vector<Pixel>> small = build_palettes(histogram_to_subset(few), {2, 16});
+    CHECK(small[0].size() == 2);
+    CHECK(small[1].size() == 3);
+}
+
+TEST_CASE("Variants match separate runs for each color count", "[variants]")
+{
+    const fs::path directory = "variants_test";
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+
+    const unsigned width = 80, height = 60;
+    const std::vector<unsigned char> rgb = make_noisy_gradient(width, height);
+    std::vector<unsigned char> input;
+    REQUIRE(encode_image(input, "in.png", rgb.data(), width, height, DEFAULT_ENCODE_SETTINGS) == 0);
+
+    CHECK(variant_output_name("dir/out.png", 16) == (fs::path("dir") / "out-16.png").string());
+    CHECK(variant_output_name("out.qoi", 256) == "out-256.qoi");
+
+    for (bool dither : {false, true})
+    {
+        const std::string output = (directory / "out.png").string();
+        Options options{"in.png", 16, output, "", {}, 0, 0, dither, 32, 3, EFFORT_FAST, false, 0, 0};
+        const std::vector<unsigned> counts = {16, 64, 8};
+
+        std::vector<VariantResult> results;
+        REQUIRE(quantize_variants(memory_source(input.data(), input.size()), options, counts, results) == 0);
+        REQUIRE(results.size() == counts.size());
+
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            CHECK(results[i].error == 0);
+            CHECK(results[i].colors == counts[i]);
+            CHECK(results[i].output == variant_output_name(output, counts[i]));
+
+            Options single{"in.png", counts[i], output, "", {}, 0, 0, dither, 32, 1, EFFORT_FAST, false, 0, 0};
+            BatchScratch scratch;
+            QuantizedImage quantized;
+            REQUIRE(quantize_source(memory_source(input.data(), input.size()), "in.png", scratch, single, quantized) == 0);
+
+            std::vector<unsigned char> expected;
+            REQUIRE(encode_image(expected, output, scratch.image.data(), quantized.channels, width, height, quantized.palette,
+                                 EncodeSettings{EFFORT_FAST, 1}) == 0);
+
+            std::ifstream file(results[i].output, std::ios::binary);
+            const std::vector<unsigned char> written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            CHECK(written == expected);
+            CHECK(results[i].outputBytes == expected.size());
+        }
+    }
+
+    fs::remove_all(directory);
+}